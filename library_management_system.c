@@ -1,11 +1,27 @@
 
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600   // WSAPoll
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
+#include <io.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#include <immintrin.h>
+#define LMS_HAVE_SSE2 1
+#endif
 
 #define MAX_TITLE_LENGTH 100
 #define MAX_AUTHOR_LENGTH 50
@@ -18,6 +34,53 @@
 #define MAX_QUEUE_SIZE 100
 #define MAX_BORROW_LIMIT 10
 #define SAVE_FILE "library_data.dat"
+#define SAVE_MAGIC 0x44534D4C          // "LMSD"
+#define SAVE_VERSION 3
+#define MAX_SCAN_WORKERS 32
+#define SCAN_CHUNK_SIZE 1024
+#define SNAPSHOT_CHUNK_SIZE 256         // book IDs or ledger rows per shared snapshot chunk
+#define FUZZY_MAX_RESULTS 5
+#define AUTOCOMPLETE_RESULTS 10
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_BITMAP_WORDS 1024
+#define STATUS_COUNT 3
+#define MAX_BATCH_LINE 512
+#define QUERY_ANY -1
+#define QUERY_CACHE_SIZE 256
+#define QUERY_CACHE_BUCKETS 512
+#define POOL_BLOCK_RECORDS 4096
+#define IMPORT_CHUNK_SIZE (1 << 20)
+#define MAX_IMPORT_FIELDS 16
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define DATE_CACHE_SLOTS 256
+#define REPORT_PAGE_SIZE 20
+#define HISTORY_PAGE_SIZE 6
+#define SERVER_DEFAULT_PORT 7070
+#define SERVER_MAX_CLIENTS 256
+#define SERVER_INPUT_SIZE 4096
+#define SERVER_OUTPUT_LIMIT (1 << 20)
+#define SERVER_SEARCH_RESULTS 50
+#define FULFILLMENT_BATCH 256
+#define HOLD_PICKUP_SECONDS (3 * 24 * 60 * 60)
+#define HOLD_WHEEL_LEVELS 4
+#define HOLD_WHEEL_BITS 6
+#define HOLD_WHEEL_SLOTS (1 << HOLD_WHEEL_BITS)
+#define RESERVATION_MAGIC 0x31565352   // "RSV1"
+#define MAX_DESK_ITEMS 32
+#define JOURNAL_FILE "library_journal.dat"
+#define JOURNAL_OLD_FILE "library_journal.old"
+#define JOURNAL_MAGIC 0x324E524A       // "JRN2"
+#define JOURNAL_FILE_MAGIC 0x464E524A  // "JRNF"
+#define NULL_HANDLE ((Handle){0, 0})
+#define ARCHIVE_PREFIX "library_archive_"
+#define ARCHIVE_INDEX_FILE "library_archive.idx"
+#define ARCHIVE_MAGIC 0x32435241       // "ARC2"
+#define ARCHIVE_MAX_MONTHS (12 * 1000)
+#define ARCHIVE_AGE_DAYS 180
+#define ARCHIVE_READ_BATCH 512
+#define LEDGER_BLOCK_ROWS 1024
+#define CIRCULATION_MAGIC 0x31545343   // "CST1"
+#define CIRCULATION_TOP 10
 
 /********************************************/
 /* Data Structures and Type Definitions     */
@@ -37,21 +100,62 @@ typedef enum {
     EXPIRED
 } UserStatus;
 
-//Enum for System History
+//Enum for the undo log (one kind of delta per mutation)
 typedef enum {
-USERADDED,
-USERDELETED,
-BOOKADDED,
-BOOKDELETED
-}History;
+UNDO_USER_ADDED,
+UNDO_USER_DELETED,
+UNDO_BOOK_ADDED,
+UNDO_BOOK_DELETED,
+UNDO_BOOK_EDITED,
+UNDO_COPIES_CHANGED,
+UNDO_USER_EDITED,
+UNDO_BORROWED,
+UNDO_RETURNED,
+UNDO_RESERVED,
+UNDO_CANCELLED
+}UndoAction;
+
+// Record fields an edit can change
+typedef enum {
+    FIELD_TITLE,
+    FIELD_AUTHOR,
+    FIELD_ISBN,
+    FIELD_NAME,
+    FIELD_USER_ID,          // fields up to here are text
+    FIELD_AGE,
+    FIELD_GENDER,
+    FIELD_STATUS
+} RecordField;
+
+// Record Handle (slot in a handle table plus the slot's generation when it was handed out)
+typedef struct {
+    int slot;               // 0 is never handed out, so a zeroed handle is null
+    uint32_t generation;
+} Handle;
+
+// Handle Table (one per record kind; releasing a slot bumps its generation so old handles go stale)
+typedef struct {
+    void** records;         // NULL while a record is detached (e.g. kept by the undo log)
+    uint32_t* generations;
+    int* freeSlots;
+    int freeCount;
+    int used;               // slots handed out so far, including slot 0
+    int capacity;
+} HandleTable;
 
 // Book Structure
 typedef struct Book {
     int id;
+    Handle handle;
     char title[MAX_TITLE_LENGTH];
     char author[MAX_AUTHOR_LENGTH];
     char isbn[MAX_ISBN_LENGTH];
-    BookStatus status;
+    char titleKey[MAX_TITLE_LENGTH];    // folded title used by every search path
+    char authorKey[MAX_AUTHOR_LENGTH];  // folded author used by every search path
+    int copies;                         // copies of the title the library owns
+    int borrowed;                       // copies out on loan
+    int held;                           // copies kept back for reservations
+    BookStatus status;                  // summary of the counters (see copyStatus)
     struct Book* left;
     struct Book* right;
 } Book;
@@ -59,2155 +163,10956 @@ typedef struct Book {
 // User Structure
 typedef struct User {
     int id;
+    Handle handle;
     char name[MAX_NAME_LENGTH];
+    char nameKey[MAX_NAME_LENGTH];      // folded name used by every search path
     char user_id[MAX_ID_LENGTH];
     int age;
     char gender;
     int borrowCount;
     UserStatus status;
-    Book *borrowed;
     struct User* next;
 } User;
 
 // Book Queue Node for reservations
 typedef struct QueueNode {
     int userId;
+    Handle user;
+    time_t since;       // when the user joined the queue
     struct QueueNode* next;
 } QueueNode;
 
-// Book Queue Structure
+// Hold Node (a copy kept for a user until they pick it up)
+typedef struct HoldNode {
+    int userId;
+    Handle user;
+    time_t since;
+    time_t until;       // pickup deadline
+    struct HoldNode* next;
+} HoldNode;
+
+// Book Queue Structure (one per title, shared by all its copies)
 typedef struct {
     QueueNode* front;
     QueueNode* rear;
     int size;
+    HoldNode* holds;    // oldest hold first
+    int holdCount;      // held copies not in this list wait for the fulfillment stage
 } BookQueue;
 
-// System History Stack Node
-typedef struct HStackNode {
-    Book* bookCopy;
-    User* userCopy;
-    time_t timeOfAction;
-    History typeOfAction;
-    struct HStackNode* next;
-} HStackNode;
-
-// Return History Stack Node
-typedef struct RStackNode {
-    int bookId;
+// Borrow Record (IDs are what is saved; the handles are bound when the record is created or loaded)
+typedef struct BorrowRecord {
     int userId;
+    int bookId;
+    Handle handle;
+    Handle user;
+    Handle book;
+    time_t borrowDate;
+    time_t dueDate;
+    bool returned;
     time_t returnDate;
-    struct RStackNode* next;
-} RStackNode;
+    int row;                    // row in the columnar ledger
+    int archiveBatch;           // archival batch holding it (0 = none); it stays until a save without it is on disk
+    struct BorrowRecord* next;
+} BorrowRecord;
+
+// Undo Log Entry (a field-level delta: the record a change touched and what it was before)
+typedef struct {
+    UndoAction action;
+    int field;                  // RecordField of an edit, queue position of a cancel (0 = a hold), 1 for a hold pickup
+    bool joined;                // undone together with the entry below it (one desk transaction)
+    time_t when;
+    Handle book;                // null for user entries
+    Handle user;                // null for book entries
+    Handle loan;
+    union {
+        int number;             // copies, age, gender or status before
+        time_t deadline;        // pickup deadline of a cancelled hold
+        char* text;             // title, author, ISBN, name or user ID before (owned)
+        Book* book;             // a deleted book, detached until the entry goes (owned)
+        User* user;             // a deleted user, detached until the entry goes (owned)
+        Handle tail;            // the ledger record a new loan was linked after
+        time_t queued;          // when a cancelled waiter had joined the queue
+    } before;
+} UndoEntry;
+
+// Undo Log (ring of the newest MAX_STACK_SIZE entries)
+typedef struct {
+    UndoEntry entries[MAX_STACK_SIZE];
+    int top;                    // slot of the newest entry
+    int count;
+} UndoLog;
 
-// Return History Stack
-typedef struct returnstack{
-    int size ;
-    RStackNode *top;
-}RStack;
+// Snapshot Chunk (immutable copies of a run of books or borrow records, shared by every snapshot it is unchanged in)
+typedef struct {
+    volatile LONG refs;
+    int count;
+    void* items;                // Book or BorrowRecord copies
+} SnapshotChunk;
 
-// Browsing History Stack
+// Chunk Changes (the epoch each chunk last changed at; a pin copies only the chunks changed since the last one)
 typedef struct {
-    HStackNode* top;
-    int size;
-} HStack;
+    LONG64* epochs;
+    int capacity;
+    LONG64 resetEpoch;          // every chunk changed at this epoch
+} ChunkChanges;
+
+// Catalog Snapshot (point-in-time copy of the book tree, sorted by ID; chunk k holds the IDs from k * SNAPSHOT_CHUNK_SIZE)
+typedef struct CatalogSnapshot {
+    LONG64 epoch;
+    int count;
+    int chunkCount;
+    SnapshotChunk** chunks;
+    int* starts;                // position of each chunk's first book
+    volatile LONG refs;
+} CatalogSnapshot;
+
+// Ledger Snapshot (point-in-time copy of the borrow records in ledger order; chunk k holds the rows from k * SNAPSHOT_CHUNK_SIZE)
+typedef struct LedgerSnapshot {
+    LONG64 epoch;
+    int count;
+    int chunkCount;
+    SnapshotChunk** chunks;
+    volatile LONG refs;
+} LedgerSnapshot;
+
+// Date columns of the columnar ledger
+typedef enum {
+    LEDGER_BORROW_DATE,
+    LEDGER_DUE_DATE,
+    LEDGER_RETURN_DATE,
+    LEDGER_DATE_COLUMNS
+} LedgerDate;
 
-// Borrow Record
-typedef struct BorrowRecord {
+// Ledger Block Summary (LEDGER_BLOCK_ROWS rows; the bounds only widen until a rebuild)
+typedef struct {
+    int64_t min[LEDGER_DATE_COLUMNS];
+    int64_t max[LEDGER_DATE_COLUMNS];   // return dates count returned loans only
+    int open;                           // unreturned loans in the block
+} LedgerBlock;
+
+// Columnar Ledger (the ledger fields as contiguous arrays, one row per record in ledger order)
+typedef struct {
+    int32_t* userIds;
+    int32_t* bookIds;
+    int64_t* dates[LEDGER_DATE_COLUMNS];
+    uint8_t* returned;
+    BorrowRecord** records;             // row -> ledger record
+    LedgerBlock* blocks;
+    int count;
+    int capacity;
+    bool stale;                         // out of step with the list; rebuilt before the next scan
+} LedgerColumns;
+
+// Ledger Filter (rows whose date column is in [from, to), optionally for one user and open or returned only)
+typedef struct {
+    LedgerDate column;
+    int64_t from;
+    int64_t to;
+    int userId;                         // QUERY_ANY = every user
+    int open;                           // 1 = unreturned, 0 = returned, QUERY_ANY = both
+} LedgerFilter;
+
+// Ledger Scan (matching rows plus how many blocks the summaries let it skip)
+typedef struct {
+    int* rows;
+    int count;
+    int blocks;
+    int skipped;
+} LedgerScan;
+
+// Prepared substring pattern for the title/name scans
+typedef struct {
+    char needle[MAX_TITLE_LENGTH];
+    int length;
+} SubstringMatcher;
+
+// Substring Kernel (one implementation of the matcher: a single buffer, or a block of titles)
+typedef struct {
+    const char* name;
+    int (*find)(const SubstringMatcher* matcher, const char* text, int bufferLength);
+    int (*matchTitles)(const SubstringMatcher* matcher, const Book* books, int count, int* hits);
+    bool needsAvx2;             // only run when the CPU reports AVX2
+} SubstringKernel;
+
+// Predicate used by catalog scans
+typedef bool (*BookMatcher)(const Book* book, const void* arg);
+
+// Bulk predicate: writes the indices of matching books in a block, returns the count
+typedef int (*BookBlockMatcher)(const Book* books, int count, const void* arg, int* hits);
+
+// Scan Worker (owns a range of chunks that other workers may steal from)
+typedef struct {
+    volatile LONG64 range;  // next chunk in the low 32 bits, end chunk in the high 32 bits
+    int* hits;              // snapshot indices of matching books
+    int hitCount;
+    int hitCapacity;
+    int blockHits[SCAN_CHUNK_SIZE];
+    HANDLE wake;
+    HANDLE thread;
+} ScanWorker;
+
+// Scan Job shared by all workers
+typedef struct {
+    CatalogSnapshot* snap;
+    BookMatcher match;
+    BookBlockMatcher blockMatch;
+    const void* arg;
+    volatile LONG pending;
+    HANDLE done;
+} ScanJob;
+
+// Worker Pool for catalog scans
+typedef struct {
+    int workerCount;
+    ScanWorker workers[MAX_SCAN_WORKERS];
+    ScanJob job;
+    CRITICAL_SECTION lock;
+    bool started;
+} ScanPool;
+
+// Result of a catalog scan (indices into the pinned snapshot, in ID order)
+typedef struct {
+    CatalogSnapshot* snap;
+    int* indices;
+    int count;
+} ScanResult;
+
+// BK-tree Node (one per distinct folded key, children keyed by edit distance)
+typedef struct BKNode {
+    char* key;
+    int distance;           // edit distance to the parent's key
+    int* ids;               // books or users carrying this key
+    int idCount;
+    int idCapacity;
+    struct BKNode* firstChild;
+    struct BKNode* nextSibling;
+} BKNode;
+
+// Fuzzy Match (a key within the distance bound)
+typedef struct {
+    BKNode* node;
+    int distance;
+} FuzzyMatch;
+
+// Prefix Index Entry (folded key and the record carrying it)
+typedef struct {
+    char* key;
+    int id;
+} PrefixEntry;
+
+// Prefix Index (entries kept sorted by key, then id)
+typedef struct {
+    PrefixEntry* entries;
+    int count;
+    int capacity;
+} PrefixIndex;
+
+// Key Index Entry (one per distinct key, e.g. folded author or ISBN)
+typedef struct KeyEntry {
+    char key[MAX_AUTHOR_LENGTH];
+    int* bookIds;
+    int count;
+    int capacity;
+    struct KeyEntry* next;
+} KeyEntry;
+
+// Key Index (hash table of keys -> book IDs, chained)
+typedef struct {
+    KeyEntry** buckets;
+    int bucketCount;
+    int keyCount;
+} KeyIndex;
+
+// Order Statistic Node (treap node keyed by (folded key, book ID), sized)
+typedef struct OrderNode {
+    char* key;
+    int id;
+    uint32_t priority;   // max-heap order, random per node
+    int size;            // nodes in this subtree, including this one
+    struct OrderNode* left;
+    struct OrderNode* right;
+} OrderNode;
+
+// Order Statistic Tree (answers select-k-th and rank in O(log n))
+typedef struct {
+    OrderNode* root;
+    uint32_t seed;
+} OrderTree;
+
+// Roaring Container (IDs sharing the same high 16 bits)
+typedef struct {
+    uint16_t key;
+    int cardinality;
+    uint16_t* values;   // sorted low bits while cardinality <= ROARING_ARRAY_MAX
+    uint64_t* bits;     // 65536-bit bitmap once the container gets dense
+    int capacity;
+} RoaringContainer;
+
+// Roaring Bitmap (containers sorted by key)
+typedef struct {
+    RoaringContainer* containers;
+    int count;
+    int capacity;
+} RoaringBitmap;
+
+// Compound Book Query (empty strings / QUERY_ANY mean "don't care")
+typedef struct {
+    char title[MAX_TITLE_LENGTH];     // folded substring
+    char author[MAX_AUTHOR_LENGTH];   // folded exact author
+    char isbn[MAX_ISBN_LENGTH];       // normalized exact ISBN
+    int status;
+    int minQueue;
+    int maxQueue;
+} BookQuery;
+
+// Where a query draws its candidates from
+typedef enum {
+    DRIVE_SCAN,
+    DRIVE_AUTHOR,
+    DRIVE_ISBN,
+    DRIVE_STATUS
+} QueryDriver;
+
+// Query Cursor (streams matching books from a pinned snapshot)
+typedef struct {
+    BookQuery query;
+    SubstringMatcher matcher;
+    CatalogSnapshot* snap;
+    QueryDriver driver;
+    int* ids;          // candidate IDs copied from a hash index
+    int idCount;
+    int position;      // next snapshot slot, candidate or status bitmap ID
+    int estimate;      // candidate count the planner expected
+} QueryCursor;
+
+// Query Cache Entry (a normalized query and its result)
+typedef struct {
+    char key[MAX_TITLE_LENGTH];
+    LONG64 generation;   // generation of the structure the result came from
+    const void* result;  // Book* or BorrowRecord*, NULL for "none"
+    int prev;            // LRU list, most recently used first
+    int next;
+    int chain;           // next entry in the same hash bucket
+} CacheEntry;
+
+// Query Cache (bounded LRU with generation-checked entries)
+typedef struct {
+    const char* name;
+    CacheEntry entries[QUERY_CACHE_SIZE];
+    int buckets[QUERY_CACHE_BUCKETS];
+    int count;
+    int head;
+    int tail;
+    long hits;
+    long misses;
+} QueryCache;
+
+// Record Pool (fixed-size records carved from large blocks)
+typedef struct {
+    size_t recordSize;
+    char* block;       // block currently being carved
+    int remaining;     // records left in the current block
+    void* freeList;    // released records, reused first
+} RecordPool;
+
+// CSV/TSV Reader (rows are split in place inside one reusable buffer)
+typedef struct {
+    FILE* file;
+    char* buffer;
+    int length;        // bytes currently in the buffer
+    int position;      // start of the next row
+    bool eof;
+    char delimiter;    // ',' or '\t', detected from the header row
+    long rowNumber;
+} CsvReader;
+
+// Output Buffer (large writes instead of one stdio call per field)
+typedef struct {
+    FILE* file;
+    char* buffer;
+    int length;
+    bool failed;
+} OutputBuffer;
+
+// Export Row Writer (the same calls produce CSV or JSON Lines)
+typedef struct {
+    OutputBuffer* out;
+    bool json;
+    const char* const* columns;
+    int columnCount;
+    int field;         // fields written in the current row
+} ExportWriter;
+
+// Orders a listing can be paged in
+typedef enum {
+    PAGE_BOOKS,     // book ID
+    PAGE_TITLES,    // folded title, then book ID
+    PAGE_USERS,     // user ID
+    PAGE_LOANS,     // ledger position
+    PAGE_AUTHORS    // folded author, then book ID
+} PageOrder;
+
+// Page Cursor (the last key returned; the next page starts after it)
+typedef struct {
+    PageOrder order;
+    int lastId;                        // book/user ID or ledger position (0 = start)
+    char lastKey[MAX_TITLE_LENGTH];    // folded title/author for PAGE_TITLES/PAGE_AUTHORS
+    bool finished;
+} PageCursor;
+
+// Outcome of a desk operation (shared by the menus and the desk server)
+typedef enum {
+    DESK_OK,
+    DESK_QUEUED,            // joined the reservation queue behind others
+    DESK_NO_BOOK,
+    DESK_NO_USER,
+    DESK_INACTIVE,
+    DESK_LIMIT,
+    DESK_UNAVAILABLE,
+    DESK_ALREADY_QUEUED,
+    DESK_NOT_BORROWED,
+    DESK_NO_RESERVATION,
+    DESK_DUPLICATE_ITEM,    // the same book twice in one transaction
+    DESK_NOT_LOGGED         // the journal could not be written
+} DeskResult;
+
+// Kind of desk transaction
+typedef enum {
+    DESK_CHECKOUT,
+    DESK_CHECKIN
+} DeskAction;
+
+// Desk Transaction (a patron's stack of books, checked out or in as one unit)
+typedef struct {
+    DeskAction action;
+    int userId;
+    int count;
+    int bookIds[MAX_DESK_ITEMS];
+    time_t when;            // stamped when logged; a replay keeps the logged time
+    int failedItem;         // item that stopped the transaction (-1 = none, or the user)
+} DeskTransaction;
+
+// Journal File Header (the journal continues the save file with the same stamp)
+typedef struct {
+    uint32_t magic;
+    int32_t reserved;
+    int64_t saveStamp;
+} JournalFileHeader;
+
+// Journal Entry Header (followed by count book IDs)
+typedef struct {
+    uint32_t magic;
+    int32_t action;
+    int32_t userId;
+    int32_t count;
+    int32_t outOfSequence;      // logged after a change the journal does not hold; never replayed
+    int32_t reserved;
+    int64_t when;
+} JournalHeader;
+
+// Desk Server Client (one connection; requests may be pipelined)
+typedef struct {
+    SOCKET socket;
+    char input[SERVER_INPUT_SIZE];   // bytes received but not yet a full line
+    int inputLength;
+    char* output;                    // responses not yet sent
+    int outputLength;
+    int outputSent;
+    int outputCapacity;
+    bool closing;                    // close once the output is sent
+} DeskClient;
+
+// Hold Timer (pickup deadline of one hold; stale timers are skipped when they fire)
+typedef struct HoldTimer {
+    int bookId;
+    int userId;
+    time_t deadline;
+    struct HoldTimer* next;
+} HoldTimer;
+
+// Hold Timer Wheel (level L slots span 64^L seconds; timers cascade down a level as their time nears)
+typedef struct {
+    HoldTimer* slots[HOLD_WHEEL_LEVELS][HOLD_WHEEL_SLOTS];
+    int levelCounts[HOLD_WHEEL_LEVELS];
+    long long now;       // next second to process
+    int count;
+} HoldTimerWheel;
+
+// Saved Reservation (a hold when holdUntil != 0, otherwise a queued waiter who joined at holdSince)
+typedef struct {
+    int32_t bookId;
+    int32_t userId;
+    int64_t holdSince;
+    int64_t holdUntil;
+} ReservationRecord;
+
+// Data File Header (the counts say how many records of each kind follow)
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t lastBookId;         // highest book ID handed out (IDs are not reused)
+    int32_t lastUserId;
+    int32_t books;
+    int32_t users;
+    int32_t loans;
+    int32_t archiveBatch;       // last archival batch whose loans are left out of this file (version 2)
+    int64_t saveStamp;          // names this save; the journal names the save it continues (version 3)
+} SaveHeader;
+
+// Saved Book (status and the borrowed count are rebuilt from the open loans)
+typedef struct {
+    int32_t id;
+    char title[MAX_TITLE_LENGTH];
+    char author[MAX_AUTHOR_LENGTH];
+    char isbn[MAX_ISBN_LENGTH];
+    int32_t copies;
+    int32_t held;
+} SavedBook;
+
+// Saved User (the loan count is rebuilt from the open loans)
+typedef struct {
+    int32_t id;
+    char name[MAX_NAME_LENGTH];
+    char user_id[MAX_ID_LENGTH];
+    int32_t age;
+    int32_t gender;
+    int32_t status;
+} SavedUser;
+
+// Saved Loan (open while returnDate is 0)
+typedef struct {
+    int32_t userId;
+    int32_t bookId;
+    int64_t borrowDate;
+    int64_t dueDate;
+    int64_t returnDate;
+} SavedLoan;
+
+// Original Book Record (the raw struct the first version wrote; read only to convert old files)
+typedef struct {
+    int id;
+    char title[MAX_TITLE_LENGTH];
+    char author[MAX_AUTHOR_LENGTH];
+    char isbn[MAX_ISBN_LENGTH];
+    BookStatus status;
+    void* left;
+    void* right;
+} LegacyBook;
+
+// Original User Record
+typedef struct {
+    int id;
+    char name[MAX_NAME_LENGTH];
+    char user_id[MAX_ID_LENGTH];
+    int age;
+    char gender;
+    int borrowCount;
+    UserStatus status;
+    void* borrowed;
+    void* next;
+} LegacyUser;
+
+// Original Borrow Record
+typedef struct {
     int userId;
     int bookId;
     time_t borrowDate;
     time_t dueDate;
     bool returned;
     time_t returnDate;
-    struct BorrowRecord* next;
-} BorrowRecord;
+    void* next;
+} LegacyLoan;
+
+// Data File Contents (read and checked in full before any of it replaces what is in memory)
+typedef struct {
+    SaveHeader header;
+    SavedBook* books;
+    SavedUser* users;
+    SavedLoan* loans;
+    ReservationRecord* reservations;
+    int reservationCount;
+} SavedData;
+
+// Archived Loan (fixed-size form of a returned loan in an archive partition)
+typedef struct {
+    int32_t userId;
+    int32_t bookId;
+    int64_t borrowDate;
+    int64_t dueDate;
+    int64_t returnDate;
+    int32_t batch;              // archival batch that wrote it
+    int32_t reserved;           // zero (keeps the record a multiple of 8 bytes)
+} ArchivedLoan;
+
+// Archive Index (partitions are months of the return date: year * 12 + month - 1);
+// followed by the committed record count of each month from firstMonth to lastMonth
+typedef struct {
+    uint32_t magic;
+    int32_t batch;              // last archival batch whose records are all committed
+    int32_t firstMonth;
+    int32_t lastMonth;
+    int64_t records;
+} ArchiveIndex;
+
+// Archive Reader (streams the partitions of a return-date range a block at a time)
+typedef struct {
+    FILE* file;
+    int month;                  // partition being read
+    int lastMonth;
+    int firstMonth;             // month of months[0]
+    int64_t* months;            // committed records of each partition
+    int64_t remaining;          // committed records of the open partition not read yet
+    time_t from;                // 0 = open-ended
+    time_t to;
+    ArchivedLoan records[ARCHIVE_READ_BATCH];
+    int count;
+    int next;
+} ArchiveReader;
+
+// Archive Candidate (a loan on its way to the archive, sorted by partition)
+typedef struct {
+    int month;
+    ArchivedLoan loan;
+} ArchiveCandidate;
+
+// Open Loan Slot (one open loan in the (user, book) index; a null loan marks an empty slot)
+typedef struct {
+    uint64_t key;
+    Handle loan;
+} OpenLoanSlot;
+
+// Open Loan Index (linear-probing hash of the open loans by user and book)
+typedef struct {
+    OpenLoanSlot* slots;
+    int count;
+    int capacity;       // a power of two, kept at most half full
+} OpenLoanIndex;
+
+// Fulfillment Queue (ring buffer of "book freed" events, by book ID)
+typedef struct {
+    int* bookIds;
+    int head;
+    int count;
+    int capacity;
+    long holdsPlaced;
+    long waitersSkipped;   // times a suspended or over-limit waiter was passed over (they keep their place)
+    long booksShelved;     // freed books nobody was waiting for
+    long holdsExpired;
+} FulfillmentQueue;
+
+// Count Ranking (indexed max-heap of IDs by count; an ID with a count of 0 is not in the heap)
+typedef struct {
+    long long* counts;      // by ID
+    int* positions;         // heap slot of each ID, -1 when it is not in the heap
+    int* heap;              // IDs, highest count first (ties: lower ID first)
+    int size;
+    int capacity;           // IDs the arrays cover
+} CountRanking;
+
+// Circulation Totals (running counts kept by the borrow, return and reservation paths)
+typedef struct {
+    long long loans;            // loans made (an undone loan is taken back)
+    long long returns;
+    long long lateReturns;      // returned after the due date
+    long long waits;            // waiters who reached a hold
+    long long waitSeconds;      // time those waiters spent in the queue
+    int activeBorrowers;        // users with a loan out
+} CirculationTotals;
 
 // Global Variables
 Book* bookRoot = NULL;
 User* userList = NULL;
-BookQueue bookQueues[MAX_BOOKS];
-HStack* HistoryStack ;
+BookQueue* bookQueues = NULL;
+int bookQueueCapacity = 0;
 BorrowRecord* borrowRecords = NULL;
-RStack* returnStack;
+BorrowRecord* borrowTail = NULL;
 int numbooks = 0;
 int numofuser = 0;
 int borrowCount = 0;
+volatile LONG64 catalogEpoch = 0;
+volatile LONG64 ledgerEpoch = 0;
+ChunkChanges catalogChanges = {NULL, 0, 0};
+ChunkChanges ledgerChanges = {NULL, 0, 0};
+CatalogSnapshot* currentCatalogSnapshot = NULL;
+LedgerSnapshot* currentLedgerSnapshot = NULL;
+CRITICAL_SECTION snapshotLock;
+ScanPool scanPool;
+int (*findSubstringKernel)(const SubstringMatcher* matcher, const char* text, int bufferLength) = NULL;
+int (*matchTitlesKernel)(const SubstringMatcher* matcher, const Book* books, int count, int* hits) = NULL;
+const char* substringKernelName = "scalar";
+LedgerColumns ledgerColumns;
+int (*filterLedgerKernel)(const LedgerColumns* columns, const LedgerFilter* filter, int start, int end, int* rows) = NULL;
+const char* ledgerKernelName = "scalar";
+BKNode* titleTree = NULL;
+BKNode* authorTree = NULL;
+BKNode* nameTree = NULL;
+PrefixIndex titlePrefix = {NULL, 0, 0};
+PrefixIndex authorPrefix = {NULL, 0, 0};
+PrefixIndex namePrefix = {NULL, 0, 0};
+KeyIndex authorIndex = {NULL, 0, 0};
+KeyIndex isbnIndex = {NULL, 0, 0};
+OrderTree titleOrder = {NULL, 2463534242u};
+OrderTree authorOrder = {NULL, 88675123u};
+RoaringBitmap statusBitmaps[STATUS_COUNT];
+LONG64 titleGeneration = 0;
+RecordPool bookPool = {sizeof(Book), NULL, 0, NULL};
+RecordPool userPool = {sizeof(User), NULL, 0, NULL};
+RecordPool loanPool = {sizeof(BorrowRecord), NULL, 0, NULL};
+User** userTable = NULL;
+int userTableSize = 0;
+OutputBuffer reportOutput = {NULL, NULL, 0, false};
+bool reportPaging = true;
+QueryCache titleCache;
+QueryCache loanCache;
+FulfillmentQueue fulfillmentQueue = {NULL, 0, 0, 0, 0, 0, 0, 0};
+HoldTimerWheel holdWheel;
+RecordPool holdTimerPool = {sizeof(HoldTimer), NULL, 0, NULL};
+UndoLog undoLog;
+bool undoInProgress = false;    // changes made by an undo are not logged
+HandleTable bookHandles;
+HandleTable userHandles;
+HandleTable loanHandles;
+int archiveAgeDays = ARCHIVE_AGE_DAYS;  // a negative age turns the archival stage off
+bool saveBlocked = false;       // the data file could not be read, so it is not overwritten
+int64_t loadedSaveStamp = 0;    // stamp of the save the data in memory continues (0 = none)
+bool journalInSequence = true;  // every change since that save is in the journal
+bool journalApplying = false;   // the changes being made are a journaled desk transaction
+OpenLoanIndex openLoans = {NULL, 0, 0};
+CirculationTotals circulation = {0, 0, 0, 0, 0, 0};
+CountRanking titleBorrows = {NULL, NULL, NULL, 0, 0};
+CountRanking userLoans = {NULL, NULL, NULL, 0, 0};
 
 
 /********************************************/
 /*     Function prototypes (needed )        */
 /********************************************/
-void pushToReturnHistory(int bookId , int userId);
-void pushToSystemHistory(Book* book ,User* user ,History His );
+UndoEntry* logUndo(UndoAction action, Book* book, User* user);
+void logFieldEdit(UndoAction action, Book* book, User* user, RecordField field, const char* oldText, int oldNumber);
+Book* searchBookById(Book* root, int id);
+User* searchUserById(int id);
+int compareInts(const void* a, const void* b);
+void statusBitmapsMove(int bookId, BookStatus from, BookStatus to);
+DeskResult queueReservation(Book* book, User* user, int* position);
+bool changeBookCopies(Book* book, int count);
+void deskTransactionMenu(DeskAction action);
+void displayLastReturn();
+void undoLastReturn();
+void joinUndoEntries(int count);
+void clearUndoLog();
+void describeUndoEntry(const UndoEntry* entry, char* text, int size);
+bool setBookCopies(Book* book, int copies);
+void saveAllData();
+long displayArchivedLoans(int userId, time_t from, time_t to);
+void countQueueWait(time_t since, time_t now);
+
 /********************************************/
-/*    BOOK MANAGEMENT set of Functions      */
+/*    Snapshot (MVCC) set of Functions      */
 /********************************************/
 
-// Create a new book
-Book* addBook(int id, const char* title, const char* author, const char* isbn) {
-    Book* newBook = (Book*)malloc(sizeof(Book));
-    
-    if (newBook == NULL) {
-        printf("Memory allocation failed!\n");
-        return NULL;
-    }
-    
-    newBook->id = id;
-    strncpy(newBook->title, title, MAX_TITLE_LENGTH - 1);
-    newBook->title[MAX_TITLE_LENGTH - 1] = '\0';
-    
-    strncpy(newBook->author, author, MAX_AUTHOR_LENGTH - 1);
-    newBook->author[MAX_AUTHOR_LENGTH - 1] = '\0';
-    
-    strncpy(newBook->isbn, isbn, MAX_ISBN_LENGTH - 1);
-    newBook->isbn[MAX_ISBN_LENGTH - 1] = '\0';
-    
-    newBook->status = AVAILABLE;
-    newBook->left = NULL;
-    newBook->right = NULL;
-    
-    return newBook;
+// Writers (the menu thread) bump the epoch after every committed change and
+// note which chunk it touched: a run of SNAPSHOT_CHUNK_SIZE book IDs, or of
+// ledger rows. Pinning on the menu thread hands out an immutable view tagged
+// with that epoch; it can be iterated without locks, even from other threads,
+// while writers keep mutating the live tree and ledger. A new view copies
+// only the chunks changed since the view before it and shares the rest, so
+// the first pin after a checkout copies one chunk of each, not everything.
+// Views and chunks are freed when their last reference is released.
+
+// Initialize snapshot state
+void initSnapshots() {
+    InitializeCriticalSection(&snapshotLock);
 }
 
-// Insert book into BST
-Book* insertBook(Book* root, Book* newBook) {
-    if (root == NULL) {
-        return newBook;
+// Note a change to chunks first to last at an epoch (every chunk, if the table cannot grow)
+void markChunkChanges(ChunkChanges* changes, int first, int last, LONG64 epoch) {
+    if (last >= changes->capacity) {
+        int capacity = changes->capacity > 0 ? changes->capacity : 16;
+        while (capacity <= last) {
+            capacity *= 2;
+        }
+        LONG64* epochs = (LONG64*)realloc(changes->epochs, sizeof(LONG64) * capacity);
+        if (epochs == NULL) {
+            changes->resetEpoch = epoch;
+            return;
+        }
+        memset(epochs + changes->capacity, 0, sizeof(LONG64) * (capacity - changes->capacity));
+        changes->epochs = epochs;
+        changes->capacity = capacity;
     }
-    
-    if (newBook->id < root->id) {
-        root->left = insertBook(root->left, newBook);
-    } else if (newBook->id > root->id) {
-        root->right = insertBook(root->right, newBook);
-    } else {
-        printf("Book with ID %d already exists!\n", newBook->id);
-        free(newBook);
+    for (int chunk = first; chunk <= last; chunk++) {
+        changes->epochs[chunk] = epoch;
     }
-    
-    return root;
 }
 
-// Search for book by ID
-Book* searchBookById(Book* root, int id) {
-    if (root == NULL || root->id == id) {
-        return root;
+// Check if a chunk is unchanged since a snapshot's epoch
+bool chunkUnchanged(const ChunkChanges* changes, int chunk, LONG64 epoch) {
+    return changes->resetEpoch <= epoch && (chunk >= changes->capacity || changes->epochs[chunk] <= epoch);
+}
+
+// Record a committed change to the whole catalog
+void commitCatalogChange() {
+    catalogChanges.resetEpoch = InterlockedIncrement64(&catalogEpoch);
+}
+
+// Record a committed change to one book (added, edited, deleted or recounted)
+void commitBookChange(int bookId) {
+    int chunk = bookId / SNAPSHOT_CHUNK_SIZE;
+    markChunkChanges(&catalogChanges, chunk, chunk, InterlockedIncrement64(&catalogEpoch));
+}
+
+// Record a committed change to the whole ledger
+void commitLedgerChange() {
+    ledgerChanges.resetEpoch = InterlockedIncrement64(&ledgerEpoch);
+}
+
+// Record a committed change to ledger rows first to last (a stale columnar ledger cannot place them)
+void commitLedgerRows(int first, int last) {
+    LONG64 epoch = InterlockedIncrement64(&ledgerEpoch);
+    if (ledgerColumns.stale || first < 0) {
+        ledgerChanges.resetEpoch = epoch;
+        return;
     }
-    
-    if (id < root->id) {
-        return searchBookById(root->left, id);
+    markChunkChanges(&ledgerChanges, first / SNAPSHOT_CHUNK_SIZE, last / SNAPSHOT_CHUNK_SIZE, epoch);
+}
+
+// Record a committed change to one loan (after its row was written or popped)
+void commitLoanChange(const BorrowRecord* record) {
+    commitLedgerRows(record->row, record->row);
+}
+
+// Change a book's status and publish the change
+void setBookStatus(Book* book, BookStatus status) {
+    if (book->status != status) {
+        statusBitmapsMove(book->id, book->status, status);
+        book->status = status;
+        commitBookChange(book->id);
     }
-    
-    return searchBookById(root->right, id);
 }
 
-// Search for book by title (partial match)
-Book* searchBookByTitle(Book* root, const char* title) {
+// Copies of a title on the shelf (neither lent nor held)
+int availableCopies(const Book* book) {
+    return book->copies - book->borrowed - book->held;
+}
+
+// Status of a title: available while a copy is on the shelf, else reserved while one is held
+BookStatus copyStatus(const Book* book) {
+    return availableCopies(book) > 0 ? AVAILABLE : book->held > 0 ? RESERVED : BORROWED;
+}
+
+// Publish a change to a title's copy counters
+void updateCopyCounts(Book* book) {
+    setBookStatus(book, copyStatus(book));
+    commitBookChange(book->id);
+}
+
+// Count books in BST
+int countBooks(Book* root) {
     if (root == NULL) {
-        return NULL;
+        return 0;
     }
-    
-    if (strstr(root->title, title) != NULL) {
-        printf("Found: %s by %s (ID = %d)\n", root->title, root->author, root->id);
-        return root;
+    return 1 + countBooks(root->left) + countBooks(root->right);
+}
+
+// Copy the books with IDs lo to hi in ID order into a flat array (helper for snapshots)
+void collectBookRange(Book* root, int lo, int hi, Book* out, int* count) {
+    if (root == NULL) {
+        return;
     }
-    
-    Book* leftResult = searchBookByTitle(root->left, title);
-    if (leftResult != NULL) {
-        return leftResult;
+    if (root->id > lo) {
+        collectBookRange(root->left, lo, hi, out, count);
+    }
+    if (root->id >= lo && root->id <= hi) {
+        out[*count] = *root;
+        out[*count].left = NULL;
+        out[*count].right = NULL;
+        (*count)++;
+    }
+    if (root->id < hi) {
+        collectBookRange(root->right, lo, hi, out, count);
     }
-    
-    return searchBookByTitle(root->right, title);
 }
-// Find minimum value node in BST (helper for deletion)
 
-Book* findMinValueNode(Book* root) {
-    Book* current = root;
-    
-    while (current && current->left != NULL) {
-        current = current->left;
+// Allocate an empty chunk with room for capacity items (NULL if out of memory)
+SnapshotChunk* newSnapshotChunk(size_t itemSize, int capacity) {
+    SnapshotChunk* chunk = (SnapshotChunk*)malloc(sizeof(SnapshotChunk));
+    void* items = malloc(itemSize * (capacity > 0 ? capacity : 1));
+    if (chunk == NULL || items == NULL) {
+        free(chunk);
+        free(items);
+        return NULL;
     }
-    
-    return current;
+    chunk->refs = 1;
+    chunk->count = 0;
+    chunk->items = items;
+    return chunk;
 }
 
-// Delete book from BST
-Book* deleteBook(Book* root, int id) {
-    if (root == NULL) {
-        return root;
+// Drop a reference to a snapshot chunk, freeing it after the last snapshot sharing it
+void releaseSnapshotChunk(SnapshotChunk* chunk) {
+    if (InterlockedDecrement(&chunk->refs) == 0) {
+        free(chunk->items);
+        free(chunk);
     }
-    
-    if (id < root->id) {
-        root->left = deleteBook(root->left, id);
-    } else if (id > root->id) {
-        root->right = deleteBook(root->right, id);
-    } else {
-        // Case 1: Leaf Node
-        if (root->left == NULL && root->right == NULL) {
-            free(root);
-            return NULL;
-        }
-        // Case 2: One child
-        else if (root->left == NULL) {
-            Book* temp = root->right;
-            free(root);
-            return temp;
-        } else if (root->right == NULL) {
-            Book* temp = root->left;
-            free(root);
-            return temp;
+}
+
+// Drop a reference to a catalog snapshot, freeing it after the last reader
+void releaseCatalogSnapshot(CatalogSnapshot* snap) {
+    if (snap != NULL && InterlockedDecrement(&snap->refs) == 0) {
+        for (int i = 0; i < snap->chunkCount; i++) {
+            releaseSnapshotChunk(snap->chunks[i]);
         }
-        
-        // Case 3: Two children
-        Book* temp = findMinValueNode(root->right);
-        root->id = temp->id;
-        strcpy(root->title, temp->title);
-        strcpy(root->author, temp->author);
-        strcpy(root->isbn, temp->isbn);
-        root->status = temp->status;
-        
-        root->right = deleteBook(root->right, temp->id);
+        free(snap->chunks);
+        free(snap->starts);
+        free(snap);
     }
-    
-    return root;
 }
 
-// Function to display a book's details
-void displayBook(Book* book) {
-    if (book != NULL) {
-        printf("---------------------------\n");
-        printf("ID: %d\n", book->id);
-        printf("Title: %s\n", book->title);
-        printf("Author: %s\n", book->author);
-        printf("ISBN: %s\n", book->isbn);
-        
-        printf("Status: ");
-        switch (book->status) {
-            case AVAILABLE:
-                printf("Available\n");
-                break;
-            case BORROWED:
-                printf("Borrowed\n");
-                break;
-            case RESERVED:
-                printf("Reserved\n");
-                break;
+// Drop a reference to a ledger snapshot, freeing it after the last reader
+void releaseLedgerSnapshot(LedgerSnapshot* snap) {
+    if (snap != NULL && InterlockedDecrement(&snap->refs) == 0) {
+        for (int i = 0; i < snap->chunkCount; i++) {
+            releaseSnapshotChunk(snap->chunks[i]);
         }
-        printf("---------------------------\n");
+        free(snap->chunks);
+        free(snap);
     }
 }
 
-// In-order traversal to display all books
-void displayAllBooks(Book* root) {
-    
-    if (root != NULL) {
-        displayAllBooks(root->left);
-        displayBook(root);
-        displayAllBooks(root->right);
-    }else {
-        printf("No books found!\n");
+// Copy the books of one ID chunk (NULL if out of memory)
+SnapshotChunk* copyCatalogChunk(int chunk) {
+    SnapshotChunk* copy = newSnapshotChunk(sizeof(Book), SNAPSHOT_CHUNK_SIZE);
+    if (copy == NULL) {
+        return NULL;
+    }
+    collectBookRange(bookRoot, chunk * SNAPSHOT_CHUNK_SIZE, chunk * SNAPSHOT_CHUNK_SIZE + SNAPSHOT_CHUNK_SIZE - 1, (Book*)copy->items, &copy->count);
+    if (copy->count > 0 && copy->count < SNAPSHOT_CHUNK_SIZE) {
+        void* items = realloc(copy->items, sizeof(Book) * copy->count);
+        if (items != NULL) {
+            copy->items = items;
+        }
     }
+    return copy;
 }
 
-// Add a new book via user input
-void bookInSys() {
-    char title[MAX_TITLE_LENGTH];
-    char author[MAX_AUTHOR_LENGTH];
-    char isbn[MAX_ISBN_LENGTH];
-    while ((getchar()) != '\n');
-
-    printf("Enter book title: ");
-    fgets(title, MAX_TITLE_LENGTH, stdin);
-    title[strcspn(title, "\n")] = '\0';  // Remove newline
-
-
-    printf("Enter author name: ");
-    fgets(author, MAX_AUTHOR_LENGTH, stdin);
-    author[strcspn(author, "\n")] = '\0';  // Remove newline
-    
-    printf("Enter ISBN: ");
-    fgets(isbn, MAX_ISBN_LENGTH, stdin);
-    isbn[strcspn(isbn, "\n")] = '\0';  // Remove newline
-    
-    numbooks++;
-    Book* newBook = addBook(numbooks, title, author, isbn);
-    bookRoot = insertBook(bookRoot, newBook);
-    Book* bookCopy = (Book*)malloc(sizeof(Book));
-    if (bookCopy == NULL) {
-        printf("Memory allocation failed! , action failed , not added to history\n");
+// Build a view of the catalog that shares the chunks unchanged since the previous view (NULL if out of memory)
+CatalogSnapshot* buildCatalogSnapshot(const CatalogSnapshot* previous) {
+    Book* highest = bookRoot;
+    while (highest != NULL && highest->right != NULL) {
+        highest = highest->right;
     }
-    *bookCopy = *newBook;
-    pushToSystemHistory(bookCopy , NULL , BOOKADDED);
-    printf("Book added successfully!\n");
-}
-
-// Edit book details
-void editBook() {
-    char bname[MAX_TITLE_LENGTH];
-        printf("Enter Book Title (or part of it): ");
-        while ((getchar()) != '\n'); // Clear input buffer
-        fgets(bname, MAX_TITLE_LENGTH, stdin);
-        bname[strcspn(bname, "\n")] = '\0';
-    
-    Book* book = searchBookByTitle(bookRoot, bname);
-    if (book == NULL) {
-        printf("Book not found!\n");
-        return;
+    int chunkCount = highest != NULL ? highest->id / SNAPSHOT_CHUNK_SIZE + 1 : 0;
+    CatalogSnapshot* fresh = (CatalogSnapshot*)malloc(sizeof(CatalogSnapshot));
+    SnapshotChunk** chunks = (SnapshotChunk**)malloc(sizeof(SnapshotChunk*) * (chunkCount > 0 ? chunkCount : 1));
+    int* starts = (int*)malloc(sizeof(int) * (chunkCount > 0 ? chunkCount : 1));
+    if (fresh == NULL || chunks == NULL || starts == NULL) {
+        free(fresh);
+        free(chunks);
+        free(starts);
+        return NULL;
     }
-    
-    printf("Current details:\n");
-    displayBook(book);
-    
-    
-    char title[MAX_TITLE_LENGTH];
-    char author[MAX_AUTHOR_LENGTH];
-    char isbn[MAX_ISBN_LENGTH];
-    int choice;
-    do{
-    printf("\nEnter new details (or leave blank to keep current):\n");
-    printf("1. Edit title\n");
-    printf("2. Edit author\n");
-    printf("3. Edit ISBN\n");
-    printf("4. Back\n");
-    printf("Enter choice: ");
-    scanf("%d", &choice);
-    printf("----------------------------------------------------\n");
-    while ((getchar()) != '\n');
-    switch (choice) {
-        case 1:
-            printf("Enter new title: ");
-            fgets(title, MAX_TITLE_LENGTH, stdin);
-            title[strcspn(title, "\n")] = '\0';
-            if (strlen(title) > 0) {
-                strncpy(book->title, title, MAX_TITLE_LENGTH - 1);
-                book->title[MAX_TITLE_LENGTH - 1] = '\0';
-            }
-            break;
-        case 2:
-            printf("Enter new author: ");
-            fgets(author, MAX_AUTHOR_LENGTH, stdin);
-            author[strcspn(author, "\n")] = '\0';
-            if (strlen(author) > 0) {
-                strncpy(book->author, author, MAX_AUTHOR_LENGTH - 1);
-                book->author[MAX_AUTHOR_LENGTH - 1] = '\0';
-            }
-            break;
-        case 3:
-            printf("Enter new ISBN: ");
-            fgets(isbn, MAX_ISBN_LENGTH, stdin);
-            isbn[strcspn(isbn, "\n")] = '\0';
-            if (strlen(isbn) > 0) {
-                strncpy(book->isbn, isbn, MAX_ISBN_LENGTH - 1);
-                book->isbn[MAX_ISBN_LENGTH - 1] = '\0';
-            }
-            break;
-        case 4:
-            return;
-        default:
-            printf("Invalid choice!\n");
+    fresh->epoch = catalogEpoch;
+    fresh->count = 0;
+    fresh->chunkCount = 0;
+    fresh->chunks = chunks;
+    fresh->starts = starts;
+    fresh->refs = 1; // held by currentCatalogSnapshot
+    for (int k = 0; k < chunkCount; k++) {
+        SnapshotChunk* chunk;
+        if (previous != NULL && k < previous->chunkCount && chunkUnchanged(&catalogChanges, k, previous->epoch)) {
+            chunk = previous->chunks[k];
+            InterlockedIncrement(&chunk->refs);
+        } else if ((chunk = copyCatalogChunk(k)) == NULL) {
+            releaseCatalogSnapshot(fresh);
+            return NULL;
+        }
+        fresh->chunks[k] = chunk;
+        fresh->starts[k] = fresh->count;
+        fresh->count += chunk->count;
+        fresh->chunkCount++;
     }
-}while (choice !=4);
-    printf("Book updated successfully!\n");
+    return fresh;
 }
 
-// View book details
-void viewBook() {
-    char title[MAX_TITLE_LENGTH];
-        printf("Enter Book Title (or part of it): ");
-        while ((getchar()) != '\n'); // Clear input buffer
-        fgets(title, MAX_TITLE_LENGTH, stdin);
-        title[strcspn(title, "\n")] = '\0';
-    
-    Book* book = searchBookByTitle(bookRoot, title);
-    if (book == NULL) {
-        printf("Book not found!\n");
-        return;
+// Copy count ledger rows from first on (NULL if out of memory)
+SnapshotChunk* copyLedgerChunk(BorrowRecord** rows, int first, int count) {
+    SnapshotChunk* copy = newSnapshotChunk(sizeof(BorrowRecord), count);
+    if (copy == NULL) {
+        return NULL;
     }
-    printf("\e[1;1H\e[2J");
-    displayBook(book);
+    BorrowRecord* records = (BorrowRecord*)copy->items;
+    for (int i = 0; i < count; i++) {
+        records[i] = *rows[first + i];
+        records[i].next = NULL;
+    }
+    copy->count = count;
+    return copy;
 }
 
-// Delete a book
-void deleteBookMenu() {
-    char title[MAX_TITLE_LENGTH];
-        printf("Enter Book Title (or part of it): ");
-        while ((getchar()) != '\n'); // Clear input buffer
-        fgets(title, MAX_TITLE_LENGTH, stdin);
-        title[strcspn(title, "\n")] = '\0';
-    
-    Book* book = searchBookByTitle(bookRoot, title);
-    if (book == NULL) {
-        printf("Book not found!\n");
-        return;
+// Build a view of the ledger that shares the chunks unchanged since the previous view (NULL if out of memory)
+LedgerSnapshot* buildLedgerSnapshot(const LedgerSnapshot* previous) {
+    // The columnar ledger finds a row's record; while it is stale the list is walked instead
+    BorrowRecord** rows = ledgerColumns.records;
+    BorrowRecord** walked = NULL;
+    int total = ledgerColumns.count;
+    if (ledgerColumns.stale) {
+        total = 0;
+        for (BorrowRecord* current = borrowRecords; current != NULL; current = current->next) {
+            total++;
+        }
+        walked = (BorrowRecord**)malloc(sizeof(BorrowRecord*) * (total > 0 ? total : 1));
+        if (walked == NULL) {
+            return NULL;
+        }
+        total = 0;
+        for (BorrowRecord* current = borrowRecords; current != NULL; current = current->next) {
+            walked[total++] = current;
+        }
+        rows = walked;
     }
-    
-    // Check if the book is borrowed
-    if (book->status != AVAILABLE) {
-        printf("Cannot delete book as it is currently borrowed or reserved!\n");
-        return;
+    int chunkCount = (total + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE;
+    LedgerSnapshot* fresh = (LedgerSnapshot*)malloc(sizeof(LedgerSnapshot));
+    SnapshotChunk** chunks = (SnapshotChunk**)malloc(sizeof(SnapshotChunk*) * (chunkCount > 0 ? chunkCount : 1));
+    if (fresh == NULL || chunks == NULL) {
+        free(fresh);
+        free(chunks);
+        free(walked);
+        return NULL;
     }
-    Book* bookCopy = (Book*)malloc(sizeof(Book));
-    if (bookCopy == NULL) {
-        printf("Memory allocation failed! , action failed , not added to history\n");
+    fresh->epoch = ledgerEpoch;
+    fresh->count = total;
+    fresh->chunkCount = 0;
+    fresh->chunks = chunks;
+    fresh->refs = 1; // held by currentLedgerSnapshot
+    for (int k = 0; k < chunkCount; k++) {
+        int first = k * SNAPSHOT_CHUNK_SIZE;
+        int length = total - first < SNAPSHOT_CHUNK_SIZE ? total - first : SNAPSHOT_CHUNK_SIZE;
+        SnapshotChunk* chunk;
+        if (previous != NULL && k < previous->chunkCount && previous->chunks[k]->count == length &&
+            chunkUnchanged(&ledgerChanges, k, previous->epoch)) {
+            chunk = previous->chunks[k];
+            InterlockedIncrement(&chunk->refs);
+        } else if ((chunk = copyLedgerChunk(rows, first, length)) == NULL) {
+            free(walked);
+            releaseLedgerSnapshot(fresh);
+            return NULL;
+        }
+        fresh->chunks[k] = chunk;
+        fresh->chunkCount++;
     }
-    *bookCopy = *book;
-    pushToSystemHistory(bookCopy , NULL , BOOKDELETED);
-    bookRoot = deleteBook(bookRoot, book->id);
-    printf("Book deleted successfully!\n");
+    free(walked);
+    return fresh;
 }
 
-// Book management menu
-void manageBooks() {
-    int choice;
-    
-    do {
-        printf("\e[1;1H\e[2J");
-        printf("\n=== Book Management ===\n");
-        printf("1. Add Book\n");
-        printf("2. Edit Book\n");
-        printf("3. View Book\n");
-        printf("4. Delete Book\n");
-        printf("5. List All Books\n");
-        printf("6. Back\n");
-        printf("Choose an option: ");
-        scanf("%d", &choice);
-        
-        switch (choice) {
-            case 1:
-            printf("\e[1;1H\e[2J");
-                bookInSys();
-                Sleep(2000);
-                break;
-            case 2:
-            printf("\e[1;1H\e[2J");
-                editBook();
-                Sleep(2000);
-                break;
-            case 3:
-            printf("\e[1;1H\e[2J");
-                viewBook();
-                Sleep(2000);
-                break;
-            case 4:
-            printf("\e[1;1H\e[2J");
-                deleteBookMenu();
-                Sleep(2000);
-                break;
-            case 5:
-            printf("\e[1;1H\e[2J");
-                displayAllBooks(bookRoot);
-                Sleep(5000);
-                break;
-            case 6:
-                return;
-            default:
-                printf("Invalid choice!\n");
+// Pin a point-in-time view of the catalog (release it when done)
+CatalogSnapshot* pinCatalogSnapshot() {
+    EnterCriticalSection(&snapshotLock);
+    CatalogSnapshot* snap = currentCatalogSnapshot;
+    if (snap == NULL || snap->epoch != catalogEpoch) {
+        CatalogSnapshot* fresh = buildCatalogSnapshot(snap);
+        if (fresh == NULL) {
+            LeaveCriticalSection(&snapshotLock);
+            printf("Memory allocation failed!\n");
+            return NULL;
         }
-    } while (choice != 6);
+
+        // Retire the previous version; its readers keep it (and the chunks only it holds) alive
+        releaseCatalogSnapshot(currentCatalogSnapshot);
+        currentCatalogSnapshot = fresh;
+        snap = fresh;
+    }
+    InterlockedIncrement(&snap->refs);
+    LeaveCriticalSection(&snapshotLock);
+    return snap;
 }
 
-/********************************************/
-/* User Management Functions                */
-/********************************************/
+// Pin a point-in-time view of the ledger (release it when done)
+LedgerSnapshot* pinLedgerSnapshot() {
+    EnterCriticalSection(&snapshotLock);
+    LedgerSnapshot* snap = currentLedgerSnapshot;
+    if (snap == NULL || snap->epoch != ledgerEpoch) {
+        LedgerSnapshot* fresh = buildLedgerSnapshot(snap);
+        if (fresh == NULL) {
+            LeaveCriticalSection(&snapshotLock);
+            printf("Memory allocation failed!\n");
+            return NULL;
+        }
 
-// Create a new user
-User* createUser(int id, const char* name, const char* user_id, int age, char gender) {
-    User* newUser = (User*)malloc(sizeof(User));
-    if (newUser == NULL) {
-        printf("Memory allocation failed!\n");
-        return NULL;
+        releaseLedgerSnapshot(currentLedgerSnapshot);
+        currentLedgerSnapshot = fresh;
+        snap = fresh;
     }
-    
-    newUser->id = id;
-    strncpy(newUser->name, name, MAX_NAME_LENGTH - 1);
-    newUser->name[MAX_NAME_LENGTH - 1] = '\0';
-    
-    strncpy(newUser->user_id, user_id, MAX_ID_LENGTH - 1);
-    newUser->user_id[MAX_ID_LENGTH - 1] = '\0';
-    
-    newUser->age = age;
-    newUser->gender = gender;
-    newUser->status = ACTIVE;
-    newUser->borrowCount = 0;
-    newUser->next = NULL;
-    
-    return newUser;
+    InterlockedIncrement(&snap->refs);
+    LeaveCriticalSection(&snapshotLock);
+    return snap;
 }
 
-// Add user to linked list
-void addUserToList(User* newUser) {
-    if (userList == NULL) {
-        userList = newUser;
-    } else {
-        User* current = userList;
-        while (current->next != NULL) {
-            current = current->next;
+// Chunk of a catalog snapshot holding a position (the last one starting at or before it)
+int snapshotChunkAt(const CatalogSnapshot* snap, int position) {
+    int lo = 0, hi = snap->chunkCount - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (snap->starts[mid] <= position) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
         }
-        current->next = newUser;
     }
+    return lo;
 }
 
-// Search for user by ID
-User* searchUserById(int id) {
-    User* current = userList;
-    while (current != NULL) {
-        if (current->id == id) {
-            return current;
+// Book at a position of a catalog snapshot (positions run in ID order)
+Book* snapshotBookAt(const CatalogSnapshot* snap, int position) {
+    int chunk = snapshotChunkAt(snap, position);
+    return &((Book*)snap->chunks[chunk]->items)[position - snap->starts[chunk]];
+}
+
+// Record at a position of a ledger snapshot
+BorrowRecord* snapshotLoanAt(const LedgerSnapshot* snap, int position) {
+    return &((BorrowRecord*)snap->chunks[position / SNAPSHOT_CHUNK_SIZE]->items)[position % SNAPSHOT_CHUNK_SIZE];
+}
+
+// Find a book by ID inside a catalog snapshot (its chunk, then a binary search)
+Book* snapshotBookById(CatalogSnapshot* snap, int id) {
+    if (id < 0 || id / SNAPSHOT_CHUNK_SIZE >= snap->chunkCount) {
+        return NULL;
+    }
+    const SnapshotChunk* chunk = snap->chunks[id / SNAPSHOT_CHUNK_SIZE];
+    Book* books = (Book*)chunk->items;
+    int lo = 0, hi = chunk->count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (books[mid].id == id) {
+            return &books[mid];
+        }
+        if (books[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
         }
-        current = current->next;
     }
     return NULL;
 }
 
-// Search for user by name
-User* searchUserByName(const char* name) {
-    User* current = userList;
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            return current;
+// Run a block matcher over snapshot positions first to last - 1, one contiguous run per chunk; hits are positions
+int matchSnapshotBlocks(const CatalogSnapshot* snap, int first, int last, BookBlockMatcher blockMatch, const void* arg, int* hits) {
+    int found = 0;
+    for (int chunk = first < last ? snapshotChunkAt(snap, first) : snap->chunkCount; first < last; chunk++) {
+        int offset = first - snap->starts[chunk];
+        int length = snap->chunks[chunk]->count - offset;
+        if (length <= 0) {
+            continue;
         }
-        current = current->next;
+        if (length > last - first) {
+            length = last - first;
+        }
+        int runHits = blockMatch((const Book*)snap->chunks[chunk]->items + offset, length, arg, hits + found);
+        for (int i = 0; i < runHits; i++) {
+            hits[found + i] += first;
+        }
+        found += runHits;
+        first += length;
     }
-    return NULL;
+    return found;
 }
 
-// Display user details
-void displayUser(User* user) {
-    printf("---------------------------\n");
-    if (user != NULL) {
-        printf("ID: %d\n", user->id);
-        printf("Name: %s\n", user->name);
-        printf("User ID: %s\n", user->user_id);
-        printf("Age: %d\n", user->age);
-        printf("Gender: %c\n", user->gender);
-        
-        printf("Status: ");
-        switch (user->status) {
-            case ACTIVE:
-                printf("Active\n");
-                break;
-            case SUSPENDED:
-                printf("Suspended\n");
-                break;
-            case EXPIRED:
-                printf("Expired\n");
-                break;
+/********************************************/
+/*      Vectorized Substring Matching       */
+/********************************************/
+
+// Each kernel compares the first and last pattern bytes against a whole
+// block of candidate positions at once and only runs memcmp on positions
+// where both match. Text lives in zero-terminated fixed-size buffers, so
+// blocks may read up to bufferLength; the terminator is found in the same
+// pass, which saves a separate strlen per record.
+
+// Portable kernel: same first/last byte filter, one position at a time
+int findSubstringScalarFrom(const SubstringMatcher* matcher, const char* text, int bufferLength, int start) {
+    int length = matcher->length;
+    char first = matcher->needle[0], last = matcher->needle[length - 1];
+    for (int i = start; i + length <= bufferLength && text[i] != '\0'; i++) {
+        if (text[i] == first && text[i + length - 1] == last && memcmp(text + i, matcher->needle, length) == 0) {
+            return i;
         }
-        printf("---------------------------\n");
     }
+    return -1;
 }
 
-// Display all users
-void displayAllUsers() {
-    User* current = userList;
-    if (current == NULL) {
-        printf("No users found!\n");
-        return;
-    }
-    
-    printf("\n=== All Users ===\n");
-    while (current != NULL) {
-        displayUser(current);
-        current = current->next;
+int findSubstringScalar(const SubstringMatcher* matcher, const char* text, int bufferLength) {
+    return findSubstringScalarFrom(matcher, text, bufferLength, 0);
+}
+
+int matchTitlesScalar(const SubstringMatcher* matcher, const Book* books, int count, int* hits) {
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        if (findSubstringScalarFrom(matcher, books[i].titleKey, MAX_TITLE_LENGTH, 0) >= 0) {
+            hits[found++] = i;
+        }
     }
+    return found;
 }
 
-// Delete user
-void delusernode(int id) {
+#ifdef LMS_HAVE_SSE2
+// SSE2 kernel: 16 candidate positions per step
+static inline int findSubstringSse2At(const SubstringMatcher* matcher, const char* text, int bufferLength,
+                                      __m128i first, __m128i last) {
+    int length = matcher->length;
+    int i = 0;
+    for (; i + length + 15 <= bufferLength; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(text + i + length - 1));
+        unsigned zeros = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(blockFirst, _mm_setzero_si128()));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst),
+                                                                  _mm_cmpeq_epi8(last, blockLast)));
+        if (zeros != 0) {
+            mask &= (zeros & (0u - zeros)) - 1; // only positions before the terminator
+        }
+        while (mask != 0) {
+            int pos = i + __builtin_ctz(mask);
+            if (memcmp(text + pos, matcher->needle, length) == 0) {
+                return pos;
+            }
+            mask &= mask - 1;
+        }
+        if (zeros != 0) {
+            return -1;
+        }
+    }
+    return findSubstringScalarFrom(matcher, text, bufferLength, i);
+}
+
+int findSubstringSse2(const SubstringMatcher* matcher, const char* text, int bufferLength) {
+    return findSubstringSse2At(matcher, text, bufferLength,
+                               _mm_set1_epi8(matcher->needle[0]), _mm_set1_epi8(matcher->needle[matcher->length - 1]));
+}
+
+int matchTitlesSse2(const SubstringMatcher* matcher, const Book* books, int count, int* hits) {
+    __m128i first = _mm_set1_epi8(matcher->needle[0]);
+    __m128i last = _mm_set1_epi8(matcher->needle[matcher->length - 1]);
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        if (findSubstringSse2At(matcher, books[i].titleKey, MAX_TITLE_LENGTH, first, last) >= 0) {
+            hits[found++] = i;
+        }
+    }
+    return found;
+}
+
+#ifdef __GNUC__
+#define LMS_HAVE_AVX2 1
+// AVX2 kernel: 32 candidate positions per step (only used when the CPU supports it)
+__attribute__((target("avx2")))
+static inline int findSubstringAvx2At(const SubstringMatcher* matcher, const char* text, int bufferLength,
+                                      __m256i first, __m256i last) {
+    int length = matcher->length;
+    int i = 0;
+    for (; i + length + 31 <= bufferLength; i += 32) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i*)(text + i + length - 1));
+        unsigned zeros = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(blockFirst, _mm256_setzero_si256()));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst),
+                                                                        _mm256_cmpeq_epi8(last, blockLast)));
+        if (zeros != 0) {
+            mask &= (zeros & (0u - zeros)) - 1;
+        }
+        while (mask != 0) {
+            int pos = i + __builtin_ctz(mask);
+            if (memcmp(text + pos, matcher->needle, length) == 0) {
+                return pos;
+            }
+            mask &= mask - 1;
+        }
+        if (zeros != 0) {
+            return -1;
+        }
+    }
+    return findSubstringScalarFrom(matcher, text, bufferLength, i);
+}
+
+__attribute__((target("avx2")))
+int findSubstringAvx2(const SubstringMatcher* matcher, const char* text, int bufferLength) {
+    return findSubstringAvx2At(matcher, text, bufferLength,
+                               _mm256_set1_epi8(matcher->needle[0]), _mm256_set1_epi8(matcher->needle[matcher->length - 1]));
+}
+
+__attribute__((target("avx2")))
+int matchTitlesAvx2(const SubstringMatcher* matcher, const Book* books, int count, int* hits) {
+    __m256i first = _mm256_set1_epi8(matcher->needle[0]);
+    __m256i last = _mm256_set1_epi8(matcher->needle[matcher->length - 1]);
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        if (findSubstringAvx2At(matcher, books[i].titleKey, MAX_TITLE_LENGTH, first, last) >= 0) {
+            hits[found++] = i;
+        }
+    }
+    return found;
+}
+#endif
+#endif
+
+// Every kernel compiled in, narrowest first
+const SubstringKernel substringKernels[] = {
+    {"scalar", findSubstringScalar, matchTitlesScalar, false},
+#ifdef LMS_HAVE_SSE2
+    {"SSE2", findSubstringSse2, matchTitlesSse2, false},
+#ifdef LMS_HAVE_AVX2
+    {"AVX2", findSubstringAvx2, matchTitlesAvx2, true},
+#endif
+#endif
+};
+
+// Check if the CPU can run a kernel
+bool substringKernelSupported(const SubstringKernel* kernel) {
+#ifdef LMS_HAVE_AVX2
+    if (kernel->needsAvx2) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return !kernel->needsAvx2;
+}
+
+// Route every scan through a kernel
+void useSubstringKernel(const SubstringKernel* kernel) {
+    findSubstringKernel = kernel->find;
+    matchTitlesKernel = kernel->matchTitles;
+    substringKernelName = kernel->name;
+}
+
+// Pick the widest kernel the CPU supports
+void selectSubstringKernel() {
+    int count = (int)(sizeof(substringKernels) / sizeof(substringKernels[0]));
+    int widest = 0;
+    for (int i = 0; i < count; i++) {
+        if (substringKernelSupported(&substringKernels[i])) {
+            widest = i;
+        }
+    }
+    useSubstringKernel(&substringKernels[widest]);
+}
+
+// Prepare a pattern for the scan kernels
+void prepareSubstringMatcher(SubstringMatcher* matcher, const char* pattern) {
+    if (findSubstringKernel == NULL) {
+        selectSubstringKernel();
+    }
+    matcher->length = (int)strlen(pattern);
+    if (matcher->length > MAX_TITLE_LENGTH - 1) {
+        matcher->length = MAX_TITLE_LENGTH - 1;
+    }
+    memcpy(matcher->needle, pattern, matcher->length);
+    matcher->needle[matcher->length] = '\0';
+}
+
+// Check if a fixed-size text buffer contains the prepared pattern
+bool containsSubstring(const SubstringMatcher* matcher, const char* text, int bufferLength) {
+    if (matcher->length == 0) {
+        return true;
+    }
+    return findSubstringKernel(matcher, text, bufferLength) >= 0;
+}
+
+// Block matcher: titles containing the prepared pattern
+int matchTitleBlock(const Book* books, int count, const void* arg, int* hits) {
+    const SubstringMatcher* matcher = (const SubstringMatcher*)arg;
+    if (matcher->length == 0) {
+        for (int i = 0; i < count; i++) {
+            hits[i] = i;
+        }
+        return count;
+    }
+    return matchTitlesKernel(matcher, books, count, hits);
+}
+
+// Time full-catalog title scans and user-name scans with every kernel the CPU runs
+void benchmarkSubstringKernels(int rounds) {
+    static const char* patterns[] = {"the", "history", "garden", "zq"};
+    int patternCount = (int)(sizeof(patterns) / sizeof(patterns[0]));
+    int kernelCount = (int)(sizeof(substringKernels) / sizeof(substringKernels[0]));
+    CatalogSnapshot* snap = pinCatalogSnapshot();
+    if (snap == NULL) {
+        return;
+    }
+    int* hits = (int*)malloc(sizeof(int) * (snap->count > 0 ? snap->count : 1));
+    if (hits == NULL) {
+        releaseCatalogSnapshot(snap);
+        printf("Memory allocation failed!\n");
+        return;
+    }
+    int users = 0;
+    for (User* user = userList; user != NULL; user = user->next) {
+        users++;
+    }
+    printf("%d title(s) and %d user name(s), %d round(s) of %d pattern(s)\n", snap->count, users, rounds, patternCount);
+
+    double scalarTitles = 0, scalarNames = 0;
+    for (int k = 0; k < kernelCount; k++) {
+        const SubstringKernel* kernel = &substringKernels[k];
+        if (!substringKernelSupported(kernel)) {
+            printf("  %-6s  not supported by this CPU\n", kernel->name);
+            continue;
+        }
+        useSubstringKernel(kernel);
+        long found = 0;
+        DWORD started = GetTickCount();
+        for (int round = 0; round < rounds; round++) {
+            for (int p = 0; p < patternCount; p++) {
+                SubstringMatcher matcher;
+                prepareSubstringMatcher(&matcher, patterns[p]);
+                found += matchSnapshotBlocks(snap, 0, snap->count, matchTitleBlock, &matcher, hits);
+            }
+        }
+        double titles = (double)(GetTickCount() - started) / (rounds * patternCount);
+        started = GetTickCount();
+        for (int round = 0; round < rounds; round++) {
+            for (int p = 0; p < patternCount; p++) {
+                SubstringMatcher matcher;
+                prepareSubstringMatcher(&matcher, patterns[p]);
+                for (User* user = userList; user != NULL; user = user->next) {
+                    found += containsSubstring(&matcher, user->nameKey, MAX_NAME_LENGTH);
+                }
+            }
+        }
+        double names = (double)(GetTickCount() - started) / (rounds * patternCount);
+        if (k == 0) {
+            scalarTitles = titles;
+            scalarNames = names;
+        }
+        printf("  %-6s  titles %8.3f ms/scan (%.2fx)  names %8.3f ms/scan (%.2fx)  %ld hit(s)\n", kernel->name,
+               titles, titles > 0 ? scalarTitles / titles : 1.0, names, names > 0 ? scalarNames / names : 1.0, found);
+    }
+    selectSubstringKernel();
+    printf("Scans use the %s kernel\n", substringKernelName);
+    free(hits);
+    releaseCatalogSnapshot(snap);
+}
+
+/********************************************/
+/*        Search Key Normalization          */
+/********************************************/
+
+// Titles, authors and names are searched through folded keys computed
+// once when a record is created, edited or loaded: lowercase, accents
+// stripped and whitespace collapsed. Text may arrive as UTF-8 or as
+// Latin-1/Windows-1252 bytes; characters outside Latin-1 and Latin
+// Extended-A are kept as they are.
+
+// Base letters for U+00C0..U+017F (capitals mark two-letter expansions)
+const char foldTable[] =
+    "aaaaaaAceeeeiiiidnoooooxouuuuyTS"  // U+00C0
+    "aaaaaaAceeeeiiiidnooooo/ouuuuyTy"  // U+00E0
+    "aaaaaaccccccccddddeeeeeeeeeegggg"  // U+0100
+    "gggghhhhiiiiiiiiiiJJjjkkklllllll"  // U+0120
+    "lllnnnnnnnnnooooooOOrrrrrrssssss"  // U+0140
+    "ssttttttuuuuuuuuuuuuwwyyyzzzzzzs"; // U+0160
+
+// Fold text into a search key of at most keySize - 1 bytes
+void foldSearchKey(const char* text, char* key, int keySize) {
+    const unsigned char* p = (const unsigned char*)text;
+    int pos = 0;
+    bool pendingSpace = false;
+
+    while (*p != '\0') {
+        unsigned code;
+        int used;
+        if (p[0] < 0x80) {
+            code = p[0];
+            used = 1;
+        } else if (p[0] >= 0xC2 && p[0] <= 0xDF && (p[1] & 0xC0) == 0x80) {
+            code = ((p[0] & 0x1Fu) << 6) | (p[1] & 0x3Fu);
+            used = 2;
+        } else if (p[0] >= 0xE0 && p[0] <= 0xF4 && (p[1] & 0xC0) == 0x80 && (p[2] & 0xC0) == 0x80 &&
+                   (p[0] < 0xF0 || (p[3] & 0xC0) == 0x80)) {
+            code = 0x10000; // three/four byte UTF-8: kept as is
+            used = p[0] < 0xF0 ? 3 : 4;
+        } else {
+            code = p[0]; // Latin-1 / Windows-1252 byte
+            used = 1;
+        }
+
+        if (code == ' ' || (code >= '\t' && code <= '\r') || code == 0xA0) {
+            pendingSpace = pos > 0;
+            p += used;
+            continue;
+        }
+
+        char folded[2] = {0, 0};
+        int foldedLength = 0;
+        if (code < 0x80) {
+            folded[0] = (char)((code >= 'A' && code <= 'Z') ? code + ('a' - 'A') : code);
+            foldedLength = 1;
+        } else if (code >= 0xC0 && code < 0x180) {
+            char base = foldTable[code - 0xC0];
+            switch (base) {
+                case 'A': folded[0] = 'a'; folded[1] = 'e'; foldedLength = 2; break;
+                case 'T': folded[0] = 't'; folded[1] = 'h'; foldedLength = 2; break;
+                case 'S': folded[0] = 's'; folded[1] = 's'; foldedLength = 2; break;
+                case 'J': folded[0] = 'i'; folded[1] = 'j'; foldedLength = 2; break;
+                case 'O': folded[0] = 'o'; folded[1] = 'e'; foldedLength = 2; break;
+                default: folded[0] = base; foldedLength = 1; break;
+            }
+        }
+
+        int needed = (foldedLength > 0 ? foldedLength : used) + (pendingSpace ? 1 : 0);
+        if (pos + needed > keySize - 1) {
+            break;
+        }
+        if (pendingSpace) {
+            key[pos++] = ' ';
+            pendingSpace = false;
+        }
+        if (foldedLength > 0) {
+            memcpy(key + pos, folded, foldedLength);
+            pos += foldedLength;
+        } else {
+            memcpy(key + pos, p, used);
+            pos += used;
+        }
+        p += used;
+    }
+    // Zero-fill so the fixed-size key buffers hold no stale bytes past the key
+    memset(key + pos, 0, keySize - pos);
+}
+
+// Recompute a book's search keys
+void refreshBookKeys(Book* book) {
+    foldSearchKey(book->title, book->titleKey, MAX_TITLE_LENGTH);
+    foldSearchKey(book->author, book->authorKey, MAX_AUTHOR_LENGTH);
+}
+
+// Normalize an ISBN for lookups (digits and letters only, uppercased)
+void normalizeIsbn(const char* text, char* key, int keySize) {
+    int length = 0;
+    for (; *text != '\0' && length < keySize - 1; text++) {
+        if (isalnum((unsigned char)*text)) {
+            key[length++] = (char)toupper((unsigned char)*text);
+        }
+    }
+    key[length] = '\0';
+}
+
+// Recompute a user's search key
+void refreshUserKeys(User* user) {
+    foldSearchKey(user->name, user->nameKey, MAX_NAME_LENGTH);
+}
+
+/********************************************/
+/*        Fuzzy Search (BK-trees)           */
+/********************************************/
+
+// Titles, authors and names each have a BK-tree over their folded keys.
+// Edit distance is a metric, so a query only descends into children
+// whose distance to their parent lies within the bound of the query's
+// distance to that parent; most of the tree is never compared.
+
+// Levenshtein distance between two keys
+int editDistance(const char* a, const char* b) {
+    int lengthA = (int)strlen(a), lengthB = (int)strlen(b);
+    if (lengthA == 0) {
+        return lengthB;
+    }
+    if (lengthA <= 64) {
+        // Bit-parallel form (Myers/Hyyrö): one column of the DP table per
+        // character of b, held as vertical +1/-1 deltas in two words
+        uint64_t peq[256] = {0};
+        uint64_t pv = ~(uint64_t)0, mv = 0, last = (uint64_t)1 << (lengthA - 1);
+        int score = lengthA;
+        for (int i = 0; i < lengthA; i++) {
+            peq[(unsigned char)a[i]] |= (uint64_t)1 << i;
+        }
+        for (int j = 0; j < lengthB; j++) {
+            uint64_t eq = peq[(unsigned char)b[j]];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if (ph & last) {
+                score++;
+            } else if (mh & last) {
+                score--;
+            }
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+        return score;
+    }
+
+    int rows[2][MAX_TITLE_LENGTH + 1];
+    int* prev = rows[0];
+    int* cur = rows[1];
+
+    for (int j = 0; j <= lengthB; j++) {
+        prev[j] = j;
+    }
+    for (int i = 1; i <= lengthA; i++) {
+        cur[0] = i;
+        for (int j = 1; j <= lengthB; j++) {
+            int best = prev[j - 1] + (a[i - 1] != b[j - 1]);
+            if (prev[j] + 1 < best) {
+                best = prev[j] + 1;
+            }
+            if (cur[j - 1] + 1 < best) {
+                best = cur[j - 1] + 1;
+            }
+            cur[j] = best;
+        }
+        int* swap = prev;
+        prev = cur;
+        cur = swap;
+    }
+    return prev[lengthB];
+}
+
+// Default typo tolerance for a query key
+int fuzzyBoundFor(const char* key) {
+    int length = (int)strlen(key);
+    if (length <= 4) {
+        return 1;
+    }
+    return length <= 10 ? 2 : 3;
+}
+
+// Create a BK-tree node
+BKNode* createBKNode(const char* key, int distance) {
+    BKNode* node = (BKNode*)malloc(sizeof(BKNode));
+    if (node == NULL) {
+        printf("Memory allocation failed!\n");
+        return NULL;
+    }
+    node->key = strdup(key);
+    node->distance = distance;
+    node->ids = NULL;
+    node->idCount = 0;
+    node->idCapacity = 0;
+    node->firstChild = NULL;
+    node->nextSibling = NULL;
+    return node;
+}
+
+// Add an id under a key (creating the key's node if needed)
+BKNode* bkInsert(BKNode* root, const char* key, int id) {
+    if (key[0] == '\0') {
+        return root;
+    }
+    if (root == NULL) {
+        root = createBKNode(key, 0);
+        if (root == NULL) {
+            return NULL;
+        }
+    }
+
+    BKNode* node = root;
+    int distance;
+    while ((distance = editDistance(key, node->key)) != 0) {
+        BKNode* child = node->firstChild;
+        while (child != NULL && child->distance != distance) {
+            child = child->nextSibling;
+        }
+        if (child == NULL) {
+            child = createBKNode(key, distance);
+            if (child == NULL) {
+                return root;
+            }
+            child->nextSibling = node->firstChild;
+            node->firstChild = child;
+        }
+        node = child;
+    }
+
+    if (node->idCount == node->idCapacity) {
+        int capacity = node->idCapacity > 0 ? node->idCapacity * 2 : 2;
+        int* ids = (int*)realloc(node->ids, sizeof(int) * capacity);
+        if (ids == NULL) {
+            printf("Memory allocation failed!\n");
+            return root;
+        }
+        node->ids = ids;
+        node->idCapacity = capacity;
+    }
+    node->ids[node->idCount++] = id;
+    return root;
+}
+
+// Remove an id from a key (the node stays as a routing point)
+void bkRemove(BKNode* root, const char* key, int id) {
+    BKNode* node = root;
+    while (node != NULL) {
+        int distance = editDistance(key, node->key);
+        if (distance == 0) {
+            for (int i = 0; i < node->idCount; i++) {
+                if (node->ids[i] == id) {
+                    node->ids[i] = node->ids[--node->idCount];
+                    return;
+                }
+            }
+            return;
+        }
+        BKNode* child = node->firstChild;
+        while (child != NULL && child->distance != distance) {
+            child = child->nextSibling;
+        }
+        node = child;
+    }
+}
+
+// Free a BK-tree
+void freeBKTree(BKNode* node) {
+    while (node != NULL) {
+        BKNode* next = node->nextSibling;
+        freeBKTree(node->firstChild);
+        free(node->key);
+        free(node->ids);
+        free(node);
+        node = next;
+    }
+}
+
+// Keep the best matches (smallest distance first)
+void addFuzzyMatch(FuzzyMatch* matches, int* count, int limit, BKNode* node, int distance) {
+    int pos = *count;
+    if (pos == limit) {
+        if (matches[limit - 1].distance <= distance) {
+            return;
+        }
+        pos = limit - 1;
+    } else {
+        (*count)++;
+    }
+    while (pos > 0 && matches[pos - 1].distance > distance) {
+        matches[pos] = matches[pos - 1];
+        pos--;
+    }
+    matches[pos].node = node;
+    matches[pos].distance = distance;
+}
+
+// Collect the closest live keys within the bound
+void bkSearch(BKNode* node, const char* key, int bound, FuzzyMatch* matches, int* count, int limit) {
+    if (node == NULL) {
+        return;
+    }
+    int distance = editDistance(key, node->key);
+    if (distance <= bound && node->idCount > 0) {
+        addFuzzyMatch(matches, count, limit, node, distance);
+        // Once the list is full, nothing farther than its worst entry can help
+        if (*count == limit && matches[limit - 1].distance < bound) {
+            bound = matches[limit - 1].distance;
+        }
+    }
+    for (BKNode* child = node->firstChild; child != NULL; child = child->nextSibling) {
+        if (child->distance >= distance - bound && child->distance <= distance + bound) {
+            bkSearch(child, key, bound, matches, count, limit);
+        }
+    }
+}
+
+// Run a fuzzy query against a tree (query is folded first)
+int fuzzyLookup(BKNode* tree, const char* query, FuzzyMatch* matches) {
+    char key[MAX_TITLE_LENGTH];
+    int count = 0;
+    foldSearchKey(query, key, MAX_TITLE_LENGTH);
+    if (key[0] != '\0') {
+        bkSearch(tree, key, fuzzyBoundFor(key), matches, &count, FUZZY_MAX_RESULTS);
+    }
+    return count;
+}
+
+// Print the closest books by title or author
+void fuzzySearchBooks(BKNode* tree, const char* query) {
+    FuzzyMatch matches[FUZZY_MAX_RESULTS];
+    int count = fuzzyLookup(tree, query, matches);
+    if (count == 0) {
+        printf("No close matches for '%s'\n", query);
+        return;
+    }
+    printf("Closest matches for '%s':\n", query);
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < matches[i].node->idCount; j++) {
+            Book* book = searchBookById(bookRoot, matches[i].node->ids[j]);
+            if (book != NULL) {
+                printf("  [%d] %s by %s (ID = %d)\n", matches[i].distance, book->title, book->author, book->id);
+            }
+        }
+    }
+}
+
+// Print the closest users by name
+void fuzzySearchUsers(const char* query) {
+    FuzzyMatch matches[FUZZY_MAX_RESULTS];
+    int count = fuzzyLookup(nameTree, query, matches);
+    if (count == 0) {
+        printf("No close matches for '%s'\n", query);
+        return;
+    }
+    printf("Closest matches for '%s':\n", query);
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < matches[i].node->idCount; j++) {
+            User* user = searchUserById(matches[i].node->ids[j]);
+            if (user != NULL) {
+                printf("  [%d] %s (ID = %d, User ID = %s)\n", matches[i].distance, user->name, user->id, user->user_id);
+            }
+        }
+    }
+}
+
+/********************************************/
+/*           Prefix Autocomplete            */
+/********************************************/
+
+// Folded keys are kept in sorted arrays. A completion is a binary search
+// for the first key >= the prefix followed by a short forward walk, so
+// it costs O(log n + results). Single updates shift the tail of the
+// array with memmove; loads sort the whole array once.
+
+// Order entries by key, then id
+int comparePrefixEntries(const void* a, const void* b) {
+    const PrefixEntry* x = (const PrefixEntry*)a;
+    const PrefixEntry* y = (const PrefixEntry*)b;
+    int order = strcmp(x->key, y->key);
+    if (order != 0) {
+        return order;
+    }
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+// First position whose entry is >= (key, id)
+int prefixLowerBound(PrefixIndex* index, const char* key, int id) {
+    PrefixEntry probe = {(char*)key, id};
+    int lo = 0, hi = index->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (comparePrefixEntries(&index->entries[mid], &probe) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Make room for one more entry
+bool growPrefixIndex(PrefixIndex* index) {
+    if (index->count < index->capacity) {
+        return true;
+    }
+    int capacity = index->capacity > 0 ? index->capacity * 2 : 64;
+    PrefixEntry* entries = (PrefixEntry*)realloc(index->entries, sizeof(PrefixEntry) * capacity);
+    if (entries == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    index->entries = entries;
+    index->capacity = capacity;
+    return true;
+}
+
+// Append without keeping order (bulk loads call sortPrefixIndex afterwards)
+void appendPrefixEntry(PrefixIndex* index, const char* key, int id) {
+    if (key[0] == '\0' || !growPrefixIndex(index)) {
+        return;
+    }
+    index->entries[index->count].key = strdup(key);
+    index->entries[index->count].id = id;
+    index->count++;
+}
+
+// Sort after a bulk load
+void sortPrefixIndex(PrefixIndex* index) {
+    qsort(index->entries, index->count, sizeof(PrefixEntry), comparePrefixEntries);
+}
+
+// Insert one entry in order
+void prefixInsert(PrefixIndex* index, const char* key, int id) {
+    if (key[0] == '\0' || !growPrefixIndex(index)) {
+        return;
+    }
+    int pos = prefixLowerBound(index, key, id);
+    memmove(&index->entries[pos + 1], &index->entries[pos], sizeof(PrefixEntry) * (index->count - pos));
+    index->entries[pos].key = strdup(key);
+    index->entries[pos].id = id;
+    index->count++;
+}
+
+// Remove one entry
+void prefixRemove(PrefixIndex* index, const char* key, int id) {
+    int pos = prefixLowerBound(index, key, id);
+    if (pos < index->count && index->entries[pos].id == id && strcmp(index->entries[pos].key, key) == 0) {
+        free(index->entries[pos].key);
+        memmove(&index->entries[pos], &index->entries[pos + 1], sizeof(PrefixEntry) * (index->count - pos - 1));
+        index->count--;
+    }
+}
+
+// Drop every entry
+void clearPrefixIndex(PrefixIndex* index) {
+    for (int i = 0; i < index->count; i++) {
+        free(index->entries[i].key);
+    }
+    index->count = 0;
+}
+
+// Collect up to limit ids whose key starts with the (folded) prefix.
+// With distinct set, only the first record of each key is returned.
+int prefixComplete(PrefixIndex* index, const char* prefix, int* ids, int limit, bool distinct) {
+    char key[MAX_TITLE_LENGTH];
+    foldSearchKey(prefix, key, MAX_TITLE_LENGTH);
+    int length = (int)strlen(key);
+    int found = 0;
+    const char* lastKey = NULL;
+
+    for (int pos = prefixLowerBound(index, key, -1); pos < index->count && found < limit; pos++) {
+        PrefixEntry* entry = &index->entries[pos];
+        if (strncmp(entry->key, key, length) != 0) {
+            break;
+        }
+        if (distinct && lastKey != NULL && strcmp(lastKey, entry->key) == 0) {
+            continue;
+        }
+        lastKey = entry->key;
+        ids[found++] = entry->id;
+    }
+    return found;
+}
+
+// Print completions for titles (1), authors (2) or user names (3)
+void showCompletions(int field, const char* prefix) {
+    int ids[AUTOCOMPLETE_RESULTS];
+    int found = 0;
+    switch (field) {
+        case 1:
+            found = prefixComplete(&titlePrefix, prefix, ids, AUTOCOMPLETE_RESULTS, false);
+            break;
+        case 2:
+            found = prefixComplete(&authorPrefix, prefix, ids, AUTOCOMPLETE_RESULTS, true);
+            break;
+        case 3:
+            found = prefixComplete(&namePrefix, prefix, ids, AUTOCOMPLETE_RESULTS, false);
+            break;
+        default:
+            printf("Invalid choice!\n");
+            return;
+    }
+    if (found == 0) {
+        printf("No completions for '%s'\n", prefix);
+        return;
+    }
+    for (int i = 0; i < found; i++) {
+        if (field == 3) {
+            User* user = searchUserById(ids[i]);
+            if (user != NULL) {
+                printf("  %s (ID = %d)\n", user->name, user->id);
+            }
+            continue;
+        }
+        Book* book = searchBookById(bookRoot, ids[i]);
+        if (book == NULL) {
+            continue;
+        }
+        if (field == 1) {
+            printf("  %s by %s (ID = %d)\n", book->title, book->author, book->id);
+        } else {
+            printf("  %s\n", book->author);
+        }
+    }
+}
+
+/********************************************/
+/*              Author Index                */
+/********************************************/
+
+// Folded author -> book IDs. An exact author query is one hash lookup;
+// a prefix query walks the sorted author prefix array. Both cost
+// O(results) instead of a catalog walk. The same hash table keyed by
+// normalized ISBN answers exact ISBN lookups.
+
+// FNV-1a hash of a key
+uint32_t hashKey(const char* key) {
+    uint32_t hash = 2166136261u;
+    while (*key != '\0') {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Find the entry for a key
+KeyEntry* findKeyEntry(KeyIndex* index, const char* key) {
+    if (index->bucketCount == 0) {
+        return NULL;
+    }
+    KeyEntry* entry = index->buckets[hashKey(key) & (index->bucketCount - 1)];
+    while (entry != NULL && strcmp(entry->key, key) != 0) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+// Double the bucket array once the chains get long
+void growKeyIndex(KeyIndex* index) {
+    int bucketCount = index->bucketCount > 0 ? index->bucketCount * 2 : 256;
+    KeyEntry** buckets = (KeyEntry**)calloc(bucketCount, sizeof(KeyEntry*));
+    if (buckets == NULL) {
+        return;
+    }
+    for (int i = 0; i < index->bucketCount; i++) {
+        KeyEntry* entry = index->buckets[i];
+        while (entry != NULL) {
+            KeyEntry* next = entry->next;
+            uint32_t slot = hashKey(entry->key) & (bucketCount - 1);
+            entry->next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucketCount = bucketCount;
+}
+
+// Add a book under a key
+void keyIndexAdd(KeyIndex* index, const char* key, int bookId) {
+    if (key[0] == '\0') {
+        return;
+    }
+    KeyEntry* entry = findKeyEntry(index, key);
+    if (entry == NULL) {
+        if (index->keyCount >= index->bucketCount * 2) {
+            growKeyIndex(index);
+        }
+        entry = (KeyEntry*)calloc(1, sizeof(KeyEntry));
+        if (entry == NULL || index->bucketCount == 0) {
+            free(entry);
+            printf("Memory allocation failed!\n");
+            return;
+        }
+        strcpy(entry->key, key);
+        uint32_t slot = hashKey(key) & (index->bucketCount - 1);
+        entry->next = index->buckets[slot];
+        index->buckets[slot] = entry;
+        index->keyCount++;
+    }
+    if (entry->count == entry->capacity) {
+        int capacity = entry->capacity > 0 ? entry->capacity * 2 : 4;
+        int* ids = (int*)realloc(entry->bookIds, sizeof(int) * capacity);
+        if (ids == NULL) {
+            printf("Memory allocation failed!\n");
+            return;
+        }
+        entry->bookIds = ids;
+        entry->capacity = capacity;
+    }
+    entry->bookIds[entry->count++] = bookId;
+}
+
+// Remove a book from a key (the key goes when it has no books left)
+void keyIndexRemove(KeyIndex* index, const char* key, int bookId) {
+    if (index->bucketCount == 0) {
+        return;
+    }
+    KeyEntry** link = &index->buckets[hashKey(key) & (index->bucketCount - 1)];
+    while (*link != NULL && strcmp((*link)->key, key) != 0) {
+        link = &(*link)->next;
+    }
+    KeyEntry* entry = *link;
+    if (entry == NULL) {
+        return;
+    }
+    for (int i = 0; i < entry->count; i++) {
+        if (entry->bookIds[i] == bookId) {
+            entry->bookIds[i] = entry->bookIds[--entry->count];
+            break;
+        }
+    }
+    if (entry->count == 0) {
+        *link = entry->next;
+        free(entry->bookIds);
+        free(entry);
+        index->keyCount--;
+    }
+}
+
+// Drop every key
+void clearKeyIndex(KeyIndex* index) {
+    for (int i = 0; i < index->bucketCount; i++) {
+        KeyEntry* entry = index->buckets[i];
+        while (entry != NULL) {
+            KeyEntry* next = entry->next;
+            free(entry->bookIds);
+            free(entry);
+            entry = next;
+        }
+        index->buckets[i] = NULL;
+    }
+    index->keyCount = 0;
+}
+
+// Print one line per book with its status
+void printBibliographyLine(Book* book) {
+    const char* status = book->status == AVAILABLE ? "Available" : book->status == BORROWED ? "Borrowed" : "Reserved";
+    printf("  %-50s ID %-6d %-9s %d/%d on shelf\n", book->title, book->id, status, availableCopies(book), book->copies);
+}
+
+// List every book by an author (exact match on the folded name)
+void listBooksByAuthor(const char* author) {
+    char key[MAX_AUTHOR_LENGTH];
+    foldSearchKey(author, key, MAX_AUTHOR_LENGTH);
+    KeyEntry* entry = findKeyEntry(&authorIndex, key);
+    if (entry == NULL) {
+        printf("No books found by '%s'\n", author);
+        return;
+    }
+
+    int* ids = (int*)malloc(sizeof(int) * entry->count);
+    if (ids == NULL) {
+        printf("Memory allocation failed!\n");
+        return;
+    }
+    memcpy(ids, entry->bookIds, sizeof(int) * entry->count);
+    qsort(ids, entry->count, sizeof(int), compareInts);
+
+    Book* first = searchBookById(bookRoot, ids[0]);
+    printf("=== Books by %s (%d) ===\n", first != NULL ? first->author : author, entry->count);
+    for (int i = 0; i < entry->count; i++) {
+        Book* book = searchBookById(bookRoot, ids[i]);
+        if (book != NULL) {
+            printBibliographyLine(book);
+        }
+    }
+    free(ids);
+}
+
+// List every book whose author starts with the prefix, grouped by author
+void listBooksByAuthorPrefix(const char* prefix) {
+    char key[MAX_AUTHOR_LENGTH];
+    foldSearchKey(prefix, key, MAX_AUTHOR_LENGTH);
+    int length = (int)strlen(key);
+    int total = 0;
+    const char* lastKey = NULL;
+
+    for (int pos = prefixLowerBound(&authorPrefix, key, -1); pos < authorPrefix.count; pos++) {
+        PrefixEntry* entry = &authorPrefix.entries[pos];
+        if (strncmp(entry->key, key, length) != 0) {
+            break;
+        }
+        Book* book = searchBookById(bookRoot, entry->id);
+        if (book == NULL) {
+            continue;
+        }
+        if (lastKey == NULL || strcmp(lastKey, entry->key) != 0) {
+            printf("=== %s ===\n", book->author);
+            lastKey = entry->key;
+        }
+        printBibliographyLine(book);
+        total++;
+    }
+    if (total == 0) {
+        printf("No authors found starting with '%s'\n", prefix);
+    } else {
+        printf("%d book(s) found\n", total);
+    }
+}
+
+/********************************************/
+/*             Status Bitmaps               */
+/********************************************/
+
+// One compressed bitmap of book IDs per BookStatus, roaring style: IDs
+// are grouped by their high 16 bits, and each group is a sorted array
+// of low bits while sparse or a 65536-bit bitmap once dense. Counts are
+// sums of container cardinalities (popcounts for dense ones), listings
+// only visit set bits, and roaringContains lets other indexes filter
+// their results by status.
+
+// Position of the container for key (or where it would go)
+int roaringFind(RoaringBitmap* bitmap, uint16_t key) {
+    int lo = 0, hi = bitmap->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (bitmap->containers[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Position of value in a sorted array container (or where it would go)
+int roaringArrayFind(RoaringContainer* container, uint16_t value) {
+    int lo = 0, hi = container->cardinality;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (container->values[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Count set bits in a dense container
+int roaringPopcount(const uint64_t* bits) {
+    int total = 0;
+    for (int i = 0; i < ROARING_BITMAP_WORDS; i++) {
+        total += __builtin_popcountll(bits[i]);
+    }
+    return total;
+}
+
+// Check if an ID is in the bitmap
+bool roaringContains(RoaringBitmap* bitmap, int id) {
+    uint16_t key = (uint16_t)((uint32_t)id >> 16), low = (uint16_t)id;
+    int pos = roaringFind(bitmap, key);
+    if (pos == bitmap->count || bitmap->containers[pos].key != key) {
+        return false;
+    }
+    RoaringContainer* container = &bitmap->containers[pos];
+    if (container->bits != NULL) {
+        return (container->bits[low >> 6] >> (low & 63)) & 1;
+    }
+    int at = roaringArrayFind(container, low);
+    return at < container->cardinality && container->values[at] == low;
+}
+
+// Add an ID to the bitmap
+void roaringAdd(RoaringBitmap* bitmap, int id) {
+    uint16_t key = (uint16_t)((uint32_t)id >> 16), low = (uint16_t)id;
+    int pos = roaringFind(bitmap, key);
+    if (pos == bitmap->count || bitmap->containers[pos].key != key) {
+        if (bitmap->count == bitmap->capacity) {
+            int capacity = bitmap->capacity > 0 ? bitmap->capacity * 2 : 4;
+            RoaringContainer* containers = (RoaringContainer*)realloc(bitmap->containers, sizeof(RoaringContainer) * capacity);
+            if (containers == NULL) {
+                printf("Memory allocation failed!\n");
+                return;
+            }
+            bitmap->containers = containers;
+            bitmap->capacity = capacity;
+        }
+        memmove(&bitmap->containers[pos + 1], &bitmap->containers[pos], sizeof(RoaringContainer) * (bitmap->count - pos));
+        RoaringContainer empty = {key, 0, NULL, NULL, 0};
+        bitmap->containers[pos] = empty;
+        bitmap->count++;
+    }
+
+    RoaringContainer* container = &bitmap->containers[pos];
+    if (container->bits != NULL) {
+        uint64_t mask = (uint64_t)1 << (low & 63);
+        if (!(container->bits[low >> 6] & mask)) {
+            container->bits[low >> 6] |= mask;
+            container->cardinality++;
+        }
+        return;
+    }
+
+    int at = roaringArrayFind(container, low);
+    if (at < container->cardinality && container->values[at] == low) {
+        return;
+    }
+    if (container->cardinality == ROARING_ARRAY_MAX) {
+        // Too dense for an array: switch to a bitmap
+        uint64_t* bits = (uint64_t*)calloc(ROARING_BITMAP_WORDS, sizeof(uint64_t));
+        if (bits == NULL) {
+            printf("Memory allocation failed!\n");
+            return;
+        }
+        for (int i = 0; i < container->cardinality; i++) {
+            bits[container->values[i] >> 6] |= (uint64_t)1 << (container->values[i] & 63);
+        }
+        bits[low >> 6] |= (uint64_t)1 << (low & 63);
+        free(container->values);
+        container->values = NULL;
+        container->capacity = 0;
+        container->bits = bits;
+        container->cardinality = roaringPopcount(bits);
+        return;
+    }
+    if (container->cardinality == container->capacity) {
+        int capacity = container->capacity > 0 ? container->capacity * 2 : 8;
+        uint16_t* values = (uint16_t*)realloc(container->values, sizeof(uint16_t) * capacity);
+        if (values == NULL) {
+            printf("Memory allocation failed!\n");
+            return;
+        }
+        container->values = values;
+        container->capacity = capacity;
+    }
+    memmove(&container->values[at + 1], &container->values[at], sizeof(uint16_t) * (container->cardinality - at));
+    container->values[at] = low;
+    container->cardinality++;
+}
+
+// Remove an ID from the bitmap
+void roaringRemove(RoaringBitmap* bitmap, int id) {
+    uint16_t key = (uint16_t)((uint32_t)id >> 16), low = (uint16_t)id;
+    int pos = roaringFind(bitmap, key);
+    if (pos == bitmap->count || bitmap->containers[pos].key != key) {
+        return;
+    }
+    RoaringContainer* container = &bitmap->containers[pos];
+    if (container->bits != NULL) {
+        uint64_t mask = (uint64_t)1 << (low & 63);
+        if (!(container->bits[low >> 6] & mask)) {
+            return;
+        }
+        container->bits[low >> 6] &= ~mask;
+        container->cardinality--;
+        if (container->cardinality < ROARING_ARRAY_MAX / 2) {
+            // Sparse again: back to a sorted array
+            uint16_t* values = (uint16_t*)malloc(sizeof(uint16_t) * ROARING_ARRAY_MAX);
+            if (values != NULL) {
+                int n = 0;
+                for (int word = 0; word < ROARING_BITMAP_WORDS; word++) {
+                    for (uint64_t bits = container->bits[word]; bits != 0; bits &= bits - 1) {
+                        values[n++] = (uint16_t)(word * 64 + __builtin_ctzll(bits));
+                    }
+                }
+                free(container->bits);
+                container->bits = NULL;
+                container->values = values;
+                container->capacity = ROARING_ARRAY_MAX;
+            }
+        }
+    } else {
+        int at = roaringArrayFind(container, low);
+        if (at == container->cardinality || container->values[at] != low) {
+            return;
+        }
+        memmove(&container->values[at], &container->values[at + 1], sizeof(uint16_t) * (container->cardinality - at - 1));
+        container->cardinality--;
+    }
+
+    if (container->cardinality == 0) {
+        free(container->values);
+        free(container->bits);
+        memmove(&bitmap->containers[pos], &bitmap->containers[pos + 1], sizeof(RoaringContainer) * (bitmap->count - pos - 1));
+        bitmap->count--;
+    }
+}
+
+// Number of IDs in the bitmap
+int roaringCardinality(RoaringBitmap* bitmap) {
+    int total = 0;
+    for (int i = 0; i < bitmap->count; i++) {
+        total += bitmap->containers[i].cardinality;
+    }
+    return total;
+}
+
+// Smallest ID >= from in the bitmap (-1 if none)
+int roaringNext(RoaringBitmap* bitmap, int from) {
+    if (from < 0) {
+        from = 0;
+    }
+    for (int pos = roaringFind(bitmap, (uint16_t)((uint32_t)from >> 16)); pos < bitmap->count; pos++) {
+        RoaringContainer* container = &bitmap->containers[pos];
+        int base = (int)container->key << 16;
+        int low = from > base ? from - base : 0;
+        if (low > 0xFFFF) {
+            continue;
+        }
+        if (container->bits != NULL) {
+            int word = low >> 6;
+            uint64_t bits = container->bits[word] & (~(uint64_t)0 << (low & 63));
+            while (bits == 0 && ++word < ROARING_BITMAP_WORDS) {
+                bits = container->bits[word];
+            }
+            if (bits != 0) {
+                return base + word * 64 + __builtin_ctzll(bits);
+            }
+        } else {
+            int at = roaringArrayFind(container, (uint16_t)low);
+            if (at < container->cardinality) {
+                return base + container->values[at];
+            }
+        }
+    }
+    return -1;
+}
+
+// Drop every ID
+void clearRoaring(RoaringBitmap* bitmap) {
+    for (int i = 0; i < bitmap->count; i++) {
+        free(bitmap->containers[i].values);
+        free(bitmap->containers[i].bits);
+    }
+    bitmap->count = 0;
+}
+
+// Move a book between status bitmaps (called on every status change)
+void statusBitmapsMove(int bookId, BookStatus from, BookStatus to) {
+    roaringRemove(&statusBitmaps[from], bookId);
+    roaringAdd(&statusBitmaps[to], bookId);
+}
+
+// Print the number of books in each status
+void displayStatusCounts() {
+    int available = roaringCardinality(&statusBitmaps[AVAILABLE]);
+    int borrowed = roaringCardinality(&statusBitmaps[BORROWED]);
+    int reserved = roaringCardinality(&statusBitmaps[RESERVED]);
+    printf("Available: %d\n", available);
+    printf("Borrowed: %d\n", borrowed);
+    printf("Reserved: %d\n", reserved);
+    printf("Total: %d\n", available + borrowed + reserved);
+}
+
+// List every book in a status
+void listBooksByStatus(BookStatus status) {
+    int total = 0;
+    for (int id = roaringNext(&statusBitmaps[status], 0); id >= 0; id = roaringNext(&statusBitmaps[status], id + 1)) {
+        Book* book = searchBookById(bookRoot, id);
+        if (book != NULL) {
+            printf("  %-50s ID %d\n", book->title, book->id);
+            total++;
+        }
+    }
+    printf("%d book(s)\n", total);
+}
+
+// Parse "available", "borrowed" or "reserved" (-1 if unknown)
+int parseBookStatus(const char* text) {
+    char key[16];
+    foldSearchKey(text, key, sizeof(key));
+    if (strcmp(key, "available") == 0) {
+        return AVAILABLE;
+    }
+    if (strcmp(key, "borrowed") == 0) {
+        return BORROWED;
+    }
+    if (strcmp(key, "reserved") == 0) {
+        return RESERVED;
+    }
+    return -1;
+}
+
+/********************************************/
+/*             Compound Queries             */
+/********************************************/
+
+// A query is a conjunction of predicates on title, author, ISBN, status
+// and reservation queue length, written as clauses separated by '|':
+//   title~dune | author=frank herbert | status=available | queue>3
+// The planner drives the query from whichever index yields the fewest
+// candidates (ISBN, author, status bitmap, or a catalog scan when no
+// index applies) and checks the remaining predicates on each candidate.
+// Results stream from a cursor over a pinned snapshot, so a long listing
+// never sees a half-applied edit.
+
+// Number of users waiting for a book
+int queueLengthOf(int bookId) {
+    return bookId >= 0 && bookId < bookQueueCapacity ? bookQueues[bookId].size : 0;
+}
+
+// Parse a query string; returns false with a message on a bad clause
+bool parseBookQuery(const char* text, BookQuery* query) {
+    char buffer[MAX_BATCH_LINE];
+    memset(query, 0, sizeof(BookQuery));
+    query->status = QUERY_ANY;
+    query->minQueue = 0;
+    query->maxQueue = INT_MAX;
+    strncpy(buffer, text, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+
+    for (char* clause = strtok(buffer, "|"); clause != NULL; clause = strtok(NULL, "|")) {
+        while (isspace((unsigned char)*clause)) {
+            clause++;
+        }
+        if (*clause == '\0') {
+            continue;
+        }
+        int nameLength = (int)strcspn(clause, "=~<>");
+        char* op = clause + nameLength;
+        if (*op == '\0' || nameLength == 0) {
+            printf("Bad clause '%s' (expected field, operator and value)\n", clause);
+            return false;
+        }
+        char name[16];
+        foldSearchKey(clause, name, nameLength + 1 < (int)sizeof(name) ? nameLength + 1 : (int)sizeof(name));
+        bool orEqual = op[1] == '=';
+        char* value = op + (orEqual ? 2 : 1);
+
+        if (strcmp(name, "title") == 0 && (*op == '~' || *op == '=')) {
+            foldSearchKey(value, query->title, MAX_TITLE_LENGTH);
+        } else if (strcmp(name, "author") == 0 && *op == '=') {
+            foldSearchKey(value, query->author, MAX_AUTHOR_LENGTH);
+        } else if (strcmp(name, "isbn") == 0 && *op == '=') {
+            normalizeIsbn(value, query->isbn, MAX_ISBN_LENGTH);
+        } else if (strcmp(name, "status") == 0 && *op == '=') {
+            query->status = parseBookStatus(value);
+            if (query->status < 0) {
+                printf("Unknown status '%s'\n", value);
+                return false;
+            }
+        } else if (strcmp(name, "queue") == 0) {
+            int length = atoi(value);
+            if (*op == '>') {
+                query->minQueue = orEqual ? length : length + 1;
+            } else if (*op == '<') {
+                query->maxQueue = orEqual ? length : length - 1;
+            } else if (*op == '=') {
+                query->minQueue = length;
+                query->maxQueue = length;
+            } else {
+                printf("Bad queue clause '%s'\n", clause);
+                return false;
+            }
+        } else {
+            printf("Unknown clause '%s'\n", clause);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Check every predicate of the query against one book
+bool bookMatchesQuery(const QueryCursor* cursor, const Book* book) {
+    const BookQuery* query = &cursor->query;
+    if (query->status != QUERY_ANY && book->status != (BookStatus)query->status) {
+        return false;
+    }
+    if (query->author[0] != '\0' && strcmp(book->authorKey, query->author) != 0) {
+        return false;
+    }
+    if (query->isbn[0] != '\0') {
+        char isbn[MAX_ISBN_LENGTH];
+        normalizeIsbn(book->isbn, isbn, MAX_ISBN_LENGTH);
+        if (strcmp(isbn, query->isbn) != 0) {
+            return false;
+        }
+    }
+    if (query->minQueue > 0 || query->maxQueue != INT_MAX) {
+        int waiting = queueLengthOf(book->id);
+        if (waiting < query->minQueue || waiting > query->maxQueue) {
+            return false;
+        }
+    }
+    if (query->title[0] != '\0' && !containsSubstring(&cursor->matcher, book->titleKey, MAX_TITLE_LENGTH)) {
+        return false;
+    }
+    return true;
+}
+
+// Copy the candidate IDs of a hash index entry into the cursor
+bool takeQueryCandidates(QueryCursor* cursor, KeyEntry* entry) {
+    cursor->idCount = entry != NULL ? entry->count : 0;
+    if (cursor->idCount == 0) {
+        return true;
+    }
+    cursor->ids = (int*)malloc(sizeof(int) * cursor->idCount);
+    if (cursor->ids == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    memcpy(cursor->ids, entry->bookIds, sizeof(int) * cursor->idCount);
+    qsort(cursor->ids, cursor->idCount, sizeof(int), compareInts);
+    return true;
+}
+
+// Plan a query and open a cursor over its results
+bool openQuery(QueryCursor* cursor, const BookQuery* query) {
+    memset(cursor, 0, sizeof(QueryCursor));
+    cursor->query = *query;
+    prepareSubstringMatcher(&cursor->matcher, query->title);
+    cursor->snap = pinCatalogSnapshot();
+    if (cursor->snap == NULL) {
+        return false;
+    }
+
+    // Estimate each usable index and drive from the smallest
+    KeyEntry* isbnEntry = NULL;
+    KeyEntry* authorEntry = NULL;
+    cursor->driver = DRIVE_SCAN;
+    cursor->estimate = cursor->snap->count;
+    if (query->isbn[0] != '\0') {
+        isbnEntry = findKeyEntry(&isbnIndex, query->isbn);
+        int estimate = isbnEntry != NULL ? isbnEntry->count : 0;
+        if (estimate <= cursor->estimate) {
+            cursor->driver = DRIVE_ISBN;
+            cursor->estimate = estimate;
+        }
+    }
+    if (query->author[0] != '\0') {
+        authorEntry = findKeyEntry(&authorIndex, query->author);
+        int estimate = authorEntry != NULL ? authorEntry->count : 0;
+        if (estimate < cursor->estimate) {
+            cursor->driver = DRIVE_AUTHOR;
+            cursor->estimate = estimate;
+        }
+    }
+    if (query->status != QUERY_ANY) {
+        int estimate = roaringCardinality(&statusBitmaps[query->status]);
+        if (estimate < cursor->estimate) {
+            cursor->driver = DRIVE_STATUS;
+            cursor->estimate = estimate;
+        }
+    }
+
+    if (cursor->driver == DRIVE_ISBN) {
+        return takeQueryCandidates(cursor, isbnEntry);
+    }
+    if (cursor->driver == DRIVE_AUTHOR) {
+        return takeQueryCandidates(cursor, authorEntry);
+    }
+    return true;
+}
+
+// Next matching book (NULL when the cursor is exhausted)
+const Book* queryNext(QueryCursor* cursor) {
+    CatalogSnapshot* snap = cursor->snap;
+    switch (cursor->driver) {
+        case DRIVE_SCAN:
+            while (cursor->position < snap->count) {
+                const Book* book = snapshotBookAt(snap, cursor->position++);
+                if (bookMatchesQuery(cursor, book)) {
+                    return book;
+                }
+            }
+            break;
+        case DRIVE_AUTHOR:
+        case DRIVE_ISBN:
+            while (cursor->position < cursor->idCount) {
+                const Book* book = snapshotBookById(snap, cursor->ids[cursor->position++]);
+                if (book != NULL && bookMatchesQuery(cursor, book)) {
+                    return book;
+                }
+            }
+            break;
+        case DRIVE_STATUS:
+            while (cursor->position >= 0) {
+                int id = roaringNext(&statusBitmaps[cursor->query.status], cursor->position);
+                cursor->position = id >= 0 ? id + 1 : -1;
+                const Book* book = id >= 0 ? snapshotBookById(snap, id) : NULL;
+                if (book != NULL && bookMatchesQuery(cursor, book)) {
+                    return book;
+                }
+            }
+            break;
+    }
+    return NULL;
+}
+
+// Release everything the cursor holds
+void closeQuery(QueryCursor* cursor) {
+    free(cursor->ids);
+    cursor->ids = NULL;
+    if (cursor->snap != NULL) {
+        releaseCatalogSnapshot(cursor->snap);
+        cursor->snap = NULL;
+    }
+}
+
+// Parse, plan and print a query
+void runBookQuery(const char* text) {
+    static const char* driverNames[] = {"catalog scan", "author index", "ISBN index", "status bitmap"};
+    BookQuery query;
+    QueryCursor cursor;
+    if (!parseBookQuery(text, &query)) {
+        return;
+    }
+    if (!openQuery(&cursor, &query)) {
+        closeQuery(&cursor);
+        return;
+    }
+
+    printf("Plan: %s (%d candidate(s))\n", driverNames[cursor.driver], cursor.estimate);
+    int total = 0;
+    for (const Book* book = queryNext(&cursor); book != NULL; book = queryNext(&cursor)) {
+        printf("  %-50s ID %-6d %-9s queue %d\n", book->title, book->id,
+               book->status == AVAILABLE ? "Available" : book->status == BORROWED ? "Borrowed" : "Reserved",
+               queueLengthOf(book->id));
+        total++;
+    }
+    printf("%d book(s) found\n", total);
+    closeQuery(&cursor);
+}
+
+/********************************************/
+/*           Query Result Cache             */
+/********************************************/
+
+// Desk searches repeat the same few titles. Each cache maps a normalized
+// query to its last result and remembers the generation of the structure
+// it was computed from: titleGeneration for title searches (bumped
+// whenever a book enters, leaves or is re-indexed) and ledgerEpoch for
+// active-loan lookups. A mutation just bumps the counter; entries from
+// an older generation count as misses and are overwritten in place, so
+// invalidation costs nothing and a repeat query is one hash probe.
+
+// Empty a cache
+void initQueryCache(QueryCache* cache, const char* name) {
+    memset(cache, 0, sizeof(QueryCache));
+    cache->name = name;
+    cache->head = -1;
+    cache->tail = -1;
+    for (int i = 0; i < QUERY_CACHE_BUCKETS; i++) {
+        cache->buckets[i] = -1;
+    }
+}
+
+// Set up the search caches
+void initQueryCaches() {
+    initQueryCache(&titleCache, "Title search");
+    initQueryCache(&loanCache, "Availability");
+}
+
+// Unlink an entry from the LRU list
+void cacheUnlink(QueryCache* cache, int slot) {
+    CacheEntry* entry = &cache->entries[slot];
+    if (entry->prev >= 0) {
+        cache->entries[entry->prev].next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next >= 0) {
+        cache->entries[entry->next].prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+}
+
+// Put an entry at the front of the LRU list
+void cachePushFront(QueryCache* cache, int slot) {
+    CacheEntry* entry = &cache->entries[slot];
+    entry->prev = -1;
+    entry->next = cache->head;
+    if (cache->head >= 0) {
+        cache->entries[cache->head].prev = slot;
+    }
+    cache->head = slot;
+    if (cache->tail < 0) {
+        cache->tail = slot;
+    }
+}
+
+// Find the slot holding a key (-1 if absent)
+int cacheFind(QueryCache* cache, const char* key) {
+    int slot = cache->buckets[hashKey(key) & (QUERY_CACHE_BUCKETS - 1)];
+    while (slot >= 0 && strcmp(cache->entries[slot].key, key) != 0) {
+        slot = cache->entries[slot].chain;
+    }
+    return slot;
+}
+
+// Look up a query; true (with the result) only if the entry is current
+bool cacheLookup(QueryCache* cache, const char* key, LONG64 generation, const void** result) {
+    int slot = cacheFind(cache, key);
+    if (slot < 0 || cache->entries[slot].generation != generation) {
+        cache->misses++;
+        return false;
+    }
+    cacheUnlink(cache, slot);
+    cachePushFront(cache, slot);
+    cache->hits++;
+    *result = cache->entries[slot].result;
+    return true;
+}
+
+// Remember a query result (evicting the least recently used when full)
+void cacheStore(QueryCache* cache, const char* key, LONG64 generation, const void* result) {
+    int slot = cacheFind(cache, key);
+    if (slot >= 0) {
+        cacheUnlink(cache, slot);
+    } else {
+        if (cache->count < QUERY_CACHE_SIZE) {
+            slot = cache->count++;
+        } else {
+            slot = cache->tail;
+            cacheUnlink(cache, slot);
+            int* link = &cache->buckets[hashKey(cache->entries[slot].key) & (QUERY_CACHE_BUCKETS - 1)];
+            while (*link != slot) {
+                link = &cache->entries[*link].chain;
+            }
+            *link = cache->entries[slot].chain;
+        }
+        strncpy(cache->entries[slot].key, key, MAX_TITLE_LENGTH - 1);
+        cache->entries[slot].key[MAX_TITLE_LENGTH - 1] = '\0';
+        int bucket = hashKey(cache->entries[slot].key) & (QUERY_CACHE_BUCKETS - 1);
+        cache->entries[slot].chain = cache->buckets[bucket];
+        cache->buckets[bucket] = slot;
+    }
+    cache->entries[slot].generation = generation;
+    cache->entries[slot].result = result;
+    cachePushFront(cache, slot);
+}
+
+// Print hit/miss counts for one cache
+void displayCacheLine(QueryCache* cache) {
+    long lookups = cache->hits + cache->misses;
+    printf("%-14s %4d/%d entries  %ld hits  %ld misses  (%.1f%% hit rate)\n", cache->name,
+           cache->count, QUERY_CACHE_SIZE, cache->hits, cache->misses,
+           lookups > 0 ? 100.0 * cache->hits / lookups : 0.0);
+}
+
+// Print hit/miss counts for every cache
+void displayCacheStats() {
+    displayCacheLine(&titleCache);
+    displayCacheLine(&loanCache);
+}
+
+/********************************************/
+/*             Order Statistics             */
+/********************************************/
+
+// Title and author order are kept in treaps whose nodes carry their
+// subtree size. Select-k-th walks down by comparing k with the left
+// subtree size and rank sums the left sizes along the search path, so
+// "the 10,000th title" or "how far into the catalog is this title" is
+// O(log n) and an add, edit or delete costs one O(log n) insert or
+// remove. Empty keys are skipped, as in the prefix indexes.
+
+// Nodes in a subtree
+int orderSize(OrderNode* node) {
+    return node != NULL ? node->size : 0;
+}
+
+// Recompute a node's subtree size from its children
+void orderUpdate(OrderNode* node) {
+    node->size = 1 + orderSize(node->left) + orderSize(node->right);
+}
+
+// Compare (key, id) with a node's entry
+int compareOrderEntry(const char* key, int id, OrderNode* node) {
+    int order = strcmp(key, node->key);
+    if (order != 0) {
+        return order;
+    }
+    return (id > node->id) - (id < node->id);
+}
+
+// Next random priority (xorshift32)
+uint32_t nextOrderPriority(OrderTree* tree) {
+    uint32_t x = tree->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    tree->seed = x;
+    return x;
+}
+
+// Split a subtree into entries < (key, id) and entries >= (key, id)
+void orderSplit(OrderNode* node, const char* key, int id, OrderNode** less, OrderNode** rest) {
+    if (node == NULL) {
+        *less = NULL;
+        *rest = NULL;
+    } else if (compareOrderEntry(key, id, node) > 0) {
+        orderSplit(node->right, key, id, &node->right, rest);
+        orderUpdate(node);
+        *less = node;
+    } else {
+        orderSplit(node->left, key, id, less, &node->left);
+        orderUpdate(node);
+        *rest = node;
+    }
+}
+
+// Join two subtrees where every entry of the first sorts before the second
+OrderNode* orderMerge(OrderNode* first, OrderNode* second) {
+    if (first == NULL) {
+        return second;
+    }
+    if (second == NULL) {
+        return first;
+    }
+    if (first->priority > second->priority) {
+        first->right = orderMerge(first->right, second);
+        orderUpdate(first);
+        return first;
+    }
+    second->left = orderMerge(first, second->left);
+    orderUpdate(second);
+    return second;
+}
+
+// Insert a node below root, returning the new subtree root
+OrderNode* orderInsertNode(OrderNode* root, OrderNode* node) {
+    if (root == NULL) {
+        return node;
+    }
+    if (node->priority > root->priority) {
+        orderSplit(root, node->key, node->id, &node->left, &node->right);
+        orderUpdate(node);
+        return node;
+    }
+    if (compareOrderEntry(node->key, node->id, root) < 0) {
+        root->left = orderInsertNode(root->left, node);
+    } else {
+        root->right = orderInsertNode(root->right, node);
+    }
+    orderUpdate(root);
+    return root;
+}
+
+// Add an entry
+void orderInsert(OrderTree* tree, const char* key, int id) {
+    if (key[0] == '\0') {
+        return;
+    }
+    OrderNode* node = (OrderNode*)calloc(1, sizeof(OrderNode));
+    if (node == NULL || (node->key = strdup(key)) == NULL) {
+        free(node);
+        printf("Memory allocation failed!\n");
+        return;
+    }
+    node->id = id;
+    node->priority = nextOrderPriority(tree);
+    node->size = 1;
+    tree->root = orderInsertNode(tree->root, node);
+}
+
+// Remove an entry below root, returning the new subtree root
+OrderNode* orderRemoveNode(OrderNode* root, const char* key, int id) {
+    if (root == NULL) {
+        return NULL;
+    }
+    int order = compareOrderEntry(key, id, root);
+    if (order == 0) {
+        OrderNode* rest = orderMerge(root->left, root->right);
+        free(root->key);
+        free(root);
+        return rest;
+    }
+    if (order < 0) {
+        root->left = orderRemoveNode(root->left, key, id);
+    } else {
+        root->right = orderRemoveNode(root->right, key, id);
+    }
+    orderUpdate(root);
+    return root;
+}
+
+// Remove an entry
+void orderRemove(OrderTree* tree, const char* key, int id) {
+    tree->root = orderRemoveNode(tree->root, key, id);
+}
+
+// Free a subtree
+void freeOrderNodes(OrderNode* node) {
+    if (node == NULL) {
+        return;
+    }
+    freeOrderNodes(node->left);
+    freeOrderNodes(node->right);
+    free(node->key);
+    free(node);
+}
+
+// Drop every entry
+void clearOrderTree(OrderTree* tree) {
+    freeOrderNodes(tree->root);
+    tree->root = NULL;
+}
+
+// Build a balanced subtree from sorted entries, then sift priorities into heap order
+OrderNode* buildOrderNodes(OrderTree* tree, const PrefixEntry* entries, int count) {
+    if (count <= 0) {
+        return NULL;
+    }
+    int mid = count / 2;
+    OrderNode* node = (OrderNode*)calloc(1, sizeof(OrderNode));
+    if (node == NULL || (node->key = strdup(entries[mid].key)) == NULL) {
+        free(node);
+        printf("Memory allocation failed!\n");
+        return NULL;
+    }
+    node->id = entries[mid].id;
+    node->priority = nextOrderPriority(tree);
+    node->left = buildOrderNodes(tree, entries, mid);
+    node->right = buildOrderNodes(tree, entries + mid + 1, count - mid - 1);
+    orderUpdate(node);
+
+    // Only priorities move, so the shape stays balanced
+    OrderNode* current = node;
+    while (true) {
+        OrderNode* larger = current->left;
+        if (larger == NULL || (current->right != NULL && current->right->priority > larger->priority)) {
+            larger = current->right;
+        }
+        if (larger == NULL || larger->priority <= current->priority) {
+            break;
+        }
+        uint32_t priority = current->priority;
+        current->priority = larger->priority;
+        larger->priority = priority;
+        current = larger;
+    }
+    return node;
+}
+
+// Replace the contents with a sorted prefix index (bulk loads)
+void buildOrderTree(OrderTree* tree, const PrefixIndex* sorted) {
+    clearOrderTree(tree);
+    tree->root = buildOrderNodes(tree, sorted->entries, sorted->count);
+}
+
+// Entry at a 0-based position (NULL if out of range)
+OrderNode* orderSelect(OrderTree* tree, long k) {
+    OrderNode* node = tree->root;
+    while (node != NULL) {
+        int leftSize = orderSize(node->left);
+        if (k < leftSize) {
+            node = node->left;
+        } else if (k == leftSize) {
+            return node;
+        } else {
+            k -= leftSize + 1;
+            node = node->right;
+        }
+    }
+    return NULL;
+}
+
+// Number of entries that sort before (key, id)
+int orderRank(OrderTree* tree, const char* key, int id) {
+    int rank = 0;
+    OrderNode* node = tree->root;
+    while (node != NULL) {
+        if (compareOrderEntry(key, id, node) <= 0) {
+            node = node->left;
+        } else {
+            rank += orderSize(node->left) + 1;
+            node = node->right;
+        }
+    }
+    return rank;
+}
+
+// IDs of up to limit entries starting at a 0-based position; returns the count
+int orderRange(OrderTree* tree, int first, int* ids, int limit) {
+    int count = 0, depth = 0, capacity = 64;
+    OrderNode** stack = (OrderNode**)malloc(sizeof(OrderNode*) * capacity);
+    if (stack == NULL) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+
+    // Descend to position first; nodes where we turn left come after it
+    OrderNode* node = tree->root;
+    int k = first;
+    bool seek = true;
+    while (count < limit) {
+        while (node != NULL) {
+            if (depth == capacity) {
+                capacity *= 2;
+                OrderNode** grown = (OrderNode**)realloc(stack, sizeof(OrderNode*) * capacity);
+                if (grown == NULL) {
+                    printf("Memory allocation failed!\n");
+                    free(stack);
+                    return count;
+                }
+                stack = grown;
+            }
+            if (!seek) {
+                stack[depth++] = node;
+                node = node->left;
+                continue;
+            }
+            int leftSize = orderSize(node->left);
+            if (k < leftSize) {
+                stack[depth++] = node;
+                node = node->left;
+            } else if (k == leftSize) {
+                stack[depth++] = node;
+                node = NULL;
+            } else {
+                k -= leftSize + 1;
+                node = node->right;
+            }
+        }
+        seek = false;
+        if (depth == 0) {
+            break;
+        }
+        OrderNode* next = stack[--depth];
+        ids[count++] = next->id;
+        node = next->right;
+    }
+    free(stack);
+    return count;
+}
+
+// Print the book at a 1-based position in title or author order
+void showOrderPosition(OrderTree* tree, const char* order, int position) {
+    int total = orderSize(tree->root);
+    OrderNode* node = position >= 1 ? orderSelect(tree, position - 1) : NULL;
+    if (node == NULL) {
+        printf("No book at position %d (%d books in %s order)\n", position, total, order);
+        return;
+    }
+    Book* book = searchBookById(bookRoot, node->id);
+    if (book != NULL) {
+        printf("Position %d of %d in %s order:\n", position, total, order);
+        printBibliographyLine(book);
+    }
+}
+
+// Print where a title or author falls in its order
+void showOrderRank(OrderTree* tree, const char* order, const char* text, int maxLength) {
+    char key[MAX_TITLE_LENGTH];
+    foldSearchKey(text, key, maxLength);
+    int total = orderSize(tree->root);
+    int rank = orderRank(tree, key, -1);
+    OrderNode* node = orderSelect(tree, rank);
+    if (node != NULL && strcmp(node->key, key) == 0) {
+        printf("'%s' is at position %d of %d in %s order (page %d of %d at %d per page)\n", text,
+               rank + 1, total, order, rank / REPORT_PAGE_SIZE + 1,
+               (total + REPORT_PAGE_SIZE - 1) / REPORT_PAGE_SIZE, REPORT_PAGE_SIZE);
+    } else {
+        printf("'%s' is not in the catalog; it would sort after %d of %d books in %s order\n", text,
+               rank, total, order);
+    }
+}
+
+/********************************************/
+/*            Index Maintenance             */
+/********************************************/
+
+// Every secondary index is keyed by record ID and folded keys, so it is
+// updated here when a record enters, leaves or changes, and rebuilt in
+// bulk after a load.
+
+// Add a book to the secondary indexes
+void indexBook(Book* book) {
+    char isbn[MAX_ISBN_LENGTH];
+    titleGeneration++;
+    titleTree = bkInsert(titleTree, book->titleKey, book->id);
+    authorTree = bkInsert(authorTree, book->authorKey, book->id);
+    prefixInsert(&titlePrefix, book->titleKey, book->id);
+    prefixInsert(&authorPrefix, book->authorKey, book->id);
+    orderInsert(&titleOrder, book->titleKey, book->id);
+    orderInsert(&authorOrder, book->authorKey, book->id);
+    keyIndexAdd(&authorIndex, book->authorKey, book->id);
+    roaringAdd(&statusBitmaps[book->status], book->id);
+    normalizeIsbn(book->isbn, isbn, MAX_ISBN_LENGTH);
+    keyIndexAdd(&isbnIndex, isbn, book->id);
+}
+
+// Remove a book from the secondary indexes (call before it changes or goes)
+void unindexBook(Book* book) {
+    char isbn[MAX_ISBN_LENGTH];
+    titleGeneration++;
+    bkRemove(titleTree, book->titleKey, book->id);
+    bkRemove(authorTree, book->authorKey, book->id);
+    prefixRemove(&titlePrefix, book->titleKey, book->id);
+    prefixRemove(&authorPrefix, book->authorKey, book->id);
+    orderRemove(&titleOrder, book->titleKey, book->id);
+    orderRemove(&authorOrder, book->authorKey, book->id);
+    keyIndexRemove(&authorIndex, book->authorKey, book->id);
+    roaringRemove(&statusBitmaps[book->status], book->id);
+    normalizeIsbn(book->isbn, isbn, MAX_ISBN_LENGTH);
+    keyIndexRemove(&isbnIndex, isbn, book->id);
+}
+
+// Point the user-ID table at a user (growing the table as needed)
+void userTableSet(int id, User* user) {
+    if (id < 0) {
+        return;
+    }
+    if (id >= userTableSize) {
+        int size = userTableSize > 0 ? userTableSize : MAX_USERS;
+        while (size <= id) {
+            size *= 2;
+        }
+        User** table = (User**)realloc(userTable, sizeof(User*) * size);
+        if (table == NULL) {
+            printf("Memory allocation failed!\n");
+            return;
+        }
+        memset(table + userTableSize, 0, sizeof(User*) * (size - userTableSize));
+        userTable = table;
+        userTableSize = size;
+    }
+    userTable[id] = user;
+}
+
+// Add a user to the secondary indexes
+void indexUser(User* user) {
+    if (searchUserById(user->id) == NULL) {
+        userTableSet(user->id, user);
+    }
+    nameTree = bkInsert(nameTree, user->nameKey, user->id);
+    prefixInsert(&namePrefix, user->nameKey, user->id);
+}
+
+// Remove a user from the secondary indexes
+void unindexUser(User* user) {
+    if (searchUserById(user->id) == user) {
+        userTableSet(user->id, NULL);
+    }
+    bkRemove(nameTree, user->nameKey, user->id);
+    prefixRemove(&namePrefix, user->nameKey, user->id);
+}
+
+// Index every book in a subtree (sorted indexes are appended, sorted once,
+// and the order trees are built from them afterwards)
+void indexBookTree(Book* root) {
+    char isbn[MAX_ISBN_LENGTH];
+    if (root == NULL) {
+        return;
+    }
+    titleTree = bkInsert(titleTree, root->titleKey, root->id);
+    authorTree = bkInsert(authorTree, root->authorKey, root->id);
+    appendPrefixEntry(&titlePrefix, root->titleKey, root->id);
+    appendPrefixEntry(&authorPrefix, root->authorKey, root->id);
+    keyIndexAdd(&authorIndex, root->authorKey, root->id);
+    roaringAdd(&statusBitmaps[root->status], root->id);
+    normalizeIsbn(root->isbn, isbn, MAX_ISBN_LENGTH);
+    keyIndexAdd(&isbnIndex, isbn, root->id);
+    indexBookTree(root->left);
+    indexBookTree(root->right);
+}
+
+// Add every book in a subtree to the status bitmaps
+void indexBookStatuses(Book* root) {
+    if (root == NULL) {
+        return;
+    }
+    roaringAdd(&statusBitmaps[root->status], root->id);
+    indexBookStatuses(root->left);
+    indexBookStatuses(root->right);
+}
+
+// Drop and rebuild the status bitmaps (after bulk status changes)
+void rebuildStatusBitmaps() {
+    for (int status = 0; status < STATUS_COUNT; status++) {
+        clearRoaring(&statusBitmaps[status]);
+    }
+    indexBookStatuses(bookRoot);
+}
+
+// Drop and rebuild the book indexes
+void rebuildBookIndexes() {
+    titleGeneration++;
+    freeBKTree(titleTree);
+    freeBKTree(authorTree);
+    titleTree = NULL;
+    authorTree = NULL;
+    clearPrefixIndex(&titlePrefix);
+    clearPrefixIndex(&authorPrefix);
+    clearKeyIndex(&authorIndex);
+    clearKeyIndex(&isbnIndex);
+    for (int status = 0; status < STATUS_COUNT; status++) {
+        clearRoaring(&statusBitmaps[status]);
+    }
+
+    indexBookTree(bookRoot);
+    sortPrefixIndex(&titlePrefix);
+    sortPrefixIndex(&authorPrefix);
+    buildOrderTree(&titleOrder, &titlePrefix);
+    buildOrderTree(&authorOrder, &authorPrefix);
+}
+
+// Drop and rebuild the user indexes
+void rebuildUserIndexes() {
+    freeBKTree(nameTree);
+    nameTree = NULL;
+    clearPrefixIndex(&namePrefix);
+    if (userTable != NULL) {
+        memset(userTable, 0, sizeof(User*) * userTableSize);
+    }
+
+    for (User* current = userList; current != NULL; current = current->next) {
+        if (searchUserById(current->id) == NULL) {
+            userTableSet(current->id, current);
+        }
+        nameTree = bkInsert(nameTree, current->nameKey, current->id);
+        appendPrefixEntry(&namePrefix, current->nameKey, current->id);
+    }
+    sortPrefixIndex(&namePrefix);
+}
+
+// Drop and rebuild every secondary index
+void rebuildIndexes() {
+    rebuildBookIndexes();
+    rebuildUserIndexes();
+}
+
+/********************************************/
+/*              Record Pools                */
+/********************************************/
+
+// Books, users and loans are carved from blocks of POOL_BLOCK_RECORDS
+// records, so a bulk import costs one malloc per block instead of one
+// per row. Released records go on a free list and are reused; blocks
+// are never returned, so any record-sized allocation may be released
+// into its pool.
+
+// Allocate one record from a pool
+void* poolAlloc(RecordPool* pool) {
+    if (pool->freeList != NULL) {
+        void* record = pool->freeList;
+        pool->freeList = *(void**)record;
+        return record;
+    }
+    if (pool->remaining == 0) {
+        pool->block = (char*)malloc(pool->recordSize * POOL_BLOCK_RECORDS);
+        if (pool->block == NULL) {
+            return NULL;
+        }
+        pool->remaining = POOL_BLOCK_RECORDS;
+    }
+    void* record = pool->block;
+    pool->block += pool->recordSize;
+    pool->remaining--;
+    return record;
+}
+
+// Give a record back to its pool
+void poolFree(RecordPool* pool, void* record) {
+    if (record == NULL) {
+        return;
+    }
+    *(void**)record = pool->freeList;
+    pool->freeList = record;
+}
+
+// Make sure the reservation queue table has a slot for a book ID
+bool reserveBookQueues(int bookId) {
+    if (bookId < bookQueueCapacity) {
+        return true;
+    }
+    int capacity = bookQueueCapacity > 0 ? bookQueueCapacity : MAX_BOOKS;
+    while (capacity <= bookId) {
+        capacity *= 2;
+    }
+    BookQueue* queues = (BookQueue*)realloc(bookQueues, sizeof(BookQueue) * capacity);
+    if (queues == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    memset(queues + bookQueueCapacity, 0, sizeof(BookQueue) * (capacity - bookQueueCapacity));
+    bookQueues = queues;
+    bookQueueCapacity = capacity;
+    return true;
+}
+
+/********************************************/
+/*              Record Handles              */
+/********************************************/
+
+// Books, users and loans refer to each other through handles: a slot in
+// the record kind's handle table plus the generation the slot had when
+// the handle was made. Resolving one is an array lookup and a compare.
+// Releasing a record bumps its slot's generation, so a handle still held
+// by a loan, a queue or the undo log resolves to NULL instead of to freed
+// or reused memory. A record the undo log keeps is only detached: its
+// handles resolve to NULL until an undo attaches it again. IDs remain
+// the keys that are saved and typed in.
+
+// Grow a handle table (doubling it)
+bool growHandleTable(HandleTable* table) {
+    int capacity = table->capacity > 0 ? table->capacity * 2 : POOL_BLOCK_RECORDS;
+    void** records = (void**)realloc(table->records, sizeof(void*) * capacity);
+    if (records == NULL) {
+        return false;
+    }
+    table->records = records;
+    uint32_t* generations = (uint32_t*)realloc(table->generations, sizeof(uint32_t) * capacity);
+    if (generations == NULL) {
+        return false;
+    }
+    table->generations = generations;
+    int* freeSlots = (int*)realloc(table->freeSlots, sizeof(int) * capacity);
+    if (freeSlots == NULL) {
+        return false;
+    }
+    table->freeSlots = freeSlots;
+    memset(generations + table->capacity, 0, sizeof(uint32_t) * (capacity - table->capacity));
+    table->capacity = capacity;
+    return true;
+}
+
+// Hand out a handle for a record (a null handle if the table cannot grow)
+Handle handleAcquire(HandleTable* table, void* record) {
+    int slot;
+    if (table->freeCount > 0) {
+        slot = table->freeSlots[--table->freeCount];
+    } else {
+        if (table->used == table->capacity && !growHandleTable(table)) {
+            printf("Memory allocation failed!\n");
+            return NULL_HANDLE;
+        }
+        if (table->used == 0) {
+            table->used = 1;    // slot 0 stays null
+        }
+        slot = table->used++;
+    }
+    table->records[slot] = record;
+    Handle handle = {slot, table->generations[slot]};
+    return handle;
+}
+
+// Check that a handle names a slot of the table in its current generation
+bool handleIsLive(const HandleTable* table, Handle handle) {
+    return handle.slot > 0 && handle.slot < table->used && table->generations[handle.slot] == handle.generation;
+}
+
+// Record a handle points at (NULL if it is null, stale or detached)
+void* handleResolve(const HandleTable* table, Handle handle) {
+    return handleIsLive(table, handle) ? table->records[handle.slot] : NULL;
+}
+
+// Detach a record: its handles resolve to NULL until it is attached again
+void handleDetach(HandleTable* table, Handle handle) {
+    if (handleIsLive(table, handle)) {
+        table->records[handle.slot] = NULL;
+    }
+}
+
+// Attach a detached record to its handle again
+void handleAttach(HandleTable* table, Handle handle, void* record) {
+    if (handleIsLive(table, handle)) {
+        table->records[handle.slot] = record;
+    }
+}
+
+// Release a record's slot: every handle to it goes stale and the slot is reused
+void handleRelease(HandleTable* table, Handle handle) {
+    if (!handleIsLive(table, handle)) {
+        return;
+    }
+    table->records[handle.slot] = NULL;
+    table->generations[handle.slot]++;
+    table->freeSlots[table->freeCount++] = handle.slot;
+}
+
+// Release every slot (before a load replaces all records)
+void clearHandleTable(HandleTable* table) {
+    table->freeCount = 0;
+    for (int slot = table->used - 1; slot > 0; slot--) {
+        table->records[slot] = NULL;
+        table->generations[slot]++;
+        table->freeSlots[table->freeCount++] = slot;
+    }
+}
+
+// Check for the null handle
+bool isNullHandle(Handle handle) {
+    return handle.slot == 0;
+}
+
+// Check if two handles name the same record
+bool sameHandle(Handle a, Handle b) {
+    return a.slot == b.slot && a.generation == b.generation;
+}
+
+// Resolve a book handle
+Book* bookFromHandle(Handle handle) {
+    return (Book*)handleResolve(&bookHandles, handle);
+}
+
+// Resolve a user handle
+User* userFromHandle(Handle handle) {
+    return (User*)handleResolve(&userHandles, handle);
+}
+
+// Resolve a loan handle
+BorrowRecord* loanFromHandle(Handle handle) {
+    return (BorrowRecord*)handleResolve(&loanHandles, handle);
+}
+
+// Handle of a user by ID (null if there is no such user)
+Handle userHandleById(int id) {
+    User* user = searchUserById(id);
+    return user != NULL ? user->handle : NULL_HANDLE;
+}
+
+/********************************************/
+/*             Output Buffers               */
+/********************************************/
+
+// Bulk output is assembled in one OUTPUT_BUFFER_SIZE buffer and written
+// in large blocks. Numbers and dates are formatted by hand: a date costs
+// one localtime call per distinct day (recent days are kept in a small
+// cache), after which the clock time is plain arithmetic on the seconds
+// since midnight.
+
+// Start buffering output to a stream
+bool openOutput(OutputBuffer* out, FILE* file) {
+    out->file = file;
+    out->length = 0;
+    out->failed = false;
+    out->buffer = (char*)malloc(OUTPUT_BUFFER_SIZE);
+    if (out->buffer == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    return true;
+}
+
+// Write out whatever is buffered
+void flushOutput(OutputBuffer* out) {
+    if (out->length > 0 && fwrite(out->buffer, 1, out->length, out->file) != (size_t)out->length) {
+        out->failed = true;
+    }
+    out->length = 0;
+}
+
+// Flush and release the buffer (the stream stays open)
+void closeOutput(OutputBuffer* out) {
+    flushOutput(out);
+    fflush(out->file);
+    free(out->buffer);
+    out->buffer = NULL;
+}
+
+// Append raw bytes
+void outBytes(OutputBuffer* out, const char* bytes, int length) {
+    if (out->length + length > OUTPUT_BUFFER_SIZE) {
+        flushOutput(out);
+        if (length > OUTPUT_BUFFER_SIZE) {
+            if (fwrite(bytes, 1, length, out->file) != (size_t)length) {
+                out->failed = true;
+            }
+            return;
+        }
+    }
+    memcpy(out->buffer + out->length, bytes, length);
+    out->length += length;
+}
+
+// Append one character
+void outChar(OutputBuffer* out, char c) {
+    if (out->length == OUTPUT_BUFFER_SIZE) {
+        flushOutput(out);
+    }
+    out->buffer[out->length++] = c;
+}
+
+// Append a string
+void outText(OutputBuffer* out, const char* text) {
+    outBytes(out, text, (int)strlen(text));
+}
+
+// Append printf-style formatted text (formatted straight into the buffer)
+void outPrintf(OutputBuffer* out, const char* format, ...) {
+    va_list args;
+    int room = OUTPUT_BUFFER_SIZE - out->length;
+    va_start(args, format);
+    int length = vsnprintf(out->buffer + out->length, room, format, args);
+    va_end(args);
+    if (length >= room) {
+        flushOutput(out);
+        va_start(args, format);
+        length = vsnprintf(out->buffer, OUTPUT_BUFFER_SIZE, format, args);
+        va_end(args);
+        if (length >= OUTPUT_BUFFER_SIZE) {
+            length = OUTPUT_BUFFER_SIZE - 1;
+        }
+    }
+    if (length > 0) {
+        out->length += length;
+    }
+}
+
+// Append a decimal integer
+void outInt(OutputBuffer* out, long long value) {
+    char digits[24];
+    int pos = sizeof(digits);
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[--pos] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        digits[--pos] = '-';
+    }
+    outBytes(out, digits + pos, (int)sizeof(digits) - pos);
+}
+
+// Write two zero-padded digits
+void outTwoDigits(char* text, int value) {
+    text[0] = (char)('0' + value / 10);
+    text[1] = (char)('0' + value % 10);
+}
+
+// Append a local date as "YYYY-MM-DD HH:MM:SS" (nothing for 0)
+void outDate(OutputBuffer* out, time_t value) {
+    // Recently seen local days, slotted by UTC day number
+    static struct {
+        time_t start;
+        time_t end;
+        char text[32];
+    } days[DATE_CACHE_SLOTS];
+    char text[19];
+
+    if (value == 0) {
+        return;
+    }
+    long long utcDay = (long long)(value / 86400);
+    int slot = -1;
+    for (int delta = -1; delta <= 1 && slot < 0; delta++) {
+        int candidate = (int)((utcDay + delta) & (DATE_CACHE_SLOTS - 1));
+        if (value >= days[candidate].start && value < days[candidate].end) {
+            slot = candidate;
+        }
+    }
+    if (slot < 0) {
+        struct tm day = *localtime(&value);
+        slot = (int)(utcDay & (DATE_CACHE_SLOTS - 1));
+        snprintf(days[slot].text, sizeof(days[slot].text), "%04d-%02d-%02d", day.tm_year + 1900, day.tm_mon + 1, day.tm_mday);
+        day.tm_hour = 0;
+        day.tm_min = 0;
+        day.tm_sec = 0;
+        day.tm_isdst = -1;
+        days[slot].start = mktime(&day);
+        day.tm_mday++;
+        day.tm_isdst = -1;
+        days[slot].end = mktime(&day);
+        if (days[slot].end - days[slot].start != 86400) {
+            // Clock change that day: midnight offsets don't give wall time
+            char fallback[20];
+            strftime(fallback, sizeof(fallback), "%Y-%m-%d %H:%M:%S", localtime(&value));
+            days[slot].start = 0;
+            days[slot].end = 0;
+            outText(out, fallback);
+            return;
+        }
+    }
+
+    int seconds = (int)(value - days[slot].start);
+    memcpy(text, days[slot].text, 10);
+    text[10] = ' ';
+    outTwoDigits(text + 11, seconds / 3600);
+    text[13] = ':';
+    outTwoDigits(text + 14, seconds / 60 % 60);
+    text[16] = ':';
+    outTwoDigits(text + 17, seconds % 60);
+    outBytes(out, text, sizeof(text));
+}
+
+/********************************************/
+/*            Report Rendering              */
+/********************************************/
+
+// Listings render into one shared output buffer instead of a printf per
+// line, resolve books and users through the snapshot and the user-ID
+// table, and go out in page-sized writes. Interactive listings stop
+// after each page and ask before continuing; batch mode prints
+// everything.
+
+// The shared report buffer (allocated on first use)
+OutputBuffer* beginReport() {
+    if (reportOutput.buffer == NULL && !openOutput(&reportOutput, stdout)) {
+        return NULL;
+    }
+    return &reportOutput;
+}
+
+// Write out the rendered report
+void endReport() {
+    if (reportOutput.buffer != NULL) {
+        flushOutput(&reportOutput);
+    }
+}
+
+// After each full page, flush and ask whether to go on (false to stop)
+bool reportPageBreak(OutputBuffer* out, int shown, int total, int pageSize) {
+    if (!reportPaging || shown >= total || shown % pageSize != 0) {
+        return true;
+    }
+    int more = 0;
+    flushOutput(out);
+    printf("%d of %d shown. do you wish to show more ?(1-Yes/0-No):", shown, total);
+    if (scanf("%d", &more) != 1) {
+        more = 0;
+    }
+    return more != 0;
+}
+
+// Render one book
+void renderBook(OutputBuffer* out, const Book* book) {
+    outText(out, "---------------------------\n");
+    outPrintf(out, "ID: %d\nTitle: %s\nAuthor: %s\nISBN: %s\n", book->id, book->title, book->author, book->isbn);
+    switch (book->status) {
+        case AVAILABLE:
+            outText(out, "Status: Available\n");
+            break;
+        case BORROWED:
+            outText(out, "Status: Borrowed\n");
+            break;
+        case RESERVED:
+            outText(out, "Status: Reserved\n");
+            break;
+    }
+    outPrintf(out, "Copies: %d (%d available, %d borrowed, %d held)\n", book->copies, availableCopies(book), book->borrowed, book->held);
+    outText(out, "---------------------------\n");
+}
+
+// Render one user
+void renderUser(OutputBuffer* out, const User* user) {
+    outText(out, "---------------------------\n");
+    outPrintf(out, "ID: %d\nName: %s\nUser ID: %s\nAge: %d\nGender: %c\n", user->id, user->name, user->user_id, user->age, user->gender);
+    switch (user->status) {
+        case ACTIVE:
+            outText(out, "Status: Active\n");
+            break;
+        case SUSPENDED:
+            outText(out, "Status: Suspended\n");
+            break;
+        case EXPIRED:
+            outText(out, "Status: Expired\n");
+            break;
+    }
+    outText(out, "---------------------------\n");
+}
+
+// Render one ledger row (book from the snapshot, user from the user-ID table)
+void renderLoan(OutputBuffer* out, CatalogSnapshot* catalog, const BorrowRecord* record, int number, time_t now) {
+    Book* book = snapshotBookById(catalog, record->bookId);
+    User* user = userFromHandle(record->user);
+    if (book == NULL || user == NULL) {
+        outText(out, "Invalid record (Book or User deleted)\n");
+        outText(out, "---------------------------\n");
+        return;
+    }
+    outPrintf(out, "Record ID: %d\nBook: %s\nUser: %s\n", number, book->title, user->name);
+    outText(out, "Borrow Date: ");
+    outDate(out, record->borrowDate);
+    outText(out, "\nDue Date: ");
+    outDate(out, record->dueDate);
+    outChar(out, '\n');
+    if (record->returned) {
+        outText(out, "Return Date: ");
+        outDate(out, record->returnDate);
+        outText(out, "\nStatus: Returned\n");
+    } else {
+        outText(out, "Status: Borrowed\n");
+        if (now > record->dueDate) {
+            outPrintf(out, "OVERDUE!\nOverdue by: %d days\n", (int)((now - record->dueDate) / (24 * 60 * 60)));
+        }
+    }
+    outText(out, "---------------------------\n");
+}
+
+// Render one undo log entry
+void renderHistoryEntry(OutputBuffer* out, const UndoEntry* entry, int position) {
+    char text[MAX_TITLE_LENGTH + MAX_NAME_LENGTH + 64];
+    describeUndoEntry(entry, text, sizeof(text));
+    outPrintf(out, "%d - %s on :\n ", position, text);
+    outDate(out, entry->when);
+    outText(out, "\n------------------------\n");
+}
+
+/********************************************/
+/*             Paged Iteration              */
+/********************************************/
+
+// A page is fetched by seeking to the last key of the previous one, so
+// page N costs a seek plus the page itself, never a re-walk of pages
+// 1..N-1: an O(height) BST descent for book IDs, a rank query in the
+// title or author order tree, a jump in the user-ID table for users and
+// an array index for ledger positions. The order trees also turn "page
+// 500" into a select-k-th, so title, author and ledger listings can be
+// opened at any page without walking the ones before it. Cursors only
+// hold keys, so a client can keep one across catalog changes (or hand it
+// back as a token) and carry on from where it stopped.
+
+// Books with ID > afterId in ID order (at most limit)
+int pageBooksById(int afterId, Book** page, int limit) {
+    int count = 0, depth = 0, capacity = 32;
+    Book** stack = (Book**)malloc(sizeof(Book*) * capacity);
+    if (stack == NULL) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    Book* node = bookRoot;
+    while (count < limit) {
+        // Skip subtrees at or before afterId; larger nodes are pending
+        while (node != NULL) {
+            if (node->id <= afterId) {
+                node = node->right;
+                continue;
+            }
+            if (depth == capacity) {
+                capacity *= 2;
+                Book** grown = (Book**)realloc(stack, sizeof(Book*) * capacity);
+                if (grown == NULL) {
+                    printf("Memory allocation failed!\n");
+                    free(stack);
+                    return count;
+                }
+                stack = grown;
+            }
+            stack[depth++] = node;
+            node = node->left;
+        }
+        if (depth == 0) {
+            break;
+        }
+        Book* next = stack[--depth];
+        page[count++] = next;
+        node = next->right;
+    }
+    free(stack);
+    return count;
+}
+
+// Books after (afterKey, afterId) in title or author order (at most limit)
+int pageBooksInOrder(OrderTree* tree, const char* afterKey, int afterId, Book** page, int limit) {
+    int* ids = (int*)malloc(sizeof(int) * limit);
+    if (ids == NULL) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    int found = orderRange(tree, orderRank(tree, afterKey, afterId + 1), ids, limit);
+    int count = 0;
+    for (int i = 0; i < found; i++) {
+        Book* book = searchBookById(bookRoot, ids[i]);
+        if (book != NULL) {
+            page[count++] = book;
+        }
+    }
+    free(ids);
+    return count;
+}
+
+// Users with ID > afterId in ID order (at most limit)
+int pageUsersById(int afterId, User** page, int limit) {
+    int count = 0;
+    for (int id = afterId < 0 ? 0 : afterId + 1; id < userTableSize && count < limit; id++) {
+        if (userTable[id] != NULL) {
+            page[count++] = userTable[id];
+        }
+    }
+    return count;
+}
+
+// Start a cursor at the beginning of a listing
+void openPageCursor(PageCursor* cursor, PageOrder order) {
+    memset(cursor, 0, sizeof(PageCursor));
+    cursor->order = order;
+}
+
+// Render the next page and move the cursor past it; returns rows shown
+int showNextPage(PageCursor* cursor, int pageSize) {
+    OutputBuffer* out = beginReport();
+    int count = 0;
+    if (out == NULL || cursor->finished || pageSize <= 0) {
+        return 0;
+    }
+
+    if (cursor->order == PAGE_LOANS) {
+        LedgerSnapshot* ledger = pinLedgerSnapshot();
+        CatalogSnapshot* catalog = pinCatalogSnapshot();
+        if (ledger != NULL && catalog != NULL) {
+            time_t now = time(NULL);
+            for (int pos = cursor->lastId; pos < ledger->count && count < pageSize; pos++, count++) {
+                renderLoan(out, catalog, snapshotLoanAt(ledger, pos), pos + 1, now);
+            }
+            cursor->lastId += count;
+            cursor->finished = cursor->lastId >= ledger->count;
+        }
+        releaseCatalogSnapshot(catalog);
+        releaseLedgerSnapshot(ledger);
+    } else if (cursor->order == PAGE_USERS) {
+        User** users = (User**)malloc(sizeof(User*) * pageSize);
+        if (users == NULL) {
+            printf("Memory allocation failed!\n");
+            return 0;
+        }
+        count = pageUsersById(cursor->lastId, users, pageSize);
+        for (int i = 0; i < count; i++) {
+            renderUser(out, users[i]);
+        }
+        if (count > 0) {
+            cursor->lastId = users[count - 1]->id;
+        }
+        cursor->finished = count < pageSize;
+        free(users);
+    } else {
+        Book** books = (Book**)malloc(sizeof(Book*) * pageSize);
+        if (books == NULL) {
+            printf("Memory allocation failed!\n");
+            return 0;
+        }
+        if (cursor->order == PAGE_TITLES) {
+            count = pageBooksInOrder(&titleOrder, cursor->lastKey, cursor->lastId, books, pageSize);
+        } else if (cursor->order == PAGE_AUTHORS) {
+            count = pageBooksInOrder(&authorOrder, cursor->lastKey, cursor->lastId, books, pageSize);
+        } else {
+            count = pageBooksById(cursor->lastId, books, pageSize);
+        }
+        for (int i = 0; i < count; i++) {
+            renderBook(out, books[i]);
+        }
+        if (count > 0) {
+            cursor->lastId = books[count - 1]->id;
+            strcpy(cursor->lastKey, cursor->order == PAGE_AUTHORS ? books[count - 1]->authorKey : books[count - 1]->titleKey);
+        }
+        cursor->finished = count < pageSize;
+        free(books);
+    }
+    endReport();
+    return count;
+}
+
+// Move a cursor to just before a 1-based page (false if the order has no ranks)
+bool seekPageCursor(PageCursor* cursor, int page, int pageSize) {
+    long skip = page > 1 ? (long)(page - 1) * pageSize : 0;
+    PageOrder order = cursor->order;
+    openPageCursor(cursor, order);
+    if (order == PAGE_LOANS) {
+        cursor->lastId = skip < INT_MAX ? (int)skip : INT_MAX;
+        return true;
+    }
+    if (order != PAGE_TITLES && order != PAGE_AUTHORS) {
+        return false;
+    }
+    if (skip > 0) {
+        OrderNode* node = orderSelect(order == PAGE_TITLES ? &titleOrder : &authorOrder, skip - 1);
+        if (node == NULL) {
+            cursor->finished = true;
+        } else {
+            cursor->lastId = node->id;
+            strcpy(cursor->lastKey, node->key);
+        }
+    }
+    return true;
+}
+
+// Write a cursor as a resume token ("<id>" or "<id>:<title/author key>")
+void formatPageToken(const PageCursor* cursor, char* token, int tokenSize) {
+    if (cursor->order == PAGE_TITLES || cursor->order == PAGE_AUTHORS) {
+        snprintf(token, tokenSize, "%d:%s", cursor->lastId, cursor->lastKey);
+    } else {
+        snprintf(token, tokenSize, "%d", cursor->lastId);
+    }
+}
+
+// Resume a cursor from a token written by formatPageToken
+void parsePageToken(PageCursor* cursor, const char* token) {
+    cursor->lastId = atoi(token);
+    const char* key = strchr(token, ':');
+    if ((cursor->order == PAGE_TITLES || cursor->order == PAGE_AUTHORS) && key != NULL) {
+        foldSearchKey(key + 1, cursor->lastKey, MAX_TITLE_LENGTH);
+    }
+}
+
+// Parse "books", "titles", "users", "loans" or "authors" (-1 if unknown)
+int parsePageOrder(const char* text) {
+    static const char* names[] = {"books", "titles", "users", "loans", "authors"};
+    for (int i = 0; i < 5; i++) {
+        if (strcmp(text, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/********************************************/
+/*    BOOK MANAGEMENT set of Functions      */
+/********************************************/
+
+// Create a new book
+Book* addBook(int id, const char* title, const char* author, const char* isbn) {
+    Book* newBook = (Book*)poolAlloc(&bookPool);
+    
+    if (newBook == NULL || !reserveBookQueues(id)) {
+        printf("Memory allocation failed!\n");
+        return NULL;
+    }
+    
+    newBook->id = id;
+    newBook->handle = handleAcquire(&bookHandles, newBook);
+    strncpy(newBook->title, title, MAX_TITLE_LENGTH - 1);
+    newBook->title[MAX_TITLE_LENGTH - 1] = '\0';
+    
+    strncpy(newBook->author, author, MAX_AUTHOR_LENGTH - 1);
+    newBook->author[MAX_AUTHOR_LENGTH - 1] = '\0';
+    
+    strncpy(newBook->isbn, isbn, MAX_ISBN_LENGTH - 1);
+    newBook->isbn[MAX_ISBN_LENGTH - 1] = '\0';
+    
+    refreshBookKeys(newBook);
+    newBook->copies = 1;
+    newBook->borrowed = 0;
+    newBook->held = 0;
+    newBook->status = AVAILABLE;
+    newBook->left = NULL;
+    newBook->right = NULL;
+    
+    return newBook;
+}
+
+// Insert book into BST
+Book* insertBook(Book* root, Book* newBook) {
+    if (root == NULL) {
+        return newBook;
+    }
+    
+    if (newBook->id < root->id) {
+        root->left = insertBook(root->left, newBook);
+    } else if (newBook->id > root->id) {
+        root->right = insertBook(root->right, newBook);
+    } else {
+        printf("Book with ID %d already exists!\n", newBook->id);
+        handleRelease(&bookHandles, newBook->handle);
+        poolFree(&bookPool, newBook);
+    }
+    
+    return root;
+}
+
+// Search for book by ID
+Book* searchBookById(Book* root, int id) {
+    if (root == NULL || root->id == id) {
+        return root;
+    }
+    
+    if (id < root->id) {
+        return searchBookById(root->left, id);
+    }
+    
+    return searchBookById(root->right, id);
+}
+
+// Search for book by title with a prepared pattern
+Book* searchBookByTitleWith(Book* root, const SubstringMatcher* matcher) {
+    if (root == NULL) {
+        return NULL;
+    }
+    
+    if (containsSubstring(matcher, root->titleKey, MAX_TITLE_LENGTH)) {
+        printf("Found: %s by %s (ID = %d)\n", root->title, root->author, root->id);
+        return root;
+    }
+    
+    Book* leftResult = searchBookByTitleWith(root->left, matcher);
+    if (leftResult != NULL) {
+        return leftResult;
+    }
+    
+    return searchBookByTitleWith(root->right, matcher);
+}
+
+// Search for book by title (partial match on folded keys, cached for the catalog)
+Book* searchBookByTitle(Book* root, const char* title) {
+    char key[MAX_TITLE_LENGTH];
+    SubstringMatcher matcher;
+    const void* cached;
+    foldSearchKey(title, key, MAX_TITLE_LENGTH);
+    if (root == bookRoot && cacheLookup(&titleCache, key, titleGeneration, &cached)) {
+        Book* book = (Book*)cached;
+        if (book != NULL) {
+            printf("Found: %s by %s (ID = %d)\n", book->title, book->author, book->id);
+        }
+        return book;
+    }
+    prepareSubstringMatcher(&matcher, key);
+    Book* book = searchBookByTitleWith(root, &matcher);
+    if (root == bookRoot) {
+        cacheStore(&titleCache, key, titleGeneration, book);
+    }
+    return book;
+}
+// Find minimum value node in BST (helper for deletion)
+
+Book* findMinValueNode(Book* root) {
+    Book* current = root;
+    
+    while (current && current->left != NULL) {
+        current = current->left;
+    }
+    
+    return current;
+}
+
+// Unlink the smallest node of a subtree (returns the new subtree root)
+Book* unlinkMinNode(Book* root) {
+    if (root->left == NULL) {
+        return root->right;
+    }
+    root->left = unlinkMinNode(root->left);
+    return root;
+}
+
+// Unlink a book node from the BST without freeing it. Nodes are relinked,
+// never copied into each other, so every other book keeps its node.
+Book* unlinkBook(Book* root, int id, Book** unlinked) {
+    if (root == NULL) {
+        return root;
+    }
+    
+    if (id < root->id) {
+        root->left = unlinkBook(root->left, id, unlinked);
+        return root;
+    } else if (id > root->id) {
+        root->right = unlinkBook(root->right, id, unlinked);
+        return root;
+    }
+    
+    Book* replacement;
+    // Case 1 and 2: Leaf Node or one child (the child takes its place)
+    if (root->left == NULL) {
+        replacement = root->right;
+    } else if (root->right == NULL) {
+        replacement = root->left;
+    } else {
+        // Case 3: Two children (the in-order successor node moves up)
+        replacement = findMinValueNode(root->right);
+        replacement->right = unlinkMinNode(root->right);
+        replacement->left = root->left;
+    }
+    root->left = NULL;
+    root->right = NULL;
+    *unlinked = root;
+    return replacement;
+}
+
+// Delete book from BST (its handles go stale)
+Book* deleteBook(Book* root, int id) {
+    Book* removed = NULL;
+    root = unlinkBook(root, id, &removed);
+    if (removed != NULL) {
+        handleRelease(&bookHandles, removed->handle);
+        poolFree(&bookPool, removed);
+    }
+    return root;
+}
+
+// Function to display a book's details
+void displayBook(Book* book) {
+    OutputBuffer* out = beginReport();
+    if (book != NULL && out != NULL) {
+        renderBook(out, book);
+        endReport();
+    }
+}
+
+// Display all books (in ID order) from a pinned catalog snapshot
+void displayAllBooks() {
+    CatalogSnapshot* snap = pinCatalogSnapshot();
+    if (snap == NULL) {
+        return;
+    }
+
+    OutputBuffer* out = beginReport();
+    if (out == NULL) {
+        releaseCatalogSnapshot(snap);
+        return;
+    }
+    if (snap->count == 0) {
+        printf("No books found!\n");
+    }
+    for (int i = 0; i < snap->count; i++) {
+        renderBook(out, snapshotBookAt(snap, i));
+        if (!reportPageBreak(out, i + 1, snap->count, REPORT_PAGE_SIZE)) {
+            break;
+        }
+    }
+    endReport();
+    releaseCatalogSnapshot(snap);
+}
+
+// Find the title with an ISBN (NULL when the ISBN is blank or unknown)
+Book* findBookByIsbn(const char* isbn) {
+    char key[MAX_ISBN_LENGTH];
+    normalizeIsbn(isbn, key, MAX_ISBN_LENGTH);
+    KeyEntry* entry = key[0] != '\0' ? findKeyEntry(&isbnIndex, key) : NULL;
+    return entry != NULL && entry->count > 0 ? searchBookById(bookRoot, entry->bookIds[0]) : NULL;
+}
+
+// Another title already listed under an ISBN (NULL if none, or if it is this book)
+Book* isbnTakenBy(const Book* book, const char* isbn) {
+    Book* other = findBookByIsbn(isbn);
+    return other != book ? other : NULL;
+}
+
+// Register a new book in the catalog, its indexes and the history
+// (a book whose ISBN is already listed becomes another copy of that
+// title; *copyAdded tells the caller which happened)
+Book* catalogNewBook(const char* title, const char* author, const char* isbn, bool* copyAdded) {
+    Book* existing = findBookByIsbn(isbn);
+    *copyAdded = existing != NULL;
+    if (existing != NULL) {
+        setBookCopies(existing, existing->copies + 1);
+        return existing;
+    }
+    numbooks++;
+    Book* newBook = addBook(numbooks, title, author, isbn);
+    if (newBook == NULL) {
+        return NULL;
+    }
+    bookRoot = insertBook(bookRoot, newBook);
+    indexBook(newBook);
+    commitBookChange(newBook->id);
+    logUndo(UNDO_BOOK_ADDED, newBook, NULL);
+    return newBook;
+}
+
+// Add a new book via user input
+void bookInSys() {
+    char title[MAX_TITLE_LENGTH];
+    char author[MAX_AUTHOR_LENGTH];
+    char isbn[MAX_ISBN_LENGTH];
+    while ((getchar()) != '\n');
+
+    printf("Enter book title: ");
+    fgets(title, MAX_TITLE_LENGTH, stdin);
+    title[strcspn(title, "\n")] = '\0';  // Remove newline
+
+
+    printf("Enter author name: ");
+    fgets(author, MAX_AUTHOR_LENGTH, stdin);
+    author[strcspn(author, "\n")] = '\0';  // Remove newline
+    
+    printf("Enter ISBN: ");
+    fgets(isbn, MAX_ISBN_LENGTH, stdin);
+    isbn[strcspn(isbn, "\n")] = '\0';  // Remove newline
+    
+    bool copyAdded;
+    Book* book = catalogNewBook(title, author, isbn, &copyAdded);
+    if (book != NULL && copyAdded) {
+        printf("ISBN already listed as '%s': copy added to ID %d (%d copies)\n", book->title, book->id, book->copies);
+    } else if (book != NULL) {
+        printf("Book added successfully!\n");
+    }
+}
+
+// Edit book details
+void editBook() {
+    char bname[MAX_TITLE_LENGTH];
+        printf("Enter Book Title (or part of it): ");
+        while ((getchar()) != '\n'); // Clear input buffer
+        fgets(bname, MAX_TITLE_LENGTH, stdin);
+        bname[strcspn(bname, "\n")] = '\0';
+    
+    Book* book = searchBookByTitle(bookRoot, bname);
+    if (book == NULL) {
+        printf("Book not found!\n");
+        return;
+    }
+    
+    printf("Current details:\n");
+    displayBook(book);
+    
+    
+    char title[MAX_TITLE_LENGTH];
+    char author[MAX_AUTHOR_LENGTH];
+    char isbn[MAX_ISBN_LENGTH];
+    int choice;
+    do{
+    printf("\nEnter new details (or leave blank to keep current):\n");
+    printf("1. Edit title\n");
+    printf("2. Edit author\n");
+    printf("3. Edit ISBN\n");
+    printf("4. Change number of copies\n");
+    printf("5. Back\n");
+    printf("Enter choice: ");
+    scanf("%d", &choice);
+    printf("----------------------------------------------------\n");
+    while ((getchar()) != '\n');
+    switch (choice) {
+        case 1:
+            printf("Enter new title: ");
+            fgets(title, MAX_TITLE_LENGTH, stdin);
+            title[strcspn(title, "\n")] = '\0';
+            if (strlen(title) > 0) {
+                logFieldEdit(UNDO_BOOK_EDITED, book, NULL, FIELD_TITLE, book->title, 0);
+                unindexBook(book);
+                strncpy(book->title, title, MAX_TITLE_LENGTH - 1);
+                book->title[MAX_TITLE_LENGTH - 1] = '\0';
+                refreshBookKeys(book);
+                indexBook(book);
+                commitBookChange(book->id);
+            }
+            break;
+        case 2:
+            printf("Enter new author: ");
+            fgets(author, MAX_AUTHOR_LENGTH, stdin);
+            author[strcspn(author, "\n")] = '\0';
+            if (strlen(author) > 0) {
+                logFieldEdit(UNDO_BOOK_EDITED, book, NULL, FIELD_AUTHOR, book->author, 0);
+                unindexBook(book);
+                strncpy(book->author, author, MAX_AUTHOR_LENGTH - 1);
+                book->author[MAX_AUTHOR_LENGTH - 1] = '\0';
+                refreshBookKeys(book);
+                indexBook(book);
+                commitBookChange(book->id);
+            }
+            break;
+        case 3:
+            printf("Enter new ISBN: ");
+            fgets(isbn, MAX_ISBN_LENGTH, stdin);
+            isbn[strcspn(isbn, "\n")] = '\0';
+            Book* other = strlen(isbn) > 0 ? isbnTakenBy(book, isbn) : NULL;
+            if (other != NULL) {
+                // One record per title: a second record with the same ISBN is refused
+                printf("ISBN already listed as '%s' (ID %d); change that title's copies instead\n", other->title, other->id);
+            } else if (strlen(isbn) > 0) {
+                logFieldEdit(UNDO_BOOK_EDITED, book, NULL, FIELD_ISBN, book->isbn, 0);
+                unindexBook(book);
+                strncpy(book->isbn, isbn, MAX_ISBN_LENGTH - 1);
+                book->isbn[MAX_ISBN_LENGTH - 1] = '\0';
+                indexBook(book);
+                commitBookChange(book->id);
+            }
+            break;
+        case 4:
+            printf("Enter number of copies (%d now, %d on the shelf): ", book->copies, availableCopies(book));
+            int copies;
+            if (scanf("%d", &copies) == 1 && copies > 0) {
+                if (!setBookCopies(book, copies)) {
+                    printf("Only copies on the shelf can be withdrawn!\n");
+                }
+            }
+            while ((getchar()) != '\n');
+            break;
+        case 5:
+            return;
+        default:
+            printf("Invalid choice!\n");
+    }
+}while (choice !=5);
+    printf("Book updated successfully!\n");
+}
+
+// View book details
+void viewBook() {
+    char title[MAX_TITLE_LENGTH];
+        printf("Enter Book Title (or part of it): ");
+        while ((getchar()) != '\n'); // Clear input buffer
+        fgets(title, MAX_TITLE_LENGTH, stdin);
+        title[strcspn(title, "\n")] = '\0';
+    
+    Book* book = searchBookByTitle(bookRoot, title);
+    if (book == NULL) {
+        printf("Book not found!\n");
+        return;
+    }
+    printf("\e[1;1H\e[2J");
+    displayBook(book);
+}
+
+// Delete a book
+void deleteBookMenu() {
+    char title[MAX_TITLE_LENGTH];
+        printf("Enter Book Title (or part of it): ");
+        while ((getchar()) != '\n'); // Clear input buffer
+        fgets(title, MAX_TITLE_LENGTH, stdin);
+        title[strcspn(title, "\n")] = '\0';
+    
+    Book* book = searchBookByTitle(bookRoot, title);
+    if (book == NULL) {
+        printf("Book not found!\n");
+        return;
+    }
+    
+    // Check if any copy is borrowed or held
+    if (book->borrowed > 0 || book->held > 0) {
+        printf("Cannot delete book as it is currently borrowed or reserved!\n");
+        return;
+    }
+    // The log keeps the detached node until the entry goes
+    int bookId = book->id;
+    unindexBook(book);
+    bookRoot = unlinkBook(bookRoot, bookId, &book);
+    UndoEntry* entry = logUndo(UNDO_BOOK_DELETED, book, NULL);
+    if (entry != NULL) {
+        handleDetach(&bookHandles, book->handle);
+        entry->before.book = book;
+    } else {
+        handleRelease(&bookHandles, book->handle);
+        poolFree(&bookPool, book);
+    }
+    commitBookChange(bookId);
+    printf("Book deleted successfully!\n");
+}
+
+// Book management menu
+void manageBooks() {
+    int choice;
+    
+    do {
+        printf("\e[1;1H\e[2J");
+        printf("\n=== Book Management ===\n");
+        printf("1. Add Book\n");
+        printf("2. Edit Book\n");
+        printf("3. View Book\n");
+        printf("4. Delete Book\n");
+        printf("5. List All Books\n");
+        printf("6. Back\n");
+        printf("Choose an option: ");
+        scanf("%d", &choice);
+        
+        switch (choice) {
+            case 1:
+            printf("\e[1;1H\e[2J");
+                bookInSys();
+                Sleep(2000);
+                break;
+            case 2:
+            printf("\e[1;1H\e[2J");
+                editBook();
+                Sleep(2000);
+                break;
+            case 3:
+            printf("\e[1;1H\e[2J");
+                viewBook();
+                Sleep(2000);
+                break;
+            case 4:
+            printf("\e[1;1H\e[2J");
+                deleteBookMenu();
+                Sleep(2000);
+                break;
+            case 5:
+            printf("\e[1;1H\e[2J");
+                displayAllBooks();
+                Sleep(5000);
+                break;
+            case 6:
+                return;
+            default:
+                printf("Invalid choice!\n");
+        }
+    } while (choice != 6);
+}
+
+/********************************************/
+/* User Management Functions                */
+/********************************************/
+
+// Create a new user
+User* createUser(int id, const char* name, const char* user_id, int age, char gender) {
+    User* newUser = (User*)poolAlloc(&userPool);
+    if (newUser == NULL) {
+        printf("Memory allocation failed!\n");
+        return NULL;
+    }
+    
+    newUser->id = id;
+    newUser->handle = handleAcquire(&userHandles, newUser);
+    strncpy(newUser->name, name, MAX_NAME_LENGTH - 1);
+    newUser->name[MAX_NAME_LENGTH - 1] = '\0';
+    refreshUserKeys(newUser);
+    
+    strncpy(newUser->user_id, user_id, MAX_ID_LENGTH - 1);
+    newUser->user_id[MAX_ID_LENGTH - 1] = '\0';
+    
+    newUser->age = age;
+    newUser->gender = gender;
+    newUser->status = ACTIVE;
+    newUser->borrowCount = 0;
+    newUser->next = NULL;
+    
+    return newUser;
+}
+
+// Add user to linked list
+void addUserToList(User* newUser) {
+    if (userList == NULL) {
+        userList = newUser;
+    } else {
+        User* current = userList;
+        while (current->next != NULL) {
+            current = current->next;
+        }
+        current->next = newUser;
+    }
+    indexUser(newUser);
+}
+
+// Search for user by ID (one lookup in the user-ID table)
+User* searchUserById(int id) {
+    return id >= 0 && id < userTableSize ? userTable[id] : NULL;
+}
+
+// Search for user by name (exact match on folded keys through the substring matcher)
+User* searchUserByName(const char* name) {
+    char key[MAX_NAME_LENGTH];
+    SubstringMatcher matcher;
+    foldSearchKey(name, key, MAX_NAME_LENGTH);
+    prepareSubstringMatcher(&matcher, key);
+    if (matcher.length == 0) {
+        return NULL;
+    }
+    User* current = userList;
+    while (current != NULL) {
+        // A key as long as the pattern that holds it at the start is the name itself
+        if (current->nameKey[matcher.length] == '\0' && findSubstringKernel(&matcher, current->nameKey, MAX_NAME_LENGTH) == 0) {
+            return current;
+        }
+        current = current->next;
+    }
+    return NULL;
+}
+
+// Display user details
+void displayUser(User* user) {
+    OutputBuffer* out = beginReport();
+    if (user == NULL) {
+        printf("---------------------------\n");
+    } else if (out != NULL) {
+        renderUser(out, user);
+        endReport();
+    }
+}
+
+// Display all users
+void displayAllUsers() {
+    User* current = userList;
+    if (current == NULL) {
+        printf("No users found!\n");
+        return;
+    }
+    
+    OutputBuffer* out = beginReport();
+    if (out == NULL) {
+        return;
+    }
+    int total = 0, shown = 0;
+    for (User* user = userList; user != NULL; user = user->next) {
+        total++;
+    }
+    printf("\n=== All Users ===\n");
+    while (current != NULL) {
+        renderUser(out, current);
+        current = current->next;
+        if (!reportPageBreak(out, ++shown, total, REPORT_PAGE_SIZE)) {
+            break;
+        }
+    }
+    endReport();
+}
+
+// Unlink a user from the list and its indexes (the node is not freed)
+User* unlinkUser(int id) {
+    User* current = userList;
+    User* prev = NULL;
+    while (current != NULL && current->id != id) {
+        prev = current;
+        current = current->next;
+    }
+    if (current == NULL) {
+        return NULL;
+    }
+    if (prev == NULL) {
+        userList = current->next;
+    } else {
+        prev->next = current->next;
+    }
+    current->next = NULL;
+    unindexUser(current);
+    return current;
+}
+
+// Delete user (the undo log keeps the node until its entry goes)
+void delusernode(int id) {
     if (userList == NULL) {
         printf("No users in the system!\n");
         return;
     }
-    
-    // Handle case where head is to be deleted
-    if (userList->id == id) {
-        User* temp = userList;
-        userList = userList->next;
-        free(temp);
-        printf("User deleted successfully!\n");
+    
+    User* user = unlinkUser(id);
+    if (user == NULL) {
+        printf("User not found!\n");
+        return;
+    }
+    UndoEntry* entry = logUndo(UNDO_USER_DELETED, NULL, user);
+    if (entry != NULL) {
+        handleDetach(&userHandles, user->handle);
+        entry->before.user = user;
+    } else {
+        handleRelease(&userHandles, user->handle);
+        poolFree(&userPool, user);
+    }
+    printf("User deleted successfully!\n");
+}
+
+// Register a new user in the user list, its indexes and the history
+User* registerNewUser(const char* name, const char* user_id, int age, char gender) {
+    numofuser++;
+    User* newUser = createUser(numofuser, name, user_id, age, gender);
+    if (newUser == NULL) {
+        return NULL;
+    }
+    addUserToList(newUser);
+    logUndo(UNDO_USER_ADDED, NULL, newUser);
+    return newUser;
+}
+
+// Add a new user via user input
+void userInSys() {
+    char name[MAX_NAME_LENGTH];
+    char user_id[MAX_ID_LENGTH];
+    int age;
+    char gender;
+    while ((getchar()) != '\n');
+
+    printf("Enter user name: ");
+    fgets(name, MAX_NAME_LENGTH, stdin);
+    name[strcspn(name, "\n")] = '\0';  // Remove newline
+    
+    printf("Enter user ID: ");
+    fgets(user_id, MAX_ID_LENGTH, stdin);
+    user_id[strcspn(user_id, "\n")] = '\0';  // Remove newline
+    
+    printf("Enter age: ");
+    scanf("%d", &age);
+    
+    printf("Enter gender (M/F): ");
+    scanf(" %c", &gender);
+    
+    if (registerNewUser(name, user_id, age, gender) != NULL) {
+        printf("User added successfully!\n");
+    }
+}
+
+// Edit user details
+void editUser() {
+
+    char uname[MAX_NAME_LENGTH];
+    printf("Enter User's name: ");
+    while ((getchar()) != '\n');
+    fgets(uname, MAX_NAME_LENGTH, stdin);
+    uname[strcspn(uname, "\n")] = '\0';
+
+    User* user = searchUserByName(uname);
+    if (user == NULL) {
+        printf("User not found!\n");
+        return;
+    }
+    
+    printf("Current details:\n");
+    displayUser(user);
+    
+    int choice;
+    char name[MAX_NAME_LENGTH];
+    char user_id[MAX_ID_LENGTH];
+    int age;
+    char gender;
+
+    
+    do{
+    printf("\nEnter new details (or leave blank to keep current):\n");
+    printf("1. Edit name\n");
+    printf("2. Edit user ID\n");
+    printf("3. Edit age\n");
+    printf("4. Edit gender\n");
+    printf("5. Edit status\n");
+    printf("6. Back\n");
+    printf("Enter choice: ");
+    printf("----------------------------------------------------\n");
+    scanf("%d", &choice);
+
+    while ((getchar()) != '\n'); 
+    
+    switch (choice) {
+        case 1:
+            printf("Enter new name: ");
+            fgets(name, MAX_NAME_LENGTH, stdin);
+            name[strcspn(name, "\n")] = '\0';
+            if (strlen(name) > 0) {
+                logFieldEdit(UNDO_USER_EDITED, NULL, user, FIELD_NAME, user->name, 0);
+                unindexUser(user);
+                strncpy(user->name, name, MAX_NAME_LENGTH - 1);
+                user->name[MAX_NAME_LENGTH - 1] = '\0';
+                refreshUserKeys(user);
+                indexUser(user);
+            }
+            break;
+        case 2:
+            printf("Enter new user ID: ");
+            fgets(user_id, MAX_ID_LENGTH, stdin);
+            user_id[strcspn(user_id, "\n")] = '\0';
+            if (strlen(user_id) > 0) {
+                logFieldEdit(UNDO_USER_EDITED, NULL, user, FIELD_USER_ID, user->user_id, 0);
+                strncpy(user->user_id, user_id, MAX_ID_LENGTH - 1);
+                user->user_id[MAX_ID_LENGTH - 1] = '\0';
+            }
+            break;
+        case 3:
+            printf("Enter new age: ");
+            scanf("%d", &age);
+            logFieldEdit(UNDO_USER_EDITED, NULL, user, FIELD_AGE, NULL, user->age);
+            user->age = age;
+            break;
+        case 4:
+            printf("Enter new gender (M/F): ");
+            scanf(" %c", &gender);
+            logFieldEdit(UNDO_USER_EDITED, NULL, user, FIELD_GENDER, NULL, user->gender);
+            user->gender = gender;
+            break;
+        case 5:
+            printf("Select new status:\n");
+            printf("1. Active\n");
+            printf("2. Suspended\n");
+            printf("3. Expired\n");
+            printf("Enter choice: ");
+            scanf("%d", &choice);
+            if (choice >= 1 && choice <= 3) {
+                logFieldEdit(UNDO_USER_EDITED, NULL, user, FIELD_STATUS, NULL, user->status);
+            }
+            
+            switch (choice) {
+                case 1:
+                    user->status = ACTIVE;
+                    break;
+                case 2:
+                    user->status = SUSPENDED;
+                    break;
+                case 3:
+                    user->status = EXPIRED;
+                    break;
+                default:
+                    printf("Invalid choice!\n");
+            }
+            break;
+        case 6:
+            return;
+        default:
+            printf("Invalid choice!\n");
+    }
+}while(choice != 6 );
+    printf("User updated successfully!\n");
+}
+
+// View user details
+void viewUser() {
+    char name[MAX_NAME_LENGTH];
+    printf("Enter User's name: ");
+    while ((getchar()) != '\n');
+    fgets(name, MAX_NAME_LENGTH, stdin);
+    name[strcspn(name, "\n")] = '\0';
+
+    User* user = searchUserByName(name);
+    if (user == NULL) {
+        printf("User not found!\n");
+        return;
+    }
+    
+    displayUser(user);
+}
+
+// Delete user menu function
+void deleteUser() {
+    char name[MAX_NAME_LENGTH];
+    printf("Enter User's name: ");
+    while ((getchar()) != '\n');
+    fgets(name, MAX_NAME_LENGTH, stdin);
+    name[strcspn(name, "\n")] = '\0';
+
+    User* user = searchUserByName(name);
+    if (user == NULL) {
+        printf("User not found!\n");
+        return;
+    }
+    
+    // Check if user has borrowed books
+    BorrowRecord* current = borrowRecords;
+    while (current != NULL) {
+        if (current->userId == user->id && !current->returned) {
+            printf("Cannot delete user as they have borrowed books!\n");
+            return;
+        }
+        current = current->next;
+    }
+    
+    delusernode(user->id);
+}
+
+// User management menu
+void manageUsers() {
+    int choice;
+    
+    do {
+        printf("\n=== User Management ===\n");
+        printf("1. Add User\n");
+        printf("2. Edit User\n");
+        printf("3. View User\n");
+        printf("4. Delete User\n");
+        printf("5. List All Users\n");
+        printf("6. Back\n");
+        printf("Choose an option: ");
+        scanf("%d", &choice);
+        
+        switch (choice) {
+            case 1:
+            printf("\e[1;1H\e[2J");
+                userInSys();
+                Sleep(2000);
+                break;
+            case 2:
+            printf("\e[1;1H\e[2J");
+                editUser();
+                Sleep(2000);
+                break;
+            case 3:
+            printf("\e[1;1H\e[2J");
+                viewUser();
+                Sleep(2000);
+                break;
+            case 4:
+            printf("\e[1;1H\e[2J");
+                deleteUser();
+                Sleep(2000);
+                break;
+            case 5:
+            printf("\e[1;1H\e[2J");
+                displayAllUsers();
+                Sleep(5000);
+                break;
+            case 6:
+                return;
+            default:
+                printf("Invalid choice!\n");
+        }
+    } while (choice != 6);
+}
+
+/********************************************/
+/* Book Queue Functions                     */
+/********************************************/
+
+// Initialize book queue
+void initializeBookQueue(int bookId) {
+    bookQueues[bookId].front = NULL;
+    bookQueues[bookId].rear = NULL;
+    bookQueues[bookId].size = 0;
+}
+
+// Check if queue is empty
+int isQueueEmpty(int bookId) {
+    return bookQueues[bookId].front == NULL;
+}
+
+// Enqueue a user for a book (since is when they joined)
+void enqueueUser(int bookId, int userId, time_t since) {
+    QueueNode* newNode = (QueueNode*)malloc(sizeof(QueueNode));
+    if (newNode == NULL) {
+        printf("Memory allocation failed!\n");
+        return;
+    }
+    
+    newNode->userId = userId;
+    newNode->user = userHandleById(userId);
+    newNode->since = since;
+    newNode->next = NULL;
+    
+    // If queue is empty
+    if (bookQueues[bookId].rear == NULL) {
+        bookQueues[bookId].front = newNode;
+        bookQueues[bookId].rear = newNode;
+    } else {
+        bookQueues[bookId].rear->next = newNode;
+        bookQueues[bookId].rear = newNode;
+    }
+    
+    bookQueues[bookId].size++;
+}
+
+// Put a user back at a queue position (1 = front; past the end means last)
+void insertQueueUser(int bookId, int userId, int position, time_t since) {
+    QueueNode* newNode = (QueueNode*)malloc(sizeof(QueueNode));
+    if (newNode == NULL) {
+        printf("Memory allocation failed!\n");
+        return;
+    }
+    newNode->userId = userId;
+    newNode->user = userHandleById(userId);
+    newNode->since = since;
+    QueueNode** link = &bookQueues[bookId].front;
+    for (int i = 1; i < position && *link != NULL; i++) {
+        link = &(*link)->next;
+    }
+    newNode->next = *link;
+    *link = newNode;
+    if (newNode->next == NULL) {
+        bookQueues[bookId].rear = newNode;
+    }
+    bookQueues[bookId].size++;
+}
+
+// Check if a user waits in a book's queue
+bool isUserQueued(int bookId, int userId) {
+    for (QueueNode* node = bookQueues[bookId].front; node != NULL; node = node->next) {
+        if (node->userId == userId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Dequeue a user from book queue (returns their handle)
+Handle dequeueUser(int bookId) {
+    if (isQueueEmpty(bookId)) {
+        printf("No users in queue for this book!\n");
+        return NULL_HANDLE;
+    }
+    
+    QueueNode* temp = bookQueues[bookId].front;
+    Handle user = temp->user;
+    
+    bookQueues[bookId].front = bookQueues[bookId].front->next;
+    
+    // If front becomes NULL, rear should also be NULL
+    if (bookQueues[bookId].front == NULL) {
+        bookQueues[bookId].rear = NULL;
+    }
+    
+    free(temp);
+    bookQueues[bookId].size--;
+    
+    return user;
+}
+
+// Unlink a waiter from a book's queue (prev is the node before it, NULL at the front) and free it
+void removeQueueNode(int bookId, QueueNode* prev, QueueNode* node) {
+    BookQueue* queue = &bookQueues[bookId];
+    if (prev == NULL) {
+        queue->front = node->next;
+    } else {
+        prev->next = node->next;
+    }
+    if (queue->rear == node) {
+        queue->rear = prev;
+    }
+    free(node);
+    queue->size--;
+}
+
+// Display all users in queue for a book
+void displayBookQueue(int bookId) {
+    for (HoldNode* hold = bookQueues[bookId].holds; hold != NULL; hold = hold->next) {
+        User* holder = userFromHandle(hold->user);
+        char until[26];
+        strftime(until, sizeof(until), "%Y-%m-%d %H:%M:%S", localtime(&hold->until));
+        printf("Held for pickup: %s (ID: %d) until %s\n", holder != NULL ? holder->name : "unknown", hold->userId, until);
+    }
+    if (isQueueEmpty(bookId)) {
+        printf("No users in queue for this book!\n");
+        return;
+    }
+    
+    QueueNode* current = bookQueues[bookId].front;
+    int position = 1;
+    
+    printf("Users in queue for book ID %d:\n", bookId);
+    printf("---------------------------\n");
+    
+    while (current != NULL) {
+        User* user = userFromHandle(current->user);
+        printf("Position %d: %s (ID: %d)\n", position, user != NULL ? user->name : "unknown", current->userId);
+        current = current->next;
+        position++;
+    }
+}
+
+/********************************************/
+/*         Reservation Fulfillment          */
+/********************************************/
+
+// A book node is a title: it counts its copies and how many of them are
+// borrowed or held, so availability is a subtraction, and its queue is
+// shared by every copy. A return never serves the queue itself. If
+// somebody is waiting, the copy is counted as held and a "book freed"
+// event is queued in O(1). The fulfillment stage runs between
+// operations (the menu loops, each batch command and each server poll
+// round). It drains up to FULFILLMENT_BATCH events at a time. For each
+// one it gives every held copy nobody holds yet to the next eligible
+// waiter. Suspended or over-limit waiters are passed over but keep
+// their place for the next copy; waiters whose user was deleted are
+// dropped. A held copy is lent only to its holder, and a freed copy
+// with nobody eligible goes back on the shelf.
+//
+// A hold lasts HOLD_PICKUP_SECONDS. Each deadline goes into a
+// hierarchical timer wheel in O(1): four levels of 64 slots, with one
+// second per level-0 slot and 64 times more per level above. Advancing
+// the wheel empties the current level-0 slot and, every 64 seconds,
+// moves one slot of the level above down a level. Each timer is moved at
+// most once per level, so an expiry costs O(1) amortized. Seconds with
+// an empty level 0 are skipped a whole slot span at a time. Picked-up or
+// cancelled holds leave their timer in place; when it fires it no longer
+// matches any of the title's holds and is dropped. An expired hold passes the
+// copy to the next waiter like a cancellation would.
+
+// Queue a "book freed" event
+void postBookFreed(int bookId) {
+    FulfillmentQueue* queue = &fulfillmentQueue;
+    if (queue->count == queue->capacity) {
+        int capacity = queue->capacity > 0 ? queue->capacity * 2 : 64;
+        int* bookIds = (int*)malloc(sizeof(int) * capacity);
+        if (bookIds == NULL) {
+            printf("Memory allocation failed!\n");
+            return;
+        }
+        for (int i = 0; i < queue->count; i++) {
+            bookIds[i] = queue->bookIds[(queue->head + i) % queue->capacity];
+        }
+        free(queue->bookIds);
+        queue->bookIds = bookIds;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    queue->bookIds[(queue->head + queue->count) % queue->capacity] = bookId;
+    queue->count++;
+}
+
+// Put a timer in the slot for its deadline
+void wheelInsert(HoldTimerWheel* wheel, HoldTimer* timer) {
+    long long horizon = 1LL << (HOLD_WHEEL_BITS * HOLD_WHEEL_LEVELS);
+    long long delta = (long long)timer->deadline - wheel->now;
+    if (delta < 0) {
+        delta = 0;
+    }
+    if (delta >= horizon) {
+        delta = horizon - 1;   // re-placed when its slot cascades
+    }
+    int level = 0;
+    while (level < HOLD_WHEEL_LEVELS - 1 && delta >= 1LL << (HOLD_WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    int slot = (int)(((wheel->now + delta) >> (HOLD_WHEEL_BITS * level)) & (HOLD_WHEEL_SLOTS - 1));
+    timer->next = wheel->slots[level][slot];
+    wheel->slots[level][slot] = timer;
+    wheel->levelCounts[level]++;
+}
+
+// Detach every timer in a slot
+HoldTimer* wheelTake(HoldTimerWheel* wheel, int level, int slot) {
+    HoldTimer* timers = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    for (HoldTimer* timer = timers; timer != NULL; timer = timer->next) {
+        wheel->levelCounts[level]--;
+    }
+    return timers;
+}
+
+// Start the pickup clock of a hold
+void addHoldTimer(int bookId, int userId, time_t deadline) {
+    HoldTimer* timer = (HoldTimer*)poolAlloc(&holdTimerPool);
+    if (timer == NULL) {
+        printf("Memory allocation failed!\n");
+        return;
+    }
+    if (holdWheel.count == 0) {
+        holdWheel.now = (long long)time(NULL);
+    }
+    timer->bookId = bookId;
+    timer->userId = userId;
+    timer->deadline = deadline;
+    wheelInsert(&holdWheel, timer);
+    holdWheel.count++;
+}
+
+// Find a user's hold on a title
+HoldNode* findHold(int bookId, int userId) {
+    HoldNode* hold = bookQueues[bookId].holds;
+    while (hold != NULL && hold->userId != userId) {
+        hold = hold->next;
+    }
+    return hold;
+}
+
+// Append a hold to a title's list (the copy must already be counted as held)
+bool appendHold(int bookId, int userId, time_t since, time_t until) {
+    HoldNode* hold = (HoldNode*)malloc(sizeof(HoldNode));
+    if (hold == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    hold->userId = userId;
+    hold->user = userHandleById(userId);
+    hold->since = since;
+    hold->until = until;
+    hold->next = NULL;
+    HoldNode** tail = &bookQueues[bookId].holds;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = hold;
+    bookQueues[bookId].holdCount++;
+    addHoldTimer(bookId, userId, until);
+    return true;
+}
+
+// Remove a user's hold from a title's list (its timer goes stale)
+bool removeHold(int bookId, int userId) {
+    HoldNode** link = &bookQueues[bookId].holds;
+    while (*link != NULL && (*link)->userId != userId) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        return false;
+    }
+    HoldNode* hold = *link;
+    *link = hold->next;
+    free(hold);
+    bookQueues[bookId].holdCount--;
+    return true;
+}
+
+// Drop every hold of a title (their timers go stale)
+void clearHolds(int bookId) {
+    while (bookQueues[bookId].holds != NULL) {
+        removeHold(bookId, bookQueues[bookId].holds->userId);
+    }
+}
+
+// Hold one of the title's held copies for a user until they pick it up
+void placeHold(Book* book, User* user) {
+    time_t now = time(NULL);
+    if (appendHold(book->id, user->id, now, now + HOLD_PICKUP_SECONDS)) {
+        fulfillmentQueue.holdsPlaced++;
+    }
+    updateCopyCounts(book);
+}
+
+// Release a user's hold (the copy goes to the next waiter through the queue)
+void releaseHold(Book* book, int userId) {
+    removeHold(book->id, userId);
+    postBookFreed(book->id);
+}
+
+// A timer fired: release the hold if it is still the one the timer was set for
+void expireHold(HoldTimer* timer) {
+    HoldNode* hold = timer->bookId < bookQueueCapacity ? findHold(timer->bookId, timer->userId) : NULL;
+    if (hold != NULL && hold->until == timer->deadline) {
+        Book* book = searchBookById(bookRoot, timer->bookId);
+        if (book != NULL) {
+            releaseHold(book, timer->userId);
+            fulfillmentQueue.holdsExpired++;
+        }
+    }
+    poolFree(&holdTimerPool, timer);
+    holdWheel.count--;
+}
+
+// Fire every hold timer due at or before now
+void expireHolds(time_t now) {
+    HoldTimerWheel* wheel = &holdWheel;
+    while (wheel->now <= (long long)now) {
+        if (wheel->count == 0) {
+            wheel->now = (long long)now + 1;
+            break;
+        }
+        // Nothing at level 0 until the next cascade: jump to it
+        if (wheel->levelCounts[0] == 0 && (wheel->now & (HOLD_WHEEL_SLOTS - 1)) != 0) {
+            long long boundary = (wheel->now | (HOLD_WHEEL_SLOTS - 1)) + 1;
+            wheel->now = boundary <= (long long)now ? boundary : (long long)now + 1;
+            continue;
+        }
+
+        // Cascade the slots of the upper levels that start this second
+        for (int level = 1; level < HOLD_WHEEL_LEVELS; level++) {
+            if ((wheel->now & ((1LL << (HOLD_WHEEL_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            int slot = (int)((wheel->now >> (HOLD_WHEEL_BITS * level)) & (HOLD_WHEEL_SLOTS - 1));
+            HoldTimer* timer = wheelTake(wheel, level, slot);
+            while (timer != NULL) {
+                HoldTimer* next = timer->next;
+                wheelInsert(wheel, timer);
+                timer = next;
+            }
+        }
+
+        HoldTimer* timer = wheelTake(wheel, 0, (int)(wheel->now & (HOLD_WHEEL_SLOTS - 1)));
+        while (timer != NULL) {
+            HoldTimer* next = timer->next;
+            if ((long long)timer->deadline <= wheel->now) {
+                expireHold(timer);
+            } else {
+                wheelInsert(wheel, timer);
+            }
+            timer = next;
+        }
+        wheel->now++;
+    }
+}
+
+// Handle one "book freed" event: give the title's unassigned held copies to waiters
+void fulfillBook(int bookId) {
+    Book* book = searchBookById(bookRoot, bookId);
+    if (book == NULL) {
+        return;
+    }
+    int pending = book->held - bookQueues[bookId].holdCount;
+    QueueNode* prev = NULL;
+    QueueNode* node = bookQueues[bookId].front;
+    while (pending > 0 && node != NULL) {
+        QueueNode* next = node->next;
+        User* user = userFromHandle(node->user);
+        if (user != NULL && (user->status != ACTIVE || user->borrowCount > MAX_BORROW_LIMIT)) {
+            fulfillmentQueue.waitersSkipped++;
+            prev = node;
+        } else {
+            time_t queued = node->since;
+            removeQueueNode(bookId, prev, node);
+            if (user != NULL) {
+                placeHold(book, user);
+                countQueueWait(queued, time(NULL));
+                pending--;
+            }
+        }
+        node = next;
+    }
+    if (pending > 0) {
+        book->held -= pending;
+        fulfillmentQueue.booksShelved += pending;
+        updateCopyCounts(book);
+    }
+}
+
+// Bring a title up to date before reporting it: expire due holds and settle its copies nobody holds
+void settleBookHolds(Book* book) {
+    expireHolds(time(NULL));
+    if (book->held > bookQueues[book->id].holdCount) {
+        fulfillBook(book->id);
+    }
+}
+
+// Expire due holds, then handle up to limit pending events; returns how many were handled
+int processFulfillmentEvents(int limit) {
+    FulfillmentQueue* queue = &fulfillmentQueue;
+    int handled = 0;
+    expireHolds(time(NULL));
+    while (queue->count > 0 && handled < limit) {
+        int bookId = queue->bookIds[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        fulfillBook(bookId);
+        handled++;
+    }
+    return handled;
+}
+
+// Queue events for titles with held copies nobody holds (e.g. after a load)
+void postUnheldReservations(Book* root) {
+    if (root == NULL) {
+        return;
+    }
+    if (root->held > bookQueues[root->id].holdCount) {
+        postBookFreed(root->id);
+    }
+    postUnheldReservations(root->left);
+    postUnheldReservations(root->right);
+}
+
+// Add copies of a title (a negative count withdraws shelf copies); waiters get new copies first
+bool changeBookCopies(Book* book, int count) {
+    if (count < 0 && availableCopies(book) < -count) {
+        return false;
+    }
+    book->copies += count;
+    if (count > 0 && !isQueueEmpty(book->id)) {
+        book->held += count;
+        postBookFreed(book->id);
+    }
+    updateCopyCounts(book);
+    return true;
+}
+
+// Set a title's number of copies and log the change
+bool setBookCopies(Book* book, int copies) {
+    int before = book->copies;
+    if (!changeBookCopies(book, copies - before)) {
+        return false;
+    }
+    UndoEntry* entry = logUndo(UNDO_COPIES_CHANGED, book, NULL);
+    if (entry != NULL) {
+        entry->before.number = before;
+    }
+    return true;
+}
+
+/********************************************/
+/*            Columnar Ledger               */
+/********************************************/
+
+// Alongside the linked list, every ledger field is kept in its own
+// contiguous column (user and book IDs, the three dates, the returned
+// flag), one row per record in ledger order. Appending a loan appends a
+// row and closing or reopening one rewrites its row, so report questions
+// (overdue loans, loans in a date range, a user's loans this month) scan
+// flat arrays instead of chasing list pointers. Every LEDGER_BLOCK_ROWS
+// rows carry a summary (min/max of each date, open loans) and a scan
+// skips any block its summary rules out. The filter kernels test four
+// rows per step with AVX2 where the CPU has it; SSE2 has no 64-bit
+// compares, so the fallback is a branch-free scalar loop. A bulk change
+// (load, import, archive) rebuilds the columns in one pass.
+
+// Portable filter kernel: one row at a time, without branches
+int filterLedgerScalar(const LedgerColumns* columns, const LedgerFilter* filter, int start, int end, int* rows) {
+    const int64_t* dates = columns->dates[filter->column];
+    int found = 0;
+    for (int i = start; i < end; i++) {
+        bool match = dates[i] >= filter->from && dates[i] < filter->to &&
+                     (filter->userId == QUERY_ANY || columns->userIds[i] == filter->userId) &&
+                     (filter->open == QUERY_ANY || columns->returned[i] != filter->open);
+        rows[found] = i;
+        found += match;
+    }
+    return found;
+}
+
+#ifdef LMS_HAVE_AVX2
+// AVX2 filter kernel: four rows per step
+__attribute__((target("avx2")))
+int filterLedgerAvx2(const LedgerColumns* columns, const LedgerFilter* filter, int start, int end, int* rows) {
+    const int64_t* dates = columns->dates[filter->column];
+    __m256i from = _mm256_set1_epi64x(filter->from);
+    __m256i to = _mm256_set1_epi64x(filter->to);
+    __m256i user = _mm256_set1_epi64x(filter->userId);
+    __m256i returned = _mm256_set1_epi64x(filter->open == 1 ? 0 : 1);
+    int found = 0;
+    int i = start;
+    for (; i + 4 <= end; i += 4) {
+        __m256i date = _mm256_loadu_si256((const __m256i*)(dates + i));
+        __m256i match = _mm256_andnot_si256(_mm256_cmpgt_epi64(from, date), _mm256_cmpgt_epi64(to, date));
+        if (filter->userId != QUERY_ANY) {
+            __m256i users = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(columns->userIds + i)));
+            match = _mm256_and_si256(match, _mm256_cmpeq_epi64(users, user));
+        }
+        if (filter->open != QUERY_ANY) {
+            int32_t flags;
+            memcpy(&flags, columns->returned + i, sizeof(flags));
+            __m256i states = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(flags));
+            match = _mm256_and_si256(match, _mm256_cmpeq_epi64(states, returned));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(match));
+        while (mask != 0) {
+            rows[found++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return found + filterLedgerScalar(columns, filter, i, end, rows + found);
+}
+#endif
+
+// Pick the widest filter kernel the CPU supports
+void selectLedgerKernel() {
+    filterLedgerKernel = filterLedgerScalar;
+    ledgerKernelName = "scalar";
+#ifdef LMS_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        filterLedgerKernel = filterLedgerAvx2;
+        ledgerKernelName = "AVX2";
+    }
+#endif
+}
+
+// Empty a block summary
+void resetLedgerBlock(LedgerBlock* block) {
+    for (int column = 0; column < LEDGER_DATE_COLUMNS; column++) {
+        block->min[column] = INT64_MAX;
+        block->max[column] = INT64_MIN;
+    }
+    block->open = 0;
+}
+
+// Grow the columns by doubling (a whole number of blocks)
+bool growLedgerColumns() {
+    LedgerColumns* columns = &ledgerColumns;
+    int capacity = columns->capacity > 0 ? columns->capacity * 2 : LEDGER_BLOCK_ROWS;
+    void* grown[LEDGER_DATE_COLUMNS + 5];
+    grown[0] = realloc(columns->userIds, sizeof(int32_t) * capacity);
+    if (grown[0] != NULL) {
+        columns->userIds = (int32_t*)grown[0];
+    }
+    grown[1] = realloc(columns->bookIds, sizeof(int32_t) * capacity);
+    if (grown[1] != NULL) {
+        columns->bookIds = (int32_t*)grown[1];
+    }
+    grown[2] = realloc(columns->returned, sizeof(uint8_t) * capacity);
+    if (grown[2] != NULL) {
+        columns->returned = (uint8_t*)grown[2];
+    }
+    grown[3] = realloc(columns->records, sizeof(BorrowRecord*) * capacity);
+    if (grown[3] != NULL) {
+        columns->records = (BorrowRecord**)grown[3];
+    }
+    grown[4] = realloc(columns->blocks, sizeof(LedgerBlock) * (capacity / LEDGER_BLOCK_ROWS));
+    if (grown[4] != NULL) {
+        columns->blocks = (LedgerBlock*)grown[4];
+    }
+    for (int column = 0; column < LEDGER_DATE_COLUMNS; column++) {
+        grown[5 + column] = realloc(columns->dates[column], sizeof(int64_t) * capacity);
+        if (grown[5 + column] != NULL) {
+            columns->dates[column] = (int64_t*)grown[5 + column];
+        }
+    }
+    for (int i = 0; i < LEDGER_DATE_COLUMNS + 5; i++) {
+        if (grown[i] == NULL) {
+            printf("Memory allocation failed!\n");
+            return false;
+        }
+    }
+    for (int block = columns->capacity / LEDGER_BLOCK_ROWS; block < capacity / LEDGER_BLOCK_ROWS; block++) {
+        resetLedgerBlock(&columns->blocks[block]);
+    }
+    columns->capacity = capacity;
+    return true;
+}
+
+// Copy a record into its row and widen the block's date bounds
+void writeLedgerRow(int row, BorrowRecord* record) {
+    LedgerColumns* columns = &ledgerColumns;
+    LedgerBlock* block = &columns->blocks[row / LEDGER_BLOCK_ROWS];
+    int64_t dates[LEDGER_DATE_COLUMNS] = {record->borrowDate, record->dueDate, record->returnDate};
+    columns->userIds[row] = record->userId;
+    columns->bookIds[row] = record->bookId;
+    columns->returned[row] = record->returned;
+    columns->records[row] = record;
+    for (int column = 0; column < LEDGER_DATE_COLUMNS; column++) {
+        columns->dates[column][row] = dates[column];
+        if (column == LEDGER_RETURN_DATE && !record->returned) {
+            continue;
+        }
+        if (dates[column] < block->min[column]) {
+            block->min[column] = dates[column];
+        }
+        if (dates[column] > block->max[column]) {
+            block->max[column] = dates[column];
+        }
+    }
+}
+
+// Add a row for a record linked at the end of the ledger
+void appendLedgerRow(BorrowRecord* record) {
+    LedgerColumns* columns = &ledgerColumns;
+    if (columns->stale || (columns->count == columns->capacity && !growLedgerColumns())) {
+        columns->stale = true;
+        return;
+    }
+    record->row = columns->count++;
+    writeLedgerRow(record->row, record);
+    if (!record->returned) {
+        columns->blocks[record->row / LEDGER_BLOCK_ROWS].open++;
+    }
+}
+
+// Rewrite a record's row after its dates or returned flag changed
+void updateLedgerRow(BorrowRecord* record) {
+    LedgerColumns* columns = &ledgerColumns;
+    int row = record->row;
+    if (columns->stale || row < 0 || row >= columns->count || columns->records[row] != record) {
+        columns->stale = true;
+        return;
+    }
+    columns->blocks[row / LEDGER_BLOCK_ROWS].open += (int)columns->returned[row] - (int)record->returned;
+    writeLedgerRow(row, record);
+}
+
+// Drop the row of the last ledger record (a loan taken back)
+void popLedgerRow(BorrowRecord* record) {
+    LedgerColumns* columns = &ledgerColumns;
+    if (columns->stale || columns->count == 0 || columns->records[columns->count - 1] != record) {
+        columns->stale = true;
+        return;
+    }
+    columns->count--;
+    if (!columns->returned[columns->count]) {
+        columns->blocks[columns->count / LEDGER_BLOCK_ROWS].open--;
+    }
+}
+
+// Rebuild every column from the ledger list
+void rebuildLedgerColumns() {
+    LedgerColumns* columns = &ledgerColumns;
+    columns->count = 0;
+    columns->stale = false;
+    for (int block = 0; block < columns->capacity / LEDGER_BLOCK_ROWS; block++) {
+        resetLedgerBlock(&columns->blocks[block]);
+    }
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        appendLedgerRow(record);
+    }
+}
+
+// Check if a block summary rules a filter out
+bool ledgerBlockExcluded(const LedgerBlock* block, int rows, const LedgerFilter* filter) {
+    if (filter->open == 1 && block->open == 0) {
+        return true;
+    }
+    if (filter->open == 0 && block->open == rows) {
+        return true;
+    }
+    if (filter->column == LEDGER_RETURN_DATE && filter->open != 0 && block->open > 0) {
+        return false;       // open loans have no return date in the bounds
+    }
+    return block->max[filter->column] < filter->from || block->min[filter->column] >= filter->to;
+}
+
+// Run a filter over the whole ledger; the caller frees scan->rows
+bool scanLedger(const LedgerFilter* filter, LedgerScan* scan) {
+    LedgerColumns* columns = &ledgerColumns;
+    if (filterLedgerKernel == NULL) {
+        selectLedgerKernel();
+    }
+    if (columns->stale) {
+        rebuildLedgerColumns();
+    }
+    memset(scan, 0, sizeof(LedgerScan));
+    scan->rows = (int*)malloc(sizeof(int) * (columns->count > 0 ? columns->count : 1));
+    if (scan->rows == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    for (int start = 0; start < columns->count; start += LEDGER_BLOCK_ROWS) {
+        int end = start + LEDGER_BLOCK_ROWS < columns->count ? start + LEDGER_BLOCK_ROWS : columns->count;
+        scan->blocks++;
+        if (ledgerBlockExcluded(&columns->blocks[start / LEDGER_BLOCK_ROWS], end - start, filter)) {
+            scan->skipped++;
+            continue;
+        }
+        scan->count += filterLedgerKernel(columns, filter, start, end, scan->rows + scan->count);
+    }
+    return true;
+}
+
+// List the loans a scan found
+void showLedgerScan(const LedgerScan* scan, const char* heading) {
+    CatalogSnapshot* catalog = pinCatalogSnapshot();
+    OutputBuffer* out = beginReport();
+    if (catalog == NULL || out == NULL) {
+        releaseCatalogSnapshot(catalog);
+        return;
+    }
+    printf("\n=== %s ===\n", heading);
+    printf("---------------------------\n");
+    time_t now = time(NULL);
+    for (int i = 0; i < scan->count; i++) {
+        renderLoan(out, catalog, ledgerColumns.records[scan->rows[i]], i + 1, now);
+        if (!reportPageBreak(out, i + 1, scan->count, REPORT_PAGE_SIZE)) {
+            break;
+        }
+    }
+    endReport();
+    releaseCatalogSnapshot(catalog);
+    printf("%d loan(s); %d of %d block(s) skipped (%s kernel)\n", scan->count, scan->skipped, scan->blocks, ledgerKernelName);
+}
+
+// Run a filter and list what it finds
+void runLedgerReport(const LedgerFilter* filter, const char* heading) {
+    LedgerScan scan;
+    if (scanLedger(filter, &scan)) {
+        showLedgerScan(&scan, heading);
+        free(scan.rows);
+    }
+}
+
+// Loans past their due date and not returned
+void listOverdueLoans() {
+    LedgerFilter filter = {LEDGER_DUE_DATE, INT64_MIN, (int64_t)time(NULL), QUERY_ANY, 1};
+    runLedgerReport(&filter, "Overdue Loans");
+}
+
+// Loans borrowed in [from, to)
+void listLoansBorrowedBetween(time_t from, time_t to) {
+    LedgerFilter filter = {LEDGER_BORROW_DATE, (int64_t)from, (int64_t)to, QUERY_ANY, QUERY_ANY};
+    runLedgerReport(&filter, "Loans In Date Range");
+}
+
+// A user's loans borrowed since the start of this month
+void listUserLoansThisMonth(int userId) {
+    time_t now = time(NULL);
+    struct tm month = *localtime(&now);
+    month.tm_mday = 1;
+    month.tm_hour = 0;
+    month.tm_min = 0;
+    month.tm_sec = 0;
+    month.tm_isdst = -1;
+    LedgerFilter filter = {LEDGER_BORROW_DATE, (int64_t)mktime(&month), INT64_MAX, userId, QUERY_ANY};
+    runLedgerReport(&filter, "Loans This Month");
+}
+
+/********************************************/
+/*        Circulation Statistics            */
+/********************************************/
+
+// The figures management asks for (most borrowed titles, busiest
+// borrowers, active borrowers, average queue wait, overdue rate) are
+// kept as running counts instead of being recomputed from the ledger.
+// The borrow, return and undo paths adjust them in O(1), and the
+// per-title and per-user loan counts sit in indexed max-heaps, so a
+// count changes in O(log n) and the top entries are read off the top
+// of the heap. The counts are saved with the data file; archived loans
+// stay counted after they leave the ledger.
+
+// Grow a ranking's per-ID arrays to cover an ID
+bool growRanking(CountRanking* ranking, int id) {
+    if (id < ranking->capacity) {
+        return true;
+    }
+    int capacity = ranking->capacity > 0 ? ranking->capacity : 64;
+    while (capacity <= id) {
+        capacity *= 2;
+    }
+    long long* counts = (long long*)realloc(ranking->counts, sizeof(long long) * capacity);
+    if (counts == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    ranking->counts = counts;
+    int* positions = (int*)realloc(ranking->positions, sizeof(int) * capacity);
+    if (positions == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    ranking->positions = positions;
+    int* heap = (int*)realloc(ranking->heap, sizeof(int) * capacity);
+    if (heap == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    ranking->heap = heap;
+    for (int i = ranking->capacity; i < capacity; i++) {
+        counts[i] = 0;
+        positions[i] = -1;
+    }
+    ranking->capacity = capacity;
+    return true;
+}
+
+// Does ID a rank above ID b
+bool rankingAbove(const CountRanking* ranking, int a, int b) {
+    return ranking->counts[a] > ranking->counts[b] || (ranking->counts[a] == ranking->counts[b] && a < b);
+}
+
+// Put an ID in a heap slot
+void rankingPlace(CountRanking* ranking, int slot, int id) {
+    ranking->heap[slot] = id;
+    ranking->positions[id] = slot;
+}
+
+// Move the ID in a slot up past the IDs it now outranks
+void rankingSiftUp(CountRanking* ranking, int slot) {
+    int id = ranking->heap[slot];
+    while (slot > 0) {
+        int parent = (slot - 1) / 2;
+        if (!rankingAbove(ranking, id, ranking->heap[parent])) {
+            break;
+        }
+        rankingPlace(ranking, slot, ranking->heap[parent]);
+        slot = parent;
+    }
+    rankingPlace(ranking, slot, id);
+}
+
+// Move the ID in a slot down below the IDs that now outrank it
+void rankingSiftDown(CountRanking* ranking, int slot) {
+    int id = ranking->heap[slot];
+    while (true) {
+        int child = 2 * slot + 1;
+        if (child >= ranking->size) {
+            break;
+        }
+        if (child + 1 < ranking->size && rankingAbove(ranking, ranking->heap[child + 1], ranking->heap[child])) {
+            child++;
+        }
+        if (!rankingAbove(ranking, ranking->heap[child], id)) {
+            break;
+        }
+        rankingPlace(ranking, slot, ranking->heap[child]);
+        slot = child;
+    }
+    rankingPlace(ranking, slot, id);
+}
+
+// Add to an ID's count (negative to take back) and restore the heap order
+void rankingAdd(CountRanking* ranking, int id, long long delta) {
+    if (id < 0 || !growRanking(ranking, id)) {
+        return;
+    }
+    ranking->counts[id] += delta;
+    if (ranking->counts[id] < 0) {
+        ranking->counts[id] = 0;
+    }
+    int slot = ranking->positions[id];
+    if (slot < 0) {
+        if (ranking->counts[id] > 0) {
+            rankingPlace(ranking, ranking->size, id);
+            ranking->size++;
+            rankingSiftUp(ranking, ranking->size - 1);
+        }
+    } else if (ranking->counts[id] == 0) {
+        // The last entry fills the slot and moves whichever way it has to
+        ranking->positions[id] = -1;
+        ranking->size--;
+        if (slot < ranking->size) {
+            int last = ranking->heap[ranking->size];
+            rankingPlace(ranking, slot, last);
+            rankingSiftUp(ranking, slot);
+            rankingSiftDown(ranking, ranking->positions[last]);
+        }
+    } else if (delta > 0) {
+        rankingSiftUp(ranking, slot);
+    } else {
+        rankingSiftDown(ranking, slot);
+    }
+}
+
+// Rebuild the heap from the counts in O(n) (after a load)
+void rebuildRankingHeap(CountRanking* ranking) {
+    ranking->size = 0;
+    for (int id = 0; id < ranking->capacity; id++) {
+        ranking->positions[id] = -1;
+        if (ranking->counts[id] > 0) {
+            rankingPlace(ranking, ranking->size, id);
+            ranking->size++;
+        }
+    }
+    for (int slot = ranking->size / 2 - 1; slot >= 0; slot--) {
+        rankingSiftDown(ranking, slot);
+    }
+}
+
+// Zero every count (the arrays are kept)
+void clearRanking(CountRanking* ranking) {
+    for (int id = 0; id < ranking->capacity; id++) {
+        ranking->counts[id] = 0;
+        ranking->positions[id] = -1;
+    }
+    ranking->size = 0;
+}
+
+// Up to limit of the highest-counted IDs that listed accepts, best first.
+// Walks the heap best-first from the root, opening only the children of
+// the entries it takes, so it looks at O(limit) entries unless many of
+// the top IDs are no longer listed (deleted books or users).
+int rankingTop(const CountRanking* ranking, bool (*listed)(int id), int* ids, int limit) {
+    int* frontier = (int*)malloc(sizeof(int) * (ranking->size > 0 ? ranking->size : 1));
+    if (frontier == NULL) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    int open = 0;
+    int found = 0;
+    if (ranking->size > 0) {
+        frontier[open++] = 0;
+    }
+    while (open > 0 && found < limit) {
+        int best = 0;
+        for (int i = 1; i < open; i++) {
+            if (rankingAbove(ranking, ranking->heap[frontier[i]], ranking->heap[frontier[best]])) {
+                best = i;
+            }
+        }
+        int slot = frontier[best];
+        frontier[best] = frontier[--open];
+        if (listed(ranking->heap[slot])) {
+            ids[found++] = ranking->heap[slot];
+        }
+        for (int child = 2 * slot + 1; child <= 2 * slot + 2 && child < ranking->size; child++) {
+            frontier[open++] = child;
+        }
+    }
+    free(frontier);
+    return found;
+}
+
+// Is a book still in the catalog
+bool bookListed(int id) {
+    return searchBookById(bookRoot, id) != NULL;
+}
+
+// Is a user still registered
+bool userListed(int id) {
+    return searchUserById(id) != NULL;
+}
+
+// Count a loan into the totals and rankings (a returned one as a return too)
+void countLoanRecord(const BorrowRecord* record) {
+    circulation.loans++;
+    rankingAdd(&titleBorrows, record->bookId, 1);
+    rankingAdd(&userLoans, record->userId, 1);
+    if (record->returned) {
+        circulation.returns++;
+        circulation.lateReturns += record->returnDate > record->dueDate;
+    }
+}
+
+// Count a loan going out (after the borrow path raised the user's loan count)
+void countLoanOpened(const BorrowRecord* record, const User* user) {
+    if (user->borrowCount == 1) {
+        circulation.activeBorrowers++;
+    }
+    countLoanRecord(record);
+}
+
+// Take back a loan that was undone (after the user's loan count went down)
+void countLoanDropped(const BorrowRecord* record, const User* user) {
+    if (user->borrowCount == 0) {
+        circulation.activeBorrowers--;
+    }
+    circulation.loans--;
+    rankingAdd(&titleBorrows, record->bookId, -1);
+    rankingAdd(&userLoans, record->userId, -1);
+}
+
+// Count a loan coming back, late when after its due date (after the user's loan count went down)
+void countLoanClosed(const BorrowRecord* record, const User* user) {
+    if (user->borrowCount == 0) {
+        circulation.activeBorrowers--;
+    }
+    circulation.returns++;
+    if (record->returnDate > record->dueDate) {
+        circulation.lateReturns++;
+    }
+}
+
+// Take back a return that was undone (after the user's loan count went up, while the loan still has its return date)
+void countLoanReopened(const BorrowRecord* record, const User* user) {
+    if (user->borrowCount == 1) {
+        circulation.activeBorrowers++;
+    }
+    circulation.returns--;
+    if (record->returnDate > record->dueDate) {
+        circulation.lateReturns--;
+    }
+}
+
+// Count the wait of a queued user who got a hold
+void countQueueWait(time_t since, time_t now) {
+    if (since > 0 && now >= since) {
+        circulation.waits++;
+        circulation.waitSeconds += now - since;
+    }
+}
+
+// Zero every count
+void clearCirculationStats() {
+    memset(&circulation, 0, sizeof(CirculationTotals));
+    clearRanking(&titleBorrows);
+    clearRanking(&userLoans);
+}
+
+// Print the most counted entries of a ranking
+void displayRankingTop(const CountRanking* ranking, bool books) {
+    int ids[CIRCULATION_TOP];
+    int count = rankingTop(ranking, books ? bookListed : userListed, ids, CIRCULATION_TOP);
+    for (int i = 0; i < count; i++) {
+        const char* name = books ? searchBookById(bookRoot, ids[i])->title : searchUserById(ids[i])->name;
+        printf("  %2d. %-50s ID %-6d %lld loan(s)\n", i + 1, name, ids[i], ranking->counts[ids[i]]);
+    }
+    if (count == 0) {
+        printf("  (none yet)\n");
+    }
+}
+
+// Print the circulation figures (read from the running counts, no ledger walk)
+void displayCirculationStats() {
+    printf("\n=== Circulation Statistics ===\n");
+    printf("Loans made: %lld (%lld still out)\n", circulation.loans, circulation.loans - circulation.returns);
+    printf("Active borrowers: %d\n", circulation.activeBorrowers);
+    printf("Returned: %lld, %lld late (overdue rate %.1f%%)\n", circulation.returns, circulation.lateReturns,
+           circulation.returns > 0 ? 100.0 * circulation.lateReturns / circulation.returns : 0.0);
+    if (circulation.waits > 0) {
+        printf("Average queue wait: %.1f hours (%lld waiter(s) reached a hold)\n",
+               (double)circulation.waitSeconds / circulation.waits / 3600.0, circulation.waits);
+    } else {
+        printf("Average queue wait: no queued user has reached a hold yet\n");
+    }
+    printf("Most borrowed titles:\n");
+    displayRankingTop(&titleBorrows, true);
+    printf("Most active borrowers:\n");
+    displayRankingTop(&userLoans, false);
+}
+
+/********************************************/
+/* Borrow Record Functions                  */
+/********************************************/
+
+// The ledger keeps a tail pointer, so a borrow appends in O(1), and the
+// open loans are hashed by (user, book) to their loan handle, so a
+// return finds its loan in O(1) instead of walking the ledger. A user
+// may hold several copies of a title; each copy's loan has its own slot
+// under the same key.
+
+// Index key of a user's loans of a book
+uint64_t openLoanKey(int userId, int bookId) {
+    return (uint64_t)(uint32_t)userId << 32 | (uint32_t)bookId;
+}
+
+// Home slot of a key
+int openLoanHome(uint64_t key) {
+    return (int)((key * 0x9E3779B97F4A7C15ull) >> 32) & (openLoans.capacity - 1);
+}
+
+// Put a loan in a free slot (the table must have room)
+void placeOpenLoan(uint64_t key, Handle loan) {
+    int slot = openLoanHome(key);
+    while (!isNullHandle(openLoans.slots[slot].loan)) {
+        slot = (slot + 1) & (openLoans.capacity - 1);
+    }
+    openLoans.slots[slot].key = key;
+    openLoans.slots[slot].loan = loan;
+    openLoans.count++;
+}
+
+// Double the table and re-place every open loan
+bool growOpenLoans() {
+    int capacity = openLoans.capacity > 0 ? openLoans.capacity * 2 : 1024;
+    OpenLoanSlot* slots = (OpenLoanSlot*)calloc(capacity, sizeof(OpenLoanSlot));
+    if (slots == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    OpenLoanSlot* old = openLoans.slots;
+    int oldCapacity = openLoans.capacity;
+    openLoans.slots = slots;
+    openLoans.capacity = capacity;
+    openLoans.count = 0;
+    for (int i = 0; i < oldCapacity; i++) {
+        if (!isNullHandle(old[i].loan)) {
+            placeOpenLoan(old[i].key, old[i].loan);
+        }
+    }
+    free(old);
+    return true;
+}
+
+// Index an open loan
+void addOpenLoan(const BorrowRecord* record) {
+    if (2 * (openLoans.count + 1) > openLoans.capacity && !growOpenLoans()) {
+        return;
+    }
+    placeOpenLoan(openLoanKey(record->userId, record->bookId), record->handle);
+}
+
+// Drop a loan from the index (backward-shift delete, so lookups need no tombstones)
+void removeOpenLoan(const BorrowRecord* record) {
+    if (openLoans.capacity == 0) {
+        return;
+    }
+    int mask = openLoans.capacity - 1;
+    int slot = openLoanHome(openLoanKey(record->userId, record->bookId));
+    while (!isNullHandle(openLoans.slots[slot].loan) && !sameHandle(openLoans.slots[slot].loan, record->handle)) {
+        slot = (slot + 1) & mask;
+    }
+    if (isNullHandle(openLoans.slots[slot].loan)) {
+        return;
+    }
+    int hole = slot;
+    for (int next = (hole + 1) & mask; !isNullHandle(openLoans.slots[next].loan); next = (next + 1) & mask) {
+        // An entry can fill the hole unless its home lies after the hole (cyclically, up to itself)
+        int home = openLoanHome(openLoans.slots[next].key);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            openLoans.slots[hole] = openLoans.slots[next];
+            hole = next;
+        }
+    }
+    openLoans.slots[hole].loan = NULL_HANDLE;
+    openLoans.count--;
+}
+
+// Index every open loan of the ledger (after a load)
+void rebuildOpenLoans() {
+    if (openLoans.slots != NULL) {
+        memset(openLoans.slots, 0, sizeof(OpenLoanSlot) * openLoans.capacity);
+    }
+    openLoans.count = 0;
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        if (!record->returned) {
+            addOpenLoan(record);
+        }
+    }
+}
+
+// Create a new borrow record
+BorrowRecord* createBorrowRecord(User* user, Book* book) {
+    BorrowRecord* newRecord = (BorrowRecord*)poolAlloc(&loanPool);
+    if (newRecord == NULL) {
+        printf("Memory allocation failed!\n");
+        return NULL;
+    }
+    
+    newRecord->userId = user->id;
+    newRecord->bookId = book->id;
+    newRecord->handle = handleAcquire(&loanHandles, newRecord);
+    newRecord->user = user->handle;
+    newRecord->book = book->handle;
+    newRecord->borrowDate = time(NULL);
+    newRecord->dueDate = newRecord->borrowDate + (1209600); // 14 days loan period
+    newRecord->returned = false;
+    newRecord->returnDate = 0;
+    newRecord->row = -1;
+    newRecord->archiveBatch = 0;
+    newRecord->next = NULL;
+    
+    return newRecord;
+}
+
+// Add a chain of count new (open) borrow records, first to last, to the list; returns the record it follows
+BorrowRecord* appendBorrowRecords(BorrowRecord* first, BorrowRecord* last, int count) {
+    BorrowRecord* current = borrowTail;
+    if (borrowTail == NULL) {
+        borrowRecords = first;
+    } else {
+        borrowTail->next = first;
+    }
+    borrowTail = last;
+    last->next = NULL;
+    for (BorrowRecord* record = first; record != NULL; record = record->next) {
+        appendLedgerRow(record);
+        addOpenLoan(record);
+    }
+    borrowCount += count;
+    commitLedgerRows(first->row, last->row);
+    return current;
+}
+
+// Add borrow record to list (returns the record it follows, NULL if it is the first)
+BorrowRecord* addBorrowRecord(BorrowRecord* newRecord) {
+    return appendBorrowRecords(newRecord, newRecord, 1);
+}
+
+// Find a user's unreturned loan of a book (one probe sequence in the open-loan index)
+BorrowRecord* findUserLoan(int bookId, int userId) {
+    if (openLoans.capacity == 0) {
+        return NULL;
+    }
+    uint64_t key = openLoanKey(userId, bookId);
+    for (int slot = openLoanHome(key); !isNullHandle(openLoans.slots[slot].loan); slot = (slot + 1) & (openLoans.capacity - 1)) {
+        if (openLoans.slots[slot].key == key) {
+            return loanFromHandle(openLoans.slots[slot].loan);
+        }
+    }
+    return NULL;
+}
+
+// Close a loan at a given time: late users are suspended and the book goes to the queue or the shelf
+void closeLoan(BorrowRecord* record, User* user, time_t when) {
+    Book* book = bookFromHandle(record->book);
+    UndoEntry* entry = logUndo(UNDO_RETURNED, book, user);
+    if (entry != NULL) {
+        entry->loan = record->handle;
+        entry->before.number = user->status;
+    }
+    record->returned = true;
+    record->returnDate = when;
+    removeOpenLoan(record);
+    updateLedgerRow(record);
+    commitLoanChange(record);
+    if(difftime(record->dueDate , when) < 0){
+        user->status=SUSPENDED;
+    }
+
+    // Update the copy counts (waiters are served by the fulfillment stage)
+    if (book != NULL) {
+        if (book->borrowed > 0) {
+            book->borrowed--;
+        }
+        if (!isQueueEmpty(record->bookId)) {
+            book->held++;
+            postBookFreed(book->id);
+        }
+        updateCopyCounts(book);
+    }
+    user->borrowCount--;
+    countLoanClosed(record, user);
+}
+
+// Mark a book as returned
+void returnBook(int bookId, int userId) {
+    BorrowRecord* current = findUserLoan(bookId, userId);
+    User* user = searchUserById(userId);
+    if (current == NULL || user == NULL) {
+        printf("No matching borrow record found!\n");
+        return;
+    }
+    closeLoan(current, user, time(NULL));
+    printf("Book returned successfully!\n");
+}
+
+// Display all borrow records from pinned ledger and catalog snapshots
+void displayAllBorrowRecords() {
+    LedgerSnapshot* ledger = pinLedgerSnapshot();
+    if (ledger == NULL) {
+        return;
+    }
+    if (ledger->count == 0) {
+        printf("No borrow records found!\n");
+        releaseLedgerSnapshot(ledger);
+        return;
+    }
+    CatalogSnapshot* catalog = pinCatalogSnapshot();
+    if (catalog == NULL) {
+        releaseLedgerSnapshot(ledger);
+        return;
+    }
+    
+    OutputBuffer* out = beginReport();
+    if (out == NULL) {
+        releaseCatalogSnapshot(catalog);
+        releaseLedgerSnapshot(ledger);
+        return;
+    }
+    printf("\n=== All Borrow Records ===\n");
+    printf("---------------------------\n");
+    
+    time_t now = time(NULL);
+    for (int i = 0; i < ledger->count; i++) {
+        renderLoan(out, catalog, snapshotLoanAt(ledger, i), i + 1, now);
+        if (!reportPageBreak(out, i + 1, ledger->count, REPORT_PAGE_SIZE)) {
+            break;
+        }
+    }
+    endReport();
+    releaseCatalogSnapshot(catalog);
+    releaseLedgerSnapshot(ledger);
+}
+
+// Short code for a desk result (batch output and server replies)
+const char* deskResultName(DeskResult result) {
+    static const char* names[] = {"OK", "QUEUED", "NO_BOOK", "NO_USER", "INACTIVE", "LIMIT",
+                                  "UNAVAILABLE", "ALREADY_QUEUED", "NOT_BORROWED", "NO_RESERVATION",
+                                  "DUPLICATE_ITEM", "NOT_LOGGED"};
+    return names[result];
+}
+
+// Lend a copy on the shelf, or the one held for the user (the loan is returned through loan)
+DeskResult checkoutBook(Book* book, User* user, BorrowRecord** loan) {
+    if (book == NULL) {
+        return DESK_NO_BOOK;
+    }
+    if (user == NULL) {
+        return DESK_NO_USER;
+    }
+    if (user->status != ACTIVE) {
+        return DESK_INACTIVE;
+    }
+    if (user->borrowCount > MAX_BORROW_LIMIT) {
+        return DESK_LIMIT;
+    }
+    bool pickup = findHold(book->id, user->id) != NULL;
+    if (availableCopies(book) <= 0 && !pickup) {
+        return DESK_UNAVAILABLE;
+    }
+    BorrowRecord* newRecord = createBorrowRecord(user, book);
+    if (newRecord == NULL) {
+        return DESK_UNAVAILABLE;
+    }
+    if (pickup) {
+        removeHold(book->id, user->id);
+        book->held--;
+    }
+    BorrowRecord* tail = addBorrowRecord(newRecord);
+    UndoEntry* entry = logUndo(UNDO_BORROWED, book, user);
+    if (entry != NULL) {
+        entry->field = pickup;
+        entry->loan = newRecord->handle;
+        entry->before.tail = tail != NULL ? tail->handle : NULL_HANDLE;
+    }
+    book->borrowed++;
+    updateCopyCounts(book);
+    user->borrowCount++;
+    countLoanOpened(newRecord, user);
+    if (loan != NULL) {
+        *loan = newRecord;
+    }
+    return DESK_OK;
+}
+
+// Take back a user's loan of a book
+DeskResult checkinBook(Book* book, User* user) {
+    if (book == NULL) {
+        return DESK_NO_BOOK;
+    }
+    if (user == NULL) {
+        return DESK_NO_USER;
+    }
+    BorrowRecord* record = book->borrowed > 0 ? findUserLoan(book->id, user->id) : NULL;
+    if (record == NULL) {
+        return DESK_NOT_BORROWED;
+    }
+    closeLoan(record, user, time(NULL));
+    return DESK_OK;
+}
+
+// Queue a user for a title; a copy on the shelf is held for them at once (position 0)
+DeskResult queueReservation(Book* book, User* user, int* position) {
+    if (book == NULL) {
+        return DESK_NO_BOOK;
+    }
+    if (user == NULL) {
+        return DESK_NO_USER;
+    }
+    if (user->status != ACTIVE) {
+        return DESK_INACTIVE;
+    }
+    if (findHold(book->id, user->id) != NULL || isUserQueued(book->id, user->id)) {
+        return DESK_ALREADY_QUEUED;
+    }
+    logUndo(UNDO_RESERVED, book, user);
+    if (availableCopies(book) > 0) {
+        book->held++;
+        placeHold(book, user);
+        if (position != NULL) {
+            *position = 0;
+        }
+        return DESK_OK;
+    }
+    enqueueUser(book->id, user->id, time(NULL));
+    if (position != NULL) {
+        *position = bookQueues[book->id].size;
+    }
+    return DESK_QUEUED;
+}
+
+// Take a user's hold or queue place (held copies nobody holds are re-offered)
+DeskResult dropReservation(Book* book, int userId) {
+    if (book == NULL) {
+        return DESK_NO_BOOK;
+    }
+    BookQueue* queue = &bookQueues[book->id];
+    User* user = searchUserById(userId);
+    HoldNode* hold = userId != 0 ? findHold(book->id, userId) : NULL;
+    if (hold != NULL) {
+        UndoEntry* entry = user != NULL ? logUndo(UNDO_CANCELLED, book, user) : NULL;
+        if (entry != NULL) {
+            entry->before.deadline = hold->until;
+        }
+        releaseHold(book, userId);
+        return DESK_OK;
+    }
+    QueueNode* prev = NULL;
+    QueueNode* node = queue->front;
+    int position = 1;
+    while (node != NULL && node->userId != userId) {
+        prev = node;
+        node = node->next;
+        position++;
+    }
+    if (node != NULL) {
+        UndoEntry* entry = user != NULL ? logUndo(UNDO_CANCELLED, book, user) : NULL;
+        if (entry != NULL) {
+            entry->field = position;
+            entry->before.queued = node->since;
+        }
+        removeQueueNode(book->id, prev, node);
+    }
+    if (book->held > queue->holdCount) {
+        postBookFreed(book->id);
+    }
+    return node != NULL ? DESK_OK : DESK_NO_RESERVATION;
+}
+
+// Borrow a book
+void borrowBook() {
+
+    char title[MAX_TITLE_LENGTH],name[MAX_NAME_LENGTH];
+
+    
+    printf("Enter Book Title (or part of it): ");
+    while ((getchar()) != '\n');
+    fgets(title, MAX_TITLE_LENGTH, stdin);
+    title[strcspn(title, "\n")] = '\0';
+    
+    printf("Enter User's name: ");
+    fgets(name, MAX_NAME_LENGTH, stdin);
+    name[strcspn(name, "\n")] = '\0';
+    
+    // Validate book and user
+    Book* book = searchBookByTitle(bookRoot, title);
+    User* user = searchUserByName(name);
+    
+    if (book == NULL) {
+        printf("Book not found!\n");
+        return;
+    }
+    
+    if (user == NULL) {
+        printf("User not found!\n");
+        return;
+    }
+    
+    BorrowRecord* newRecord = NULL;
+    DeskResult result = checkoutBook(book, user, &newRecord);
+
+    // Check if user is active
+    if (result == DESK_INACTIVE) {
+        printf("User account is not active!\n");
+        return;
+    }
+
+    if(result == DESK_LIMIT){
+        printf("user is not eligible to borrow this book");
+        return ;
+    }
+
+    // Check if book is available
+    if (result == DESK_OK) {
+        printf("Book borrowed successfully!\n");
+        
+        // Format due date
+        char dueDateStr[26];
+        strftime(dueDateStr, sizeof(dueDateStr), "%Y-%m-%d %H:%M:%S", localtime(&newRecord->dueDate));
+        printf("Due Date: %s\n", dueDateStr);
+    } else if (result == DESK_UNAVAILABLE) {
+        printf("Every copy is %s. Would you like to join the reservation queue? (1-Yes/0-No): ", book->held == 0 ? "already borrowed" : "borrowed or held");
+        int choice;
+        scanf("%d", &choice);
+        
+        if (choice == 1) {
+            // Add user to queue
+            if (queueReservation(book, user, NULL) == DESK_ALREADY_QUEUED) {
+                printf("the user is already in the reservation queue\n");
+            } else {
+                printf("User added to reservation queue!\n");
+            }
+        }
+    }
+}
+
+// Reserve a book
+void reserveBook() {
+
+    char title[MAX_TITLE_LENGTH];
+        printf("Enter Book Title (or part of it): ");
+        while ((getchar()) != '\n'); // Clear input buffer
+        fgets(title, MAX_TITLE_LENGTH, stdin);
+        title[strcspn(title, "\n")] = '\0';
+    
+        char name[MAX_NAME_LENGTH];
+        printf("Enter User's name: ");
+        fgets(name, MAX_NAME_LENGTH, stdin);
+        name[strcspn(name, "\n")] = '\0';
+    
+        // Validate book and user
+    Book* book = searchBookByTitle(bookRoot, title);
+    User* user = searchUserByName(name);
+        
+    
+    if (book == NULL) {
+        printf("Book not found!\n");
+        return;
+    }
+    
+    if (user == NULL) {
+        printf("User not found!\n");
+        return;
+    }
+    
+    int position;
+    DeskResult result = queueReservation(book, user, &position);
+
+    // Check if user is active
+    if (result == DESK_INACTIVE) {
+        printf("User account is not active!\n");
+        return;
+    }
+    
+    //checks if user is already in queue 
+    if(result == DESK_ALREADY_QUEUED){
+        printf("the user is already in the reservation queue");
+        return;
+    }
+
+    // An available book is now held for the user
+    if (result == DESK_OK) {
+        printf("Book reserved successfully! You can pick it up now.\n");
+    } else {
+        printf("User added to reservation queue!\n");
+        printf("Your position in queue: %d\n", position);
+    }
+}
+
+// Cancel reservation 
+void cancelReservation() {
+    int userId;
+    char title[MAX_TITLE_LENGTH];
+        printf("Enter Book Title (or part of it): ");
+        while ((getchar()) != '\n'); // Clear input buffer
+        fgets(title, MAX_TITLE_LENGTH, stdin);
+        title[strcspn(title, "\n")] = '\0';
+    
+        printf("Enter User ID: ");
+        scanf("%d", &userId);
+        
+        // Validate book    
+    Book* book = searchBookByTitle(bookRoot, title);
+    if (book == NULL) {
+        printf("Book not found!\n");
+        return;
+    }
+    
+    // Check if anyone holds or waits for the book
+    if (bookQueues[book->id].size == 0 && bookQueues[book->id].holdCount == 0) {
+        dropReservation(book, userId);
+        printf("No reservations for this book!\n");
+        return;
+    }
+    
+    // Find and remove user from the hold or the queue
+    if (dropReservation(book, userId) == DESK_OK) {
+        printf("Reservation cancelled successfully!\n");
+    } else {
+        printf("This user has no reservation for this book!\n");
+    }
+    }
+
+// Find the unreturned loan of a book (cached until the ledger changes)
+BorrowRecord* findActiveLoan(int bookId) {
+    char key[16];
+    const void* cached;
+    sprintf(key, "%d", bookId);
+    if (cacheLookup(&loanCache, key, ledgerEpoch, &cached)) {
+        return (BorrowRecord*)cached;
+    }
+    BorrowRecord* current = borrowRecords;
+    while (current != NULL && (current->bookId != bookId || current->returned)) {
+        current = current->next;
+    }
+    cacheStore(&loanCache, key, ledgerEpoch, current);
+    return current;
+}
+
+// Print the availability of the first book matching a title
+void showBookAvailability(const char* title) {
+    Book* book = searchBookByTitle(bookRoot, title);
+
+    if (book == NULL) {
+        printf("Book not found!\n");
+        return;
+    }
+    settleBookHolds(book);
+    
+    printf("Book: %s by %s\n", book->title, book->author);
+    printf("Copies: %d (%d available, %d borrowed, %d held)\n", book->copies, availableCopies(book), book->borrowed, book->held);
+    printf("Status: ");
+    
+    switch (book->status) {
+        case AVAILABLE:
+            printf("Available for borrowing\n");
+            break;
+        case BORROWED:
+            printf(book->copies > 1 ? "All copies borrowed\n" : "Currently borrowed\n");
+            
+            // Find who borrowed it (a single copy only)
+            BorrowRecord* current = book->copies == 1 ? findActiveLoan(book->id) : NULL;
+            if (current != NULL) {
+                User* user = userFromHandle(current->user);
+                if (user != NULL) {
+                    printf("Borrowed by: %s\n", user->name);
+                    
+                    // Format due date
+                    char dueDateStr[26];
+                    strftime(dueDateStr, sizeof(dueDateStr), "%Y-%m-%d %H:%M:%S", localtime(&current->dueDate));
+                    printf("Due Date: %s\n", dueDateStr);
+                }
+            }
+            
+            // Show queue length
+            if (bookQueues[book->id].size > 0) {
+                printf("Reservation Queue Length: %d\n", bookQueues[book->id].size);
+            }
+            break;
+        case RESERVED:
+            printf("Reserved\n");
+            
+            // Show who the copies are held for
+            for (HoldNode* hold = bookQueues[book->id].holds; hold != NULL; hold = hold->next) {
+                User* user = userFromHandle(hold->user);
+                if (user != NULL) {
+                    char until[26];
+                    strftime(until, sizeof(until), "%Y-%m-%d %H:%M:%S", localtime(&hold->until));
+                    printf("Held for: %s (pick up by %s)\n", user->name, until);
+                }
+            }
+            if (book->held > bookQueues[book->id].holdCount) {
+                printf("%d copy(ies) waiting to be held for the next reservation\n", book->held - bookQueues[book->id].holdCount);
+            }
+            
+            // Show queue length
+            if (bookQueues[book->id].size > 0) {
+                printf("Additional Reservations: %d\n", bookQueues[book->id].size);
+            }
+            break;
+    }
+}
+
+// Check book availability
+void checkBookAvailability() {
+    char title[MAX_TITLE_LENGTH];
+        printf("Enter Book Title (or part of it) to check : ");
+        while ((getchar()) != '\n'); // Clear input buffer
+        fgets(title, MAX_TITLE_LENGTH, stdin);
+        title[strcspn(title, "\n")] = '\0';
+    
+    showBookAvailability(title);
+}
+
+// Process next reservation
+void processNextReservation() {
+    char title[MAX_TITLE_LENGTH];
+        printf("Enter Book Title (or part of it): ");
+        while ((getchar()) != '\n'); // Clear input buffer
+        fgets(title, MAX_TITLE_LENGTH, stdin);
+        title[strcspn(title, "\n")] = '\0';
+    
+    Book* book = searchBookByTitle(bookRoot, title);
+
+    if (book == NULL) {
+        printf("Book not found!\n");
+        return;
+    }
+    
+    if (book->held == 0) {
+        printf("Book is not available for reservation processing!\n");
+        return;
+    }
+    
+    // Let the fulfillment stage catch up so the hold is in place
+    processFulfillmentEvents(FULFILLMENT_BATCH);
+    if (bookQueues[book->id].holds == NULL) {
+        printf("No reservations in queue for this book!\n");
+        return;
+    }
+    
+    // The oldest hold is served first
+    User* user = userFromHandle(bookQueues[book->id].holds->user);
+    BorrowRecord* newRecord = NULL;
+    DeskResult result = checkoutBook(book, user, &newRecord);
+    if (result != DESK_OK) {
+        printf("The user holding this book cannot borrow it right now!\n");
+        return;
+    }
+    
+    printf("Reservation processed successfully!\n");
+    printf("Book '%s' is now borrowed by %s\n", book->title, user->name);
+    
+    // Format due date
+    char dueDateStr[26];
+    strftime(dueDateStr, sizeof(dueDateStr), "%Y-%m-%d %H:%M:%S", localtime(&newRecord->dueDate));
+    printf("Due Date: %s\n", dueDateStr);
+}
+
+// Return a borrowed book
+void returnBookMenu() {
+    char title[MAX_TITLE_LENGTH];
+        printf("Enter Book Title (or part of it): ");
+        while ((getchar()) != '\n'); // Clear input buffer
+        fgets(title, MAX_TITLE_LENGTH, stdin);
+        title[strcspn(title, "\n")] = '\0';
+
+        char name[MAX_NAME_LENGTH];
+        printf("Enter User's name: ");
+        fgets(name, MAX_NAME_LENGTH, stdin);
+        name[strcspn(name, "\n")] = '\0';
+    
+        // Validate book and user    
+    Book* book = searchBookByTitle(bookRoot, title);
+    User* user = searchUserByName(name);
+        
+    
+    if (book == NULL) {
+        printf("Book not found!\n");
+        return;
+    }
+    
+    if (user == NULL) {
+        printf("User not found!\n");
+        return;
+    }
+    
+    // Check if a copy is borrowed
+    if (book->borrowed == 0) {
+        printf("This book is not currently borrowed!\n");
+        return;
+    }
+    
+    // Verify the user has borrowed this book
+    BorrowRecord* current = borrowRecords;
+    bool userHasBorrowed = false;
+    while (current != NULL) {
+        if (current->bookId == book->id && current->userId == user->id && !current->returned) {
+            userHasBorrowed = true;
+            break;
+        }
+        current = current->next;
+    }
+    
+    if (!userHasBorrowed) {
+        printf("This user has not borrowed this book!\n");
+        return;
+    }
+    
+    // Return the book (the next waiter's hold is placed by the fulfillment stage)
+    returnBook(book->id, user->id);
+    if (!isQueueEmpty(book->id)) {
+        printf("%d user(s) waiting; the copy will be held for the next one.\n", bookQueues[book->id].size);
+    }
+}
+
+//displays all the books currently being borrowed by a used
+void displayAllBorrowByUser(int userId){
+    BorrowRecord* current = borrowRecords;
+    User* user = searchUserById(userId);
+    int count = 0;
+
+    while (current != NULL){
+        if(current->userId == userId && current->returned == false);
+        Book* book = bookFromHandle(current->book);
+        printf("%s has borrowed %s \n " ,user->name , book != NULL ? book->title : "a deleted book" );
+        current = current->next;
+        count++;
+    }
+
+    if(count == 0){
+        printf("%s has no borrowed books for the time being" , user->name);
+    }
+    else{
+        printf("%s has borrowed %d books" , user->name , count);
+    }
+
+    
+}
+
+// Book borrowing management menu
+void manageBorrowing() {
+    int choice;
+    
+    do {
+        processFulfillmentEvents(FULFILLMENT_BATCH);
+        printf("\e[1;1H\e[2J");
+        printf("\n=== Borrow Management ===\n");
+        printf("1. Borrow Book\n");
+        printf("2. Return Book\n");
+        printf("3. Reserve Book\n");
+        printf("4. Cancel Reservation\n");
+        printf("5. Check Book Availability\n");
+        printf("6. Display Book Queue\n");
+        printf("7. Process Next Reservation\n");
+        printf("8. View last return\n");
+        printf("9. Undo Last Return\n");
+        printf("10. View All Borrow Records \n");
+        printf("11. View all the books borrowed by User \n");
+        printf("12. Check Out Several Books (by ID)\n");
+        printf("13. Return Several Books (by ID)\n");
+        printf("14. Archive Old Returned Loans\n");
+        printf("15. View Archived Loans of a User\n");
+        printf("16. Overdue Loans Report\n");
+        printf("17. Circulation Statistics\n");
+        printf("18. Back\n");
+        printf("Choose an option: ");
+        scanf("%d", &choice);
+        printf("\n");
+
+        switch (choice) {
+            case 1:
+            printf("\e[1;1H\e[2J");
+                borrowBook();
+                Sleep(2000);
+                break;
+            case 2:
+            printf("\e[1;1H\e[2J");
+                returnBookMenu();
+                Sleep(2000);
+                break;
+            case 3:
+            printf("\e[1;1H\e[2J");
+                reserveBook();
+                Sleep(2000);
+                break;
+            case 4:
+            printf("\e[1;1H\e[2J");
+                cancelReservation();
+                Sleep(2000);
+                break;
+            case 5:
+            printf("\e[1;1H\e[2J");
+                checkBookAvailability();
+                Sleep(2000);
+                break;
+            case 6: {
+                printf("\e[1;1H\e[2J");
+                char title[MAX_TITLE_LENGTH];
+                printf("Enter Book Title (or part of it): ");
+                while ((getchar()) != '\n'); // Clear input buffer
+                fgets(title, MAX_TITLE_LENGTH, stdin);
+                title[strcspn(title, "\n")] = '\0';
+    
+                Book* book = searchBookByTitle(bookRoot, title);
+                printf("\e[1;1H\e[2J");
+                displayBookQueue(book->id);
+                Sleep(5000);
+                break;
+            }
+            case 7:
+            printf("\e[1;1H\e[2J");
+                processNextReservation();
+                Sleep(2000);
+                break;
+            case 8:
+            printf("\e[1;1H\e[2J");
+                displayLastReturn();
+                Sleep(2000);
+                break;
+            case 9:
+            printf("\e[1;1H\e[2J");
+                undoLastReturn();
+                Sleep(2000);
+                break;
+            case 10:
+            printf("\e[1;1H\e[2J");
+                displayAllBorrowRecords();
+                Sleep(5000);
+                break;
+            case 11:
+            printf("\e[1;1H\e[2J");
+            char name[MAX_NAME_LENGTH];
+            printf("Enter User's name: ");
+            while ((getchar()) != '\n');
+            fgets(name, MAX_NAME_LENGTH, stdin);
+            name[strcspn(name, "\n")] = '\0';
+        
+            User* user = searchUserByName(name);
+
+            if(user == NULL){
+                printf("user unfound");
+                Sleep(2000);
+                break;
+            }
+            printf("\e[1;1H\e[2J");
+                displayAllBorrowByUser(user->id); 
+                Sleep(2000);
+                break;
+            case 12:
+            printf("\e[1;1H\e[2J");
+                deskTransactionMenu(DESK_CHECKOUT);
+                Sleep(2000);
+                break;
+            case 13:
+            printf("\e[1;1H\e[2J");
+                deskTransactionMenu(DESK_CHECKIN);
+                Sleep(2000);
+                break;
+            case 14:
+            printf("\e[1;1H\e[2J");
+                printf("Archive loans returned more than how many days ago? (now %d): ", archiveAgeDays);
+                scanf("%d", &archiveAgeDays);
+                saveAllData();     // archives first, so the save file and the archive agree
+                Sleep(2000);
+                break;
+            case 15: {
+                printf("\e[1;1H\e[2J");
+                char archivedName[MAX_NAME_LENGTH];
+                printf("Enter User's name: ");
+                while ((getchar()) != '\n');
+                fgets(archivedName, MAX_NAME_LENGTH, stdin);
+                archivedName[strcspn(archivedName, "\n")] = '\0';
+                User* archivedUser = searchUserByName(archivedName);
+                if (archivedUser == NULL) {
+                    printf("user unfound");
+                } else if (displayArchivedLoans(archivedUser->id, 0, 0) == 0) {
+                    printf("%s has no archived loans\n", archivedUser->name);
+                }
+                Sleep(5000);
+                break;
+            }
+            case 16:
+            printf("\e[1;1H\e[2J");
+                listOverdueLoans();
+                Sleep(5000);
+                break;
+            case 17:
+            printf("\e[1;1H\e[2J");
+                displayCirculationStats();
+                Sleep(5000);
+                break;
+            case 18:
+                return;
+            default:
+                printf("Invalid choice!\n");
+        }
+    } while (choice != 18);
+}
+
+/********************************************/
+/*            Desk Transactions             */
+/********************************************/
+
+// A patron's stack of books is checked out or in as one transaction.
+// The user is looked up and the borrow limit checked once. Every item is
+// resolved and checked before anything changes, and a checkout allocates
+// its loan records up front, so applying cannot fail halfway: every item
+// goes through or none does. Before it is applied the transaction is
+// appended to JOURNAL_FILE in a single write and flushed to disk. A save
+// empties the journal and a load replays what is left, so transactions
+// made since the last save survive a crash.
+//
+// Only desk transactions are journaled, so a replay is only right on the
+// exact save the journal continues: the journal starts with that save's
+// stamp, and a journal with another stamp is set aside as
+// JOURNAL_OLD_FILE rather than replayed. Any other change (an edit, an
+// undo, an import) puts the journal out of sequence until the next save;
+// transactions logged after it are flagged and replay stops at the first
+// of them.
+
+// Read up to MAX_DESK_ITEMS book IDs; returns the count (-1 if there are more)
+int parseDeskItems(const char* text, int* bookIds) {
+    int count = 0;
+    char* end;
+    long value = strtol(text, &end, 10);
+    while (end != text) {
+        if (count == MAX_DESK_ITEMS) {
+            return -1;
+        }
+        bookIds[count++] = (int)value;
+        text = end;
+        value = strtol(text, &end, 10);
+    }
+    return count;
+}
+
+// Resolve and check every item before anything changes
+DeskResult prepareDeskTransaction(DeskTransaction* tx, User* user, Book** books, BorrowRecord** loans) {
+    tx->failedItem = -1;
+    if (user == NULL) {
+        return DESK_NO_USER;
+    }
+    if (tx->count <= 0 || tx->count > MAX_DESK_ITEMS) {
+        return DESK_NO_BOOK;
+    }
+    if (tx->action == DESK_CHECKOUT) {
+        if (user->status != ACTIVE) {
+            return DESK_INACTIVE;
+        }
+        // The stack as a whole must stay within the limit
+        if (user->borrowCount + tx->count > MAX_BORROW_LIMIT) {
+            return DESK_LIMIT;
+        }
+    }
+    for (int i = 0; i < tx->count; i++) {
+        tx->failedItem = i;
+        for (int j = 0; j < i; j++) {
+            if (tx->bookIds[j] == tx->bookIds[i]) {
+                return DESK_DUPLICATE_ITEM;
+            }
+        }
+        books[i] = searchBookById(bookRoot, tx->bookIds[i]);
+        if (books[i] == NULL) {
+            return DESK_NO_BOOK;
+        }
+        if (tx->action == DESK_CHECKOUT) {
+            if (availableCopies(books[i]) <= 0 && findHold(books[i]->id, user->id) == NULL) {
+                return DESK_UNAVAILABLE;
+            }
+        } else {
+            loans[i] = books[i]->borrowed > 0 ? findUserLoan(books[i]->id, user->id) : NULL;
+            if (loans[i] == NULL) {
+                return DESK_NOT_BORROWED;
+            }
+        }
+    }
+    tx->failedItem = -1;
+    return DESK_OK;
+}
+
+// Note a change the journal does not hold (later transactions cannot be replayed on the last save)
+void noteUnjournaledChange() {
+    if (!journalApplying) {
+        journalInSequence = false;
+    }
+}
+
+// Keep a journal that cannot be replayed on the data in memory as JOURNAL_OLD_FILE
+void setJournalAside(const char* reason) {
+    if (MoveFileExA(JOURNAL_FILE, JOURNAL_OLD_FILE, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        printf("%s %s; it was kept as %s\n", JOURNAL_FILE, reason, JOURNAL_OLD_FILE);
+    } else {
+        remove(JOURNAL_FILE);
+    }
+}
+
+// Start a journal that continues the loaded save
+FILE* startJournal() {
+    JournalFileHeader header = {JOURNAL_FILE_MAGIC, 0, loadedSaveStamp};
+    FILE* file = fopen(JOURNAL_FILE, "wb");
+    if (file != NULL && fwrite(&header, sizeof(JournalFileHeader), 1, file) != 1) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+// Open the journal for appending (one that continues another save is set aside first)
+FILE* openJournal() {
+    JournalFileHeader header;
+    FILE* file = fopen(JOURNAL_FILE, "rb");
+    if (file == NULL) {
+        return startJournal();
+    }
+    bool continues = fread(&header, sizeof(JournalFileHeader), 1, file) == 1 &&
+                     header.magic == JOURNAL_FILE_MAGIC && header.saveStamp == loadedSaveStamp;
+    fclose(file);
+    if (continues) {
+        return fopen(JOURNAL_FILE, "ab");
+    }
+    setJournalAside("belongs to a different save");
+    return startJournal();
+}
+
+// Append a transaction to the journal in one write and flush it to disk
+bool journalDeskTransaction(const DeskTransaction* tx) {
+    char entry[sizeof(JournalHeader) + sizeof(int) * MAX_DESK_ITEMS];
+    JournalHeader header = {JOURNAL_MAGIC, tx->action, tx->userId, tx->count, !journalInSequence, 0, tx->when};
+    size_t size = sizeof(JournalHeader) + sizeof(int) * tx->count;
+    memcpy(entry, &header, sizeof(JournalHeader));
+    memcpy(entry + sizeof(JournalHeader), tx->bookIds, sizeof(int) * tx->count);
+
+    FILE* file = openJournal();
+    if (file == NULL) {
+        return false;
+    }
+    bool written = fwrite(entry, 1, size, file) == size && fflush(file) == 0 && _commit(_fileno(file)) == 0;
+    fclose(file);
+    return written;
+}
+
+// Give back loan records that were never linked into the ledger
+void discardLoanRecords(BorrowRecord** loans, int count) {
+    for (int i = 0; i < count; i++) {
+        handleRelease(&loanHandles, loans[i]->handle);
+        poolFree(&loanPool, loans[i]);
+    }
+}
+
+// Check, log and apply a transaction as one unit (new loans are returned through loans)
+DeskResult runDeskTransaction(DeskTransaction* tx, bool journal, BorrowRecord** loans) {
+    Book* books[MAX_DESK_ITEMS];
+    BorrowRecord* records[MAX_DESK_ITEMS];
+    User* user = searchUserById(tx->userId);
+    DeskResult result = prepareDeskTransaction(tx, user, books, records);
+    if (result != DESK_OK) {
+        return result;
+    }
+    if (tx->action == DESK_CHECKOUT) {
+        for (int i = 0; i < tx->count; i++) {
+            records[i] = createBorrowRecord(user, books[i]);
+            if (records[i] == NULL) {
+                tx->failedItem = i;
+                discardLoanRecords(records, i);
+                return DESK_UNAVAILABLE;
+            }
+        }
+    }
+    if (journal) {
+        tx->when = time(NULL);
+        if (!journalDeskTransaction(tx)) {
+            if (tx->action == DESK_CHECKOUT) {
+                discardLoanRecords(records, tx->count);
+            }
+            return DESK_NOT_LOGGED;
+        }
+    }
+
+    // Nothing below can fail
+    journalApplying = true;
+    if (tx->action == DESK_CHECKOUT) {
+        for (int i = 1; i < tx->count; i++) {
+            records[i - 1]->next = records[i];
+        }
+        BorrowRecord* tail = appendBorrowRecords(records[0], records[tx->count - 1], tx->count);
+        for (int i = 0; i < tx->count; i++) {
+            bool pickup = removeHold(books[i]->id, user->id);
+            if (pickup) {
+                books[i]->held--;
+            }
+            records[i]->borrowDate = tx->when;
+            records[i]->dueDate = tx->when + 1209600; // 14 days loan period
+            updateLedgerRow(records[i]);
+            commitLoanChange(records[i]);
+            books[i]->borrowed++;
+            updateCopyCounts(books[i]);
+            user->borrowCount++;
+            countLoanOpened(records[i], user);
+            UndoEntry* entry = logUndo(UNDO_BORROWED, books[i], user);
+            if (entry != NULL) {
+                entry->field = pickup;
+                entry->loan = records[i]->handle;
+                entry->before.tail = i > 0 ? records[i - 1]->handle : tail != NULL ? tail->handle : NULL_HANDLE;
+            }
+        }
+        if (loans != NULL) {
+            memcpy(loans, records, sizeof(BorrowRecord*) * tx->count);
+        }
+    } else {
+        for (int i = 0; i < tx->count; i++) {
+            closeLoan(records[i], user, tx->when);
+        }
+    }
+    joinUndoEntries(tx->count);
+    journalApplying = false;
+    return DESK_OK;
+}
+
+// Cut the journal back to its first length bytes (the whole file is kept as JOURNAL_OLD_FILE)
+void trimJournal(long length, const char* reason) {
+    char* kept = (char*)malloc(length);
+    FILE* file = kept != NULL ? fopen(JOURNAL_FILE, "rb") : NULL;
+    bool read = file != NULL && fread(kept, 1, length, file) == (size_t)length;
+    if (file != NULL) {
+        fclose(file);
+    }
+    setJournalAside(reason);
+    file = read ? fopen(JOURNAL_FILE, "wb") : NULL;
+    if (file != NULL) {
+        bool written = fwrite(kept, 1, length, file) == (size_t)length && fflush(file) == 0 && _commit(_fileno(file)) == 0;
+        if (fclose(file) != 0 || !written) {
+            remove(JOURNAL_FILE);
+        }
+    }
+    free(kept);
+}
+
+// Re-apply the transactions logged since the loaded save; returns how many applied
+int replayJournal() {
+    FILE* file = fopen(JOURNAL_FILE, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    JournalFileHeader start;
+    if (fread(&start, sizeof(JournalFileHeader), 1, file) != 1 || start.magic != JOURNAL_FILE_MAGIC ||
+        start.saveStamp != loadedSaveStamp) {
+        fclose(file);
+        setJournalAside("does not continue this save, so it was not replayed");
+        return 0;
+    }
+    DeskTransaction tx;
+    JournalHeader header;
+    int applied = 0, skipped = 0, unordered = 0;
+    long replayed = ftell(file);    // end of the last entry replayed
+    // A torn entry at the end (a crash during the write) is ignored
+    while (fread(&header, sizeof(JournalHeader), 1, file) == 1 && header.magic == JOURNAL_MAGIC &&
+           header.count > 0 && header.count <= MAX_DESK_ITEMS &&
+           fread(tx.bookIds, sizeof(int), header.count, file) == (size_t)header.count) {
+        if (header.outOfSequence || unordered > 0) {
+            unordered++;
+            continue;
+        }
+        tx.action = (DeskAction)header.action;
+        tx.userId = header.userId;
+        tx.count = header.count;
+        tx.when = (time_t)header.when;
+        if (runDeskTransaction(&tx, false, NULL) == DESK_OK) {
+            applied++;
+        } else {
+            skipped++;
+        }
+        replayed = ftell(file);
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fclose(file);
+    if (applied + skipped > 0) {
+        printf("Replayed %d desk transaction(s) from %s (%d no longer applied)\n", applied, JOURNAL_FILE, skipped);
+    }
+    if (unordered > 0) {
+        printf("%d desk transaction(s) were logged after changes the journal does not hold and were not replayed\n", unordered);
+    }
+    // New entries go right after the replayed ones
+    if (length > replayed) {
+        trimJournal(replayed, "had entries that were not replayed");
+    }
+    return applied;
+}
+
+// Print why a transaction was refused
+void printDeskFailure(const DeskTransaction* tx, DeskResult result) {
+    if (tx->failedItem >= 0) {
+        printf("Nothing was %s: book %d: %s\n", tx->action == DESK_CHECKOUT ? "checked out" : "returned",
+               tx->bookIds[tx->failedItem], deskResultName(result));
+    } else {
+        printf("Nothing was %s: %s\n", tx->action == DESK_CHECKOUT ? "checked out" : "returned", deskResultName(result));
+    }
+}
+
+// Check out or return a stack of books by ID
+void deskTransactionMenu(DeskAction action) {
+    DeskTransaction tx;
+    char line[MAX_BATCH_LINE];
+    BorrowRecord* loans[MAX_DESK_ITEMS];
+    tx.action = action;
+    printf("Enter User ID: ");
+    if (scanf("%d", &tx.userId) != 1) {
+        tx.userId = -1;
+    }
+    while ((getchar()) != '\n');
+    printf("Enter the book IDs (up to %d, separated by spaces): ", MAX_DESK_ITEMS);
+    fgets(line, MAX_BATCH_LINE, stdin);
+    tx.count = parseDeskItems(line, tx.bookIds);
+    if (tx.count <= 0) {
+        printf("Enter between 1 and %d book IDs!\n", MAX_DESK_ITEMS);
+        return;
+    }
+
+    DeskResult result = runDeskTransaction(&tx, true, loans);
+    if (result != DESK_OK) {
+        printDeskFailure(&tx, result);
         return;
     }
-    
-    // Find user to delete
-    User* current = userList;
-    User* prev = NULL;
-    
-    while (current != NULL && current->id != id) {
-        prev = current;
-        current = current->next;
+    if (action == DESK_CHECKIN) {
+        printf("%d book(s) returned successfully!\n", tx.count);
+        return;
     }
-    
-    if (current == NULL) {
+    char dueDateStr[26];
+    strftime(dueDateStr, sizeof(dueDateStr), "%Y-%m-%d %H:%M:%S", localtime(&loans[0]->dueDate));
+    printf("%d book(s) borrowed successfully! Due Date: %s\n", tx.count, dueDateStr);
+}
+
+/********************************************/
+/*                Undo Log                  */
+/********************************************/
+
+// Every change made through the menus, the batch commands and the desk
+// server logs one small delta: the action, the record it touched (a
+// user, book or loan handle) and the old value of the one field
+// that changed. Undo reverses the newest entry in O(1) without scanning
+// the ledger. When later changes the log does not cover are in the
+// way, such as a copy already held for someone else, the entry can no
+// longer be undone and is dropped. Deleted users and books stay
+// detached in their entry until it is undone or drops off the end of
+// the ring. The entries of one desk transaction are undone together:
+// all of them are checked first, so a transaction is undone whole or
+// not at all. Loads and bulk imports are not logged.
+
+// Entry i places below the newest (0 = newest), or NULL
+UndoEntry* undoEntryAt(int i) {
+    if (i < 0 || i >= undoLog.count) {
+        return NULL;
+    }
+    return &undoLog.entries[(undoLog.top - i + MAX_STACK_SIZE) % MAX_STACK_SIZE];
+}
+
+// Free what an entry still owns
+void releaseUndoEntry(UndoEntry* entry) {
+    if ((entry->action == UNDO_BOOK_EDITED || entry->action == UNDO_USER_EDITED) && entry->field <= FIELD_USER_ID) {
+        free(entry->before.text);
+    } else if (entry->action == UNDO_BOOK_DELETED && entry->before.book != NULL) {
+        handleRelease(&bookHandles, entry->before.book->handle);
+        poolFree(&bookPool, entry->before.book);
+    } else if (entry->action == UNDO_USER_DELETED && entry->before.user != NULL) {
+        handleRelease(&userHandles, entry->before.user->handle);
+        poolFree(&userPool, entry->before.user);
+    }
+}
+
+// Add an entry for a change (NULL while an undo runs); the caller fills in the old value
+UndoEntry* logUndo(UndoAction action, Book* book, User* user) {
+    noteUnjournaledChange();
+    if (undoInProgress) {
+        return NULL;
+    }
+    undoLog.top = (undoLog.top + 1) % MAX_STACK_SIZE;
+    if (undoLog.count == MAX_STACK_SIZE) {
+        releaseUndoEntry(&undoLog.entries[undoLog.top]);   // the oldest entry goes
+    } else {
+        undoLog.count++;
+    }
+    UndoEntry* entry = &undoLog.entries[undoLog.top];
+    memset(entry, 0, sizeof(UndoEntry));
+    entry->action = action;
+    entry->when = time(NULL);
+    entry->book = book != NULL ? book->handle : NULL_HANDLE;
+    entry->user = user != NULL ? user->handle : NULL_HANDLE;
+    return entry;
+}
+
+// Log an edit of one field (text fields keep a copy of the old text)
+void logFieldEdit(UndoAction action, Book* book, User* user, RecordField field, const char* oldText, int oldNumber) {
+    UndoEntry* entry = logUndo(action, book, user);
+    if (entry == NULL) {
+        return;
+    }
+    entry->field = field;
+    if (field <= FIELD_USER_ID) {
+        entry->before.text = strdup(oldText);
+    } else {
+        entry->before.number = oldNumber;
+    }
+}
+
+// Make the newest count entries undo as one
+void joinUndoEntries(int count) {
+    for (int i = 0; i < count - 1 && !undoInProgress; i++) {
+        UndoEntry* entry = undoEntryAt(i);
+        if (entry != NULL) {
+            entry->joined = true;
+        }
+    }
+}
+
+// Drop entry i places below the newest
+void dropUndoEntry(int i) {
+    UndoEntry* entry = undoEntryAt(i);
+    if (entry == NULL) {
+        return;
+    }
+    // The entry above takes over the end of a joined group
+    if (!entry->joined && i > 0) {
+        undoEntryAt(i - 1)->joined = false;
+    }
+    releaseUndoEntry(entry);
+    for (int j = i; j > 0; j--) {
+        *undoEntryAt(j) = *undoEntryAt(j - 1);
+    }
+    undoLog.top = (undoLog.top - 1 + MAX_STACK_SIZE) % MAX_STACK_SIZE;
+    undoLog.count--;
+}
+
+// Drop every entry
+void clearUndoLog() {
+    while (undoLog.count > 0) {
+        dropUndoEntry(0);
+    }
+}
+
+// Title of the book an entry is about (NULL if it is gone)
+const char* undoBookTitle(const UndoEntry* entry) {
+    if (entry->action == UNDO_BOOK_DELETED) {
+        return entry->before.book->title;
+    }
+    Book* book = bookFromHandle(entry->book);
+    return book != NULL ? book->title : NULL;
+}
+
+// User an entry is about (NULL if it is gone)
+User* undoUser(const UndoEntry* entry) {
+    if (entry->action == UNDO_USER_DELETED) {
+        return entry->before.user;
+    }
+    return userFromHandle(entry->user);
+}
+
+// Describe an entry in one line
+void describeUndoEntry(const UndoEntry* entry, char* text, int size) {
+    static const char* fieldNames[] = {"title", "author", "ISBN", "name", "user ID", "age", "gender", "status"};
+    char title[MAX_TITLE_LENGTH + 16];
+    const char* name = undoUser(entry) != NULL ? undoUser(entry)->name : "a deleted user";
+    snprintf(title, sizeof(title), "%s", undoBookTitle(entry) != NULL ? undoBookTitle(entry) : "a deleted book");
+    switch (entry->action) {
+        case UNDO_USER_ADDED:
+            snprintf(text, size, "A user going by the name of %s has been added", name);
+            break;
+        case UNDO_USER_DELETED:
+            snprintf(text, size, "A user going by the name of %s was deleted", name);
+            break;
+        case UNDO_BOOK_ADDED:
+            snprintf(text, size, "A book with the title of %s has been added", title);
+            break;
+        case UNDO_BOOK_DELETED:
+            snprintf(text, size, "A book with the title of %s was deleted", title);
+            break;
+        case UNDO_BOOK_EDITED:
+            snprintf(text, size, "The %s of %s was changed", fieldNames[entry->field], title);
+            break;
+        case UNDO_COPIES_CHANGED:
+            snprintf(text, size, "The copies of %s were changed from %d", title, entry->before.number);
+            break;
+        case UNDO_USER_EDITED:
+            snprintf(text, size, "The %s of %s was changed", fieldNames[entry->field], name);
+            break;
+        case UNDO_BORROWED:
+            snprintf(text, size, "%s borrowed %s", name, title);
+            break;
+        case UNDO_RETURNED:
+            snprintf(text, size, "%s returned %s", name, title);
+            break;
+        case UNDO_RESERVED:
+            snprintf(text, size, "%s reserved %s", name, title);
+            break;
+        case UNDO_CANCELLED:
+            snprintf(text, size, "%s cancelled a reservation of %s", name, title);
+            break;
+    }
+}
+
+// Take back a loan that is still the last record in the ledger
+bool undoBorrow(UndoEntry* entry, Book* book) {
+    BorrowRecord* loan = loanFromHandle(entry->loan);
+    BorrowRecord* tail = loanFromHandle(entry->before.tail);
+    User* user = userFromHandle(entry->user);
+    bool linked = tail != NULL || isNullHandle(entry->before.tail);
+    bool last = linked && loan != NULL && loan->next == NULL && (tail != NULL ? tail->next == loan : borrowRecords == loan);
+    if (book == NULL || user == NULL || !last || loan->returned) {
+        printf("The loan was returned or later loans were recorded!\n");
+        return false;
+    }
+    if (tail != NULL) {
+        tail->next = NULL;
+    } else {
+        borrowRecords = NULL;
+    }
+    borrowTail = tail;
+    removeOpenLoan(loan);
+    popLedgerRow(loan);
+    borrowCount--;
+    commitLoanChange(loan);
+    book->borrowed--;
+    user->borrowCount--;
+    countLoanDropped(loan, user);
+    if (entry->field) {
+        // A picked-up hold is placed again (with a new pickup deadline)
+        book->held++;
+        placeHold(book, user);
+    } else {
+        updateCopyCounts(book);
+    }
+    handleRelease(&loanHandles, loan->handle);
+    poolFree(&loanPool, loan);
+    return true;
+}
+
+// Reopen a closed loan if its copy has not gone to anyone else
+bool undoReturn(UndoEntry* entry, Book* book) {
+    BorrowRecord* loan = loanFromHandle(entry->loan);
+    User* user = userFromHandle(entry->user);
+    if (book == NULL || user == NULL || loan == NULL || !loan->returned) {
+        printf("The loan is no longer closed!\n");
+        return false;
+    }
+    if (availableCopies(book) <= 0) {
+        if (book->held <= bookQueues[book->id].holdCount) {
+            printf("the book you wish to unreturn has been loaned out or held \n");
+            return false;
+        }
+        book->held--;   // the fulfillment stage had not handed the copy out yet
+    }
+    user->borrowCount++;
+    countLoanReopened(loan, user);
+    loan->returned = false;
+    loan->returnDate = 0;
+    addOpenLoan(loan);
+    updateLedgerRow(loan);
+    commitLoanChange(loan);
+    book->borrowed++;
+    updateCopyCounts(book);
+    user->status = (UserStatus)entry->before.number;
+    return true;
+}
+
+// Give a cancelled reservation back: the hold if its copy is still free, else the old queue place
+bool undoCancel(UndoEntry* entry, Book* book) {
+    User* user = userFromHandle(entry->user);
+    if (book == NULL || user == NULL) {
+        printf("The book or user is no longer in the system!\n");
+        return false;
+    }
+    if (findHold(book->id, user->id) != NULL || isUserQueued(book->id, user->id)) {
+        printf("The user has a reservation for this book again!\n");
+        return false;
+    }
+    if (entry->field == 0) {
+        if (book->held > bookQueues[book->id].holdCount || availableCopies(book) > 0) {
+            if (book->held <= bookQueues[book->id].holdCount) {
+                book->held++;
+            }
+            appendHold(book->id, user->id, entry->when, entry->before.deadline);
+            updateCopyCounts(book);
+            return true;
+        }
+        entry->field = 1;   // the copy went to someone else: first in the queue instead
+        entry->before.queued = entry->when;
+    }
+    insertQueueUser(book->id, user->id, entry->field, entry->before.queued);
+    return true;
+}
+
+// Reverse one entry; prints why and returns false when later changes are in the way
+bool applyUndo(UndoEntry* entry) {
+    noteUnjournaledChange();
+    Book* book = bookFromHandle(entry->book);
+    User* user = userFromHandle(entry->user);
+    bool undone = true;
+    if (!isNullHandle(entry->user) && user == NULL && entry->action != UNDO_USER_DELETED) {
         printf("User not found!\n");
+        return false;
+    }
+    undoInProgress = true;
+    switch (entry->action) {
+        case UNDO_USER_ADDED:
+            if (user->borrowCount > 0) {
+                printf("Cannot delete user as they have borrowed books!\n");
+                undone = false;
+            } else {
+                unlinkUser(user->id);
+                handleRelease(&userHandles, user->handle);
+                poolFree(&userPool, user);
+            }
+            break;
+        case UNDO_USER_DELETED:
+            user = entry->before.user;
+            handleAttach(&userHandles, user->handle, user);
+            addUserToList(user);
+            entry->before.user = NULL;
+            break;
+        case UNDO_BOOK_ADDED:
+            if (book != NULL && (book->borrowed > 0 || book->held > 0 || !isQueueEmpty(book->id))) {
+                printf("Cannot delete book as it is currently borrowed or reserved!\n");
+                undone = false;
+            } else if (book != NULL) {
+                int bookId = book->id;
+                unindexBook(book);
+                bookRoot = deleteBook(bookRoot, bookId);
+                commitBookChange(bookId);
+            }
+            break;
+        case UNDO_BOOK_DELETED:
+            book = entry->before.book;
+            if (searchBookById(bookRoot, book->id) != NULL) {
+                printf("Book with ID %d already exists!\n", book->id);
+                undone = false;
+                break;
+            }
+            if (isbnTakenBy(book, book->isbn) != NULL) {
+                printf("Another title is listed under ISBN %s now!\n", book->isbn);
+                undone = false;
+                break;
+            }
+            book->left = NULL;
+            book->right = NULL;
+            handleAttach(&bookHandles, book->handle, book);
+            bookRoot = insertBook(bookRoot, book);
+            indexBook(book);
+            commitBookChange(book->id);
+            entry->before.book = NULL;
+            break;
+        case UNDO_BOOK_EDITED: {
+            if (book == NULL) {
+                printf("Book not found!\n");
+                undone = false;
+                break;
+            }
+            if (entry->field == FIELD_ISBN && isbnTakenBy(book, entry->before.text) != NULL) {
+                printf("Another title is listed under ISBN %s now!\n", entry->before.text);
+                undone = false;
+                break;
+            }
+            char* fields[] = {book->title, book->author, book->isbn};
+            int sizes[] = {MAX_TITLE_LENGTH, MAX_AUTHOR_LENGTH, MAX_ISBN_LENGTH};
+            unindexBook(book);
+            strncpy(fields[entry->field], entry->before.text, sizes[entry->field] - 1);
+            fields[entry->field][sizes[entry->field] - 1] = '\0';
+            refreshBookKeys(book);
+            indexBook(book);
+            commitBookChange(book->id);
+            break;
+        }
+        case UNDO_COPIES_CHANGED:
+            if (book == NULL || !changeBookCopies(book, entry->before.number - book->copies)) {
+                printf("Only copies on the shelf can be withdrawn!\n");
+                undone = false;
+            }
+            break;
+        case UNDO_USER_EDITED:
+            if (entry->field == FIELD_NAME) {
+                unindexUser(user);
+                strncpy(user->name, entry->before.text, MAX_NAME_LENGTH - 1);
+                user->name[MAX_NAME_LENGTH - 1] = '\0';
+                refreshUserKeys(user);
+                indexUser(user);
+            } else if (entry->field == FIELD_USER_ID) {
+                strncpy(user->user_id, entry->before.text, MAX_ID_LENGTH - 1);
+                user->user_id[MAX_ID_LENGTH - 1] = '\0';
+            } else if (entry->field == FIELD_AGE) {
+                user->age = entry->before.number;
+            } else if (entry->field == FIELD_GENDER) {
+                user->gender = (char)entry->before.number;
+            } else {
+                user->status = (UserStatus)entry->before.number;
+            }
+            break;
+        case UNDO_BORROWED:
+            undone = undoBorrow(entry, book);
+            break;
+        case UNDO_RETURNED:
+            undone = undoReturn(entry, book);
+            break;
+        case UNDO_RESERVED:
+            if (book == NULL || dropReservation(book, user->id) != DESK_OK) {
+                printf("The reservation was already picked up or cancelled!\n");
+                undone = false;
+            }
+            break;
+        case UNDO_CANCELLED:
+            undone = undoCancel(entry, book);
+            break;
+    }
+    undoInProgress = false;
+    return undone;
+}
+
+// Can every entry of the newest desk transaction be undone? (checked before any is, so none is left half undone)
+bool undoGroupPossible() {
+    BorrowRecord* newer = NULL;     // the loan undone just before this one, which must follow it in the ledger
+    for (int i = 0; i < undoLog.count; i++) {
+        UndoEntry* entry = undoEntryAt(i);
+        Book* book = bookFromHandle(entry->book);
+        BorrowRecord* loan = loanFromHandle(entry->loan);
+        if (book == NULL || userFromHandle(entry->user) == NULL || loan == NULL) {
+            return false;
+        }
+        if (entry->action == UNDO_BORROWED) {
+            BorrowRecord* tail = loanFromHandle(entry->before.tail);
+            bool linked = tail != NULL ? tail->next == loan : isNullHandle(entry->before.tail) && borrowRecords == loan;
+            if (!linked || loan->next != newer || loan->returned) {
+                return false;
+            }
+            newer = loan;
+        } else if (entry->action == UNDO_RETURNED) {
+            // The items of a transaction are distinct titles, so each copy is checked on its own
+            if (!loan->returned || (availableCopies(book) <= 0 && book->held <= bookQueues[book->id].holdCount)) {
+                return false;
+            }
+        }
+        if (!entry->joined) {
+            break;
+        }
+    }
+    return true;
+}
+
+// Drop the newest entry and the rest of its desk transaction
+void dropNewestUndoGroup() {
+    bool joined = true;
+    while (joined && undoLog.count > 0) {
+        joined = undoEntryAt(0)->joined;
+        dropUndoEntry(0);
+    }
+}
+
+// undo most recent action (with the rest of its desk transaction)
+void undoSystemhistory() {
+    if (undoLog.count == 0) {
+        printf("System history is empty!\n");
+        return ;
+    }
+    if (undoEntryAt(0)->joined && !undoGroupPossible()) {
+        dropNewestUndoGroup();
+        printf("Part of this desk transaction can no longer be undone, so none of it was; it was dropped from the history\n");
         return;
     }
-    
-    // Delete the node
-    prev->next = current->next;
-    User* userCopy = (User*)malloc(sizeof(User));
-    if (userCopy == NULL) {
-        printf("Memory allocation failed! , action failed , not added to history\n");
+    bool joined;
+    do {
+        UndoEntry* entry = undoEntryAt(0);
+        joined = entry->joined;
+        if (!applyUndo(entry)) {
+            // Drop it (and the rest of its transaction) so older entries stay reachable
+            dropNewestUndoGroup();
+            printf("This change can no longer be undone and was dropped from the history\n");
+            return;
+        }
+        dropUndoEntry(0);
+    } while (joined && undoLog.count > 0);
+    printf("Action undone successfully");
+}
+
+// Find the newest return in the log (its place below the newest entry, or -1)
+int findLastReturn() {
+    for (int i = 0; i < undoLog.count; i++) {
+        if (undoEntryAt(i)->action == UNDO_RETURNED) {
+            return i;
+        }
     }
-    *userCopy = *current;
-    pushToSystemHistory(NULL,userCopy,USERDELETED);
-    free(current);
-    printf("User deleted successfully!\n");
+    return -1;
 }
 
-// Add a new user via user input
-void userInSys() {
-    char name[MAX_NAME_LENGTH];
-    char user_id[MAX_ID_LENGTH];
-    int age;
-    char gender;
-    while ((getchar()) != '\n');
+//view last return
+void displayLastReturn() {
+    int position = findLastReturn();
+    if (position < 0) {
+        printf("no recent returns");
+        return;
+    }
+    UndoEntry* entry = undoEntryAt(position);
+    BorrowRecord* loan = loanFromHandle(entry->loan);
+    User* user = userFromHandle(entry->user);
+    if (loan == NULL || user == NULL) {
+        printf("the last return is no longer in the system");
+        return;
+    }
+    Book* returnedBook = bookFromHandle(loan->book);
+    struct tm* rettime;
+    rettime = localtime(&(loan->returnDate));
+    printf("%s has been returned by %s on %s" , returnedBook != NULL ? returnedBook->title : "a deleted book" , user->name , asctime(rettime));
+}
 
-    printf("Enter user name: ");
-    fgets(name, MAX_NAME_LENGTH, stdin);
-    name[strcspn(name, "\n")] = '\0';  // Remove newline
-    
-    printf("Enter user ID: ");
-    fgets(user_id, MAX_ID_LENGTH, stdin);
-    user_id[strcspn(user_id, "\n")] = '\0';  // Remove newline
-    
-    printf("Enter age: ");
-    scanf("%d", &age);
-    
-    printf("Enter gender (M/F): ");
-    scanf(" %c", &gender);
+//undo last return (even if other changes were logged after it)
+void undoLastReturn(){
+    int position = findLastReturn();
+    if (position < 0) {
+        printf("no recent returns");
+        return ;
+    }
+    UndoEntry* entry = undoEntryAt(position);
+    BorrowRecord* loan = loanFromHandle(entry->loan);
+    User* user = userFromHandle(entry->user);
+    Book* book = loan != NULL ? bookFromHandle(loan->book) : NULL;
+    bool undone = applyUndo(entry);
+    dropUndoEntry(position);
+    if (undone) {
+        printf("the return was undone successfully \n");
+        struct tm* rettime;
+        rettime = localtime(&(loan->dueDate));
+        printf("your book return window is still due until %s \n" , asctime(rettime));
+    } else if (book != NULL && user != NULL && loan->returned) {
+        // Someone else has the copy now, so the user joins its queue instead
+        int queued;
+        if (queueReservation(book, user, &queued) == DESK_QUEUED) {
+            printf("\n User added to reservation queue! (position %d)\n", queued);
+        }
+    }
+}
+
+// Display history
+void displaySystemHistory() {
+    if (undoLog.count == 0) {
+        printf("System history is empty!\n");
+        return;
+    }
     
-    numofuser++;
-    User* newUser = createUser(numofuser, name, user_id, age, gender);
-    addUserToList(newUser);
-    User* userCopy = (User*)malloc(sizeof(User));
-    if (userCopy == NULL) {
-        printf("Memory allocation failed! , action failed , not added to history\n");
+    OutputBuffer* out = beginReport();
+    if (out == NULL) {
+        return;
+    }
+    printf("\n=== System History ===\n");
+    printf("------------------------\n");
+    for (int i = 0; i < undoLog.count; i++) {
+        renderHistoryEntry(out, undoEntryAt(i), i + 1);
+        if (!reportPageBreak(out, i + 1, undoLog.count, HISTORY_PAGE_SIZE)) {
+            break;
+        }
+    }
+    endReport();
+}
+
+//history Menu
+void HistoryMenu(){
+int choice;
+do{
+    printf("\e[1;1H\e[2J");
+    printf("\n=== History Menu ===\n");
+    printf("1. View Recent History\n");
+    printf("2. undo Most recent Action\n");
+    printf("3. Back\n");
+    printf("Choose an option: ");
+    scanf("%d", &choice);
+
+    switch (choice)
+    {
+    case 1:
+    printf("\e[1;1H\e[2J");
+        displaySystemHistory();
+        break;
+    case 2:
+    printf("\e[1;1H\e[2J");
+        undoSystemhistory();
+        Sleep(2000);
+        break;
+    case 3:
+        return;
+        break; 
+    default:
+        printf("please input a valid choice");
+        break;
+    }
+
+}while(choice != 3);
+
+}
+
+/********************************************/
+/*         Parallel Catalog Scan            */
+/********************************************/
+
+// Compare two ints (for qsort)
+int compareInts(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Pack a chunk range [next, end) into one word
+LONG64 packScanRange(int next, int end) {
+    return ((LONG64)end << 32) | (uint32_t)next;
+}
+
+// Take the next chunk from the worker's own range (-1 if empty)
+int takeScanChunk(ScanWorker* worker) {
+    while (1) {
+        LONG64 old = worker->range;
+        int next = (int)(uint32_t)old, end = (int)(old >> 32);
+        if (next >= end) {
+            return -1;
+        }
+        if (InterlockedCompareExchange64(&worker->range, packScanRange(next + 1, end), old) == old) {
+            return next;
+        }
     }
-    *userCopy = *newUser;
-    pushToSystemHistory(NULL,newUser,USERADDED);
-    printf("User added successfully!\n");
 }
 
-// Edit user details
-void editUser() {
+// Steal half of another worker's remaining chunks (-1 if all are empty)
+int stealScanChunk(ScanWorker* self) {
+    for (int i = 1; i < scanPool.workerCount; i++) {
+        ScanWorker* victim = &scanPool.workers[((self - scanPool.workers) + i) % scanPool.workerCount];
+        while (1) {
+            LONG64 old = victim->range;
+            int next = (int)(uint32_t)old, end = (int)(old >> 32);
+            if (next >= end) {
+                break;
+            }
+            int split = end - (end - next + 1) / 2;
+            if (InterlockedCompareExchange64(&victim->range, packScanRange(next, split), old) == old) {
+                // Keep the first stolen chunk, publish the rest for others
+                LONG64 mine = self->range;
+                while (InterlockedCompareExchange64(&self->range, packScanRange(split + 1, end), mine) != mine) {
+                    mine = self->range;
+                }
+                return split;
+            }
+        }
+    }
+    return -1;
+}
 
-    char uname[MAX_NAME_LENGTH];
-    printf("Enter User's name: ");
-    while ((getchar()) != '\n');
-    fgets(uname, MAX_NAME_LENGTH, stdin);
-    uname[strcspn(uname, "\n")] = '\0';
+// Record a matching book for the worker
+void addScanHit(ScanWorker* worker, int index) {
+    if (worker->hitCount == worker->hitCapacity) {
+        int capacity = worker->hitCapacity > 0 ? worker->hitCapacity * 2 : 256;
+        int* hits = (int*)realloc(worker->hits, sizeof(int) * capacity);
+        if (hits == NULL) {
+            return;
+        }
+        worker->hits = hits;
+        worker->hitCapacity = capacity;
+    }
+    worker->hits[worker->hitCount++] = index;
+}
 
-    User* user = searchUserByName(uname);
-    if (user == NULL) {
-        printf("User not found!\n");
+// Scan one chunk of the snapshot
+void scanChunk(ScanJob* job, ScanWorker* worker, int chunk) {
+    int first = chunk * SCAN_CHUNK_SIZE;
+    int last = first + SCAN_CHUNK_SIZE;
+    if (last > job->snap->count) {
+        last = job->snap->count;
+    }
+    if (job->blockMatch != NULL) {
+        int found = matchSnapshotBlocks(job->snap, first, last, job->blockMatch, job->arg, worker->blockHits);
+        for (int i = 0; i < found; i++) {
+            addScanHit(worker, worker->blockHits[i]);
+        }
         return;
     }
-    
-    printf("Current details:\n");
-    displayUser(user);
-    
-    int choice;
-    char name[MAX_NAME_LENGTH];
-    char user_id[MAX_ID_LENGTH];
-    int age;
-    char gender;
+    for (int i = first; i < last; i++) {
+        if (job->match(snapshotBookAt(job->snap, i), job->arg)) {
+            addScanHit(worker, i);
+        }
+    }
+}
 
-    
-    do{
-    printf("\nEnter new details (or leave blank to keep current):\n");
-    printf("1. Edit name\n");
-    printf("2. Edit user ID\n");
-    printf("3. Edit age\n");
-    printf("4. Edit gender\n");
-    printf("5. Edit status\n");
-    printf("6. Back\n");
-    printf("Enter choice: ");
-    printf("----------------------------------------------------\n");
-    scanf("%d", &choice);
+// Scan worker thread
+DWORD WINAPI scanWorkerMain(LPVOID param) {
+    ScanWorker* worker = (ScanWorker*)param;
+    while (1) {
+        WaitForSingleObject(worker->wake, INFINITE);
+        ScanJob* job = &scanPool.job;
+        int chunk;
+        while ((chunk = takeScanChunk(worker)) >= 0 || (chunk = stealScanChunk(worker)) >= 0) {
+            scanChunk(job, worker, chunk);
+        }
+        if (InterlockedDecrement(&job->pending) == 0) {
+            SetEvent(job->done);
+        }
+    }
+    return 0;
+}
 
-    while ((getchar()) != '\n'); 
-    
-    switch (choice) {
-        case 1:
-            printf("Enter new name: ");
-            fgets(name, MAX_NAME_LENGTH, stdin);
-            name[strcspn(name, "\n")] = '\0';
-            if (strlen(name) > 0) {
-                strncpy(user->name, name, MAX_NAME_LENGTH - 1);
-                user->name[MAX_NAME_LENGTH - 1] = '\0';
-            }
-            break;
-        case 2:
-            printf("Enter new user ID: ");
-            fgets(user_id, MAX_ID_LENGTH, stdin);
-            user_id[strcspn(user_id, "\n")] = '\0';
-            if (strlen(user_id) > 0) {
-                strncpy(user->user_id, user_id, MAX_ID_LENGTH - 1);
-                user->user_id[MAX_ID_LENGTH - 1] = '\0';
-            }
-            break;
-        case 3:
-            printf("Enter new age: ");
-            scanf("%d", &age);
-            user->age = age;
-            break;
-        case 4:
-            printf("Enter new gender (M/F): ");
-            scanf(" %c", &gender);
-            user->gender = gender;
-            break;
-        case 5:
-            printf("Select new status:\n");
-            printf("1. Active\n");
-            printf("2. Suspended\n");
-            printf("3. Expired\n");
-            printf("Enter choice: ");
-            scanf("%d", &choice);
-            
-            switch (choice) {
-                case 1:
-                    user->status = ACTIVE;
-                    break;
-                case 2:
-                    user->status = SUSPENDED;
-                    break;
-                case 3:
-                    user->status = EXPIRED;
-                    break;
-                default:
-                    printf("Invalid choice!\n");
-            }
+// Start the worker pool (one worker per core)
+void initScanPool() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    InitializeCriticalSection(&scanPool.lock);
+    scanPool.workerCount = (int)info.dwNumberOfProcessors;
+    if (scanPool.workerCount < 1) {
+        scanPool.workerCount = 1;
+    }
+    if (scanPool.workerCount > MAX_SCAN_WORKERS) {
+        scanPool.workerCount = MAX_SCAN_WORKERS;
+    }
+    scanPool.job.done = CreateEvent(NULL, FALSE, FALSE, NULL);
+    for (int i = 0; i < scanPool.workerCount; i++) {
+        ScanWorker* worker = &scanPool.workers[i];
+        worker->range = packScanRange(0, 0);
+        worker->hits = NULL;
+        worker->hitCount = 0;
+        worker->hitCapacity = 0;
+        worker->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+        worker->thread = CreateThread(NULL, 0, scanWorkerMain, worker, 0, NULL);
+        if (worker->thread == NULL) {
+            scanPool.workerCount = i > 0 ? i : 1;
             break;
-        case 6:
-            return;
-        default:
-            printf("Invalid choice!\n");
+        }
     }
-}while(choice != 6 );
-    printf("User updated successfully!\n");
+    scanPool.started = true;
 }
 
-// View user details
-void viewUser() {
-    char name[MAX_NAME_LENGTH];
-    printf("Enter User's name: ");
-    while ((getchar()) != '\n');
-    fgets(name, MAX_NAME_LENGTH, stdin);
-    name[strcspn(name, "\n")] = '\0';
+// Scan the whole catalog for books accepted by the matcher (per book) or
+// the block matcher (per chunk of contiguous books), whichever is given.
+// Small catalogs are scanned inline; larger ones are split into chunks
+// and scanned by the worker pool. Release the result when done.
+ScanResult runCatalogScan(BookMatcher match, BookBlockMatcher blockMatch, const void* arg) {
+    ScanResult result = {NULL, NULL, 0};
+    result.snap = pinCatalogSnapshot();
+    if (result.snap == NULL) {
+        return result;
+    }
+    int chunkCount = (result.snap->count + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
 
-    User* user = searchUserByName(name);
-    if (user == NULL) {
-        printf("User not found!\n");
-        return;
+    if (!scanPool.started) {
+        initScanPool();
     }
-    
-    displayUser(user);
+
+    if (chunkCount < 2 || scanPool.workers[0].thread == NULL) {
+        result.indices = (int*)malloc(sizeof(int) * (result.snap->count > 0 ? result.snap->count : 1));
+        if (result.indices == NULL) {
+            return result;
+        }
+        if (blockMatch != NULL) {
+            result.count = matchSnapshotBlocks(result.snap, 0, result.snap->count, blockMatch, arg, result.indices);
+            return result;
+        }
+        for (int i = 0; i < result.snap->count; i++) {
+            if (match(snapshotBookAt(result.snap, i), arg)) {
+                result.indices[result.count++] = i;
+            }
+        }
+        return result;
+    }
+
+    EnterCriticalSection(&scanPool.lock);
+    scanPool.job.snap = result.snap;
+    scanPool.job.match = match;
+    scanPool.job.blockMatch = blockMatch;
+    scanPool.job.arg = arg;
+    scanPool.job.pending = scanPool.workerCount;
+    for (int i = 0; i < scanPool.workerCount; i++) {
+        ScanWorker* worker = &scanPool.workers[i];
+        worker->hitCount = 0;
+        worker->range = packScanRange((int)((LONG64)chunkCount * i / scanPool.workerCount),
+                                      (int)((LONG64)chunkCount * (i + 1) / scanPool.workerCount));
+    }
+    for (int i = 0; i < scanPool.workerCount; i++) {
+        SetEvent(scanPool.workers[i].wake);
+    }
+    WaitForSingleObject(scanPool.job.done, INFINITE);
+
+    // Merge the per-worker hits back into ID order
+    int total = 0;
+    for (int i = 0; i < scanPool.workerCount; i++) {
+        total += scanPool.workers[i].hitCount;
+    }
+    result.indices = (int*)malloc(sizeof(int) * (total > 0 ? total : 1));
+    if (result.indices != NULL) {
+        for (int i = 0; i < scanPool.workerCount; i++) {
+            memcpy(result.indices + result.count, scanPool.workers[i].hits, sizeof(int) * scanPool.workers[i].hitCount);
+            result.count += scanPool.workers[i].hitCount;
+        }
+    }
+    LeaveCriticalSection(&scanPool.lock);
+
+    if (result.indices != NULL) {
+        qsort(result.indices, result.count, sizeof(int), compareInts);
+    }
+    return result;
 }
 
-// Delete user menu function
-void deleteUser() {
-    char name[MAX_NAME_LENGTH];
-    printf("Enter User's name: ");
-    while ((getchar()) != '\n');
-    fgets(name, MAX_NAME_LENGTH, stdin);
-    name[strcspn(name, "\n")] = '\0';
+// Scan the catalog with a per-book matcher
+ScanResult parallelScanBooks(BookMatcher match, const void* arg) {
+    return runCatalogScan(match, NULL, arg);
+}
 
-    User* user = searchUserByName(name);
-    if (user == NULL) {
-        printf("User not found!\n");
+// Scan the catalog with a block matcher over contiguous snapshot records
+ScanResult parallelScanBookBlocks(BookBlockMatcher blockMatch, const void* arg) {
+    return runCatalogScan(NULL, blockMatch, arg);
+}
+
+// Release a scan result and its snapshot
+void releaseScanResult(ScanResult* result) {
+    free(result->indices);
+    releaseCatalogSnapshot(result->snap);
+    result->indices = NULL;
+    result->snap = NULL;
+    result->count = 0;
+}
+
+// List every book whose title contains the pattern
+void listBooksByTitle(const char* title) {
+    char key[MAX_TITLE_LENGTH];
+    SubstringMatcher matcher;
+    foldSearchKey(title, key, MAX_TITLE_LENGTH);
+    prepareSubstringMatcher(&matcher, key);
+    ScanResult result = parallelScanBookBlocks(matchTitleBlock, &matcher);
+    if (result.snap == NULL) {
         return;
     }
-    
-    // Check if user has borrowed books
-    BorrowRecord* current = borrowRecords;
-    while (current != NULL) {
-        if (current->userId == user->id && !current->returned) {
-            printf("Cannot delete user as they have borrowed books!\n");
-            return;
-        }
-        current = current->next;
+    if (result.count == 0) {
+        printf("No books found matching '%s'\n", title);
     }
-    
-    delusernode(user->id);
+    for (int i = 0; i < result.count; i++) {
+        displayBook(snapshotBookAt(result.snap, result.indices[i]));
+    }
+    printf("%d book(s) found\n", result.count);
+    releaseScanResult(&result);
 }
 
-// User management menu
-void manageUsers() {
+/********************************************/
+/*         Search functionalities           */
+/********************************************/
+
+void searchMenu() {
     int choice;
     
     do {
-        printf("\n=== User Management ===\n");
-        printf("1. Add User\n");
-        printf("2. Edit User\n");
-        printf("3. View User\n");
-        printf("4. Delete User\n");
-        printf("5. List All Users\n");
-        printf("6. Back\n");
+        printf("\e[1;1H\e[2J");
+        printf("\n=== Search Menu ===\n");
+        printf("1. Search Book by ID\n");
+        printf("2. Search Book by Title\n");
+        printf("3. Search User by ID\n");
+        printf("4. Search User by Name\n");
+        printf("5. List All Books Matching Title\n");
+        printf("6. Fuzzy Search (Title/Author/User Name)\n");
+        printf("7. Autocomplete (Title/Author/User Name)\n");
+        printf("8. Books by Author\n");
+        printf("9. Availability Counts / Books by Status\n");
+        printf("10. Compound Query\n");
+        printf("11. Search Cache Statistics\n");
+        printf("12. Browse Catalog by Title/Author (jump to page)\n");
+        printf("13. Back\n");
         printf("Choose an option: ");
         scanf("%d", &choice);
         
         switch (choice) {
-            case 1:
-            printf("\e[1;1H\e[2J");
-                userInSys();
+            case 1: {
+                printf("\e[1;1H\e[2J");
+                int id;
+                printf("Enter Book ID: ");
+                scanf("%d", &id);
+                printf("\e[1;1H\e[2J");
+                Book* book = searchBookById(bookRoot, id);
+                if (book != NULL) {
+                    displayBook(book);
+                } else {
+                    printf("Book not found!\n");
+                }
                 Sleep(2000);
                 break;
-            case 2:
-            printf("\e[1;1H\e[2J");
-                editUser();
+            }
+            case 2: {
+                printf("\e[1;1H\e[2J");
+                char title[MAX_TITLE_LENGTH];
+                printf("Enter Book Title (or part of it): ");
+                while ((getchar()) != '\n'); // Clear input buffer
+                fgets(title, MAX_TITLE_LENGTH, stdin);
+                title[strcspn(title, "\n")] = '\0';
+
+                Book* book = searchBookByTitle(bookRoot, title);
+                printf("\e[1;1H\e[2J");
+                if (book != NULL) {
+                    displayBook(book);
+                } else {
+                    printf("No books found matching '%s'\n", title);
+                }
+                Sleep(2000);
+                break;
+            }
+            case 3: {
+                int id;
+                printf("\e[1;1H\e[2J");
+                printf("Enter User ID: ");
+                scanf("%d", &id);
+                User* user = searchUserById(id);
+                printf("\e[1;1H\e[2J");
+                if (user != NULL) {
+                    displayUser(user);
+                } else {
+                    printf("User not found!\n");
+                }
+                Sleep(2000);
+                break;
+            }
+            case 4: {
+                printf("\e[1;1H\e[2J");
+                char name[MAX_NAME_LENGTH];
+                printf("Enter User Name: ");
+                while ((getchar()) != '\n'); // Clear input buffer
+                fgets(name, MAX_NAME_LENGTH, stdin);
+                name[strcspn(name, "\n")] = '\0';
+                User* user = searchUserByName(name);
+                printf("\e[1;1H\e[2J");
+                if (user != NULL) {
+                    displayUser(user);
+                } else {
+                    printf("User not found!\n");
+                }
                 Sleep(2000);
                 break;
-            case 3:
-            printf("\e[1;1H\e[2J");
-                viewUser();
-                Sleep(2000);
+            }
+            case 5: {
+                printf("\e[1;1H\e[2J");
+                char title[MAX_TITLE_LENGTH];
+                printf("Enter Book Title (or part of it): ");
+                while ((getchar()) != '\n'); // Clear input buffer
+                fgets(title, MAX_TITLE_LENGTH, stdin);
+                title[strcspn(title, "\n")] = '\0';
+                printf("\e[1;1H\e[2J");
+                listBooksByTitle(title);
+                Sleep(5000);
                 break;
-            case 4:
-            printf("\e[1;1H\e[2J");
-                deleteUser();
-                Sleep(2000);
+            }
+            case 6: {
+                printf("\e[1;1H\e[2J");
+                int field;
+                char query[MAX_TITLE_LENGTH];
+                printf("Search in: 1. Title  2. Author  3. User Name\n");
+                printf("Choose an option: ");
+                scanf("%d", &field);
+                printf("Enter search text (typos allowed): ");
+                while ((getchar()) != '\n'); // Clear input buffer
+                fgets(query, MAX_TITLE_LENGTH, stdin);
+                query[strcspn(query, "\n")] = '\0';
+                printf("\e[1;1H\e[2J");
+                switch (field) {
+                    case 1:
+                        fuzzySearchBooks(titleTree, query);
+                        break;
+                    case 2:
+                        fuzzySearchBooks(authorTree, query);
+                        break;
+                    case 3:
+                        fuzzySearchUsers(query);
+                        break;
+                    default:
+                        printf("Invalid choice!\n");
+                }
+                Sleep(5000);
                 break;
-            case 5:
-            printf("\e[1;1H\e[2J");
-                displayAllUsers();
+            }
+            case 7: {
+                printf("\e[1;1H\e[2J");
+                int field;
+                char prefix[MAX_TITLE_LENGTH];
+                printf("Complete: 1. Title  2. Author  3. User Name\n");
+                printf("Choose an option: ");
+                scanf("%d", &field);
+                printf("Start typing: ");
+                while ((getchar()) != '\n'); // Clear input buffer
+                fgets(prefix, MAX_TITLE_LENGTH, stdin);
+                prefix[strcspn(prefix, "\n")] = '\0';
+                printf("\e[1;1H\e[2J");
+                showCompletions(field, prefix);
                 Sleep(5000);
                 break;
-            case 6:
+            }
+            case 8: {
+                printf("\e[1;1H\e[2J");
+                int mode;
+                char author[MAX_AUTHOR_LENGTH];
+                printf("1. Exact author name  2. Author name starts with\n");
+                printf("Choose an option: ");
+                scanf("%d", &mode);
+                printf("Enter author: ");
+                while ((getchar()) != '\n'); // Clear input buffer
+                fgets(author, MAX_AUTHOR_LENGTH, stdin);
+                author[strcspn(author, "\n")] = '\0';
+                printf("\e[1;1H\e[2J");
+                if (mode == 2) {
+                    listBooksByAuthorPrefix(author);
+                } else {
+                    listBooksByAuthor(author);
+                }
+                Sleep(5000);
+                break;
+            }
+            case 9: {
+                printf("\e[1;1H\e[2J");
+                int status;
+                displayStatusCounts();
+                printf("\nList books: 1. Available  2. Borrowed  3. Reserved  0. None\n");
+                printf("Choose an option: ");
+                scanf("%d", &status);
+                if (status >= 1 && status <= STATUS_COUNT) {
+                    printf("\e[1;1H\e[2J");
+                    listBooksByStatus((BookStatus)(status - 1));
+                    Sleep(5000);
+                }
+                break;
+            }
+            case 10: {
+                printf("\e[1;1H\e[2J");
+                char query[MAX_BATCH_LINE];
+                printf("Clauses separated by '|': title~text  author=name  isbn=number\n");
+                printf("  status=available|borrowed|reserved  queue>n  queue<n  queue=n\n");
+                printf("Enter query: ");
+                while ((getchar()) != '\n'); // Clear input buffer
+                fgets(query, MAX_BATCH_LINE, stdin);
+                query[strcspn(query, "\n")] = '\0';
+                printf("\e[1;1H\e[2J");
+                runBookQuery(query);
+                Sleep(5000);
+                break;
+            }
+            case 11:
+                printf("\e[1;1H\e[2J");
+                displayCacheStats();
+                Sleep(5000);
+                break;
+            case 12: {
+                printf("\e[1;1H\e[2J");
+                int mode, page, more = 1;
+                PageCursor cursor;
+                printf("Browse by: 1. Title  2. Author\n");
+                printf("Choose an option: ");
+                scanf("%d", &mode);
+                openPageCursor(&cursor, mode == 2 ? PAGE_AUTHORS : PAGE_TITLES);
+                int total = orderSize(mode == 2 ? authorOrder.root : titleOrder.root);
+                printf("Jump to page (1-%d): ", total > 0 ? (total + REPORT_PAGE_SIZE - 1) / REPORT_PAGE_SIZE : 1);
+                scanf("%d", &page);
+                seekPageCursor(&cursor, page, REPORT_PAGE_SIZE);
+                while (more == 1 && !cursor.finished) {
+                    printf("\e[1;1H\e[2J");
+                    printf("=== Page %d ===\n", page++);
+                    if (showNextPage(&cursor, REPORT_PAGE_SIZE) == 0) {
+                        printf("No books on this page\n");
+                    }
+                    if (cursor.finished) {
+                        Sleep(5000);
+                        break;
+                    }
+                    printf("do you wish to show more ?(1-Yes/0-No)\n");
+                    scanf("%d", &more);
+                }
+                break;
+            }
+            case 13:
                 return;
             default:
                 printf("Invalid choice!\n");
         }
-    } while (choice != 6);
+    } while (choice != 13);
 }
 
 /********************************************/
-/* Book Queue Functions                     */
+/*               Loan Archive               */
 /********************************************/
 
-// Initialize book queue
-void initializeBookQueue(int bookId) {
-    bookQueues[bookId].front = NULL;
-    bookQueues[bookId].rear = NULL;
-    bookQueues[bookId].size = 0;
+// Returned loans older than archiveAgeDays leave the ledger in an
+// archival stage that runs before every save, so returns, availability
+// checks, per-user listings and snapshots walk mostly open loans. They
+// are written as fixed-size ArchivedLoan records to one file per month
+// of their return date (ARCHIVE_PREFIX "YYYYMM.dat"). ARCHIVE_INDEX_FILE
+// keeps the first and last month and the committed record count of each
+// partition, so an ArchiveReader can stream the partitions of a date
+// range in order without listing the directory. Loans the undo log still
+// refers to stay in the ledger until their entries go.
+//
+// Each run is a numbered batch. Its records go after the committed ones
+// and the index, replaced as a whole, commits them; records an aborted
+// run left behind are never read and are overwritten by the next one.
+// Archived loans stay in memory until a save file without them is in
+// place, and that file records the last batch it leaves out. A file
+// behind the index (a save that did not finish) still holds loans of
+// the newer batches; they are dropped from the ledger on load.
+
+// Partition (month) of a return date
+int archiveMonthOf(time_t when) {
+    struct tm* date = localtime(&when);
+    return date != NULL ? (date->tm_year + 1900) * 12 + date->tm_mon : 0;
 }
 
-// Check if queue is empty
-int isQueueEmpty(int bookId) {
-    return bookQueues[bookId].front == NULL;
+// File name of a partition
+void archivePartitionName(int month, char* name, int size) {
+    snprintf(name, size, ARCHIVE_PREFIX "%04d%02d.dat", month / 12, month % 12 + 1);
 }
 
-// Enqueue a user for a book
-void enqueueUser(int bookId, int userId) {
-    QueueNode* newNode = (QueueNode*)malloc(sizeof(QueueNode));
-    if (newNode == NULL) {
-        printf("Memory allocation failed!\n");
-        return;
+// Read the archive index and the committed count of each partition
+// (false, with an empty index, if nothing was archived yet; the caller frees months)
+bool readArchiveIndex(ArchiveIndex* index, int64_t** months) {
+    FILE* file = fopen(ARCHIVE_INDEX_FILE, "rb");
+    *months = NULL;
+    bool read = file != NULL && fread(index, sizeof(ArchiveIndex), 1, file) == 1 && index->magic == ARCHIVE_MAGIC;
+    if (read && index->firstMonth <= index->lastMonth) {
+        long span = (long)index->lastMonth - index->firstMonth + 1;
+        *months = span <= ARCHIVE_MAX_MONTHS ? (int64_t*)malloc(sizeof(int64_t) * span) : NULL;
+        read = *months != NULL && fread(*months, sizeof(int64_t), span, file) == (size_t)span;
     }
-    
-    newNode->userId = userId;
-    newNode->next = NULL;
-    
-    // If queue is empty
-    if (bookQueues[bookId].rear == NULL) {
-        bookQueues[bookId].front = newNode;
-        bookQueues[bookId].rear = newNode;
-    } else {
-        bookQueues[bookId].rear->next = newNode;
-        bookQueues[bookId].rear = newNode;
+    if (file != NULL) {
+        fclose(file);
     }
-    
-    bookQueues[bookId].size++;
+    if (!read) {
+        free(*months);
+        *months = NULL;
+        index->magic = ARCHIVE_MAGIC;
+        index->batch = 0;
+        index->firstMonth = INT_MAX;
+        index->lastMonth = INT_MIN;
+        index->records = 0;
+    }
+    return read;
 }
 
-// Dequeue a user from book queue
-int dequeueUser(int bookId) {
-    if (isQueueEmpty(bookId)) {
-        printf("No users in queue for this book!\n");
-        return -1;
-    }
-    
-    QueueNode* temp = bookQueues[bookId].front;
-    int userId = temp->userId;
-    
-    bookQueues[bookId].front = bookQueues[bookId].front->next;
-    
-    // If front becomes NULL, rear should also be NULL
-    if (bookQueues[bookId].front == NULL) {
-        bookQueues[bookId].rear = NULL;
+// Last archival batch the index has committed (0 if nothing was archived yet)
+int committedArchiveBatch() {
+    ArchiveIndex index;
+    int64_t* months;
+    readArchiveIndex(&index, &months);
+    free(months);
+    return index.batch;
+}
+
+// Write the archive index to a new file and move it over the old one (this commits a batch)
+bool writeArchiveIndex(const ArchiveIndex* index, const int64_t* months) {
+    FILE* file = fopen(ARCHIVE_INDEX_FILE ".tmp", "wb");
+    if (file == NULL) {
+        return false;
     }
-    
-    free(temp);
-    bookQueues[bookId].size--;
-    
-    return userId;
+    long span = index->firstMonth <= index->lastMonth ? (long)index->lastMonth - index->firstMonth + 1 : 0;
+    bool written = fwrite(index, sizeof(ArchiveIndex), 1, file) == 1 &&
+                   fwrite(months, sizeof(int64_t), span, file) == (size_t)span &&
+                   fflush(file) == 0 && _commit(_fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    return written && MoveFileExA(ARCHIVE_INDEX_FILE ".tmp", ARCHIVE_INDEX_FILE,
+                                  MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
 }
 
-// Display all users in queue for a book
-void displayBookQueue(int bookId) {
-    if (isQueueEmpty(bookId)) {
-        printf("No users in queue for this book!\n");
-        return;
+// Widen the partition counts of an index to cover a month
+bool widenArchiveMonths(ArchiveIndex* index, int64_t** months, int month) {
+    if (index->firstMonth <= month && month <= index->lastMonth) {
+        return true;
     }
-    
-    QueueNode* current = bookQueues[bookId].front;
-    int position = 1;
-    
-    printf("Users in queue for book ID %d:\n", bookId);
-    printf("---------------------------\n");
-    
-    while (current != NULL) {
-        User* user = searchUserById(current->userId);
-        printf("Position %d: %s (ID: %d)\n", position, user->name, user->id);
-        current = current->next;
-        position++;
+    int first = month < index->firstMonth ? month : index->firstMonth;
+    int last = month > index->lastMonth ? month : index->lastMonth;
+    int64_t* widened = (int64_t*)calloc((size_t)(last - first) + 1, sizeof(int64_t));
+    if (widened == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
     }
+    if (*months != NULL) {
+        memcpy(widened + (index->firstMonth - first), *months,
+               sizeof(int64_t) * ((size_t)(index->lastMonth - index->firstMonth) + 1));
+    }
+    free(*months);
+    *months = widened;
+    index->firstMonth = first;
+    index->lastMonth = last;
+    return true;
 }
 
-/********************************************/
-/* Borrow Record Functions                  */
-/********************************************/
-
-// Create a new borrow record
-BorrowRecord* createBorrowRecord(int userId, int bookId) {
-    BorrowRecord* newRecord = (BorrowRecord*)malloc(sizeof(BorrowRecord));
-    if (newRecord == NULL) {
-        printf("Memory allocation failed!\n");
-        return NULL;
+// Write a run of loans after the committed records of a partition (a new partition starts with the magic)
+bool writeArchivePartition(int month, int64_t committed, const ArchivedLoan* loans, int count) {
+    char name[64];
+    archivePartitionName(month, name, sizeof(name));
+    FILE* file = fopen(name, committed > 0 ? "r+b" : "wb");
+    if (file == NULL) {
+        return false;
     }
-    
-    newRecord->userId = userId;
-    newRecord->bookId = bookId;
-    newRecord->borrowDate = time(NULL);
-    newRecord->dueDate = newRecord->borrowDate + (1209600); // 14 days loan period
-    newRecord->returned = false;
-    newRecord->returnDate = 0;
-    newRecord->next = NULL;
-    
-    return newRecord;
+    uint32_t magic = ARCHIVE_MAGIC;
+    bool written = (committed > 0 || fwrite(&magic, sizeof(magic), 1, file) == 1) &&
+                   fseek(file, (long)(sizeof(magic) + committed * sizeof(ArchivedLoan)), SEEK_SET) == 0 &&
+                   fwrite(loans, sizeof(ArchivedLoan), count, file) == (size_t)count &&
+                   fflush(file) == 0 && _commit(_fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    return written;
 }
 
-// Add borrow record to list
-void addBorrowRecord(BorrowRecord* newRecord) {
-    if (borrowRecords == NULL) {
-        borrowRecords = newRecord;
-    } else {
-        BorrowRecord* current = borrowRecords;
-        while (current->next != NULL) {
-            current = current->next;
+// Check if the undo log still refers to a loan
+bool loanInUndoLog(const BorrowRecord* record) {
+    for (int i = 0; i < undoLog.count; i++) {
+        UndoEntry* entry = undoEntryAt(i);
+        if (sameHandle(entry->loan, record->handle) ||
+            (entry->action == UNDO_BORROWED && sameHandle(entry->before.tail, record->handle))) {
+            return true;
         }
-        current->next = newRecord;
     }
-    borrowCount++;
+    return false;
 }
 
-// Mark a book as returned
-void returnBook(int bookId, int userId) {
-    BorrowRecord* current = borrowRecords;
-    User* user = searchUserById(userId);
-    while (current != NULL) {
-        if (current->bookId == bookId && current->userId == userId && !current->returned) {
-            current->returned = true;
-            current->returnDate = time(NULL);
-            if(difftime(current->dueDate , time(NULL)) < 0){
-                user->status=SUSPENDED;
-            }
-            
-            // Update book status
-            Book* book = searchBookById(bookRoot, bookId);
-            if (book != NULL) {
-                // Check if there are users in queue
-                if (!isQueueEmpty(bookId)) {
-                    book->status = RESERVED;
-                } else {
-                    book->status = AVAILABLE;
-                }
-            }
-            user->borrowCount--;
-            pushToReturnHistory(bookId,userId);
-            printf("Book returned successfully!\n");
-            return;
-        }
-        current = current->next;
+// Check if a loan is due for the archive
+bool isArchivable(const BorrowRecord* record, time_t cutoff) {
+    return record->returned && record->archiveBatch == 0 && record->returnDate < cutoff && !loanInUndoLog(record);
+}
+
+// Order archive candidates by partition, then return date
+int compareArchiveCandidates(const void* a, const void* b) {
+    const ArchiveCandidate* x = (const ArchiveCandidate*)a;
+    const ArchiveCandidate* y = (const ArchiveCandidate*)b;
+    if (x->month != y->month) {
+        return x->month < y->month ? -1 : 1;
     }
-    
-    printf("No matching borrow record found!\n");
+    return x->loan.returnDate < y->loan.returnDate ? -1 : x->loan.returnDate > y->loan.returnDate;
 }
 
-//adds returns to stack
-void pushToReturnHistory(int bookId , int userId) {
-    RStackNode* newNode = (RStackNode*)malloc(sizeof(RStackNode));
-    newNode->next = NULL ; 
-    if (newNode == NULL) {
+// Copy loans returned before cutoff into the archive as a new batch and
+// mark them with it; returns how many (-1 on a write error, with none marked)
+long archiveClosedLoans(time_t cutoff) {
+    long count = 0;
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        if (isArchivable(record, cutoff)) {
+            count++;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    ArchiveCandidate* candidates = (ArchiveCandidate*)malloc(sizeof(ArchiveCandidate) * count);
+    ArchivedLoan* run = (ArchivedLoan*)malloc(sizeof(ArchivedLoan) * count);
+    if (candidates == NULL || run == NULL) {
         printf("Memory allocation failed!\n");
-        return;
+        free(candidates);
+        free(run);
+        return -1;
     }
-    
-    newNode->bookId = bookId;
-    newNode->userId = userId;
-    newNode->returnDate = time(NULL);
-    newNode->next = returnStack->top;
-    returnStack->top = newNode;
-    
-    // Limit stack size
-    if (returnStack->size > MAX_STACK_SIZE) {
-        // Remove bottom node
-        RStackNode* current = returnStack->top;
-        RStackNode* prev = NULL;
-        
-        while (current->next != NULL) {
-            prev = current;
-            current = current->next;
+    ArchiveIndex index;
+    int64_t* months;
+    FILE* existing = readArchiveIndex(&index, &months) ? NULL : fopen(ARCHIVE_INDEX_FILE, "rb");
+    if (existing != NULL) {
+        // Writing over partitions an unreadable index describes would lose them
+        fclose(existing);
+        printf("%s is not an archive index this program can read; move it aside to archive again.\n", ARCHIVE_INDEX_FILE);
+        free(candidates);
+        free(run);
+        return -1;
+    }
+    int batch = index.batch + 1;
+    long filled = 0;
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        if (isArchivable(record, cutoff)) {
+            ArchivedLoan loan = {record->userId, record->bookId, record->borrowDate, record->dueDate,
+                                 record->returnDate, batch, 0};
+            candidates[filled].month = archiveMonthOf(record->returnDate);
+            candidates[filled++].loan = loan;
         }
-        
-        if (prev != NULL) {
-            prev->next = NULL;
-            free(current);
-            returnStack->size--;
+    }
+    qsort(candidates, count, sizeof(ArchiveCandidate), compareArchiveCandidates);
+
+    // One write per partition, then the index commits them all
+    bool written = true;
+    for (long start = 0; start < count && written; ) {
+        int month = candidates[start].month;
+        int length = 0;
+        while (start + length < count && candidates[start + length].month == month) {
+            run[length] = candidates[start + length].loan;
+            length++;
+        }
+        written = widenArchiveMonths(&index, &months, month) &&
+                  writeArchivePartition(month, months[month - index.firstMonth], run, length);
+        if (written) {
+            months[month - index.firstMonth] += length;
+        }
+        start += length;
+    }
+    index.batch = batch;
+    index.records += count;
+    written = written && writeArchiveIndex(&index, months);
+    free(months);
+    free(candidates);
+    free(run);
+    if (!written) {
+        return -1;
+    }
+
+    // Mark the archived loans; they leave the ledger once a save without them is in place
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        if (isArchivable(record, cutoff)) {
+            record->archiveBatch = batch;
+            commitLoanChange(record);
         }
     }
+    return count;
 }
 
-//view last return
-void displayLastReturn() {
+// Unlink the loans marked as archived; returns how many
+long unlinkArchivedLoans() {
+    long count = 0;
+    BorrowRecord** link = &borrowRecords;
+    borrowTail = NULL;
+    while (*link != NULL) {
+        BorrowRecord* record = *link;
+        if (record->archiveBatch != 0) {
+            *link = record->next;
+            handleRelease(&loanHandles, record->handle);
+            poolFree(&loanPool, record);
+            borrowCount--;
+            count++;
+        } else {
+            borrowTail = record;
+            link = &record->next;
+        }
+    }
+    return count;
+}
 
-    Book* returnedBook = searchBookById(bookRoot , returnStack->top->bookId);
-    User* user = searchUserById(returnStack->top->userId);
-    struct tm* rettime;
-    rettime = localtime(&(returnStack->top->returnDate));
-    printf("%s has been returned by %s on %s" , returnedBook->title , user->name , asctime(rettime));
+// Drop the archived loans from the ledger (once the save file no longer holds them)
+void dropArchivedLoans() {
+    if (unlinkArchivedLoans() > 0) {
+        rebuildLedgerColumns();
+        commitLedgerChange();
+    }
+}
 
+// The archival stage: archive loans returned more than archiveAgeDays ago
+void runArchivalStage() {
+    if (archiveAgeDays < 0) {
+        return;
+    }
+    long archived = archiveClosedLoans(time(NULL) - (time_t)archiveAgeDays * 24 * 60 * 60);
+    if (archived > 0) {
+        printf("%ld returned loan(s) moved to the archive\n", archived);
+    } else if (archived < 0) {
+        printf("Error writing the loan archive! The loans stay in the ledger.\n");
+    }
 }
 
-//undo last return 
-void undoLastReturn(){
+// Start streaming the archived loans returned between from and to (0 = open-ended)
+bool openArchiveReader(ArchiveReader* reader, time_t from, time_t to) {
+    ArchiveIndex index;
+    reader->file = NULL;
+    reader->count = 0;
+    reader->next = 0;
+    reader->from = from;
+    reader->to = to;
+    if (!readArchiveIndex(&index, &reader->months) || reader->months == NULL) {
+        reader->month = 1;
+        reader->lastMonth = 0;
+        return false;
+    }
+    reader->firstMonth = index.firstMonth;
+    reader->month = from != 0 && archiveMonthOf(from) > index.firstMonth ? archiveMonthOf(from) : index.firstMonth;
+    reader->lastMonth = to != 0 && archiveMonthOf(to) < index.lastMonth ? archiveMonthOf(to) : index.lastMonth;
+    return true;
+}
 
-Book* book = searchBookById(bookRoot , returnStack->top->bookId);
+// Read the next block of the reader's partitions (false when they are exhausted)
+bool fillArchiveReader(ArchiveReader* reader) {
+    while (reader->month <= reader->lastMonth) {
+        if (reader->file == NULL) {
+            char name[64];
+            uint32_t magic = 0;
+            reader->remaining = reader->months[reader->month - reader->firstMonth];
+            archivePartitionName(reader->month, name, sizeof(name));
+            reader->file = reader->remaining > 0 ? fopen(name, "rb") : NULL;
+            if (reader->file != NULL && (fread(&magic, sizeof(magic), 1, reader->file) != 1 || magic != ARCHIVE_MAGIC)) {
+                fclose(reader->file);
+                reader->file = NULL;
+            }
+            if (reader->file == NULL) {
+                reader->month++;    // months nothing was returned in have no file
+                continue;
+            }
+        }
+        int wanted = reader->remaining < ARCHIVE_READ_BATCH ? (int)reader->remaining : ARCHIVE_READ_BATCH;
+        reader->count = (int)fread(reader->records, sizeof(ArchivedLoan), wanted, reader->file);
+        reader->remaining -= reader->count;
+        reader->next = 0;
+        if (reader->count > 0) {
+            return true;
+        }
+        fclose(reader->file);
+        reader->file = NULL;
+        reader->month++;
+    }
+    return false;
+}
+
+// Next archived loan in the reader's range (NULL at the end)
+const ArchivedLoan* archiveNext(ArchiveReader* reader) {
+    while (true) {
+        if (reader->next == reader->count && !fillArchiveReader(reader)) {
+            return NULL;
+        }
+        const ArchivedLoan* loan = &reader->records[reader->next++];
+        if ((reader->from == 0 || loan->returnDate >= reader->from) && (reader->to == 0 || loan->returnDate <= reader->to)) {
+            return loan;
+        }
+    }
+}
 
+// Stop streaming
+void closeArchiveReader(ArchiveReader* reader) {
+    if (reader->file != NULL) {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+    free(reader->months);
+    reader->months = NULL;
+}
 
-BorrowRecord* current = borrowRecords;
+// Order loans by who borrowed what and when (an archived loan is found by these fields)
+int compareLoanIdentity(const void* a, const void* b) {
+    const BorrowRecord* x = *(const BorrowRecord* const*)a;
+    const BorrowRecord* y = *(const BorrowRecord* const*)b;
+    if (x->userId != y->userId) {
+        return x->userId < y->userId ? -1 : 1;
+    }
+    if (x->bookId != y->bookId) {
+        return x->bookId < y->bookId ? -1 : 1;
+    }
+    if (x->borrowDate != y->borrowDate) {
+        return x->borrowDate < y->borrowDate ? -1 : 1;
+    }
+    if (x->dueDate != y->dueDate) {
+        return x->dueDate < y->dueDate ? -1 : 1;
+    }
+    return x->returnDate < y->returnDate ? -1 : x->returnDate > y->returnDate;
+}
 
-while(current != NULL ){
-    if(current->bookId == returnStack->top->bookId && current->userId == returnStack->top->userId){
+// Mark the loaded loans that archival batches after savedBatch already
+// hold (left in the file by a save that did not finish); returns how many
+long markArchivedDuplicates(int savedBatch) {
+    static ArchiveReader reader;
+    if (committedArchiveBatch() <= savedBatch) {
+        return 0;
+    }
+    long returned = 0;
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        returned += record->returned;
+    }
+    BorrowRecord** loans = (BorrowRecord**)malloc(sizeof(BorrowRecord*) * (returned > 0 ? returned : 1));
+    if (loans == NULL) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    long filled = 0;
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        if (record->returned) {
+            loans[filled++] = record;
+        }
+    }
+    qsort(loans, returned, sizeof(BorrowRecord*), compareLoanIdentity);
+
+    long marked = 0;
+    if (returned > 0 && openArchiveReader(&reader, 0, 0)) {
+        const ArchivedLoan* loan;
+        while ((loan = archiveNext(&reader)) != NULL) {
+            if (loan->batch <= savedBatch) {
+                continue;
+            }
+            BorrowRecord probe = {0};
+            BorrowRecord* key = &probe;
+            probe.userId = loan->userId;
+            probe.bookId = loan->bookId;
+            probe.borrowDate = (time_t)loan->borrowDate;
+            probe.dueDate = (time_t)loan->dueDate;
+            probe.returnDate = (time_t)loan->returnDate;
+            BorrowRecord** found = (BorrowRecord**)bsearch(&key, loans, returned, sizeof(BorrowRecord*), compareLoanIdentity);
+            if (found == NULL) {
+                continue;
+            }
+            // The same loan may appear more than once; take the first unmarked copy
+            while (found > loans && compareLoanIdentity(found - 1, &key) == 0) {
+                found--;
+            }
+            while (found < loans + returned && compareLoanIdentity(found, &key) == 0 && (*found)->archiveBatch != 0) {
+                found++;
+            }
+            if (found < loans + returned && compareLoanIdentity(found, &key) == 0) {
+                (*found)->archiveBatch = loan->batch;
+                marked++;
+            }
+        }
+        closeArchiveReader(&reader);
+    }
+    free(loans);
+    return marked;
+}
 
-        if(book->status == AVAILABLE){
+// Display the archived loans of a user (QUERY_ANY for everyone) returned between from and to; returns how many
+long displayArchivedLoans(int userId, time_t from, time_t to) {
+    static ArchiveReader reader;
+    if (!openArchiveReader(&reader, from, to)) {
+        return 0;
+    }
+    CatalogSnapshot* catalog = pinCatalogSnapshot();
+    OutputBuffer* out = beginReport();
+    if (catalog == NULL || out == NULL) {
+        releaseCatalogSnapshot(catalog);
+        return 0;
+    }
+    long shown = 0;
+    time_t now = time(NULL);
+    const ArchivedLoan* loan;
+    while ((loan = archiveNext(&reader)) != NULL) {
+        if (userId != QUERY_ANY && loan->userId != userId) {
+            continue;
+        }
+        if (shown == 0) {
+            outText(out, "\n=== Archived Loans ===\n---------------------------\n");
+        }
+        BorrowRecord record = {0};
+        record.userId = loan->userId;
+        record.bookId = loan->bookId;
+        record.user = userHandleById(loan->userId);
+        record.borrowDate = (time_t)loan->borrowDate;
+        record.dueDate = (time_t)loan->dueDate;
+        record.returnDate = (time_t)loan->returnDate;
+        record.returned = true;
+        renderLoan(out, catalog, &record, (int)++shown, now);
+    }
+    closeArchiveReader(&reader);
+    endReport();
+    releaseCatalogSnapshot(catalog);
+    return shown;
+}
 
-            current->returnDate = 0;
-            current->returned = false;
+/********************************************/
+/* File Handling Functions                  */
+/********************************************/
 
-            printf("the return was undone successfully \n");
+// The data file starts with a SaveHeader (format version, last IDs
+// handed out, record counts, the last archival batch whose loans it
+// leaves out and the stamp the journal refers to), then the books,
+// users and loans in fixed-size on-disk forms, then tagged sections for
+// the reservations and the circulation counts. Only source fields are
+// written: fold keys, handles, ledger rows and the borrowed and loan
+// counts are rebuilt on load. A file is read and checked in full before
+// anything in memory is replaced. A save goes to a temporary file that
+// is moved over the old one only once it is completely written. Files
+// of the original version (raw structs, no header) are converted; any
+// other format is refused, and saving stays off until a load succeeds
+// so the file is not overwritten.
+
+// Save book data to file (in ID order, from a pinned snapshot)
+void saveBooks(FILE* file, CatalogSnapshot* snap) {
+    for (int i = 0; i < snap->count; i++) {
+        const Book* book = snapshotBookAt(snap, i);
+        SavedBook saved;
+        memset(&saved, 0, sizeof(SavedBook));
+        saved.id = book->id;
+        strcpy(saved.title, book->title);
+        strcpy(saved.author, book->author);
+        strcpy(saved.isbn, book->isbn);
+        saved.copies = book->copies;
+        saved.held = book->held;
+        fwrite(&saved, sizeof(SavedBook), 1, file);
+    }
+}
 
-            struct tm* rettime;
-            rettime = localtime(&(current->dueDate));
-            book->status =BORROWED;
+// Save user data to file
+void saveUsers(FILE* file) {
+    for (User* current = userList; current != NULL; current = current->next) {
+        SavedUser saved;
+        memset(&saved, 0, sizeof(SavedUser));
+        saved.id = current->id;
+        strcpy(saved.name, current->name);
+        strcpy(saved.user_id, current->user_id);
+        saved.age = current->age;
+        saved.gender = current->gender;
+        saved.status = current->status;
+        fwrite(&saved, sizeof(SavedUser), 1, file);
+    }
+}
 
-            printf("your book return window is still due until %s \n" , asctime(rettime));
+// Save borrow records to file (from a pinned snapshot; archived loans are left out)
+void saveBorrowRecords(FILE* file, LedgerSnapshot* snap) {
+    for (int i = 0; i < snap->count; i++) {
+        const BorrowRecord* record = snapshotLoanAt(snap, i);
+        if (record->archiveBatch != 0) {
+            continue;
         }
-        else{
-            printf("the book you wish to unreturn has been loaned out \n ");
-            printf("do you want to enter the queue for this book ? (1-Yes/0-No): ");
-
-            int choice ;
-            scanf("%d" , &choice);
+        SavedLoan saved = {record->userId, record->bookId, record->borrowDate, record->dueDate,
+                           record->returned ? record->returnDate : 0};
+        fwrite(&saved, sizeof(SavedLoan), 1, file);
+    }
+}
 
-            if (choice == 1) {
-                // Initialize queue if not initialized
-                if (bookQueues[book->id].size == 0) {
-                    initializeBookQueue(book->id);
-                }
-                
-                // Add user to queue
-                enqueueUser(book->id, returnStack->top->userId);
-                printf("\n User added to reservation queue!\n");
-            }
+// Save holds and reservation queues (a tagged section after the loans)
+void saveReservations(FILE* file) {
+    uint32_t magic = RESERVATION_MAGIC;
+    int32_t count = 0;
+    for (int id = 0; id < bookQueueCapacity; id++) {
+        count += bookQueues[id].size + bookQueues[id].holdCount;
+    }
+    fwrite(&magic, sizeof(magic), 1, file);
+    fwrite(&count, sizeof(count), 1, file);
+    for (int id = 0; id < bookQueueCapacity; id++) {
+        for (HoldNode* hold = bookQueues[id].holds; hold != NULL; hold = hold->next) {
+            ReservationRecord record = {id, hold->userId, hold->since, hold->until};
+            fwrite(&record, sizeof(ReservationRecord), 1, file);
+        }
+        for (QueueNode* node = bookQueues[id].front; node != NULL; node = node->next) {
+            ReservationRecord waiter = {id, node->userId, node->since, 0};
+            fwrite(&waiter, sizeof(ReservationRecord), 1, file);
         }
-        break;
     }
-    current = current->next;
 }
-if(current == NULL){
-    printf("no recent returns");
-    return ;
+
+// Save a ranking's counts by ID
+void saveRanking(FILE* file, const CountRanking* ranking) {
+    int32_t capacity = ranking->capacity;
+    fwrite(&capacity, sizeof(capacity), 1, file);
+    fwrite(ranking->counts, sizeof(int64_t), ranking->capacity, file);
 }
-//pop the top
-RStackNode* temp;
-temp = returnStack->top;
-returnStack->top = returnStack->top->next;
-returnStack->size--;
-free(temp);
 
+// Save the circulation counts (a tagged section after the reservations; active borrowers are recounted on load)
+void saveCirculationStats(FILE* file) {
+    uint32_t magic = CIRCULATION_MAGIC;
+    int64_t totals[5] = {circulation.loans, circulation.returns, circulation.lateReturns,
+                         circulation.waits, circulation.waitSeconds};
+    fwrite(&magic, sizeof(magic), 1, file);
+    fwrite(totals, sizeof(int64_t), 5, file);
+    saveRanking(file, &titleBorrows);
+    saveRanking(file, &userLoans);
 }
 
-// Display all borrow records
-void displayAllBorrowRecords() {
-    BorrowRecord* current = borrowRecords;
-    if (current == NULL) {
-        printf("No borrow records found!\n");
-        return;
-    }
-    
-    printf("\n=== All Borrow Records ===\n");
-    printf("---------------------------\n");
-    
-    while (current != NULL) {
-        Book* book = searchBookById(bookRoot, current->bookId);
-        User* user = searchUserById(current->userId);
-        
-        if (book != NULL && user != NULL) {
-            printf("Record ID: %d\n", borrowCount);
-            printf("Book: %s\n", book->title);
-            printf("User: %s\n", user->name);
-            
-            // Convert time_t to readable format
-            char borrowDateStr[26];
-            char dueDateStr[26];
-            
-            strftime(borrowDateStr, sizeof(borrowDateStr), "%Y-%m-%d %H:%M:%S", localtime(&current->borrowDate));
-            strftime(dueDateStr, sizeof(dueDateStr), "%Y-%m-%d %H:%M:%S", localtime(&current->dueDate));
-            
-            printf("Borrow Date: %s\n", borrowDateStr);
-            printf("Due Date: %s\n", dueDateStr);
-            
-            if (current->returned) {
-                char returnDateStr[26];
-                strftime(returnDateStr, sizeof(returnDateStr), "%Y-%m-%d %H:%M:%S", localtime(&current->returnDate));
-                printf("Return Date: %s\n", returnDateStr);
-                printf("Status: Returned\n");
-            } else {
-                printf("Status: Borrowed\n");
-                
-                // Check if overdue
-                time_t now = time(NULL);
-                if (now > current->dueDate) {
-                    printf("OVERDUE!\n");
-                    
-                    // Calculate overdue days
-                    int overdueDays = (now - current->dueDate) / (24 * 60 * 60);
-                    printf("Overdue by: %d days\n", overdueDays);
-                }
-            }
-        } else {
-            printf("Invalid record (Book or User deleted)\n");
+// New stamp for a save (seconds in the high bits, so the stamps of different saves differ)
+int64_t newSaveStamp() {
+    int64_t stamp = ((int64_t)time(NULL) << 20) | ((GetTickCount() ^ (DWORD)rand()) & 0xFFFFF);
+    return stamp == loadedSaveStamp || stamp == 0 ? stamp + 1 : stamp;
+}
+
+// Stamp of a file saved without one (an FNV-1a hash of its bytes, with bit 62 set so it is never a save time)
+int64_t contentStamp(FILE* file) {
+    unsigned char buffer[4096];
+    uint64_t hash = 14695981039346656037ULL;
+    size_t read;
+    fseek(file, 0, SEEK_SET);
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (size_t i = 0; i < read; i++) {
+            hash = (hash ^ buffer[i]) * 1099511628211ULL;
         }
-        
-        printf("---------------------------\n");
-        current = current->next;
     }
+    return (int64_t)((hash & ~(3ULL << 62)) | (1ULL << 62));
 }
 
-// Borrow a book
-void borrowBook() {
+// Save all data to file
+void saveAllData() {
+    if (saveBlocked) {
+        printf("Not saving: %s could not be read when it was loaded. Move it aside, then save again.\n", SAVE_FILE);
+        return;
+    }
 
-    char title[MAX_TITLE_LENGTH],name[MAX_NAME_LENGTH];
+    // Old returned loans go to the archive before the ledger is saved
+    runArchivalStage();
+
+    // Pin both views first so the file reflects a single point in time
+    CatalogSnapshot* catalog = pinCatalogSnapshot();
+    LedgerSnapshot* ledger = pinLedgerSnapshot();
+    if (catalog == NULL || ledger == NULL) {
+        releaseCatalogSnapshot(catalog);
+        releaseLedgerSnapshot(ledger);
+        return;
+    }
 
+    FILE* file = fopen(SAVE_FILE ".tmp", "wb");
+    if (file == NULL) {
+        printf("Error opening file for writing!\n");
+        releaseCatalogSnapshot(catalog);
+        releaseLedgerSnapshot(ledger);
+        return;
+    }
     
-    printf("Enter Book Title (or part of it): ");
-    while ((getchar()) != '\n');
-    fgets(title, MAX_TITLE_LENGTH, stdin);
-    title[strcspn(title, "\n")] = '\0';
+    // Save the header first
+    SaveHeader header = {SAVE_MAGIC, SAVE_VERSION, numbooks, numofuser, catalog->count, 0, 0, committedArchiveBatch(),
+                         newSaveStamp()};
+    for (User* user = userList; user != NULL; user = user->next) {
+        header.users++;
+    }
+    for (int i = 0; i < ledger->count; i++) {
+        header.loans += snapshotLoanAt(ledger, i)->archiveBatch == 0;
+    }
+    fwrite(&header, sizeof(SaveHeader), 1, file);
     
-    printf("Enter User's name: ");
-    fgets(name, MAX_NAME_LENGTH, stdin);
-    name[strcspn(name, "\n")] = '\0';
+    // Save books (BST)
+    saveBooks(file, catalog);
     
-    // Validate book and user
-    Book* book = searchBookByTitle(bookRoot, title);
-    User* user = searchUserByName(name);
+    // Save users (Linked List)
+    saveUsers(file);
     
-    if (book == NULL) {
-        printf("Book not found!\n");
-        return;
-    }
+    // Save borrow records (Linked List)
+    saveBorrowRecords(file, ledger);
     
-    if (user == NULL) {
-        printf("User not found!\n");
-        return;
-    }
+    // Save holds and reservation queues
+    saveReservations(file);
     
-    // Check if user is active
-    if (user->status != ACTIVE) {
-        printf("User account is not active!\n");
+    // Save the circulation counts
+    saveCirculationStats(file);
+    
+    bool written = fflush(file) == 0 && _commit(_fileno(file)) == 0 && !ferror(file);
+    written = fclose(file) == 0 && written;
+    releaseCatalogSnapshot(catalog);
+    releaseLedgerSnapshot(ledger);
+    if (!written || !MoveFileExA(SAVE_FILE ".tmp", SAVE_FILE, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        printf("Error writing %s! The previous save is unchanged.\n", SAVE_FILE);
+        remove(SAVE_FILE ".tmp");
         return;
     }
+    // Everything the journal held is in the file now, and archived loans are out of it
+    remove(JOURNAL_FILE);
+    loadedSaveStamp = header.saveStamp;
+    journalInSequence = true;
+    dropArchivedLoans();
+    printf("Data saved successfully to %s\n", SAVE_FILE);
+}
 
-    if(user->status != ACTIVE || user->borrowCount > MAX_BORROW_LIMIT){
-        printf("user is not eligible to borrow this book");
-        return ;
+// Release what readSavedData allocated
+void freeSavedData(SavedData* data) {
+    free(data->books);
+    free(data->users);
+    free(data->loans);
+    free(data->reservations);
+    memset(data, 0, sizeof(SavedData));
+}
+
+// Read count fixed-size records into a new array
+bool readSavedRecords(FILE* file, void** records, size_t size, int count) {
+    *records = malloc(size * (count > 0 ? count : 1));
+    if (*records == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
     }
+    return fread(*records, size, count, file) == (size_t)count;
+}
 
-    // Check if book is available
-    if (book->status == AVAILABLE) {
-        // Create borrow record
-        BorrowRecord* newRecord = createBorrowRecord(user->id, book->id);
-        addBorrowRecord(newRecord);
-        
-        // Update book status
-        book->status = BORROWED;
-        
-        user->borrowCount++;
-        printf("Book borrowed successfully!\n");
-        
-        // Format due date
-        char dueDateStr[26];
-        strftime(dueDateStr, sizeof(dueDateStr), "%Y-%m-%d %H:%M:%S", localtime(&newRecord->dueDate));
-        printf("Due Date: %s\n", dueDateStr);
-    } else if (book->status == BORROWED) {
-        printf("Book is already borrowed. Would you like to join the reservation queue? (1-Yes/0-No): ");
-        int choice;
-        scanf("%d", &choice);
-        
-        if (choice == 1) {
-            // Initialize queue if not initialized
-            if (bookQueues[book->id].size == 0) {
-                initializeBookQueue(book->id);
-            }
-            
-            // Add user to queue
-            enqueueUser(book->id, user->id);
-            printf("User added to reservation queue!\n");
-        }
-    } else if (book->status == RESERVED) {
-        printf("Book is reserved. Would you like to join the reservation queue? (1-Yes/0-No): ");
-        int choice;
-        scanf("%d", &choice);
-        
-        if (choice == 1) {
-            // Add user to queue
-            enqueueUser(book->id, user->id);
-            printf("User added to reservation queue!\n");
+// Order saved books by ID
+int compareSavedBooks(const void* a, const void* b) {
+    return compareInts(&((const SavedBook*)a)->id, &((const SavedBook*)b)->id);
+}
+
+// Check that the IDs of count records (sorted in place) are positive and distinct
+bool savedIdsDistinct(int* ids, int count) {
+    qsort(ids, count, sizeof(int), compareInts);
+    for (int i = 0; i < count; i++) {
+        if (ids[i] <= 0 || (i > 0 && ids[i] == ids[i - 1])) {
+            return false;
         }
     }
+    return true;
 }
 
-// Reserve a book
-void reserveBook() {
-
-    char title[MAX_TITLE_LENGTH];
-        printf("Enter Book Title (or part of it): ");
-        while ((getchar()) != '\n'); // Clear input buffer
-        fgets(title, MAX_TITLE_LENGTH, stdin);
-        title[strcspn(title, "\n")] = '\0';
-    
-        char name[MAX_NAME_LENGTH];
-        printf("Enter User's name: ");
-        fgets(name, MAX_NAME_LENGTH, stdin);
-        name[strcspn(name, "\n")] = '\0';
-    
-        // Validate book and user
-    Book* book = searchBookByTitle(bookRoot, title);
-    User* user = searchUserByName(name);
-        
-    
-    if (book == NULL) {
-        printf("Book not found!\n");
-        return;
+// Check what was read before any of it is used (strings are terminated, books end up in ID order)
+bool checkSavedData(SavedData* data) {
+    SaveHeader* header = &data->header;
+    if (header->books < 0 || header->users < 0 || header->loans < 0 || data->reservationCount < 0) {
+        return false;
     }
-    
-    if (user == NULL) {
-        printf("User not found!\n");
-        return;
+    qsort(data->books, header->books, sizeof(SavedBook), compareSavedBooks);
+    for (int i = 0; i < header->books; i++) {
+        SavedBook* book = &data->books[i];
+        book->title[MAX_TITLE_LENGTH - 1] = '\0';
+        book->author[MAX_AUTHOR_LENGTH - 1] = '\0';
+        book->isbn[MAX_ISBN_LENGTH - 1] = '\0';
+        if (book->id <= 0 || (i > 0 && book->id == data->books[i - 1].id) ||
+            book->copies < 0 || book->held < 0 || book->held > book->copies) {
+            return false;
+        }
+        if (book->id > header->lastBookId) {
+            header->lastBookId = book->id;
+        }
     }
-    
-    // Check if user is active
-    if (user->status != ACTIVE) {
-        printf("User account is not active!\n");
-        return;
+
+    int* ids = (int*)malloc(sizeof(int) * (header->users > 0 ? header->users : 1));
+    if (ids == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
     }
-    
-    // Initialize queue if not initialized
-    if (bookQueues[book->id].size == 0) {
-        initializeBookQueue(book->id);
+    for (int i = 0; i < header->users; i++) {
+        SavedUser* user = &data->users[i];
+        user->name[MAX_NAME_LENGTH - 1] = '\0';
+        user->user_id[MAX_ID_LENGTH - 1] = '\0';
+        ids[i] = user->id;
+        if (user->status < ACTIVE || user->status > EXPIRED) {
+            free(ids);
+            return false;
+        }
+        if (user->id > header->lastUserId) {
+            header->lastUserId = user->id;
+        }
+    }
+    bool distinct = savedIdsDistinct(ids, header->users);
+    free(ids);
+    if (!distinct) {
+        return false;
     }
 
-    //checks if user is already in queue 
-    int Uid;bool exist = false ;
-    for(int i=0 ; i<bookQueues[book->id].size ; i++){
-        Uid = dequeueUser(book->id);
-
-        if(Uid == user->id){
-        exist = true;
+    for (int i = 0; i < header->loans; i++) {
+        const SavedLoan* loan = &data->loans[i];
+        if (loan->userId <= 0 || loan->bookId <= 0 || loan->returnDate < 0) {
+            return false;
         }
-
-        enqueueUser(book->id , Uid);
     }
-    if(exist){
-        printf("the user is already in the reservation queue");
-        return;
+    for (int i = 0; i < data->reservationCount; i++) {
+        const ReservationRecord* record = &data->reservations[i];
+        if (record->bookId <= 0 || record->userId <= 0) {
+            return false;
+        }
     }
+    return true;
+}
 
-    // Add user to queue
-    enqueueUser(book->id, user->id);
-    
-    // If book is available, mark as reserved
-    if (book->status == AVAILABLE) {
-        book->status = RESERVED;
-        printf("Book reserved successfully! You can pick it up now.\n");
-    } else {
-        printf("User added to reservation queue!\n");
-        printf("Your position in queue: %d\n", bookQueues[book->id].size);
+// Check that the circulation section is whole (it is read once the records are in place)
+bool circulationSectionWhole(FILE* file) {
+    long start = ftell(file);
+    uint32_t magic = 0;
+    int64_t totals[5];
+    bool whole = fread(&magic, sizeof(magic), 1, file) == 1 && magic == CIRCULATION_MAGIC &&
+                 fread(totals, sizeof(int64_t), 5, file) == 5;
+    for (int i = 0; i < 2 && whole; i++) {
+        int32_t capacity = 0;
+        whole = fread(&capacity, sizeof(capacity), 1, file) == 1 && capacity >= 0 &&
+                fseek(file, (long)capacity * (long)sizeof(int64_t), SEEK_CUR) == 0;
     }
+    long end = ftell(file);
+    whole = whole && fseek(file, 0, SEEK_END) == 0 && ftell(file) >= end;
+    fseek(file, start, SEEK_SET);
+    return whole;
 }
 
-// Cancel reservation 
-void cancelReservation() {
-    int userId;
-    char title[MAX_TITLE_LENGTH];
-        printf("Enter Book Title (or part of it): ");
-        while ((getchar()) != '\n'); // Clear input buffer
-        fgets(title, MAX_TITLE_LENGTH, stdin);
-        title[strcspn(title, "\n")] = '\0';
-    
-        printf("Enter User ID: ");
-        scanf("%d", &userId);
-        
-        // Validate book    
-    Book* book = searchBookByTitle(bookRoot, title);
-    if (book == NULL) {
-        printf("Book not found!\n");
-        return;
+// Read a data file in the current format (the magic has been read)
+bool readCurrentData(FILE* file, SavedData* data) {
+    SaveHeader* header = &data->header;
+    header->magic = SAVE_MAGIC;
+    uint32_t magic = 0;
+    int32_t count = 0;
+    if (fread(&header->version, sizeof(uint32_t), 1, file) != 1) {
+        printf("%s ends inside its header.\n", SAVE_FILE);
+        return false;
     }
-    
-    if (bookQueues[book->id].size == 0 && book->status == RESERVED) {
-        book->status = AVAILABLE;
-        printf("Book is available for borrowing");
-        return ;
+    if (header->version < 1 || header->version > SAVE_VERSION) {
+        printf("%s is format version %u; this program reads versions 1 to %d.\n", SAVE_FILE, header->version, SAVE_VERSION);
+        return false;
     }
-
-    // Check if queue exists
-    if (bookQueues[book->id].size == 0) {
-        printf("No reservations for this book!\n");
-        return;
+    // Version 1 headers end before the archive watermark (0: any archived loan may be in the file),
+    // version 2 headers before the stamp (0: no journal continues the file)
+    int fields = header->version == 1 ? 5 : 6;
+    header->archiveBatch = 0;
+    header->saveStamp = 0;
+    if (fread(&header->lastBookId, sizeof(int32_t), fields, file) != (size_t)fields ||
+        (header->version >= 3 && fread(&header->saveStamp, sizeof(int64_t), 1, file) != 1)) {
+        printf("%s ends inside its header.\n", SAVE_FILE);
+        return false;
     }
-    
-    // Find and remove user from queue
-    int Uid;bool exist = false ;
-    for(int i=0 ; i<bookQueues[book->id].size ; i++){
-        Uid = dequeueUser(book->id);
+    if (header->books < 0 || header->users < 0 || header->loans < 0 ||
+        !readSavedRecords(file, (void**)&data->books, sizeof(SavedBook), header->books) ||
+        !readSavedRecords(file, (void**)&data->users, sizeof(SavedUser), header->users) ||
+        !readSavedRecords(file, (void**)&data->loans, sizeof(SavedLoan), header->loans) ||
+        fread(&magic, sizeof(magic), 1, file) != 1 || magic != RESERVATION_MAGIC ||
+        fread(&count, sizeof(count), 1, file) != 1 || count < 0 ||
+        !readSavedRecords(file, (void**)&data->reservations, sizeof(ReservationRecord), count) ||
+        !circulationSectionWhole(file)) {
+        printf("%s is shorter than its header says.\n", SAVE_FILE);
+        return false;
+    }
+    data->reservationCount = count;
+    return true;
+}
 
-        if(Uid == userId){
-        exist = true;
+// Read original-layout records into their saved forms
+bool readLegacyRecords(FILE* file, SavedData* data) {
+    SaveHeader* header = &data->header;
+    data->books = (SavedBook*)calloc(header->books > 0 ? header->books : 1, sizeof(SavedBook));
+    data->users = (SavedUser*)calloc(header->users > 0 ? header->users : 1, sizeof(SavedUser));
+    data->loans = (SavedLoan*)calloc(header->loans > 0 ? header->loans : 1, sizeof(SavedLoan));
+    if (data->books == NULL || data->users == NULL || data->loans == NULL) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    for (int i = 0; i < header->books; i++) {
+        LegacyBook book;
+        if (fread(&book, sizeof(LegacyBook), 1, file) != 1) {
+            return false;
+        }
+        SavedBook* saved = &data->books[i];
+        saved->id = book.id;
+        memcpy(saved->title, book.title, MAX_TITLE_LENGTH);
+        memcpy(saved->author, book.author, MAX_AUTHOR_LENGTH);
+        memcpy(saved->isbn, book.isbn, MAX_ISBN_LENGTH);
+        saved->copies = 1;
+    }
+    for (int i = 0; i < header->users; i++) {
+        LegacyUser user;
+        if (fread(&user, sizeof(LegacyUser), 1, file) != 1) {
+            return false;
         }
+        SavedUser* saved = &data->users[i];
+        saved->id = user.id;
+        memcpy(saved->name, user.name, MAX_NAME_LENGTH);
+        memcpy(saved->user_id, user.user_id, MAX_ID_LENGTH);
+        saved->age = user.age;
+        saved->gender = user.gender;
+        saved->status = user.status;
+    }
+    for (int i = 0; i < header->loans; i++) {
+        LegacyLoan loan;
+        if (fread(&loan, sizeof(LegacyLoan), 1, file) != 1) {
+            return false;
+        }
+        SavedLoan* saved = &data->loans[i];
+        saved->userId = loan.userId;
+        saved->bookId = loan.bookId;
+        saved->borrowDate = loan.borrowDate;
+        saved->dueDate = loan.dueDate;
+        // A returned loan needs a return date to stay closed
+        saved->returnDate = !loan.returned ? 0 : loan.returnDate != 0 ? loan.returnDate : loan.borrowDate;
+    }
+    return true;
+}
 
-        if(!exist){
-        enqueueUser(book->id , Uid);
+// Read a data file of the original version: three counters, then raw
+// books, users and loans. The book and user counters are the last IDs
+// handed out, so after deletions the file holds fewer records than they
+// say; every split that fits the file size is tried, fewest deletions first.
+bool readLegacyData(FILE* file, SavedData* data) {
+    int32_t counters[3];
+    if (fseek(file, 0, SEEK_END) != 0) {
+        return false;
+    }
+    long size = ftell(file);
+    if (size < (long)sizeof(counters) || fseek(file, 0, SEEK_SET) != 0 ||
+        fread(counters, sizeof(int32_t), 3, file) != 3 ||
+        counters[0] < 0 || counters[1] < 0 || counters[2] < 0) {
+        return false;
+    }
+    long records = size - (long)sizeof(counters) - (long)counters[2] * (long)sizeof(LegacyLoan);
+    for (int books = counters[0]; books >= 0 && records >= 0; books--) {
+        long rest = records - (long)books * (long)sizeof(LegacyBook);
+        if (rest < 0 || rest % sizeof(LegacyUser) != 0 || rest / sizeof(LegacyUser) > (unsigned long)counters[1]) {
+            continue;
+        }
+        freeSavedData(data);
+        data->header = (SaveHeader){SAVE_MAGIC, 0, counters[0], counters[1], books, (int32_t)(rest / sizeof(LegacyUser)), counters[2], 0, 0};
+        if (fseek(file, sizeof(counters), SEEK_SET) == 0 && readLegacyRecords(file, data) && checkSavedData(data)) {
+            return true;
         }
     }
-    if(exist){
-        bookQueues[book->id].size--;
-        printf("Reservation cancelled successfully!\n");
+    return false;
+}
+
+// Read and check the whole data file (converted is set for an original-version file)
+bool readSavedData(FILE* file, SavedData* data, bool* converted) {
+    uint32_t magic = 0;
+    *converted = false;
+    if (fread(&magic, sizeof(magic), 1, file) == 1 && magic == SAVE_MAGIC) {
+        if (!readCurrentData(file, data)) {
+            return false;
+        }
+        if (!checkSavedData(data)) {
+            printf("%s holds records that are out of range or repeated.\n", SAVE_FILE);
+            return false;
+        }
+        return true;
     }
+    if (!readLegacyData(file, data)) {
+        printf("%s is not a library data file this program can read.\n", SAVE_FILE);
+        return false;
     }
+    *converted = true;
+    return true;
+}
 
-// Check book availability
-void checkBookAvailability() {
-    char title[MAX_TITLE_LENGTH];
-        printf("Enter Book Title (or part of it) to check : ");
-        while ((getchar()) != '\n'); // Clear input buffer
-        fgets(title, MAX_TITLE_LENGTH, stdin);
-        title[strcspn(title, "\n")] = '\0';
-    
-    Book* book = searchBookByTitle(bookRoot, title);
+// Build a balanced BST from books sorted by ID
+Book* buildBalancedBooks(Book** books, int lo, int hi) {
+    if (lo > hi) {
+        return NULL;
+    }
+    int mid = lo + (hi - lo) / 2;
+    Book* root = books[mid];
+    root->left = buildBalancedBooks(books, lo, mid - 1);
+    root->right = buildBalancedBooks(books, mid + 1, hi);
+    return root;
+}
 
-    if (book == NULL) {
-        printf("Book not found!\n");
-        return;
+// Rebuild the BST from saved books (sorted by ID when checked)
+Book* loadBooks(const SavedBook* saved, int bookCount) {
+    Book** books = (Book**)malloc(sizeof(Book*) * (bookCount > 0 ? bookCount : 1));
+    if (books == NULL) {
+        printf("Memory allocation failed!\n");
+        return NULL;
     }
-    
-    printf("Book: %s by %s\n", book->title, book->author);
-    printf("Status: ");
-    
-    switch (book->status) {
-        case AVAILABLE:
-            printf("Available for borrowing\n");
+    int loaded = 0;
+    for (int i = 0; i < bookCount; i++) {
+        Book* book = (Book*)poolAlloc(&bookPool);
+        if (book == NULL || !reserveBookQueues(saved[i].id)) {
+            poolFree(&bookPool, book);
+            printf("Memory allocation failed!\n");
             break;
-        case BORROWED:
-            printf("Currently borrowed\n");
-            
-            // Find who borrowed it
-            BorrowRecord* current = borrowRecords;
-            while (current != NULL) {
-                if (current->bookId == book->id&& !current->returned) {
-                    User* user = searchUserById(current->userId);
-                    if (user != NULL) {
-                        printf("Borrowed by: %s\n", user->name);
-                        
-                        // Format due date
-                        char dueDateStr[26];
-                        strftime(dueDateStr, sizeof(dueDateStr), "%Y-%m-%d %H:%M:%S", localtime(&current->dueDate));
-                        printf("Due Date: %s\n", dueDateStr);
-                    }
-                    break;
-                }
-                current = current->next;
-            }
-            
-            // Show queue length
-            if (bookQueues[book->id].size > 0) {
-                printf("Reservation Queue Length: %d\n", bookQueues[book->id].size);
-            }
+        }
+        memset(book, 0, sizeof(Book));
+        book->id = saved[i].id;
+        strcpy(book->title, saved[i].title);
+        strcpy(book->author, saved[i].author);
+        strcpy(book->isbn, saved[i].isbn);
+        book->copies = saved[i].copies;
+        book->held = saved[i].held;
+        book->status = copyStatus(book);
+        book->handle = handleAcquire(&bookHandles, book);
+        refreshBookKeys(book);
+        books[loaded++] = book;
+    }
+    Book* root = buildBalancedBooks(books, 0, loaded - 1);
+    free(books);
+    return root;
+}
+
+// Rebuild the user list from saved users
+void loadUsers(const SavedUser* saved, int userCount) {
+    userList = NULL;
+    User* prev = NULL;
+    for (int i = 0; i < userCount; i++) {
+        User* user = (User*)poolAlloc(&userPool);
+        if (user == NULL) {
+            printf("Memory allocation failed!\n");
             break;
-        case RESERVED:
-            printf("Reserved\n");
-            
-            // Show first person in queue
-            if (bookQueues[book->id].front != NULL) {
-                User* user = searchUserById(bookQueues[book->id].front->userId);
-                if (user != NULL) {
-                    printf("Reserved for: %s\n", user->name);
-                }
-                
-                // Show queue length
-                if (bookQueues[book->id].size > 1) {
-                    printf("Additional Reservations: %d\n", bookQueues[book->id].size - 1);
-                }
-            }
+        }
+        memset(user, 0, sizeof(User));
+        user->id = saved[i].id;
+        strcpy(user->name, saved[i].name);
+        strcpy(user->user_id, saved[i].user_id);
+        user->age = saved[i].age;
+        user->gender = (char)saved[i].gender;
+        user->status = (UserStatus)saved[i].status;
+        user->handle = handleAcquire(&userHandles, user);
+        refreshUserKeys(user);
+        if (prev == NULL) {
+            userList = user;
+        } else {
+            prev->next = user;
+        }
+        prev = user;
+    }
+}
+
+// Rebuild the ledger from saved loans
+void loadBorrowRecords(const SavedLoan* saved, int recordCount) {
+    borrowRecords = NULL;
+    BorrowRecord* prev = NULL;
+    for (int i = 0; i < recordCount; i++) {
+        BorrowRecord* record = (BorrowRecord*)poolAlloc(&loanPool);
+        if (record == NULL) {
+            printf("Memory allocation failed!\n");
             break;
+        }
+        memset(record, 0, sizeof(BorrowRecord));
+        record->userId = saved[i].userId;
+        record->bookId = saved[i].bookId;
+        record->borrowDate = (time_t)saved[i].borrowDate;
+        record->dueDate = (time_t)saved[i].dueDate;
+        record->returned = saved[i].returnDate != 0;
+        record->returnDate = (time_t)saved[i].returnDate;
+        record->handle = handleAcquire(&loanHandles, record);
+        if (prev == NULL) {
+            borrowRecords = record;
+        } else {
+            prev->next = record;
+        }
+        prev = record;
     }
+    borrowTail = prev;
 }
 
-// Process next reservation
-void processNextReservation() {
-    char title[MAX_TITLE_LENGTH];
-        printf("Enter Book Title (or part of it): ");
-        while ((getchar()) != '\n'); // Clear input buffer
-        fgets(title, MAX_TITLE_LENGTH, stdin);
-        title[strcspn(title, "\n")] = '\0';
-    
-    Book* book = searchBookByTitle(bookRoot, title);
+// Bind the handles of loaded loans, holds and queued waiters (once the indexes are built)
+void bindLoadedHandles() {
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        Book* book = searchBookById(bookRoot, record->bookId);
+        record->book = book != NULL ? book->handle : NULL_HANDLE;
+        record->user = userHandleById(record->userId);
+    }
+    for (int id = 0; id < bookQueueCapacity; id++) {
+        for (HoldNode* hold = bookQueues[id].holds; hold != NULL; hold = hold->next) {
+            hold->user = userHandleById(hold->userId);
+        }
+        for (QueueNode* node = bookQueues[id].front; node != NULL; node = node->next) {
+            node->user = userHandleById(node->userId);
+        }
+    }
+}
 
-    if (book == NULL) {
-        printf("Book not found!\n");
+// Settle the copy counts and status of loaded books (a title never has fewer copies than are out or held)
+void settleLoadedCopies(Book* root) {
+    if (root == NULL) {
         return;
     }
-    
-    if (book->status != AVAILABLE && book->status != RESERVED) {
-        printf("Book is not available for reservation processing!\n");
-        return;
+    if (root->copies < root->borrowed + root->held) {
+        root->copies = root->borrowed + root->held;
     }
-    
-    if (isQueueEmpty(book->id)) {
-        printf("No reservations in queue for this book!\n");
-        return;
+    root->status = copyStatus(root);
+    settleLoadedCopies(root->left);
+    settleLoadedCopies(root->right);
+}
+
+// Rebuild the borrowed and loan counts from the open loans (they are not saved)
+void countLoadedLoans() {
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        if (record->returned) {
+            continue;
+        }
+        Book* book = bookFromHandle(record->book);
+        User* user = userFromHandle(record->user);
+        if (book != NULL) {
+            book->borrowed++;
+        }
+        if (user != NULL) {
+            user->borrowCount++;
+        }
     }
-    
-    // Dequeue next user
-    int userId = dequeueUser(book->id);
-    if (userId == -1) {
-        return;
+    settleLoadedCopies(bookRoot);
+    rebuildStatusBitmaps();
+}
+
+
+
+// Drop every hold, queued waiter and hold timer
+void clearReservations() {
+    for (int id = 0; id < bookQueueCapacity; id++) {
+        while (!isQueueEmpty(id)) {
+            dequeueUser(id);
+        }
+        clearHolds(id);
     }
-    
-    User* user = searchUserById(userId);
-    if (user == NULL) {
-        printf("User not found!\n");
-        return;
+    for (int level = 0; level < HOLD_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < HOLD_WHEEL_SLOTS; slot++) {
+            HoldTimer* timer = wheelTake(&holdWheel, level, slot);
+            while (timer != NULL) {
+                HoldTimer* next = timer->next;
+                poolFree(&holdTimerPool, timer);
+                timer = next;
+            }
+        }
     }
-    
-    // Create borrow record
-    BorrowRecord* newRecord = createBorrowRecord(userId, book->id);
-    addBorrowRecord(newRecord);
-    
-    // Update book status
-    book->status = BORROWED;
-    
-    printf("Reservation processed successfully!\n");
-    printf("Book '%s' is now borrowed by %s\n", book->title, user->name);
-    
-    // Format due date
-    char dueDateStr[26];
-    strftime(dueDateStr, sizeof(dueDateStr), "%Y-%m-%d %H:%M:%S", localtime(&newRecord->dueDate));
-    printf("Due Date: %s\n", dueDateStr);
+    holdWheel.count = 0;
 }
 
-// Return a borrowed book
-void returnBookMenu() {
-    char title[MAX_TITLE_LENGTH];
-        printf("Enter Book Title (or part of it): ");
-        while ((getchar()) != '\n'); // Clear input buffer
-        fgets(title, MAX_TITLE_LENGTH, stdin);
-        title[strcspn(title, "\n")] = '\0';
+// Rebuild holds and reservation queues from saved reservations
+void loadReservations(const ReservationRecord* saved, int count) {
+    clearReservations();
+    for (int i = 0; i < count; i++) {
+        const ReservationRecord* record = &saved[i];
+        if (!reserveBookQueues(record->bookId)) {
+            continue;
+        }
+        if (record->holdUntil != 0) {
+            appendHold(record->bookId, record->userId, (time_t)record->holdSince, (time_t)record->holdUntil);
+        } else {
+            // A waiter without a join time starts waiting now
+            enqueueUser(record->bookId, record->userId, record->holdSince != 0 ? (time_t)record->holdSince : time(NULL));
+        }
+    }
+}
 
-        char name[MAX_NAME_LENGTH];
-        printf("Enter User's name: ");
-        fgets(name, MAX_NAME_LENGTH, stdin);
-        name[strcspn(name, "\n")] = '\0';
-    
-        // Validate book and user    
-    Book* book = searchBookByTitle(bookRoot, title);
-    User* user = searchUserByName(name);
-        
-    
-    if (book == NULL) {
-        printf("Book not found!\n");
-        return;
+// Load a ranking's counts and heap it
+bool loadRanking(FILE* file, CountRanking* ranking) {
+    int32_t capacity = 0;
+    if (fread(&capacity, sizeof(capacity), 1, file) != 1 || capacity < 0 ||
+        (capacity > 0 && !growRanking(ranking, capacity - 1)) ||
+        fread(ranking->counts, sizeof(int64_t), capacity, file) != (size_t)capacity) {
+        return false;
     }
-    
-    if (user == NULL) {
-        printf("User not found!\n");
+    rebuildRankingHeap(ranking);
+    return true;
+}
+
+// Count the users with a loan out
+void countActiveBorrowers() {
+    circulation.activeBorrowers = 0;
+    for (User* user = userList; user != NULL; user = user->next) {
+        circulation.activeBorrowers += user->borrowCount > 0;
+    }
+}
+
+// Load the circulation counts (false when the section is missing or cut short)
+bool loadCirculationStats(FILE* file) {
+    uint32_t magic = 0;
+    int64_t totals[5];
+    clearCirculationStats();
+    if (fread(&magic, sizeof(magic), 1, file) != 1 || magic != CIRCULATION_MAGIC ||
+        fread(totals, sizeof(int64_t), 5, file) != 5 ||
+        !loadRanking(file, &titleBorrows) || !loadRanking(file, &userLoans)) {
+        return false;
+    }
+    circulation.loans = totals[0];
+    circulation.returns = totals[1];
+    circulation.lateReturns = totals[2];
+    circulation.waits = totals[3];
+    circulation.waitSeconds = totals[4];
+    return true;
+}
+
+// Count the ledger, the archive and the users' loans from scratch (files without saved counts)
+void rebuildCirculationStats() {
+    static ArchiveReader reader;
+    clearCirculationStats();
+    for (BorrowRecord* record = borrowRecords; record != NULL; record = record->next) {
+        countLoanRecord(record);
+    }
+    if (openArchiveReader(&reader, 0, 0)) {
+        const ArchivedLoan* loan;
+        while ((loan = archiveNext(&reader)) != NULL) {
+            circulation.loans++;
+            circulation.returns++;
+            circulation.lateReturns += loan->returnDate > loan->dueDate;
+            rankingAdd(&titleBorrows, loan->bookId, 1);
+            rankingAdd(&userLoans, loan->userId, 1);
+        }
+        closeArchiveReader(&reader);
+    }
+    countActiveBorrowers();
+}
+
+// Load all data from file
+void loadAllData() {
+    FILE* file = fopen(SAVE_FILE, "rb");
+    if (file == NULL) {
+        printf("No saved data found!\n");
         return;
     }
     
-    // Check if book is borrowed
-    if (book->status != BORROWED) {
-        printf("This book is not currently borrowed!\n");
+    // Read and check the whole file before anything is replaced
+    SavedData data;
+    bool converted = false;
+    memset(&data, 0, sizeof(SavedData));
+    if (!readSavedData(file, &data, &converted)) {
+        fclose(file);
+        freeSavedData(&data);
+        saveBlocked = true;
+        printf("Nothing was loaded, and saving is off so %s is not overwritten.\n", SAVE_FILE);
         return;
     }
+    numbooks = data.header.lastBookId;
+    numofuser = data.header.lastUserId;
+    borrowCount = data.header.loans;
+    int64_t savedStamp = data.header.saveStamp;
     
-    // Verify the user has borrowed this book
-    BorrowRecord* current = borrowRecords;
-    bool userHasBorrowed = false;
-    while (current != NULL) {
-        if (current->bookId == book->id && current->userId == user->id && !current->returned) {
-            userHasBorrowed = true;
-            break;
-        }
-        current = current->next;
-    }
+    // Handles to the records being replaced go stale
+    clearUndoLog();
+    clearHandleTable(&bookHandles);
+    clearHandleTable(&userHandles);
+    clearHandleTable(&loanHandles);
     
-    if (!userHasBorrowed) {
-        printf("This user has not borrowed this book!\n");
-        return;
+    // Load books (BST)
+    bookRoot = loadBooks(data.books, data.header.books);
+    
+    // Load users (Linked List)
+    loadUsers(data.users, data.header.users);
+    
+    // Load borrow records (Linked List)
+    loadBorrowRecords(data.loans, data.header.loans);
+    
+    // Loans a later archival batch holds were left in the file by a save that did not finish
+    if (markArchivedDuplicates(data.header.archiveBatch) > 0) {
+        printf("%ld loan(s) already in the archive were left out of the ledger\n", unlinkArchivedLoans());
     }
     
-    // Return the book
-    returnBook(book->id, user->id);
+    // Load holds and reservation queues
+    loadReservations(data.reservations, data.reservationCount);
+    freeSavedData(&data);
     
-    // Check if there are users in queue
-    if (!isQueueEmpty(book->id)) {
-        printf("There are users waiting for this book. Process next reservation? (1-Yes/0-No): ");
-        int choice;
-        scanf("%d", &choice);
-        
-        if (choice == 1) {
-            processNextReservation();
-        }
+    // Load the circulation counts (an original-version file has none)
+    bool counted = !converted && loadCirculationStats(file);
+    
+    // A file saved without a stamp is named by its contents, which stay the same until the next save
+    loadedSaveStamp = savedStamp != 0 ? savedStamp : contentStamp(file);
+    fclose(file);
+    rebuildIndexes();
+    bindLoadedHandles();
+    countLoadedLoans();
+    rebuildLedgerColumns();
+    rebuildOpenLoans();
+    if (counted) {
+        countActiveBorrowers();
+    } else {
+        rebuildCirculationStats();
+    }
+    replayJournal();
+    postUnheldReservations(bookRoot);
+    // Loaded and replayed changes are not undoable, and the journal holds every change since the save
+    clearUndoLog();
+    journalInSequence = true;
+    commitCatalogChange();
+    commitLedgerChange();
+    saveBlocked = false;
+    if (converted) {
+        printf("%s was in the original format; the next save writes it in the current one.\n", SAVE_FILE);
     }
+    printf("Data loaded successfully from %s\n", SAVE_FILE);
 }
 
-//displays all the books currently being borrowed by a used
-void displayAllBorrowByUser(int userId){
-    BorrowRecord* current = borrowRecords;
-    User* user = searchUserById(userId);
-    int count = 0;
-
-    while (current != NULL){
-        if(current->userId == userId && current->returned == false);
-        Book* book = searchBookById(bookRoot , current->bookId);
-        printf("%s has borrowed %s \n " ,user->name , book->title );
-        current = current->next;
-        count++;
-    }
+/********************************************/
+/*               Bulk Import                */
+/********************************************/
 
-    if(count == 0){
-        printf("%s has no borrowed books for the time being" , user->name);
+// CSV or TSV files with a header row naming the columns, in any order:
+//   books: title, author, isbn, copies (1 when missing)
+//   users: name, user_id, age, gender
+//   loans: isbn, user_id, borrow_date, due_date, return_date
+// Files are read in IMPORT_CHUNK_SIZE chunks and each row is split in
+// place, so nothing is allocated per line. A book row whose ISBN is
+// already listed (in the catalog or an earlier row) adds its copies to
+// that title instead of a new book; user rows with a duplicate user ID
+// are skipped. Records come from the pools, the book tree is rebuilt
+// balanced and the secondary indexes are built once at the end. Imports
+// are not recorded in the undo history.
+
+// Open a CSV/TSV file for streaming
+bool openCsvReader(CsvReader* reader, const char* path) {
+    memset(reader, 0, sizeof(CsvReader));
+    reader->delimiter = ',';
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        printf("Cannot open '%s'\n", path);
+        return false;
     }
-    else{
-        printf("%s has borrowed %d books" , user->name , count);
+    reader->buffer = (char*)malloc(IMPORT_CHUNK_SIZE + 1);
+    if (reader->buffer == NULL) {
+        printf("Memory allocation failed!\n");
+        fclose(reader->file);
+        reader->file = NULL;
+        return false;
     }
+    return true;
+}
 
-    
+// Release the reader's file and buffer
+void closeCsvReader(CsvReader* reader) {
+    if (reader->file != NULL) {
+        fclose(reader->file);
+    }
+    free(reader->buffer);
+    reader->file = NULL;
+    reader->buffer = NULL;
 }
 
-// Book borrowing management menu
-void manageBorrowing() {
-    int choice;
-    
-    do {
-        printf("\e[1;1H\e[2J");
-        printf("\n=== Borrow Management ===\n");
-        printf("1. Borrow Book\n");
-        printf("2. Return Book\n");
-        printf("3. Reserve Book\n");
-        printf("4. Cancel Reservation\n");
-        printf("5. Check Book Availability\n");
-        printf("6. Display Book Queue\n");
-        printf("7. Process Next Reservation\n");
-        printf("8. View last return\n");
-        printf("9. Undo Last Return\n");
-        printf("10. View All Borrow Records \n");
-        printf("11. View all the books borrowed by User \n");
-        printf("12. Back\n");
-        printf("Choose an option: ");
-        scanf("%d", &choice);
-        printf("\n");
+// Move the unread tail to the front of the buffer and read another chunk
+bool refillCsvReader(CsvReader* reader) {
+    if (reader->eof) {
+        return false;
+    }
+    int tail = reader->length - reader->position;
+    memmove(reader->buffer, reader->buffer + reader->position, tail);
+    reader->length = tail;
+    reader->position = 0;
+    size_t got = fread(reader->buffer + tail, 1, IMPORT_CHUNK_SIZE - tail, reader->file);
+    if (got == 0) {
+        reader->eof = true;
+        return false;
+    }
+    reader->length += (int)got;
+    return true;
+}
 
-        switch (choice) {
-            case 1:
-            printf("\e[1;1H\e[2J");
-                borrowBook();
-                Sleep(2000);
-                break;
-            case 2:
-            printf("\e[1;1H\e[2J");
-                returnBookMenu();
-                Sleep(2000);
-                break;
-            case 3:
-            printf("\e[1;1H\e[2J");
-                reserveBook();
-                Sleep(2000);
-                break;
-            case 4:
-            printf("\e[1;1H\e[2J");
-                cancelReservation();
-                Sleep(2000);
-                break;
-            case 5:
-            printf("\e[1;1H\e[2J");
-                checkBookAvailability();
-                Sleep(2000);
-                break;
-            case 6: {
-                printf("\e[1;1H\e[2J");
-                char title[MAX_TITLE_LENGTH];
-                printf("Enter Book Title (or part of it): ");
-                while ((getchar()) != '\n'); // Clear input buffer
-                fgets(title, MAX_TITLE_LENGTH, stdin);
-                title[strcspn(title, "\n")] = '\0';
-    
-                Book* book = searchBookByTitle(bookRoot, title);
-                printf("\e[1;1H\e[2J");
-                displayBookQueue(book->id);
-                Sleep(5000);
-                break;
+// Split a row in place on the delimiter, unquoting "..." fields
+int splitCsvRow(char* row, char delimiter, char** fields, int maxFields) {
+    int count = 0;
+    char* p = row;
+    for (;;) {
+        char* field = p;
+        char* next;
+        if (*p == '"') {
+            // Quoted field: "" is an escaped quote, the delimiter may appear inside
+            char* out = p;
+            p++;
+            while (*p != '\0') {
+                if (*p == '"') {
+                    if (p[1] != '"') {
+                        p++;
+                        break;
+                    }
+                    p++;
+                }
+                *out++ = *p++;
             }
-            case 7:
-            printf("\e[1;1H\e[2J");
-                processNextReservation();
-                Sleep(2000);
-                break;
-            case 8:
-            printf("\e[1;1H\e[2J");
-                displayLastReturn();
-                Sleep(2000);
-                break;
-            case 9:
-            printf("\e[1;1H\e[2J");
-                undoLastReturn();
-                Sleep(2000);
-                break;
-            case 10:
-            printf("\e[1;1H\e[2J");
-                displayAllBorrowRecords();
-                Sleep(5000);
-                break;
-            case 11:
-            printf("\e[1;1H\e[2J");
-            char name[MAX_NAME_LENGTH];
-            printf("Enter User's name: ");
-            while ((getchar()) != '\n');
-            fgets(name, MAX_NAME_LENGTH, stdin);
-            name[strcspn(name, "\n")] = '\0';
-        
-            User* user = searchUserByName(name);
+            next = strchr(p, delimiter);
+            *out = '\0';
+        } else {
+            next = strchr(p, delimiter);
+            if (next != NULL) {
+                *next = '\0';
+            }
+        }
+        if (count < maxFields) {
+            fields[count++] = field;
+        }
+        if (next == NULL) {
+            return count;
+        }
+        p = next + 1;
+    }
+}
 
-            if(user == NULL){
-                printf("user unfound");
-                Sleep(2000);
+// Read and split the next row; returns its field count (-1 at end of file)
+int readCsvRow(CsvReader* reader, char** fields, int maxFields) {
+    for (;;) {
+        char* start = reader->buffer + reader->position;
+        char* limit = reader->buffer + reader->length;
+        char* end = NULL;
+        bool quoted = false;
+
+        // A newline inside a quoted field does not end the row
+        for (char* scan = start; scan < limit; ) {
+            char* newline = (char*)memchr(scan, '\n', limit - scan);
+            char* stop = newline != NULL ? newline : limit;
+            for (char* quote = (char*)memchr(scan, '"', stop - scan); quote != NULL;
+                 quote = (char*)memchr(quote + 1, '"', stop - quote - 1)) {
+                quoted = !quoted;
+            }
+            if (newline == NULL) {
                 break;
             }
-            printf("\e[1;1H\e[2J");
-                displayAllBorrowByUser(user->id); 
-                Sleep(2000);
+            if (!quoted) {
+                end = newline;
                 break;
-            case 12:
-                return;
-            default:
-                printf("Invalid choice!\n");
+            }
+            scan = newline + 1;
         }
-    } while (choice != 12);
-}
 
-/********************************************/
-/*             Stack Functions              */
-/********************************************/
+        if (end == NULL) {
+            bool full = reader->position == 0 && reader->length == IMPORT_CHUNK_SIZE;
+            if (!full && refillCsvReader(reader)) {
+                continue;
+            }
+            start = reader->buffer + reader->position;
+            limit = reader->buffer + reader->length;
+            if (start == limit) {
+                return -1;
+            }
+            // Last row without a newline (or a row longer than the buffer)
+            end = limit;
+        }
 
-// Initialize stacks
-void initStacks() {
-    HistoryStack = (HStack*)malloc(sizeof(HStack));
-    if (HistoryStack == NULL) {
-        printf("Memory allocation failed for return stack!\n");
-        exit(1); // Exit if memory allocation fails
+        reader->position = (int)(end - reader->buffer) + (end < limit ? 1 : 0);
+        *end = '\0';
+        if (end > start && end[-1] == '\r') {
+            end[-1] = '\0';
+        }
+        if (reader->rowNumber == 0) {
+            if (strncmp(start, "\xEF\xBB\xBF", 3) == 0) {
+                start += 3;
+            }
+            if (strchr(start, '\t') != NULL) {
+                reader->delimiter = '\t';
+            }
+        }
+        reader->rowNumber++;
+        if (*start == '\0') {
+            continue;
+        }
+        return splitCsvRow(start, reader->delimiter, fields, maxFields);
     }
-    HistoryStack->top = NULL;
-    HistoryStack->size = 0;
+}
 
-    returnStack = (RStack*)malloc(sizeof(RStack));
-    if (returnStack == NULL) {
-        printf("Memory allocation failed for return stack!\n");
-        exit(1); // Exit if memory allocation fails
+// Find a named column in the header row (-1 if missing)
+int findCsvColumn(char** header, int count, const char* name) {
+    char key[32];
+    for (int i = 0; i < count; i++) {
+        foldSearchKey(header[i], key, sizeof(key));
+        if (strcmp(key, name) == 0) {
+            return i;
+        }
     }
-    returnStack->top = NULL;
-    returnStack->size = 0;
+    return -1;
 }
 
-// Check if history stack is empty
-int isHStackEmpty() {
-    return HistoryStack->top == NULL;
+// Field of a row by column ("" if the column or field is missing)
+const char* csvField(char** fields, int count, int column) {
+    return column >= 0 && column < count ? fields[column] : "";
 }
 
-//check if return stack is empty
-int isRStackEmpty(){
-    return returnStack->top == NULL;
-}
+// Parse "YYYY-MM-DD[ HH:MM[:SS]]" or epoch seconds (fallback if empty)
+time_t parseImportDate(const char* text, time_t fallback) {
+    static int cachedDay = -1;
+    static time_t cachedMidnight = 0;
+    int y = 0, m = 0, d = 0, hh = 0, mm = 0, ss = 0;
 
-// most recent history to stack
-void pushToSystemHistory(Book* book , User* user ,History His) {
-    HStackNode* newNode = (HStackNode*)malloc(sizeof(HStackNode));
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    if (*text == '\0') {
+        return fallback;
+    }
+    if (strchr(text, '-') == NULL) {
+        return (time_t)strtoll(text, NULL, 10);
+    }
+    if (sscanf(text, "%d-%d-%d%*[ T]%d:%d:%d", &y, &m, &d, &hh, &mm, &ss) < 3) {
+        return fallback;
+    }
 
-    if (newNode == NULL) {
-        printf("Memory allocation failed!\n");
-        return;
+    // Loans cluster on a few days, so mktime runs once per distinct day
+    int day = y * 10000 + m * 100 + d;
+    if (day != cachedDay) {
+        struct tm date = {0};
+        date.tm_year = y - 1900;
+        date.tm_mon = m - 1;
+        date.tm_mday = d;
+        date.tm_isdst = -1;
+        cachedMidnight = mktime(&date);
+        cachedDay = day;
     }
-    switch (His)
-    {
-    case USERADDED:
-    newNode->userCopy = user;
-    newNode->bookCopy = book;
-    newNode->typeOfAction = His;
-    newNode->timeOfAction =time(NULL);
-    newNode->next = HistoryStack->top;
-    HistoryStack->top = newNode;
-    HistoryStack->size++;
-        break;
-    case USERDELETED:
-    newNode->userCopy = user;
-    newNode->bookCopy = book;
-    newNode->typeOfAction = His;
-    newNode->timeOfAction =time(NULL);
-    newNode->next = HistoryStack->top;
-    HistoryStack->top = newNode;
-    HistoryStack->size++;
-        break;
-    case BOOKADDED:
-    newNode->userCopy = user;
-    newNode->bookCopy = book;
-    newNode->typeOfAction = His;
-    newNode->timeOfAction =time(NULL);
-    newNode->next = HistoryStack->top;
-    HistoryStack->top = newNode;
-    HistoryStack->size++;
-        break;
-    case BOOKDELETED:
-    newNode->userCopy = user;
-    newNode->bookCopy = book;
-    newNode->typeOfAction = His;
-    newNode->timeOfAction =time(NULL);
-    newNode->next = HistoryStack->top;
-    HistoryStack->top = newNode;
-    HistoryStack->size++;
-        break;
-    default:
-    printf("not a valid action");
-        break;
+    return cachedMidnight + hh * 3600 + mm * 60 + ss;
+}
+
+// Collect the book tree in ID order
+void collectBookNodes(Book* root, Book** out, int* count) {
+    if (root == NULL) {
+        return;
     }
-    
-    
-    // Limit stack size
-    if ( HistoryStack->size > MAX_STACK_SIZE) {
-        // Remove bottom node
-        HStackNode* current = HistoryStack->top;
-        HStackNode* prev = NULL;
-        
-        while (current->next != NULL) {
-            prev = current;
-            current = current->next;
+    collectBookNodes(root->left, out, count);
+    out[(*count)++] = root;
+    collectBookNodes(root->right, out, count);
+}
+
+// Find a book in an ID-ordered array
+Book* findCollectedBook(Book** books, int count, int id) {
+    int low = 0, high = count - 1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        if (books[mid]->id == id) {
+            return books[mid];
         }
-        
-        if (prev != NULL) {
-            prev->next = NULL;
-            free(current);
-            HistoryStack->size--;
+        if (books[mid]->id < id) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
         }
     }
+    return NULL;
 }
 
-// undo most recent action
-void undoSystemhistory() {
-    if (isHStackEmpty()) {
-        printf("System history is empty!\n");
-        return ;
+// Print how long an import took
+void printImportRate(const char* what, long rows, DWORD started) {
+    DWORD elapsed = GetTickCount() - started;
+    printf("%ld %s rows read in %lu ms", rows, what, (unsigned long)elapsed);
+    if (elapsed > 0) {
+        printf(" (%.0f rows/s)", rows * 1000.0 / elapsed);
     }
+    printf("\n");
+}
 
-    switch (HistoryStack->top->typeOfAction)
-    {
-    case USERADDED:{
-    int id = HistoryStack->top->userCopy->id;
-    BorrowRecord* current = borrowRecords;
-    while (current != NULL) {
-        if (current->userId == id && !current->returned) {
-            printf("Cannot delete user as they have borrowed books!\n");
-            return;
-        }
-        current = current->next;
+// Import books from a CSV/TSV file
+void importBooks(const char* path) {
+    CsvReader reader;
+    char* fields[MAX_IMPORT_FIELDS];
+    char isbn[MAX_ISBN_LENGTH];
+    DWORD started = GetTickCount();
+    if (!openCsvReader(&reader, path)) {
+        return;
     }
-    
-    delusernode(id);
-    printf("Actions undone successfully");
-}
-        break;
-    case USERDELETED:{
-    int id = HistoryStack->top->userCopy->id , age = HistoryStack->top->userCopy->age;
-    char gender = HistoryStack->top->userCopy->gender,name[MAX_NAME_LENGTH] , uid[MAX_ID_LENGTH];
-    strcpy(name , HistoryStack->top->userCopy->name);
-    strcpy(uid , HistoryStack->top->userCopy->user_id);
-    User* user = (User*)malloc(sizeof(User));
-    user = createUser(id, name , uid , age , gender);
-    addUserToList(user);
-    printf("Action undone successfully");
+    noteUnjournaledChange();
+    int count = readCsvRow(&reader, fields, MAX_IMPORT_FIELDS);
+    int titleColumn = findCsvColumn(fields, count, "title");
+    int authorColumn = findCsvColumn(fields, count, "author");
+    int isbnColumn = findCsvColumn(fields, count, "isbn");
+    int copiesColumn = findCsvColumn(fields, count, "copies");
+    if (titleColumn < 0) {
+        printf("Missing 'title' column in the header row\n");
+        closeCsvReader(&reader);
+        return;
     }
-        break;
-    case BOOKADDED:{
-        deleteBook(bookRoot , HistoryStack->top->bookCopy->id);
-        printf("Action undone successfully");
+
+    // New IDs go after the largest existing one, so the ID order is a plain append
+    int existing = countBooks(bookRoot);
+    int capacity = existing + POOL_BLOCK_RECORDS;
+    int total = 0;
+    Book** books = (Book**)malloc(sizeof(Book*) * capacity);
+    if (books == NULL) {
+        printf("Memory allocation failed!\n");
+        closeCsvReader(&reader);
+        return;
     }
-        break; 
-    case BOOKDELETED:{
-        int id = HistoryStack->top->bookCopy->id;
-        char title[MAX_TITLE_LENGTH] , author[MAX_AUTHOR_LENGTH] , isbn[MAX_ISBN_LENGTH]; 
-        strcpy(title ,HistoryStack->top->bookCopy->title);
-        strcpy(author ,HistoryStack->top->bookCopy->author);
-        strcpy(isbn ,HistoryStack->top->bookCopy->isbn);
-        Book* newBook = (Book*)malloc(sizeof(Book));
-        newBook = addBook(id, title, author, isbn);
-        bookRoot = insertBook(bookRoot, newBook);
-        printf("Action undone successfully");
+    collectBookNodes(bookRoot, books, &total);
+    int nextId = numbooks;
+    if (total > 0 && books[total - 1]->id > nextId) {
+        nextId = books[total - 1]->id;
     }
-        break;
-    default:
-    printf("not a valid action");
-        break;
+    int lastExistingId = nextId;
+
+    long rows = 0;
+    int added = 0, copiesAdded = 0, rejected = 0;
+    while ((count = readCsvRow(&reader, fields, MAX_IMPORT_FIELDS)) >= 0) {
+        rows++;
+        const char* title = csvField(fields, count, titleColumn);
+        if (title[0] == '\0') {
+            rejected++;
+            continue;
+        }
+        int copies = atoi(csvField(fields, count, copiesColumn));
+        if (copies <= 0) {
+            copies = 1;
+        }
+
+        // A listed ISBN adds copies to its title (through the queue if it is already in the catalog)
+        normalizeIsbn(csvField(fields, count, isbnColumn), isbn, MAX_ISBN_LENGTH);
+        KeyEntry* listed = isbn[0] != '\0' ? findKeyEntry(&isbnIndex, isbn) : NULL;
+        if (listed != NULL) {
+            Book* book = findCollectedBook(books, total, listed->bookIds[0]);
+            if (book != NULL && book->id <= lastExistingId) {
+                changeBookCopies(book, copies);
+            } else if (book != NULL) {
+                book->copies += copies;
+            }
+            copiesAdded += copies;
+            continue;
+        }
+        if (total == capacity) {
+            capacity *= 2;
+            Book** grown = (Book**)realloc(books, sizeof(Book*) * capacity);
+            if (grown == NULL) {
+                printf("Memory allocation failed!\n");
+                break;
+            }
+            books = grown;
+        }
+        Book* book = addBook(nextId + 1, title, csvField(fields, count, authorColumn), csvField(fields, count, isbnColumn));
+        if (book == NULL) {
+            break;
+        }
+        nextId++;
+        book->copies = copies;
+        books[total++] = book;
+        if (isbn[0] != '\0') {
+            // Only for de-duplicating later rows; rebuilt with the rest below
+            keyIndexAdd(&isbnIndex, isbn, book->id);
+        }
+        added++;
     }
+    closeCsvReader(&reader);
+
+    numbooks = nextId;
+    bookRoot = buildBalancedBooks(books, 0, total - 1);
+    free(books);
+    rebuildBookIndexes();
+    commitCatalogChange();
+    printImportRate("book", rows, started);
+    printf("Added %d book(s) and %d copies of listed ISBNs, skipped %d row(s) without a title\n", added, copiesAdded, rejected);
 }
 
-// Display history
-void displaySystemHistory() {
-    if (isHStackEmpty()) {
-        printf("System history is empty!\n");
+// Import users from a CSV/TSV file
+void importUsers(const char* path) {
+    CsvReader reader;
+    char* fields[MAX_IMPORT_FIELDS];
+    KeyIndex seen = {NULL, 0, 0};
+    DWORD started = GetTickCount();
+    if (!openCsvReader(&reader, path)) {
         return;
     }
-    
-    HStackNode* current = HistoryStack->top;
-    int position = 1 , i = 0 ;
-     uint8_t cont = 1 ;
-     struct tm* acttime ;
-    printf("\n=== System History ===\n");
-    printf("------------------------\n");
-    do{
-    while (current != NULL && i%6 != 0 || i == 0){
-        switch (current->typeOfAction)
-        {
-        case USERADDED:
-        acttime= localtime(&(current->timeOfAction));
-        printf("%d - A user going by the name of %s has been added on :\n %s " ,position, current->userCopy->name ,asctime(acttime) );
-            break;
-        case USERDELETED:
-        acttime= localtime(&(current->timeOfAction));
-        printf("%d - A user going by the name of %s was deleted on :\n %s " ,position, current->userCopy->name ,asctime(acttime) );
-            break;
-        case BOOKADDED:
-        acttime= localtime(&(current->timeOfAction));
-        printf("%d - A book with the title of %s has been added on :\n %s " ,position , current->bookCopy->title , asctime(acttime) );
-            break;
-        case BOOKDELETED:
-        acttime= localtime(&(current->timeOfAction));
-        printf("%d - A book with the title of %s was deleted on :\n %s ",position , current->bookCopy->title ,asctime(acttime) );
-            break;
-        default:
-        printf("not a valid action");
+    noteUnjournaledChange();
+    int count = readCsvRow(&reader, fields, MAX_IMPORT_FIELDS);
+    int nameColumn = findCsvColumn(fields, count, "name");
+    int idColumn = findCsvColumn(fields, count, "user_id");
+    int ageColumn = findCsvColumn(fields, count, "age");
+    int genderColumn = findCsvColumn(fields, count, "gender");
+    if (nameColumn < 0 || idColumn < 0) {
+        printf("Missing 'name' or 'user_id' column in the header row\n");
+        closeCsvReader(&reader);
+        return;
+    }
+
+    // Existing user IDs count as seen; new users are appended at the tail
+    int nextId = numofuser;
+    User* tail = NULL;
+    for (User* current = userList; current != NULL; current = current->next) {
+        keyIndexAdd(&seen, current->user_id, current->id);
+        if (current->id > nextId) {
+            nextId = current->id;
+        }
+        tail = current;
+    }
+
+    long rows = 0;
+    int added = 0, duplicates = 0, rejected = 0;
+    while ((count = readCsvRow(&reader, fields, MAX_IMPORT_FIELDS)) >= 0) {
+        rows++;
+        const char* name = csvField(fields, count, nameColumn);
+        const char* uid = csvField(fields, count, idColumn);
+        if (name[0] == '\0' || uid[0] == '\0') {
+            rejected++;
+            continue;
+        }
+        if (findKeyEntry(&seen, uid) != NULL) {
+            duplicates++;
+            continue;
+        }
+        const char* gender = csvField(fields, count, genderColumn);
+        User* user = createUser(nextId + 1, name, uid, atoi(csvField(fields, count, ageColumn)),
+                                gender[0] != '\0' ? (char)toupper((unsigned char)gender[0]) : 'U');
+        if (user == NULL) {
             break;
         }
-        printf("------------------------\n");
-        current = current->next;
-        position++;
-        i++;
+        nextId++;
+        if (tail == NULL) {
+            userList = user;
+        } else {
+            tail->next = user;
+        }
+        tail = user;
+        keyIndexAdd(&seen, user->user_id, user->id);
+        added++;
     }
-    printf("do you wish to show more ?(1-Yes/0-No):");
-    scanf("%u" , &cont);
-    i = 0;
-    }while(cont);
+    closeCsvReader(&reader);
+    clearKeyIndex(&seen);
+    free(seen.buckets);
+
+    numofuser = nextId;
+    rebuildUserIndexes();
+    printImportRate("user", rows, started);
+    printf("Added %d user(s), skipped %d duplicate user ID(s) and %d incomplete row(s)\n", added, duplicates, rejected);
 }
 
-//history Menu
-void HistoryMenu(){
-int choice;
-do{
-    printf("\e[1;1H\e[2J");
-    printf("\n=== History Menu ===\n");
-    printf("1. View Recent History\n");
-    printf("2. undo Most recent Action\n");
-    printf("3. Back\n");
-    printf("Choose an option: ");
-    scanf("%d", &choice);
-
-    switch (choice)
-    {
-    case 1:
-    printf("\e[1;1H\e[2J");
-        displaySystemHistory();
-        break;
-    case 2:
-    printf("\e[1;1H\e[2J");
-        undoSystemhistory();
-        Sleep(2000);
-        break;
-    case 3:
+// Import historical loans (books by ISBN, users by user ID)
+void importLoans(const char* path) {
+    CsvReader reader;
+    char* fields[MAX_IMPORT_FIELDS];
+    char isbn[MAX_ISBN_LENGTH];
+    KeyIndex userIds = {NULL, 0, 0};
+    DWORD started = GetTickCount();
+    if (!openCsvReader(&reader, path)) {
+        return;
+    }
+    noteUnjournaledChange();
+    int count = readCsvRow(&reader, fields, MAX_IMPORT_FIELDS);
+    int isbnColumn = findCsvColumn(fields, count, "isbn");
+    int idColumn = findCsvColumn(fields, count, "user_id");
+    int borrowColumn = findCsvColumn(fields, count, "borrow_date");
+    int dueColumn = findCsvColumn(fields, count, "due_date");
+    int returnColumn = findCsvColumn(fields, count, "return_date");
+    if (isbnColumn < 0 || idColumn < 0) {
+        printf("Missing 'isbn' or 'user_id' column in the header row\n");
+        closeCsvReader(&reader);
         return;
-        break; 
-    default:
-        printf("please input a valid choice");
-        break;
     }
 
-}while(choice != 3);
+    // user_id -> numeric ID through a temporary hash, then the user-ID table
+    for (User* current = userList; current != NULL; current = current->next) {
+        keyIndexAdd(&userIds, current->user_id, current->id);
+    }
+    BorrowRecord* tail = borrowTail;
+
+    long rows = 0;
+    int added = 0, active = 0, unknown = 0;
+    time_t now = time(NULL);
+    while ((count = readCsvRow(&reader, fields, MAX_IMPORT_FIELDS)) >= 0) {
+        rows++;
+        normalizeIsbn(csvField(fields, count, isbnColumn), isbn, MAX_ISBN_LENGTH);
+        KeyEntry* bookEntry = isbn[0] != '\0' ? findKeyEntry(&isbnIndex, isbn) : NULL;
+        KeyEntry* userEntry = findKeyEntry(&userIds, csvField(fields, count, idColumn));
+        Book* book = bookEntry != NULL ? searchBookById(bookRoot, bookEntry->bookIds[0]) : NULL;
+        User* user = userEntry != NULL ? searchUserById(userEntry->bookIds[0]) : NULL;
+        if (book == NULL || user == NULL) {
+            unknown++;
+            continue;
+        }
 
+        BorrowRecord* record = (BorrowRecord*)poolAlloc(&loanPool);
+        if (record == NULL) {
+            printf("Memory allocation failed!\n");
+            break;
+        }
+        record->userId = user->id;
+        record->bookId = book->id;
+        record->handle = handleAcquire(&loanHandles, record);
+        record->user = user->handle;
+        record->book = book->handle;
+        record->borrowDate = parseImportDate(csvField(fields, count, borrowColumn), now);
+        record->dueDate = parseImportDate(csvField(fields, count, dueColumn), record->borrowDate + 1209600);
+        record->returnDate = parseImportDate(csvField(fields, count, returnColumn), 0);
+        record->returned = record->returnDate != 0;
+        record->archiveBatch = 0;
+        record->next = NULL;
+        if (tail == NULL) {
+            borrowRecords = record;
+        } else {
+            tail->next = record;
+        }
+        tail = record;
+        appendLedgerRow(record);
+        borrowCount++;
+        added++;
+
+        // An open loan puts a copy out (status bitmaps are rebuilt below)
+        if (record->returned) {
+            countLoanRecord(record);
+        } else {
+            book->borrowed++;
+            if (book->borrowed > book->copies) {
+                book->copies = book->borrowed;
+            }
+            book->status = copyStatus(book);
+            user->borrowCount++;
+            countLoanOpened(record, user);
+            addOpenLoan(record);
+            active++;
+        }
+    }
+    borrowTail = tail;
+    closeCsvReader(&reader);
+    clearKeyIndex(&userIds);
+    free(userIds.buckets);
+
+    rebuildStatusBitmaps();
+    commitCatalogChange();
+    commitLedgerChange();
+    printImportRate("loan", rows, started);
+    printf("Added %d loan(s) (%d still open), skipped %d row(s) with an unknown ISBN or user ID\n", added, active, unknown);
 }
 
+
 /********************************************/
-/*         Search functionalities           */
+/*               Bulk Export                */
 /********************************************/
 
-void searchMenu() {
-    int choice;
-    
-    do {
-        printf("\e[1;1H\e[2J");
-        printf("\n=== Search Menu ===\n");
-        printf("1. Search Book by ID\n");
-        printf("2. Search Book by Title\n");
-        printf("3. Search User by ID\n");
-        printf("4. Search User by Name\n");
-        printf("5. Back\n");
-        printf("Choose an option: ");
-        scanf("%d", &choice);
-        
-        switch (choice) {
-            case 1: {
-                printf("\e[1;1H\e[2J");
-                int id;
-                printf("Enter Book ID: ");
-                scanf("%d", &id);
-                printf("\e[1;1H\e[2J");
-                Book* book = searchBookById(bookRoot, id);
-                if (book != NULL) {
-                    displayBook(book);
-                } else {
-                    printf("Book not found!\n");
-                }
-                Sleep(2000);
-                break;
+// Catalog, users, ledger and reservation queues as CSV (with a header
+// row) or JSON Lines (one object per row). Books and loans stream from
+// pinned snapshots, so a dump is consistent and memory does not grow
+// with the output. The loans file uses the same isbn/user_id columns
+// the importer reads. The queues file lists each title's holds first
+// (position 0, with their pickup deadline) and then its waiters.
+
+// Start writing rows with the given columns
+void beginExport(ExportWriter* writer, OutputBuffer* out, bool json, const char* const* columns, int columnCount) {
+    writer->out = out;
+    writer->json = json;
+    writer->columns = columns;
+    writer->columnCount = columnCount;
+    writer->field = 0;
+    if (!json) {
+        for (int i = 0; i < columnCount; i++) {
+            if (i > 0) {
+                outChar(out, ',');
             }
-            case 2: {
-                printf("\e[1;1H\e[2J");
-                char title[MAX_TITLE_LENGTH];
-                printf("Enter Book Title (or part of it): ");
-                while ((getchar()) != '\n'); // Clear input buffer
-                fgets(title, MAX_TITLE_LENGTH, stdin);
-                title[strcspn(title, "\n")] = '\0';
+            outText(out, columns[i]);
+        }
+        outChar(out, '\n');
+    }
+}
 
-                Book* book = searchBookByTitle(bookRoot, title);
-                printf("\e[1;1H\e[2J");
-                if (book != NULL) {
-                    displayBook(book);
-                } else {
-                    printf("No books found matching '%s'\n", title);
-                }
-                Sleep(2000);
-                break;
-            }
-            case 3: {
-                int id;
-                printf("\e[1;1H\e[2J");
-                printf("Enter User ID: ");
-                scanf("%d", &id);
-                User* user = searchUserById(id);
-                printf("\e[1;1H\e[2J");
-                if (user != NULL) {
-                    displayUser(user);
-                } else {
-                    printf("User not found!\n");
-                }
-                Sleep(2000);
-                break;
-            }
-            case 4: {
-                printf("\e[1;1H\e[2J");
-                char name[MAX_NAME_LENGTH];
-                printf("Enter User Name: ");
-                while ((getchar()) != '\n'); // Clear input buffer
-                fgets(name, MAX_NAME_LENGTH, stdin);
-                name[strcspn(name, "\n")] = '\0';
-                User* user = searchUserByName(name);
-                printf("\e[1;1H\e[2J");
-                if (user != NULL) {
-                    displayUser(user);
-                } else {
-                    printf("User not found!\n");
-                }
-                Sleep(2000);
-                break;
-            }
-            case 5:
-                return;
-            default:
-                printf("Invalid choice!\n");
+// Separator (and JSON key) before the next field
+void exportFieldStart(ExportWriter* writer) {
+    OutputBuffer* out = writer->out;
+    if (writer->json) {
+        outText(out, writer->field == 0 ? "{\"" : ",\"");
+        outText(out, writer->columns[writer->field]);
+        outText(out, "\":");
+    } else if (writer->field > 0) {
+        outChar(out, ',');
+    }
+    writer->field++;
+}
+
+// Write a text field (quoted/escaped as the format needs)
+void exportText(ExportWriter* writer, const char* text) {
+    OutputBuffer* out = writer->out;
+    exportFieldStart(writer);
+    if (writer->json) {
+        outChar(out, '"');
+        for (const char* p = text; *p != '\0'; p++) {
+            unsigned char c = (unsigned char)*p;
+            if (c == '"' || c == '\\') {
+                outChar(out, '\\');
+                outChar(out, (char)c);
+            } else if (c < 0x20) {
+                char escape[8];
+                sprintf(escape, "\\u%04x", c);
+                outText(out, escape);
+            } else {
+                outChar(out, (char)c);
+            }
+        }
+        outChar(out, '"');
+    } else if (strpbrk(text, ",\"\r\n") != NULL) {
+        outChar(out, '"');
+        for (const char* p = text; *p != '\0'; p++) {
+            if (*p == '"') {
+                outChar(out, '"');
+            }
+            outChar(out, *p);
         }
-    } while (choice != 5);
+        outChar(out, '"');
+    } else {
+        outText(out, text);
+    }
 }
 
-/********************************************/
-/* File Handling Functions                  */
-/********************************************/
+// Write a numeric field
+void exportInt(ExportWriter* writer, long long value) {
+    exportFieldStart(writer);
+    outInt(writer->out, value);
+}
 
-// Save book data to file
-void saveBooks(FILE* file, Book* root) {
-    if (root == NULL) {
+// Write a date field (empty / null for 0)
+void exportDate(ExportWriter* writer, time_t value) {
+    exportFieldStart(writer);
+    if (value == 0) {
+        if (writer->json) {
+            outText(writer->out, "null");
+        }
         return;
     }
-    
-    // Save current book
-    fwrite(root, sizeof(Book), 1, file);
-    
-    // Save left and right subtrees
-    saveBooks(file, root->left);
-    saveBooks(file, root->right);
+    if (writer->json) {
+        outChar(writer->out, '"');
+    }
+    outDate(writer->out, value);
+    if (writer->json) {
+        outChar(writer->out, '"');
+    }
 }
 
-// Save user data to file
-void saveUsers(FILE* file) {
-    User* current = userList;
-    while (current != NULL) {
-        fwrite(current, sizeof(User), 1, file);
-        current = current->next;
+// Finish the current row
+void endExportRow(ExportWriter* writer) {
+    if (writer->json) {
+        outChar(writer->out, '}');
     }
+    outChar(writer->out, '\n');
+    writer->field = 0;
 }
 
-// Save borrow records to file
-void saveBorrowRecords(FILE* file) {
-    BorrowRecord* current = borrowRecords;
-    while (current != NULL) {
-        fwrite(current, sizeof(BorrowRecord), 1, file);
-        current = current->next;
+// Status names used in exports
+const char* bookStatusName(BookStatus status) {
+    return status == AVAILABLE ? "available" : status == BORROWED ? "borrowed" : "reserved";
+}
+
+const char* userStatusName(UserStatus status) {
+    return status == ACTIVE ? "active" : status == SUSPENDED ? "suspended" : "expired";
+}
+
+// Stream the catalog
+long exportBooks(OutputBuffer* out, bool json) {
+    static const char* const columns[] = {"id", "title", "author", "isbn", "status", "copies", "available", "queue_length"};
+    ExportWriter writer;
+    CatalogSnapshot* snap = pinCatalogSnapshot();
+    if (snap == NULL) {
+        return -1;
     }
+    beginExport(&writer, out, json, columns, 8);
+    for (int i = 0; i < snap->count; i++) {
+        Book* book = snapshotBookAt(snap, i);
+        exportInt(&writer, book->id);
+        exportText(&writer, book->title);
+        exportText(&writer, book->author);
+        exportText(&writer, book->isbn);
+        exportText(&writer, bookStatusName(book->status));
+        exportInt(&writer, book->copies);
+        exportInt(&writer, availableCopies(book));
+        exportInt(&writer, queueLengthOf(book->id));
+        endExportRow(&writer);
+    }
+    long rows = snap->count;
+    releaseCatalogSnapshot(snap);
+    return rows;
 }
 
-// Save all data to file
-void saveAllData() {
-    FILE* file = fopen(SAVE_FILE, "wb");
+// Stream the users
+long exportUsers(OutputBuffer* out, bool json) {
+    static const char* const columns[] = {"id", "name", "user_id", "age", "gender", "status", "borrow_count"};
+    ExportWriter writer;
+    char gender[2] = {0, 0};
+    long rows = 0;
+    beginExport(&writer, out, json, columns, 7);
+    for (User* user = userList; user != NULL; user = user->next) {
+        gender[0] = user->gender;
+        exportInt(&writer, user->id);
+        exportText(&writer, user->name);
+        exportText(&writer, user->user_id);
+        exportInt(&writer, user->age);
+        exportText(&writer, gender);
+        exportText(&writer, userStatusName(user->status));
+        exportInt(&writer, user->borrowCount);
+        endExportRow(&writer);
+        rows++;
+    }
+    return rows;
+}
+
+// Stream the ledger (books and users joined in for isbn and user_id)
+long exportLoans(OutputBuffer* out, bool json) {
+    static const char* const columns[] = {"book_id", "isbn", "user_id", "borrow_date", "due_date", "return_date", "returned"};
+    ExportWriter writer;
+    LedgerSnapshot* ledger = pinLedgerSnapshot();
+    CatalogSnapshot* catalog = pinCatalogSnapshot();
+    if (ledger == NULL || catalog == NULL) {
+        releaseLedgerSnapshot(ledger);
+        releaseCatalogSnapshot(catalog);
+        return -1;
+    }
+    beginExport(&writer, out, json, columns, 7);
+    for (int i = 0; i < ledger->count; i++) {
+        BorrowRecord* record = snapshotLoanAt(ledger, i);
+        Book* book = snapshotBookById(catalog, record->bookId);
+        User* user = userFromHandle(record->user);
+        exportInt(&writer, record->bookId);
+        exportText(&writer, book != NULL ? book->isbn : "");
+        exportText(&writer, user != NULL ? user->user_id : "");
+        exportDate(&writer, record->borrowDate);
+        exportDate(&writer, record->dueDate);
+        exportDate(&writer, record->returned ? record->returnDate : 0);
+        exportInt(&writer, record->returned ? 1 : 0);
+        endExportRow(&writer);
+    }
+    long rows = ledger->count;
+    releaseCatalogSnapshot(catalog);
+    releaseLedgerSnapshot(ledger);
+    return rows;
+}
+
+// Stream every reservation queue in book ID order
+long exportQueues(OutputBuffer* out, bool json) {
+    static const char* const columns[] = {"book_id", "position", "user_id", "hold_until"};
+    ExportWriter writer;
+    long rows = 0;
+    CatalogSnapshot* catalog = pinCatalogSnapshot();
+    if (catalog == NULL) {
+        return -1;
+    }
+    beginExport(&writer, out, json, columns, 4);
+    for (int i = 0; i < catalog->count; i++) {
+        int bookId = snapshotBookAt(catalog, i)->id;
+        if (bookId >= bookQueueCapacity) {
+            continue;
+        }
+        for (HoldNode* hold = bookQueues[bookId].holds; hold != NULL; hold = hold->next) {
+            User* user = userFromHandle(hold->user);
+            exportInt(&writer, bookId);
+            exportInt(&writer, 0);
+            exportText(&writer, user != NULL ? user->user_id : "");
+            exportDate(&writer, hold->until);
+            endExportRow(&writer);
+            rows++;
+        }
+        int position = 1;
+        for (QueueNode* node = bookQueues[bookId].front; node != NULL; node = node->next) {
+            User* user = userFromHandle(node->user);
+            exportInt(&writer, bookId);
+            exportInt(&writer, position++);
+            exportText(&writer, user != NULL ? user->user_id : "");
+            exportDate(&writer, 0);
+            endExportRow(&writer);
+            rows++;
+        }
+    }
+    releaseCatalogSnapshot(catalog);
+    return rows;
+}
+
+// Export one data set ("books", "users", "loans" or "queues") to a file
+void exportData(const char* what, const char* format, const char* path) {
+    long (*exporter)(OutputBuffer* out, bool json) = NULL;
+    if (strcmp(what, "books") == 0) {
+        exporter = exportBooks;
+    } else if (strcmp(what, "users") == 0) {
+        exporter = exportUsers;
+    } else if (strcmp(what, "loans") == 0) {
+        exporter = exportLoans;
+    } else if (strcmp(what, "queues") == 0) {
+        exporter = exportQueues;
+    }
+    bool json = strcmp(format, "jsonl") == 0 || strcmp(format, "json") == 0;
+    if (exporter == NULL || (!json && strcmp(format, "csv") != 0)) {
+        printf("usage: export books|users|loans|queues csv|jsonl <file>\n");
+        return;
+    }
+
+    FILE* file = fopen(path, "wb");
     if (file == NULL) {
-        printf("Error opening file for writing!\n");
+        printf("Cannot open '%s' for writing\n", path);
         return;
     }
-    
-    // Save counters first
-    fwrite(&numbooks, sizeof(int), 1, file);
-    fwrite(&numofuser, sizeof(int), 1, file);
-    fwrite(&borrowCount, sizeof(int), 1, file);
-    
-    // Save books (BST)
-    saveBooks(file, bookRoot);
-    
-    // Save users (Linked List)
-    saveUsers(file);
-    
-    // Save borrow records (Linked List)
-    saveBorrowRecords(file);
-    
-    
-    fclose(file);
-    printf("Data saved successfully to %s\n", SAVE_FILE);
+    OutputBuffer out;
+    DWORD started = GetTickCount();
+    if (!openOutput(&out, file)) {
+        fclose(file);
+        return;
+    }
+    long rows = exporter(&out, json);
+    closeOutput(&out);
+    bool failed = out.failed || fclose(file) != 0;
+    if (rows < 0 || failed) {
+        printf("Export to '%s' failed\n", path);
+        return;
+    }
+    printf("Exported %ld %s row(s) to %s in %lu ms\n", rows, what, path, (unsigned long)(GetTickCount() - started));
 }
 
-// Load book data from file and rebuild BST
-Book* loadBooks(FILE* file, int bookCount) {
-    Book* root = NULL;
-    for (int i = 0; i < bookCount; i++) {
-        Book* book = (Book*)malloc(sizeof(Book));
-        if (fread(book, sizeof(Book), 1, file) != 1) {
-            free(book);
+// Import / export data menu
+void importExportMenu() {
+    static const char* sets[] = {"books", "users", "loans", "queues"};
+    int choice, format = 1;
+    char path[MAX_BATCH_LINE];
+    printf("\n=== Import / Export Data ===\n");
+    printf("1. Import Books (title, author, isbn)\n");
+    printf("2. Import Users (name, user_id, age, gender)\n");
+    printf("3. Import Loans (isbn, user_id, borrow_date, due_date, return_date)\n");
+    printf("4. Export Books\n");
+    printf("5. Export Users\n");
+    printf("6. Export Loans\n");
+    printf("7. Export Reservation Queues\n");
+    printf("8. Back\n");
+    printf("Enter your choice: ");
+    scanf("%d", &choice);
+    if (choice < 1 || choice > 7) {
+        return;
+    }
+    if (choice >= 4) {
+        printf("Format: 1. CSV  2. JSON Lines\n");
+        printf("Choose an option: ");
+        scanf("%d", &format);
+    }
+    printf(choice <= 3 ? "Enter CSV/TSV file path: " : "Enter output file path: ");
+    while ((getchar()) != '\n'); // Clear input buffer
+    fgets(path, MAX_BATCH_LINE, stdin);
+    path[strcspn(path, "\n")] = '\0';
+    switch (choice) {
+        case 1:
+            importBooks(path);
             break;
-        }
-        book->left = NULL;
-        book->right = NULL;
-        root = insertBook(root, book);
+        case 2:
+            importUsers(path);
+            break;
+        case 3:
+            importLoans(path);
+            break;
+        default:
+            exportData(sets[choice - 4], format == 2 ? "jsonl" : "csv", path);
     }
-    return root;
 }
 
-// Load user data from file and rebuild linked list
-void loadUsers(FILE* file, int userCount) {
-    userList = NULL;
-    User* prev = NULL;
-    for (int i = 0; i < userCount; i++) {
-        User* user = (User*)malloc(sizeof(User));
-        if (fread(user, sizeof(User), 1, file) != 1) {
-            free(user);
+/********************************************/
+/*               Batch Mode                 */
+/********************************************/
+
+// Batch mode reads one command per line from standard input and prints
+// the results, so scripts can drive the library without the menus.
+// Arguments follow the command after a space; multi-field arguments
+// are separated by '|'.
+
+// Split "a|b|c" in place into at most maxFields trimmed fields
+int splitBatchFields(char* text, char** fields, int maxFields) {
+    int count = 0;
+    while (count < maxFields) {
+        fields[count++] = text;
+        char* bar = strchr(text, '|');
+        if (bar == NULL) {
             break;
         }
-        user->next = NULL;
-        if (prev == NULL) {
-            userList = user;
+        *bar = '\0';
+        text = bar + 1;
+    }
+    return count;
+}
+
+// Print the batch command summary
+void printBatchHelp() {
+    printf("Commands:\n");
+    printf("  load | save | help | quit\n");
+    printf("  add-book <title>|<author>|<isbn>\n");
+    printf("  add-user <name>|<user id>|<age>|<gender>\n");
+    printf("  book <id>            user <id>\n");
+    printf("  find-title <text>    find-user <name>    list-title <text>\n");
+    printf("  fuzzy-title <text>   fuzzy-author <text> fuzzy-user <text>\n");
+    printf("  complete-title <prefix> complete-author <prefix> complete-user <prefix>\n");
+    printf("  author <name>        author-prefix <prefix>\n");
+    printf("  status-counts        list-status available|borrowed|reserved\n");
+    printf("  query <clause>|...   e.g. query author=austen|status=available|queue>=1\n");
+    printf("  availability <title> cache-stats       bench-scan [<rounds>]\n");
+    printf("  import-books <file>  import-users <file> import-loans <file>\n");
+    printf("  export books|users|loans|queues csv|jsonl <file>\n");
+    printf("  list-books           list-users          list-loans\n");
+    printf("  page books|titles|authors|users|loans <size> [<token from the previous page>|#<page>]\n");
+    printf("  title-at <n>         author-at <n>       title-rank <title>  author-rank <author>\n");
+    printf("  borrow <book id> <user id>   return <book id> <user id>\n");
+    printf("  reserve <book id> <user id>  cancel <book id> <user id>\n");
+    printf("  copies <book id> <total copies>\n");
+    printf("  history              undo                undo-return\n");
+    printf("  archive [<days>]     (archive loans returned more than <days> ago, then save)\n");
+    printf("  archived [<user id>|*] [<from date>] [<to date>]\n");
+    printf("  overdue              loans-between <from date> <to date>  user-month <user id>\n");
+    printf("  circulation          (most borrowed titles, active borrowers, queue wait, overdue rate)\n");
+    printf("  checkout <user id> <book id>...  checkin <user id> <book id>...  (all or nothing)\n");
+}
+
+// Run one batch command; returns false on quit
+bool runBatchCommand(char* line) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#') {
+        return true;
+    }
+    char* args = strchr(line, ' ');
+    if (args != NULL) {
+        *args++ = '\0';
+    } else {
+        args = line + strlen(line);
+    }
+
+    if (strcmp(line, "quit") == 0 || strcmp(line, "exit") == 0) {
+        return false;
+    } else if (strcmp(line, "help") == 0) {
+        printBatchHelp();
+    } else if (strcmp(line, "load") == 0) {
+        loadAllData();
+    } else if (strcmp(line, "save") == 0) {
+        saveAllData();
+    } else if (strcmp(line, "archive") == 0) {
+        if (*args != '\0') {
+            archiveAgeDays = atoi(args);
+        }
+        saveAllData();
+    } else if (strcmp(line, "overdue") == 0) {
+        listOverdueLoans();
+    } else if (strcmp(line, "circulation") == 0) {
+        displayCirculationStats();
+    } else if (strcmp(line, "loans-between") == 0) {
+        char* from = strtok(args, " ");
+        char* to = from != NULL ? strtok(NULL, " ") : NULL;
+        if (to == NULL) {
+            printf("usage: loans-between <from date> <to date>\n");
+            return true;
+        }
+        listLoansBorrowedBetween(parseImportDate(from, 0), parseImportDate(to, 0));
+    } else if (strcmp(line, "user-month") == 0) {
+        listUserLoansThisMonth(atoi(args));
+    } else if (strcmp(line, "archived") == 0) {
+        char* fields[3] = {"", "", ""};
+        char* token = strtok(args, " ");
+        for (int i = 0; i < 3 && token != NULL; i++, token = strtok(NULL, " ")) {
+            fields[i] = token;
+        }
+        int userId = fields[0][0] != '\0' && strcmp(fields[0], "*") != 0 ? atoi(fields[0]) : QUERY_ANY;
+        long shown = displayArchivedLoans(userId, parseImportDate(fields[1], 0), parseImportDate(fields[2], 0));
+        printf("%ld archived loan(s)\n", shown);
+    } else if (strcmp(line, "add-book") == 0) {
+        char* fields[3] = {"", "", ""};
+        if (splitBatchFields(args, fields, 3) < 3) {
+            printf("usage: add-book <title>|<author>|<isbn>\n");
+            return true;
+        }
+        bool copyAdded;
+        Book* newBook = catalogNewBook(fields[0], fields[1], fields[2], &copyAdded);
+        if (newBook != NULL && copyAdded) {
+            printf("Copy added to ID %d (%d copies)\n", newBook->id, newBook->copies);
+        } else if (newBook != NULL) {
+            printf("Book added with ID %d\n", newBook->id);
+        }
+    } else if (strcmp(line, "add-user") == 0) {
+        char* fields[4] = {"", "", "", ""};
+        if (splitBatchFields(args, fields, 4) < 4) {
+            printf("usage: add-user <name>|<user id>|<age>|<gender>\n");
+            return true;
+        }
+        User* newUser = registerNewUser(fields[0], fields[1], atoi(fields[2]), fields[3][0]);
+        if (newUser != NULL) {
+            printf("User added with ID %d\n", newUser->id);
+        }
+    } else if (strcmp(line, "book") == 0) {
+        Book* book = searchBookById(bookRoot, atoi(args));
+        if (book != NULL) {
+            displayBook(book);
         } else {
-            prev->next = user;
+            printf("Book not found!\n");
         }
-        prev = user;
+    } else if (strcmp(line, "user") == 0) {
+        User* user = searchUserById(atoi(args));
+        if (user != NULL) {
+            displayUser(user);
+        } else {
+            printf("User not found!\n");
+        }
+    } else if (strcmp(line, "find-title") == 0) {
+        Book* book = searchBookByTitle(bookRoot, args);
+        if (book != NULL) {
+            displayBook(book);
+        } else {
+            printf("No books found matching '%s'\n", args);
+        }
+    } else if (strcmp(line, "list-title") == 0) {
+        listBooksByTitle(args);
+    } else if (strcmp(line, "find-user") == 0) {
+        User* user = searchUserByName(args);
+        if (user != NULL) {
+            displayUser(user);
+        } else {
+            printf("User not found!\n");
+        }
+    } else if (strcmp(line, "fuzzy-title") == 0) {
+        fuzzySearchBooks(titleTree, args);
+    } else if (strcmp(line, "fuzzy-author") == 0) {
+        fuzzySearchBooks(authorTree, args);
+    } else if (strcmp(line, "fuzzy-user") == 0) {
+        fuzzySearchUsers(args);
+    } else if (strcmp(line, "complete-title") == 0) {
+        showCompletions(1, args);
+    } else if (strcmp(line, "complete-author") == 0) {
+        showCompletions(2, args);
+    } else if (strcmp(line, "complete-user") == 0) {
+        showCompletions(3, args);
+    } else if (strcmp(line, "author") == 0) {
+        listBooksByAuthor(args);
+    } else if (strcmp(line, "author-prefix") == 0) {
+        listBooksByAuthorPrefix(args);
+    } else if (strcmp(line, "import-books") == 0) {
+        importBooks(args);
+    } else if (strcmp(line, "import-users") == 0) {
+        importUsers(args);
+    } else if (strcmp(line, "import-loans") == 0) {
+        importLoans(args);
+    } else if (strcmp(line, "page") == 0) {
+        char* what = strtok(args, " ");
+        char* size = strtok(NULL, " ");
+        char* token = strtok(NULL, "");
+        int order = what != NULL ? parsePageOrder(what) : -1;
+        if (order < 0 || size == NULL || atoi(size) <= 0) {
+            printf("usage: page books|titles|authors|users|loans <size> [<token>|#<page>]\n");
+            return true;
+        }
+        PageCursor cursor;
+        char next[MAX_TITLE_LENGTH + 16];
+        openPageCursor(&cursor, (PageOrder)order);
+        if (token != NULL && token[0] == '#') {
+            if (!seekPageCursor(&cursor, atoi(token + 1), atoi(size))) {
+                printf("Page numbers work in titles, authors and loans order\n");
+                return true;
+            }
+        } else if (token != NULL) {
+            parsePageToken(&cursor, token);
+        }
+        int shown = showNextPage(&cursor, atoi(size));
+        formatPageToken(&cursor, next, sizeof(next));
+        if (cursor.finished) {
+            printf("%d row(s), end of listing\n", shown);
+        } else {
+            printf("%d row(s), next: page %s %s %s\n", shown, what, size, next);
+        }
+    } else if (strcmp(line, "borrow") == 0 || strcmp(line, "return") == 0 ||
+               strcmp(line, "reserve") == 0 || strcmp(line, "cancel") == 0) {
+        int bookId = -1, userId = -1, position = 0;
+        sscanf(args, "%d %d", &bookId, &userId);
+        Book* book = searchBookById(bookRoot, bookId);
+        User* user = searchUserById(userId);
+        DeskResult result;
+        if (line[0] == 'b') {
+            result = checkoutBook(book, user, NULL);
+        } else if (line[0] == 'r' && line[2] == 't') {
+            result = checkinBook(book, user);
+        } else if (line[0] == 'r') {
+            result = queueReservation(book, user, &position);
+        } else {
+            result = dropReservation(book, userId);
+        }
+        if (result == DESK_QUEUED) {
+            printf("%s: queued at position %d\n", line, position);
+        } else {
+            printf("%s: %s\n", line, deskResultName(result));
+        }
+    } else if (strcmp(line, "history") == 0) {
+        displaySystemHistory();
+    } else if (strcmp(line, "undo") == 0) {
+        undoSystemhistory();
+        printf("\n");
+    } else if (strcmp(line, "undo-return") == 0) {
+        undoLastReturn();
+        printf("\n");
+    } else if (strcmp(line, "checkout") == 0 || strcmp(line, "checkin") == 0) {
+        DeskTransaction tx;
+        char* end;
+        tx.action = strcmp(line, "checkout") == 0 ? DESK_CHECKOUT : DESK_CHECKIN;
+        tx.userId = (int)strtol(args, &end, 10);
+        tx.count = end != args ? parseDeskItems(end, tx.bookIds) : 0;
+        if (tx.count <= 0) {
+            printf("usage: %s <user id> <book id>... (up to %d books)\n", line, MAX_DESK_ITEMS);
+            return true;
+        }
+        DeskResult result = runDeskTransaction(&tx, true, NULL);
+        if (result == DESK_OK) {
+            printf("%s: OK (%d book(s))\n", line, tx.count);
+        } else if (tx.failedItem >= 0) {
+            printf("%s: %s at book %d\n", line, deskResultName(result), tx.bookIds[tx.failedItem]);
+        } else {
+            printf("%s: %s\n", line, deskResultName(result));
+        }
+    } else if (strcmp(line, "copies") == 0) {
+        int bookId = -1, copies = 0;
+        sscanf(args, "%d %d", &bookId, &copies);
+        Book* book = searchBookById(bookRoot, bookId);
+        if (book == NULL || copies <= 0) {
+            printf("usage: copies <book id> <total copies>\n");
+        } else if (!setBookCopies(book, copies)) {
+            printf("copies: only %d cop(ies) on the shelf can be withdrawn\n", availableCopies(book));
+        } else {
+            printf("copies: %d (%d available, %d borrowed, %d held)\n", book->copies, availableCopies(book), book->borrowed, book->held);
+        }
+    } else if (strcmp(line, "title-at") == 0) {
+        showOrderPosition(&titleOrder, "title", atoi(args));
+    } else if (strcmp(line, "author-at") == 0) {
+        showOrderPosition(&authorOrder, "author", atoi(args));
+    } else if (strcmp(line, "title-rank") == 0) {
+        showOrderRank(&titleOrder, "title", args, MAX_TITLE_LENGTH);
+    } else if (strcmp(line, "author-rank") == 0) {
+        showOrderRank(&authorOrder, "author", args, MAX_AUTHOR_LENGTH);
+    } else if (strcmp(line, "list-books") == 0) {
+        displayAllBooks();
+    } else if (strcmp(line, "list-users") == 0) {
+        displayAllUsers();
+    } else if (strcmp(line, "list-loans") == 0) {
+        displayAllBorrowRecords();
+    } else if (strcmp(line, "export") == 0) {
+        char* what = strtok(args, " ");
+        char* format = strtok(NULL, " ");
+        char* path = strtok(NULL, "");
+        if (what == NULL || format == NULL || path == NULL) {
+            printf("usage: export books|users|loans|queues csv|jsonl <file>\n");
+        } else {
+            exportData(what, format, path);
+        }
+    } else if (strcmp(line, "availability") == 0) {
+        showBookAvailability(args);
+    } else if (strcmp(line, "cache-stats") == 0) {
+        displayCacheStats();
+    } else if (strcmp(line, "bench-scan") == 0) {
+        int rounds = atoi(args);
+        benchmarkSubstringKernels(rounds > 0 ? rounds : 20);
+    } else if (strcmp(line, "query") == 0) {
+        runBookQuery(args);
+    } else if (strcmp(line, "status-counts") == 0) {
+        displayStatusCounts();
+    } else if (strcmp(line, "list-status") == 0) {
+        int status = parseBookStatus(args);
+        if (status < 0) {
+            printf("usage: list-status available|borrowed|reserved\n");
+        } else {
+            listBooksByStatus((BookStatus)status);
+        }
+    } else {
+        printf("Unknown command '%s' (try 'help')\n", line);
     }
+    return true;
 }
 
-// Load borrow records from file and rebuild linked list
-void loadBorrowRecords(FILE* file, int recordCount) {
-    borrowRecords = NULL;
-    BorrowRecord* prev = NULL;
-    for (int i = 0; i < recordCount; i++) {
-        BorrowRecord* record = (BorrowRecord*)malloc(sizeof(BorrowRecord));
-        if (fread(record, sizeof(BorrowRecord), 1, file) != 1) {
-            free(record);
+// Run commands from a stream until end of input or quit
+void runBatch(FILE* input) {
+    reportPaging = false;
+    char line[MAX_BATCH_LINE];
+    while (fgets(line, sizeof(line), input) != NULL) {
+        if (!runBatchCommand(line)) {
             break;
         }
-        record->next = NULL;
-        if (prev == NULL) {
-            borrowRecords = record;
+        processFulfillmentEvents(FULFILLMENT_BATCH);
+        fflush(stdout);
+    }
+}
+
+/********************************************/
+/*               Desk Server                */
+/********************************************/
+
+// --serve [port] [address] keeps one library in memory and serves the
+// desks over TCP. A single WSAPoll loop owns every connection, so the
+// library is only ever touched from one thread and needs no locking.
+// Sockets are non-blocking: each readable client has all of its complete
+// request lines handled in arrival order (clients may pipeline as many
+// requests as they like) and the replies are sent straight away, with
+// whatever the socket won't take kept until it is writable again. A
+// client with SERVER_OUTPUT_LIMIT bytes of unsent replies is not read
+// from until it catches up.
+//
+// Protocol: one request per line, "VERB arg arg". Every reply starts
+// with "OK ..." or "ERR <CODE>"; list replies are "OK <count>" followed
+// by count tab-separated lines. Dates are seconds since the epoch.
+//   PING                          OK PONG
+//   SEARCH <title text>           OK <n>, then id title author status
+//   BOOK <book id>                OK id title author isbn status queue copies
+//   USER <user id>                OK id name user-id status borrowed
+//   AVAIL <book id>               OK status copies available borrowed held queue
+//   BORROW <book id> <user id>    OK <due date> (also picks up a held copy)
+//   RETURN <book id> <user id>    OK <new book status>
+//   RESERVE <book id> <user id>   OK <queue position> (0 = held now)
+//   CANCEL <book id> <user id>    OK
+//   CHECKOUT <user id> <book id>...  OK <n>, then book-id due-date (all or nothing;
+//                                 a refused item is named: ERR <CODE> <book id>)
+//   CHECKIN <user id> <book id>...   OK <n> (all or nothing, as CHECKOUT)
+//   HISTORY [count]               OK <n>, then date action name/title
+//   OVERDUE                       OK <n>, then book-id user-id due-date
+//   STATS                         OK loans returns late-returns active-borrowers average-queue-wait
+//   SAVE | QUIT | SHUTDOWN        OK
+
+// Append a formatted reply
+void deskReply(DeskClient* client, const char* format, ...) {
+    va_list args;
+    while (true) {
+        int room = client->outputCapacity - client->outputLength;
+        va_start(args, format);
+        int length = vsnprintf(client->output + client->outputLength, room > 0 ? room : 0, format, args);
+        va_end(args);
+        if (length < 0) {
+            return;
+        }
+        if (length < room) {
+            client->outputLength += length;
+            return;
+        }
+        int capacity = client->outputCapacity > 0 ? client->outputCapacity * 2 : 4096;
+        while (capacity - client->outputLength <= length) {
+            capacity *= 2;
+        }
+        char* output = (char*)realloc(client->output, capacity);
+        if (output == NULL) {
+            printf("Memory allocation failed!\n");
+            client->closing = true;
+            return;
+        }
+        client->output = output;
+        client->outputCapacity = capacity;
+    }
+}
+
+// Copy a field for a reply, turning tabs and line breaks into spaces
+const char* deskField(const char* text, char* field, int fieldSize) {
+    int length = 0;
+    while (text[length] != '\0' && length < fieldSize - 1) {
+        field[length] = (unsigned char)text[length] < ' ' ? ' ' : text[length];
+        length++;
+    }
+    field[length] = '\0';
+    return field;
+}
+
+// Reply with "OK" or the error code of a desk result
+void deskReplyResult(DeskClient* client, DeskResult result) {
+    if (result == DESK_OK || result == DESK_QUEUED) {
+        deskReply(client, "OK\n");
+    } else {
+        deskReply(client, "ERR %s\n", deskResultName(result));
+    }
+}
+
+// Handle one request line; returns false on SHUTDOWN
+bool handleDeskRequest(DeskClient* client, char* line) {
+    line[strcspn(line, "\r")] = '\0';
+    if (line[0] == '\0') {
+        return true;
+    }
+    char* args = strchr(line, ' ');
+    if (args != NULL) {
+        *args++ = '\0';
+    } else {
+        args = line + strlen(line);
+    }
+    for (char* c = line; *c != '\0'; c++) {
+        *c = (char)toupper((unsigned char)*c);
+    }
+    char title[MAX_TITLE_LENGTH], author[MAX_AUTHOR_LENGTH], isbn[MAX_ISBN_LENGTH];
+    char name[MAX_NAME_LENGTH], userCode[MAX_ID_LENGTH];
+    int first = -1, second = -1;
+    sscanf(args, "%d %d", &first, &second);
+    Book* book = searchBookById(bookRoot, first);
+    User* user = searchUserById(second);
+
+    if (strcmp(line, "PING") == 0) {
+        deskReply(client, "OK PONG\n");
+    } else if (strcmp(line, "SEARCH") == 0) {
+        char key[MAX_TITLE_LENGTH];
+        SubstringMatcher matcher;
+        foldSearchKey(args, key, MAX_TITLE_LENGTH);
+        prepareSubstringMatcher(&matcher, key);
+        ScanResult result = parallelScanBookBlocks(matchTitleBlock, &matcher);
+        int count = result.count < SERVER_SEARCH_RESULTS ? result.count : SERVER_SEARCH_RESULTS;
+        deskReply(client, "OK %d\n", count);
+        for (int i = 0; i < count; i++) {
+            Book* match = snapshotBookAt(result.snap, result.indices[i]);
+            deskReply(client, "%d\t%s\t%s\t%s\n", match->id, deskField(match->title, title, MAX_TITLE_LENGTH),
+                      deskField(match->author, author, MAX_AUTHOR_LENGTH), bookStatusName(match->status));
+        }
+        releaseScanResult(&result);
+    } else if (strcmp(line, "BOOK") == 0) {
+        if (book == NULL) {
+            deskReplyResult(client, DESK_NO_BOOK);
         } else {
-            prev->next = record;
+            deskReply(client, "OK %d\t%s\t%s\t%s\t%s\t%d\t%d\n", book->id, deskField(book->title, title, MAX_TITLE_LENGTH),
+                      deskField(book->author, author, MAX_AUTHOR_LENGTH), deskField(book->isbn, isbn, MAX_ISBN_LENGTH),
+                      bookStatusName(book->status), bookQueues[book->id].size, book->copies);
         }
-        prev = record;
+    } else if (strcmp(line, "USER") == 0) {
+        user = searchUserById(first);
+        if (user == NULL) {
+            deskReplyResult(client, DESK_NO_USER);
+        } else {
+            deskReply(client, "OK %d\t%s\t%s\t%s\t%d\n", user->id, deskField(user->name, name, MAX_NAME_LENGTH),
+                      deskField(user->user_id, userCode, MAX_ID_LENGTH),
+                      userStatusName(user->status), user->borrowCount);
+        }
+    } else if (strcmp(line, "AVAIL") == 0) {
+        if (book == NULL) {
+            deskReplyResult(client, DESK_NO_BOOK);
+        } else {
+            settleBookHolds(book);
+            deskReply(client, "OK %s\t%d\t%d\t%d\t%d\t%d\n", bookStatusName(book->status), book->copies,
+                      availableCopies(book), book->borrowed, book->held, bookQueues[book->id].size);
+        }
+    } else if (strcmp(line, "BORROW") == 0) {
+        BorrowRecord* loan = NULL;
+        DeskResult result = checkoutBook(book, user, &loan);
+        if (result == DESK_OK) {
+            deskReply(client, "OK %lld\n", (long long)loan->dueDate);
+        } else {
+            deskReplyResult(client, result);
+        }
+    } else if (strcmp(line, "RETURN") == 0) {
+        DeskResult result = checkinBook(book, user);
+        if (result == DESK_OK) {
+            deskReply(client, "OK %s\n", bookStatusName(book->status));
+        } else {
+            deskReplyResult(client, result);
+        }
+    } else if (strcmp(line, "RESERVE") == 0) {
+        int position = 0;
+        DeskResult result = queueReservation(book, user, &position);
+        if (result == DESK_OK || result == DESK_QUEUED) {
+            deskReply(client, "OK %d\n", position);
+        } else {
+            deskReplyResult(client, result);
+        }
+    } else if (strcmp(line, "CANCEL") == 0) {
+        deskReplyResult(client, dropReservation(book, second));
+    } else if (strcmp(line, "CHECKOUT") == 0 || strcmp(line, "CHECKIN") == 0) {
+        DeskTransaction tx;
+        BorrowRecord* loans[MAX_DESK_ITEMS];
+        char* end;
+        tx.action = line[5] == 'O' ? DESK_CHECKOUT : DESK_CHECKIN;
+        tx.userId = (int)strtol(args, &end, 10);
+        tx.count = end != args ? parseDeskItems(end, tx.bookIds) : 0;
+        DeskResult result = tx.count > 0 ? runDeskTransaction(&tx, true, loans) : DESK_NO_BOOK;
+        if (result != DESK_OK) {
+            if (tx.count > 0 && tx.failedItem >= 0) {
+                deskReply(client, "ERR %s %d\n", deskResultName(result), tx.bookIds[tx.failedItem]);
+            } else {
+                deskReplyResult(client, result);
+            }
+        } else if (tx.action == DESK_CHECKIN) {
+            deskReply(client, "OK %d\n", tx.count);
+        } else {
+            deskReply(client, "OK %d\n", tx.count);
+            for (int i = 0; i < tx.count; i++) {
+                deskReply(client, "%d\t%lld\n", loans[i]->bookId, (long long)loans[i]->dueDate);
+            }
+        }
+    } else if (strcmp(line, "HISTORY") == 0) {
+        static const char* actions[] = {"USER_ADDED", "USER_DELETED", "BOOK_ADDED", "BOOK_DELETED", "BOOK_EDITED",
+                                        "COPIES_CHANGED", "USER_EDITED", "BORROWED", "RETURNED", "RESERVED", "CANCELLED"};
+        int limit = first > 0 ? first : 10;
+        int count = undoLog.count < limit ? undoLog.count : limit;
+        deskReply(client, "OK %d\n", count);
+        for (int i = 0; i < count; i++) {
+            UndoEntry* entry = undoEntryAt(i);
+            const char* subject = isNullHandle(entry->book) ? (undoUser(entry) != NULL ? undoUser(entry)->name : NULL) : undoBookTitle(entry);
+            deskReply(client, "%lld\t%s\t%s\n", (long long)entry->when, actions[entry->action],
+                      deskField(subject != NULL ? subject : "", title, MAX_TITLE_LENGTH));
+        }
+    } else if (strcmp(line, "OVERDUE") == 0) {
+        LedgerFilter filter = {LEDGER_DUE_DATE, INT64_MIN, (int64_t)time(NULL), QUERY_ANY, 1};
+        LedgerScan scan;
+        if (!scanLedger(&filter, &scan)) {
+            deskReply(client, "ERR NO_MEMORY\n");
+        } else {
+            deskReply(client, "OK %d\n", scan.count);
+            for (int i = 0; i < scan.count; i++) {
+                int row = scan.rows[i];
+                deskReply(client, "%d\t%d\t%lld\n", ledgerColumns.bookIds[row], ledgerColumns.userIds[row],
+                          (long long)ledgerColumns.dates[LEDGER_DUE_DATE][row]);
+            }
+            free(scan.rows);
+        }
+    } else if (strcmp(line, "STATS") == 0) {
+        deskReply(client, "OK %lld %lld %lld %d %lld\n", circulation.loans, circulation.returns,
+                  circulation.lateReturns, circulation.activeBorrowers,
+                  circulation.waits > 0 ? circulation.waitSeconds / circulation.waits : 0LL);
+    } else if (strcmp(line, "SAVE") == 0) {
+        saveAllData();
+        deskReply(client, "OK\n");
+    } else if (strcmp(line, "QUIT") == 0) {
+        deskReply(client, "OK\n");
+        client->closing = true;
+    } else if (strcmp(line, "SHUTDOWN") == 0) {
+        deskReply(client, "OK\n");
+        return false;
+    } else {
+        deskReply(client, "ERR BAD_REQUEST\n");
     }
+    return true;
 }
 
+// Send as much pending output as the socket takes; false once the connection
+// has failed, or a closing client has nothing left to send
+bool sendDeskOutput(DeskClient* client) {
+    while (client->outputSent < client->outputLength) {
+        int sent = send(client->socket, client->output + client->outputSent, client->outputLength - client->outputSent, 0);
+        if (sent == SOCKET_ERROR) {
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+        client->outputSent += sent;
+    }
+    client->outputLength = 0;
+    client->outputSent = 0;
+    return !client->closing;
+}
 
+// Read what has arrived and handle every complete line; false if the connection is gone
+bool readDeskInput(DeskClient* client, bool* running) {
+    int received = recv(client->socket, client->input + client->inputLength, SERVER_INPUT_SIZE - client->inputLength, 0);
+    if (received == SOCKET_ERROR) {
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+    }
+    if (received == 0) {
+        return false;
+    }
+    client->inputLength += received;
+
+    int start = 0;
+    char* newline;
+    while (*running && !client->closing && (newline = (char*)memchr(client->input + start, '\n', client->inputLength - start)) != NULL) {
+        *newline = '\0';
+        if (!handleDeskRequest(client, client->input + start)) {
+            *running = false;
+        }
+        start = (int)(newline - client->input) + 1;
+    }
+    client->inputLength -= start;
+    memmove(client->input, client->input + start, client->inputLength);
+    if (client->inputLength == SERVER_INPUT_SIZE) {
+        deskReply(client, "ERR TOO_LONG\n");
+        client->closing = true;
+    }
+    return sendDeskOutput(client);
+}
 
-// Load all data from file
-void loadAllData() {
-    FILE* file = fopen(SAVE_FILE, "rb");
-    if (file == NULL) {
-        printf("No saved data found!\n");
-        return;
+// Close a connection and free its buffers
+void closeDeskClient(DeskClient* client) {
+    closesocket(client->socket);
+    free(client->output);
+    free(client);
+}
+
+// Serve the library until a client sends SHUTDOWN; false if it never started
+bool runDeskServer(int port, const char* address) {
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        printf("Winsock could not be started!\n");
+        return false;
     }
-    
-    // Load counters first
-    fread(&numbooks, sizeof(int), 1, file);
-    fread(&numofuser, sizeof(int), 1, file);
-    fread(&borrowCount, sizeof(int), 1, file);
-    
-    // Load books (BST)
-    bookRoot = loadBooks(file, numbooks);
-    
-    // Load users (Linked List)
-    loadUsers(file, numofuser);
-    
-    // Load borrow records (Linked List)
-    loadBorrowRecords(file, borrowCount);
-    
-    
-    fclose(file);
-    printf("Data loaded successfully from %s\n", SAVE_FILE);
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in local;
+    u_long nonBlocking = 1;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons((u_short)port);
+    if (inet_pton(AF_INET, address, &local.sin_addr) != 1) {
+        printf("Invalid address: %s\n", address);
+        closesocket(listener);
+        WSACleanup();
+        return false;
+    }
+    if (listener == INVALID_SOCKET || bind(listener, (struct sockaddr*)&local, sizeof(local)) == SOCKET_ERROR ||
+        listen(listener, SOMAXCONN) == SOCKET_ERROR || ioctlsocket(listener, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+        printf("Could not listen on %s:%d (error %d)\n", address, port, WSAGetLastError());
+        if (listener != INVALID_SOCKET) {
+            closesocket(listener);
+        }
+        WSACleanup();
+        return false;
+    }
+    printf("Serving the library on %s:%d\n", address, port);
+    fflush(stdout);
+
+    // Slot 0 is the listener; clients are kept packed behind it
+    WSAPOLLFD fds[SERVER_MAX_CLIENTS + 1];
+    DeskClient* clients[SERVER_MAX_CLIENTS + 1];
+    int count = 1;
+    bool running = true;
+    fds[0].fd = listener;
+    while (running) {
+        fds[0].events = count <= SERVER_MAX_CLIENTS ? POLLRDNORM : 0;
+        for (int i = 1; i < count; i++) {
+            DeskClient* client = clients[i];
+            fds[i].events = 0;
+            if (!client->closing && client->outputLength - client->outputSent < SERVER_OUTPUT_LIMIT) {
+                fds[i].events |= POLLRDNORM;
+            }
+            if (client->outputSent < client->outputLength) {
+                fds[i].events |= POLLWRNORM;
+            }
+        }
+        // Wake up once a second while holds are ticking
+        if (WSAPoll(fds, count, holdWheel.count > 0 ? 1000 : -1) == SOCKET_ERROR) {
+            printf("Poll failed (error %d)\n", WSAGetLastError());
+            break;
+        }
+
+        for (int i = count - 1; i >= 1; i--) {
+            DeskClient* client = clients[i];
+            bool alive = true;
+            if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                alive = (fds[i].revents & POLLRDNORM) != 0 && readDeskInput(client, &running);
+            } else {
+                if (fds[i].revents & POLLWRNORM) {
+                    alive = sendDeskOutput(client);
+                }
+                if (alive && (fds[i].revents & POLLRDNORM)) {
+                    alive = readDeskInput(client, &running);
+                }
+            }
+            if (!alive) {
+                closeDeskClient(client);
+                count--;
+                fds[i] = fds[count];
+                clients[i] = clients[count];
+            }
+        }
+
+        // Accept everything that is waiting
+        while ((fds[0].revents & POLLRDNORM) && count <= SERVER_MAX_CLIENTS) {
+            SOCKET accepted = accept(listener, NULL, NULL);
+            if (accepted == INVALID_SOCKET) {
+                break;
+            }
+            int noDelay = 1;
+            DeskClient* client = (DeskClient*)calloc(1, sizeof(DeskClient));
+            if (client == NULL || ioctlsocket(accepted, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+                free(client);
+                closesocket(accepted);
+                continue;
+            }
+            setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+            client->socket = accepted;
+            clients[count] = client;
+            fds[count].fd = accepted;
+            fds[count].revents = 0;
+            count++;
+        }
+
+        // Serve the waiters of books returned during this round
+        processFulfillmentEvents(FULFILLMENT_BATCH);
+    }
+
+    for (int i = 1; i < count; i++) {
+        closeDeskClient(clients[i]);
+    }
+    closesocket(listener);
+    WSACleanup();
+    printf("Server stopped\n");
+    return true;
 }
 
 /********************************************/
 /*              Main function               */
 /********************************************/
-void main(){
+void main(int argc, char* argv[]){
 int choice;
-initStacks();
+initSnapshots();
+initQueryCaches();
+
+if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+    runBatch(stdin);
+    return;
+}
+
+if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+    loadAllData();
+    if (runDeskServer(argc > 2 ? atoi(argv[2]) : SERVER_DEFAULT_PORT, argc > 3 ? argv[3] : "127.0.0.1")) {
+        saveAllData();
+    }
+    return;
+}
 
 do{
+    processFulfillmentEvents(FULFILLMENT_BATCH);
     printf("\e[1;1H\e[2J");
 printf("=== Library Management System === ");
 printf("\n1. Manage Books \n");
@@ -2217,7 +11122,8 @@ printf("4. Search (Catalog, Student by ID/Name, Book by ID/Title \n");
 printf("5. View System History \n");
 printf("6. Save Data to File\n");
 printf("7. Load Data from File\n");
-printf("8. Exit \n");
+printf("8. Import / Export Data (CSV, TSV, JSON Lines)\n");
+printf("9. Exit \n");
 scanf("%d" , &choice );
 switch (choice)
 {
@@ -2252,12 +11158,17 @@ printf("\e[1;1H\e[2J");
     Sleep(2000);
     break;
 case 8:
+printf("\e[1;1H\e[2J");
+    importExportMenu();
+    Sleep(5000);
+    break;
+case 9:
 printf("thanks for using our system");
     break;
 default:
 printf("please select a valid choice ");
     break;
 }
-}while(choice != 8);
+}while(choice != 9);
 
 }
\ No newline at end of file